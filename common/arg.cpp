@@ -1523,6 +1523,46 @@ common_params_context common_params_parser_init(common_params & params, llama_ex
             params.kv_unified = true;
         }
     ).set_env("LLAMA_ARG_KV_SPLIT"));
+    add_opt(common_arg(
+        {"--kv-cache-file"}, "FNAME",
+        "memory-map the KV cache from this file instead of allocating it in RAM (default: none)\n"
+        "allows contexts larger than the RAM when the file is on a fast SSD - the file is overwritten\n"
+        "only applies to the part of the KV cache that is stored in host memory",
+        [](common_params & params, const std::string & value) {
+            params.kv_cache_file = value;
+        }
+    ).set_env("LLAMA_ARG_KV_CACHE_FILE"));
+    add_opt(common_arg(
+        {"--sparse-ffn"}, "F",
+        string_format("fraction of the FFN neurons computed per token in the layers that have an activation predictor (default: %.2f, 0 = dense)\n"
+            "the neurons with the highest predicted activations are computed, the others are treated as zero", (double) params.sparse_ffn),
+        [](common_params & params, const std::string & value) {
+            params.sparse_ffn = std::stof(value);
+        }
+    ).set_env("LLAMA_ARG_SPARSE_FFN"));
+    add_opt(common_arg(
+        {"--kv-budget"}, "N",
+        string_format("max. number of KV cells per sequence (default: %d, 0 = disabled)\n"
+            "beyond it, the cells that received the least attention are evicted, except for the sinks and the recent window\n"
+            "requires flash attention to be off, and the context should leave room for one batch per sequence on top of the budget", params.kv_budget),
+        [](common_params & params, int value) {
+            params.kv_budget = value;
+        }
+    ).set_env("LLAMA_ARG_KV_BUDGET"));
+    add_opt(common_arg(
+        {"--kv-sinks"}, "N",
+        string_format("number of leading KV cells of each sequence that are never evicted with --kv-budget (default: %d)", params.kv_n_sink),
+        [](common_params & params, int value) {
+            params.kv_n_sink = value;
+        }
+    ).set_env("LLAMA_ARG_KV_SINKS"));
+    add_opt(common_arg(
+        {"--kv-recent"}, "N",
+        string_format("number of trailing KV cells of each sequence that are never evicted with --kv-budget (default: %d)", params.kv_n_recent),
+        [](common_params & params, int value) {
+            params.kv_n_recent = value;
+        }
+    ).set_env("LLAMA_ARG_KV_RECENT"));
     add_opt(common_arg(
         {"--no-context-shift"},
         string_format("disables context shift on infinite text generation (default: %s)", params.ctx_shift ? "disabled" : "enabled"),
@@ -1613,7 +1653,7 @@ common_params_context common_params_parser_init(common_params & params, llama_ex
             }
             params.in_files.push_back(value);
         }
-    ).set_examples({LLAMA_EXAMPLE_IMATRIX}));
+    ).set_examples({LLAMA_EXAMPLE_IMATRIX, LLAMA_EXAMPLE_BATCH_INFER}));
     add_opt(common_arg(
         {"-bf", "--binary-file"}, "FNAME",
         "binary file containing the prompt (default: none)",
@@ -2164,6 +2204,13 @@ common_params_context common_params_parser_init(common_params & params, llama_ex
             params.no_extra_bufts = true;
         }
     ).set_env("LLAMA_ARG_NO_REPACK"));
+    add_opt(common_arg(
+        {"--fuse-weights"},
+        "[EXPERIMENTAL] fuse Q/K/V and gate/up weights into single matrices at load time (default: disabled)",
+        [](common_params & params) {
+            params.fuse_weights = true;
+        }
+    ).set_env("LLAMA_ARG_FUSE_WEIGHTS"));
     add_opt(common_arg(
         {"-ctk", "--cache-type-k"}, "TYPE",
         string_format(
@@ -2283,6 +2330,23 @@ common_params_context common_params_parser_init(common_params & params, llama_ex
             params.n_sequences = value;
         }
     ).set_examples({LLAMA_EXAMPLE_PARALLEL}));
+    add_opt(common_arg(
+        {"--sort-window"}, "N",
+        string_format("number of input prompts that are grouped by common prefix and ordered by length together (default: %d)", params.n_infer_window),
+        [](common_params & params, int value) {
+            if (value < 1) {
+                throw std::invalid_argument("invalid value");
+            }
+            params.n_infer_window = value;
+        }
+    ).set_examples({LLAMA_EXAMPLE_BATCH_INFER}));
+    add_opt(common_arg(
+        {"--min-shared-prefix"}, "N",
+        string_format("min. number of common leading tokens for prompts to share their prefix in the KV cache (default: %d)", params.n_infer_min_prefix),
+        [](common_params & params, int value) {
+            params.n_infer_min_prefix = std::max(value, 1);
+        }
+    ).set_examples({LLAMA_EXAMPLE_BATCH_INFER}));
     add_opt(common_arg(
         {"-cb", "--cont-batching"},
         string_format("enable continuous batching (a.k.a dynamic batching) (default: %s)", params.cont_batching ? "enabled" : "disabled"),
@@ -2297,6 +2361,13 @@ common_params_context common_params_parser_init(common_params & params, llama_ex
             params.cont_batching = false;
         }
     ).set_examples({LLAMA_EXAMPLE_SERVER}).set_env("LLAMA_ARG_NO_CONT_BATCHING"));
+    add_opt(common_arg(
+        {"--prefill-buckets"},
+        string_format("batch the prompts with the fewest remaining tokens first and decode prompts of different KV length buckets in separate ubatches (default: %s)", params.prefill_buckets ? "enabled" : "disabled"),
+        [](common_params & params) {
+            params.prefill_buckets = true;
+        }
+    ).set_examples({LLAMA_EXAMPLE_SERVER}).set_env("LLAMA_ARG_PREFILL_BUCKETS"));
     add_opt(common_arg(
         {"--mmproj"}, "FILE",
         "path to a multimodal projector file. see tools/mtmd/README.md\n"
@@ -2326,6 +2397,19 @@ common_params_context common_params_parser_init(common_params & params, llama_ex
             params.mmproj_use_gpu = false;
         }
     ).set_examples(mmproj_examples).set_env("LLAMA_ARG_NO_MMPROJ_OFFLOAD"));
+    add_opt(common_arg(
+        {"--image-merge-ratio"}, "N",
+        string_format(
+            "fraction of the image tokens to remove before they reach the LLM, by averaging the most similar ones together\n"
+            "higher values make the prompt processing faster at the cost of image detail (default: %.2f, 0.0 = disabled)", (double) params.image_merge_ratio
+        ),
+        [](common_params & params, const std::string & value) {
+            params.image_merge_ratio = std::stof(value);
+            if (params.image_merge_ratio < 0.0f || params.image_merge_ratio >= 1.0f) {
+                throw std::invalid_argument("image merge ratio must be in [0, 1)");
+            }
+        }
+    ).set_examples(mmproj_examples).set_env("LLAMA_ARG_IMAGE_MERGE_RATIO"));
     add_opt(common_arg(
         {"--image", "--audio"}, "FILE",
         "path to an image or audio file. use with multimodal models, can be repeated if you have multiple files\n",
@@ -2357,6 +2441,14 @@ common_params_context common_params_parser_init(common_params & params, llama_ex
             params.use_mmap = false;
         }
     ).set_env("LLAMA_ARG_NO_MMAP"));
+    add_opt(common_arg(
+        {"--stream-weights"},
+        "[EXPERIMENTAL] read the memory-mapped weights of the next layers ahead of the computation and deprioritize\n"
+        "the pages of finished layers - useful when the model does not fit in RAM (default: disabled)",
+        [](common_params & params) {
+            params.stream_weights = true;
+        }
+    ).set_env("LLAMA_ARG_STREAM_WEIGHTS"));
     add_opt(common_arg(
         {"--numa"}, "TYPE",
         "attempt optimizations that help on some NUMA systems\n"
@@ -2714,7 +2806,7 @@ common_params_context common_params_parser_init(common_params & params, llama_ex
         [](common_params & params, const std::string & value) {
             params.out_file = value;
         }
-    ).set_examples({LLAMA_EXAMPLE_IMATRIX, LLAMA_EXAMPLE_CVECTOR_GENERATOR, LLAMA_EXAMPLE_EXPORT_LORA, LLAMA_EXAMPLE_TTS, LLAMA_EXAMPLE_FINETUNE}));
+    ).set_examples({LLAMA_EXAMPLE_IMATRIX, LLAMA_EXAMPLE_CVECTOR_GENERATOR, LLAMA_EXAMPLE_EXPORT_LORA, LLAMA_EXAMPLE_TTS, LLAMA_EXAMPLE_FINETUNE, LLAMA_EXAMPLE_BATCH_INFER}));
     add_opt(common_arg(
         {"-ofreq", "--output-frequency"}, "N",
         string_format("output the imatrix every N iterations (default: %d)", params.n_out_freq),
@@ -2955,6 +3047,26 @@ common_params_context common_params_parser_init(common_params & params, llama_ex
             params.n_cache_reuse = value;
         }
     ).set_examples({LLAMA_EXAMPLE_SERVER}).set_env("LLAMA_ARG_CACHE_REUSE"));
+    add_opt(common_arg(
+        {"--cache-completions"}, "N",
+        string_format(
+            "cache the results of up to N deterministic (greedy or fixed seed), non-streaming completion requests\n"
+            "and merge identical requests that are in flight at the same time (default: %d, 0 = disabled)", params.n_cache_cmpl
+        ),
+        [](common_params & params, int value) {
+            params.n_cache_cmpl = value;
+        }
+    ).set_examples({LLAMA_EXAMPLE_SERVER}).set_env("LLAMA_ARG_CACHE_COMPLETIONS"));
+    add_opt(common_arg(
+        {"--admission-deadline"}, "N",
+        string_format(
+            "reject requests with HTTP 429 when their predicted time to first token exceeds N milliseconds\n"
+            "the prediction uses the queued work and the measured throughput (default: %d, -1 = disabled)", params.admission_deadline
+        ),
+        [](common_params & params, int value) {
+            params.admission_deadline = value;
+        }
+    ).set_examples({LLAMA_EXAMPLE_SERVER}).set_env("LLAMA_ARG_ADMISSION_DEADLINE"));
     add_opt(common_arg(
         {"--metrics"},
         string_format("enable prometheus compatible metrics endpoint (default: %s)", params.endpoint_metrics ? "enabled" : "disabled"),
@@ -2994,6 +3106,14 @@ common_params_context common_params_parser_init(common_params & params, llama_ex
             }
         }
     ).set_examples({LLAMA_EXAMPLE_SERVER}));
+    add_opt(common_arg(
+        {"--pin-prefix"}, "FNAME",
+        "path to a slot save file whose prompt is kept in memory and restored into any slot whose prompt starts with it\n"
+        "(can be repeated to pin multiple prefixes)",
+        [](common_params & params, const std::string & value) {
+            params.pinned_prefixes.push_back(value);
+        }
+    ).set_examples({LLAMA_EXAMPLE_SERVER}));
     add_opt(common_arg(
         {"--jinja"},
         "use jinja template for chat (default: disabled)",
@@ -3090,14 +3210,14 @@ common_params_context common_params_parser_init(common_params & params, llama_ex
     ).set_examples({LLAMA_EXAMPLE_CVECTOR_GENERATOR}));
     add_opt(common_arg(
         {"--pca-batch"}, "N",
-        string_format("batch size used for PCA. Larger batch runs faster, but uses more memory (default: %d)", params.n_pca_batch),
+        string_format("number of random vectors used for PCA. Larger is more accurate, but uses more memory (default: %d)", params.n_pca_batch),
         [](common_params & params, int value) {
             params.n_pca_batch = value;
         }
     ).set_examples({LLAMA_EXAMPLE_CVECTOR_GENERATOR}));
     add_opt(common_arg(
         {"--pca-iter"}, "N",
-        string_format("number of iterations used for PCA (default: %d)", params.n_pca_iterations),
+        string_format("number of power iterations used for PCA (default: %d)", params.n_pca_iterations),
         [](common_params & params, int value) {
             params.n_pca_iterations = value;
         }
@@ -3639,6 +3759,35 @@ common_params_context common_params_parser_init(common_params & params, llama_ex
                            }
                        })
                 .set_examples({ LLAMA_EXAMPLE_FINETUNE }));
+    add_opt(common_arg({ "-opt-type", "--optimizer-state-type" }, "TYPE",
+                       "type of the adamw momenta: f32 or q8_0 (8-bit, 1/4 of the memory) (default: f32)",
+                       [](common_params & params, const std::string & value) {
+                           if (value == "f32") {
+                               params.optimizer_state_type = GGML_TYPE_F32;
+                           } else if (value == "q8_0") {
+                               params.optimizer_state_type = GGML_TYPE_Q8_0;
+                           } else {
+                               throw std::invalid_argument("invalid --optimizer-state-type, valid options: f32, q8_0");
+                           }
+                       })
+                .set_examples({ LLAMA_EXAMPLE_FINETUNE }));
+    add_opt(common_arg({ "--dp-ring" }, "HOST:PORT,...",
+                       "data-parallel training: comma-separated endpoints of all workers, gradients are all-reduced over a ring (requires RPC backend)",
+                       [](common_params & params, const std::string & value) { params.dp_ring = value; })
+                .set_examples({ LLAMA_EXAMPLE_FINETUNE }));
+    add_opt(common_arg({ "--dp-rank" }, "N",
+                       string_format("data-parallel training: index of this worker in --dp-ring (default: %d)", params.dp_rank),
+                       [](common_params & params, int value) { params.dp_rank = value; })
+                .set_examples({ LLAMA_EXAMPLE_FINETUNE }));
+    add_opt(common_arg({ "--cp-ring" }, "HOST:PORT,...",
+                       "[EXPERIMENTAL] context-parallel prefill: comma-separated endpoints of all workers, the rows of the prompt batches\n"
+                       "are split between the workers and the K/V are exchanged over a ring, only worker 0 generates (requires RPC backend)",
+                       [](common_params & params, const std::string & value) { params.cp_ring = value; })
+                .set_examples({ LLAMA_EXAMPLE_MAIN }));
+    add_opt(common_arg({ "--cp-rank" }, "N",
+                       string_format("context-parallel prefill: index of this worker in --cp-ring (default: %d)", params.cp_rank),
+                       [](common_params & params, int value) { params.cp_rank = value; })
+                .set_examples({ LLAMA_EXAMPLE_MAIN }));
 
     return ctx_arg;
 }
@@ -1117,6 +1117,9 @@ struct llama_model_params common_model_params_to_llama(common_params & params) {
     mparams.use_mlock       = params.use_mlock;
     mparams.check_tensors   = params.check_tensors;
     mparams.use_extra_bufts = !params.no_extra_bufts;
+    mparams.fuse_weights    = params.fuse_weights;
+    mparams.stream_weights  = params.stream_weights;
+    mparams.sparse_ffn      = params.sparse_ffn > 0.0f;
 
     if (params.kv_overrides.empty()) {
         mparams.kv_overrides = NULL;
@@ -1167,6 +1170,11 @@ struct llama_context_params common_context_params_to_llama(const common_params &
     cparams.op_offload        = !params.no_op_offload;
     cparams.swa_full          = params.swa_full;
     cparams.kv_unified        = params.kv_unified;
+    cparams.kv_cache_path     = params.kv_cache_file.empty() ? nullptr : params.kv_cache_file.c_str();
+    cparams.sparse_ffn        = params.sparse_ffn;
+    cparams.kv_budget         = params.kv_budget;
+    cparams.kv_n_sink         = params.kv_n_sink;
+    cparams.kv_n_recent       = params.kv_n_recent;
 
     cparams.type_k = params.cache_type_k;
     cparams.type_v = params.cache_type_v;
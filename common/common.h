@@ -89,6 +89,7 @@ enum llama_example {
     LLAMA_EXAMPLE_TTS,
     LLAMA_EXAMPLE_DIFFUSION,
     LLAMA_EXAMPLE_FINETUNE,
+    LLAMA_EXAMPLE_BATCH_INFER,
 
     LLAMA_EXAMPLE_COUNT,
 };
@@ -291,6 +292,10 @@ struct common_params {
     float   yarn_beta_fast        = 32.0f; // YaRN low correction dim
     float   yarn_beta_slow        =  1.0f; // YaRN high correction dim
     int32_t yarn_orig_ctx         =     0; // YaRN original context length
+    float   sparse_ffn            =  0.0f; // fraction of the FFN neurons computed per token with an activation predictor (0 = dense)
+    int32_t kv_budget             =     0; // max. number of KV cells per sequence before the least attended ones are evicted (0 = disabled)
+    int32_t kv_n_sink             =     4; // number of leading KV cells of each sequence that are never evicted
+    int32_t kv_n_recent           =   256; // number of trailing KV cells of each sequence that are never evicted
 
     // offload params
     std::vector<ggml_backend_dev_t> devices; // devices to use for offloading
@@ -332,6 +337,7 @@ struct common_params {
     std::string lookup_cache_static  = ""; // path of static ngram cache file for lookup decoding           // NOLINT
     std::string lookup_cache_dynamic = ""; // path of dynamic ngram cache file for lookup decoding          // NOLINT
     std::string logits_file          = ""; // file for saving *all* logits                                  // NOLINT
+    std::string kv_cache_file        = ""; // path of the file used as backing storage for the KV cache     // NOLINT
 
     std::vector<std::string> in_files;   // all input files
     std::vector<std::string> antiprompt; // strings upon which more user input is prompted (a.k.a. reverse prompts)
@@ -376,6 +382,7 @@ struct common_params {
     bool multiline_input   = false; // reverse the usage of `\`
     bool simple_io         = false; // improves compatibility with subprocesses and limited consoles
     bool cont_batching     = true;  // insert new sequences for decoding on-the-fly
+    bool prefill_buckets   = false; // batch the shortest prompts first and do not mix KV length buckets in a ubatch
     bool no_perf           = false; // disable performance metrics
     bool ctx_shift         = false;  // context shift on infinite text generation
     bool swa_full          = false; // use full-size SWA cache (https://github.com/ggml-org/llama.cpp/pull/13194#issuecomment-2868343055)
@@ -391,6 +398,8 @@ struct common_params {
     bool check_tensors     = false; // validate tensor data
     bool no_op_offload     = false; // globally disable offload host tensor operations to device
     bool no_extra_bufts    = false; // disable extra buffer types (used for weight repacking)
+    bool fuse_weights      = false; // fuse Q/K/V and gate/up weights at load time
+    bool stream_weights    = false; // read the mmap'd weights of the next layers ahead of the computation
 
     bool single_turn       = false; // single turn chat conversation
 
@@ -402,13 +411,21 @@ struct common_params {
     // multimodal models (see tools/mtmd)
     struct common_params_model mmproj;
     bool mmproj_use_gpu = true;     // use GPU for multimodal model
+    float image_merge_ratio = 0.0f; // fraction of the image tokens removed by merging similar ones (0.0 = disabled)
     bool no_mmproj = false;         // explicitly disable multimodal model
     std::vector<std::string> image; // path to image file(s)
 
     // finetune
     struct lr_opt lr;
     enum ggml_opt_optimizer_type optimizer = GGML_OPT_OPTIMIZER_TYPE_ADAMW;
+    ggml_type optimizer_state_type = GGML_TYPE_F32; // type of the AdamW momenta (F32 or Q8_0)
     float val_split = 0.05f; // fraction of the data used for the validation set
+    std::string dp_ring;     // comma-separated host:port of the data-parallel workers, empty = disabled
+    int32_t dp_rank = 0;     // index of this worker in dp_ring
+
+    // context-parallel prefill (main)
+    std::string cp_ring;     // comma-separated host:port of the context-parallel workers, empty = disabled
+    int32_t cp_rank = 0;     // index of this worker in cp_ring
 
     // embedding
     bool embedding         = false; // get only sentence embedding
@@ -424,6 +441,8 @@ struct common_params {
     int32_t n_threads_http    = -1;           // number of threads to process HTTP requests (TODO: support threadpool)
     int32_t n_cache_reuse     = 0;            // min chunk size to reuse from the cache via KV shifting
     int32_t n_swa_checkpoints = 3;            // max number of SWA checkpoints per slot
+    int32_t n_cache_cmpl      = 0;            // max number of cached deterministic completion results (0 = disabled)
+    int32_t admission_deadline = -1;          // reject tasks whose predicted time to first token exceeds this (ms, -1 = disabled)
 
     std::string hostname      = "127.0.0.1";
     std::string public_path   = "";                                                                         // NOLINT
@@ -451,6 +470,7 @@ struct common_params {
     bool log_json = false;
 
     std::string slot_save_path;
+    std::vector<std::string> pinned_prefixes; // sequence state files of prompt prefixes that are kept in memory by the server
 
     float slot_prompt_similarity = 0.5f;
 
@@ -484,8 +504,8 @@ struct common_params {
     bool parse_special   = false; // whether to parse special tokens during imatrix tokenization
 
     // cvector-generator params
-    int n_pca_batch = 100;
-    int n_pca_iterations = 1000;
+    int n_pca_batch = 16;      // number of random vectors sketching each layer in the randomized PCA
+    int n_pca_iterations = 8;  // number of power iterations of the randomized PCA
     dimre_method cvector_dimre_method = DIMRE_METHOD_PCA;
     std::string cvector_positive_file = "tools/cvector-generator/positive.txt";
     std::string cvector_negative_file = "tools/cvector-generator/negative.txt";
@@ -495,6 +515,10 @@ struct common_params {
     // batched-bench params
     bool batched_bench_output_jsonl = false;
 
+    // batch-infer params
+    int32_t n_infer_window     = 16384; // number of input prompts that are grouped and ordered together
+    int32_t n_infer_min_prefix = 32;    // min. number of common leading tokens for prompts to share their prefix in the KV cache
+
     // common params
     std::string out_file; // output filename for all example programs
     // optional callback for model loading progress and cancellation:
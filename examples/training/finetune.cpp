@@ -69,7 +69,47 @@ int main(int argc, char ** argv) {
         /*get_opt_pars    =*/common_opt_lr_pars,
         /*get_opt_pars_ud =*/&params.lr,
         /*optimizer_type  =*/params.optimizer,
+        /*momenta_type    =*/params.optimizer_state_type,
+        /*dp_rank         =*/0,
+        /*dp_size         =*/1,
+        /*all_reduce      =*/nullptr,
+        /*all_reduce_ud   =*/nullptr,
     };
+
+    // data parallelism: connect to the other workers, the gradients are summed over a ring of RPC sockets
+    typedef void (*ggml_backend_rpc_ring_free_t)(void * ring);
+    ggml_backend_rpc_ring_free_t ring_free = nullptr;
+    void * ring = nullptr;
+    if (!params.dp_ring.empty()) {
+        ggml_backend_reg_t rpc_reg = ggml_backend_reg_by_name("RPC");
+        if (!rpc_reg) {
+            LOG_ERR("%s: --dp-ring requires the RPC backend\n", __func__);
+            return 1;
+        }
+        typedef void * (*ggml_backend_rpc_ring_init_t)(const char * endpoints, int rank);
+        typedef int    (*ggml_backend_rpc_ring_size_t)(void * ring);
+        auto ring_init  = (ggml_backend_rpc_ring_init_t) ggml_backend_reg_get_proc_address(rpc_reg, "ggml_backend_rpc_ring_init");
+        auto ring_size  = (ggml_backend_rpc_ring_size_t) ggml_backend_reg_get_proc_address(rpc_reg, "ggml_backend_rpc_ring_size");
+        auto all_reduce = (ggml_opt_all_reduce_t)        ggml_backend_reg_get_proc_address(rpc_reg, "ggml_backend_rpc_ring_all_reduce");
+        ring_free       = (ggml_backend_rpc_ring_free_t) ggml_backend_reg_get_proc_address(rpc_reg, "ggml_backend_rpc_ring_free");
+        if (!ring_init || !ring_size || !all_reduce || !ring_free) {
+            LOG_ERR("%s: failed to find the RPC ring functions\n", __func__);
+            return 1;
+        }
+
+        LOG_INF("%s: connecting data-parallel worker %d to %s\n", __func__, params.dp_rank, params.dp_ring.c_str());
+        ring = ring_init(params.dp_ring.c_str(), params.dp_rank);
+        if (!ring) {
+            LOG_ERR("%s: failed to set up the data-parallel ring\n", __func__);
+            return 1;
+        }
+
+        lopt_params.dp_rank       = params.dp_rank;
+        lopt_params.dp_size       = ring_size(ring);
+        lopt_params.all_reduce    = all_reduce;
+        lopt_params.all_reduce_ud = ring;
+    }
+
     llama_opt_init(ctx.get(), model.get(), lopt_params);
 
     const int64_t idata_split = ggml_opt_dataset_ndata(dataset) * (1.0f - params.val_split);
@@ -88,7 +128,14 @@ int main(int argc, char ** argv) {
     ggml_opt_result_free(result_train);
     ggml_opt_result_free(result_eval);
 
-    llama_model_save_to_file(model.get(), params.out_file.c_str());
+    if (ring) {
+        ring_free(ring);
+    }
+
+    // all workers end up with the same weights, only the first one saves them
+    if (params.dp_rank == 0) {
+        llama_model_save_to_file(model.get(), params.out_file.c_str());
+    }
 
     llama_backend_free();
 
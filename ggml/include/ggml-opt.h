@@ -107,6 +107,10 @@ extern "C" {
     // casts userdata to ggml_opt_optimizer_params and returns it
     GGML_API struct ggml_opt_optimizer_params ggml_opt_get_constant_optimizer_params(void * userdata);
 
+    // callback to sum data element-wise over all data-parallel workers, in place
+    // called by each worker with the same n and in the same order
+    typedef void (*ggml_opt_all_reduce_t)(float * data, int64_t n, void * userdata);
+
     // parameters for initializing a new optimization context
     struct ggml_opt_params {
         ggml_backend_sched_t backend_sched; // defines which backends are used to construct the compute graphs
@@ -127,6 +131,17 @@ extern "C" {
 
         // only GGML_OPT_OPTIMIZER_TYPE_ADAMW needs m, v momenta per parameter tensor
         enum ggml_opt_optimizer_type optimizer;
+
+        // type of the AdamW momenta: GGML_TYPE_F32 or GGML_TYPE_Q8_0 (8-bit, ~1/4 of the memory)
+        // parameters whose rows are not a multiple of the block size fall back to F32
+        enum ggml_type momenta_type;
+
+        // data-parallel training: each of the dp_size workers processes every dp_size-th batch starting at dp_rank,
+        // the gradients are averaged over the workers with all_reduce before each optimizer step
+        int32_t               dp_rank;
+        int32_t               dp_size;
+        ggml_opt_all_reduce_t all_reduce;
+        void *                all_reduce_ud;
     };
 
     // get parameters for an optimization context with defaults set where possible
@@ -157,6 +172,9 @@ extern "C" {
 
     GGML_API enum ggml_opt_optimizer_type ggml_opt_context_optimizer_type(ggml_opt_context_t); //TODO consistent naming scheme
 
+    GGML_API int32_t ggml_opt_dp_rank(ggml_opt_context_t opt_ctx); // rank of this worker for data-parallel training
+    GGML_API int32_t ggml_opt_dp_size(ggml_opt_context_t opt_ctx); // number of data-parallel workers
+
     GGML_API const char * ggml_opt_optimizer_name(enum ggml_opt_optimizer_type);
 
     // ====== Optimization Result ======
@@ -28,6 +28,23 @@ GGML_BACKEND_API ggml_backend_reg_t ggml_backend_rpc_reg(void);
 
 GGML_BACKEND_API ggml_backend_dev_t ggml_backend_rpc_add_device(const char * endpoint);
 
+// ring of workers for collective operations (e.g. data-parallel training, context-parallel prefill)
+typedef struct ggml_backend_rpc_ring * ggml_backend_rpc_ring_t;
+
+// connect the workers listed in endpoints (comma-separated "host:port") into a ring, this worker is endpoints[rank]
+// each worker listens on its own endpoint and connects to the next one - blocks until the ring is complete
+GGML_BACKEND_API ggml_backend_rpc_ring_t ggml_backend_rpc_ring_init(const char * endpoints, int rank);
+GGML_BACKEND_API void                    ggml_backend_rpc_ring_free(ggml_backend_rpc_ring_t ring);
+GGML_BACKEND_API int                     ggml_backend_rpc_ring_size(ggml_backend_rpc_ring_t ring);
+
+// element-wise sum of n floats over all workers of the ring, in place (ring reduce-scatter + all-gather)
+// must be called by all workers with the same n, the signature matches ggml_opt_all_reduce_t
+GGML_BACKEND_API void ggml_backend_rpc_ring_all_reduce(float * data, int64_t n, void * ring);
+
+// concatenation of the blocks of all workers, in place: data holds the blocks of sizes[0], ..., sizes[size - 1] bytes
+// back to back and block rank is filled by this worker, the signature matches llama_all_gather_t
+GGML_BACKEND_API void ggml_backend_rpc_ring_all_gather(void * data, const size_t * sizes, void * ring);
+
 #ifdef  __cplusplus
 }
 #endif
@@ -488,6 +488,8 @@ extern "C" {
         GGML_OP_MUL_MAT,
         GGML_OP_MUL_MAT_ID,
         GGML_OP_OUT_PROD,
+        GGML_OP_MUL_MAT_SEL,
+        GGML_OP_OUT_PROD_SEL,
 
         GGML_OP_SCALE,
         GGML_OP_SET,
@@ -525,6 +527,7 @@ extern "C" {
         GGML_OP_ARANGE,
         GGML_OP_TIMESTEP_EMBEDDING,
         GGML_OP_ARGSORT,
+        GGML_OP_MOE_ROUTE,
         GGML_OP_LEAKY_RELU,
 
         GGML_OP_FLASH_ATTN_EXT,
@@ -1321,6 +1324,28 @@ extern "C" {
             struct ggml_tensor  * a,
             struct ggml_tensor  * b);
 
+    // matrix multiplication restricted to selected rows of a
+    // a:      [n, m]
+    // b:      [n, n_tokens] (F32)
+    // ids:    [k, n_tokens] (I32), rows of a to use for each column of b
+    // result: [k, n_tokens] (F32), result[i, t] = a[:, ids[i, t]] . b[:, t]
+    GGML_API struct ggml_tensor * ggml_mul_mat_sel(
+            struct ggml_context * ctx,
+            struct ggml_tensor  * a,
+            struct ggml_tensor  * b,
+            struct ggml_tensor  * ids);
+
+    // sum of selected rows of a, weighted by b (the transposed counterpart of ggml_mul_mat_sel)
+    // a:      [n, m]
+    // b:      [k, n_tokens] (F32), zero weights are skipped
+    // ids:    [k, n_tokens] (I32)
+    // result: [n, n_tokens] (F32), result[:, t] = sum_i b[i, t]*a[:, ids[i, t]]
+    GGML_API struct ggml_tensor * ggml_out_prod_sel(
+            struct ggml_context * ctx,
+            struct ggml_tensor  * a,
+            struct ggml_tensor  * b,
+            struct ggml_tensor  * ids);
+
     //
     // operations on tensors without backpropagation
     //
@@ -2098,6 +2123,38 @@ extern "C" {
             struct ggml_tensor  * a,
             int                   k);
 
+    // gating function used by ggml_moe_route
+    enum ggml_moe_gating {
+        GGML_MOE_GATING_SOFTMAX,        // softmax over all experts
+        GGML_MOE_GATING_SIGMOID,        // sigmoid of each expert logit
+        GGML_MOE_GATING_SOFTMAX_WEIGHT, // softmax over the selected experts only
+    };
+
+    // mixture-of-experts routing: gating, top-k expert selection and weight normalization in a single op
+    // a:      router logits [n_expert, n_tokens]
+    // b:      optional expert selection bias [n_expert], only used to select the experts (can be NULL)
+    // norm:   normalize the weights of the selected experts to sum to 1
+    // scale:  scale applied to the final weights
+    // result: [n_expert_used, n_tokens, 2] - use ggml_moe_route_ids and ggml_moe_route_weights to access the ids and the weights
+    GGML_API struct ggml_tensor * ggml_moe_route(
+            struct ggml_context  * ctx,
+            struct ggml_tensor   * a,
+            struct ggml_tensor   * b,
+            int                    n_expert_used,
+            enum ggml_moe_gating   gating,
+            bool                   norm,
+            float                  scale);
+
+    // ids of the selected experts [n_expert_used, n_tokens] (I32), in descending order of selection score
+    GGML_API struct ggml_tensor * ggml_moe_route_ids(
+            struct ggml_context * ctx,
+            struct ggml_tensor  * route);
+
+    // weights of the selected experts [1, n_expert_used, n_tokens] (F32)
+    GGML_API struct ggml_tensor * ggml_moe_route_weights(
+            struct ggml_context * ctx,
+            struct ggml_tensor  * route);
+
 #define GGML_KQ_MASK_PAD 64
 
     // q:    [n_embd_k, n_batch,     n_head,    ne3 ]
@@ -2337,14 +2394,14 @@ extern "C" {
             struct ggml_tensor  * grad,
             struct ggml_tensor  * m,
             struct ggml_tensor  * v,
-            struct ggml_tensor  * adamw_params); // parameters such as the learning rate
+            struct ggml_tensor  * adamw_params); // parameters such as the learning rate, optionally followed by the step number
 
     // stochastic gradient descent step (with weight decay)
     GGML_API struct ggml_tensor * ggml_opt_step_sgd(
         struct ggml_context * ctx,
         struct ggml_tensor *  a,
         struct ggml_tensor *  grad,
-        struct ggml_tensor *  sgd_params); // alpha, weight decay
+        struct ggml_tensor *  sgd_params); // alpha, weight decay, optionally the step number
 
     //
     // automatic differentiation
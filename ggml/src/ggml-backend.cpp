@@ -668,6 +668,13 @@ struct ggml_backend_sched_split {
     struct ggml_cgraph graph;
 };
 
+// execution plan of a split, for the backends that support graph plans
+struct ggml_backend_sched_plan {
+    int backend_id;
+    ggml_backend_graph_plan_t plan;
+    bool valid; // false if the graph has been split again since the plan was created
+};
+
 struct ggml_backend_sched {
     bool is_reset; // true if the scheduler has been reset since the last graph split
     bool is_alloc;
@@ -697,6 +704,10 @@ struct ggml_backend_sched {
     int n_splits;
     int splits_capacity;
 
+    // cached execution plans of the splits, kept while the same graph is computed (e.g. when it is reused)
+    struct ggml_backend_sched_plan * plans;
+    int plans_capacity;
+
     // pipeline parallelism support
     int n_copies;
     int cur_copy;
@@ -908,6 +919,11 @@ void ggml_backend_sched_split_graph(ggml_backend_sched_t sched, struct ggml_cgra
     sched->n_graph_inputs = 0;
     sched->is_reset = false;
 
+    // the plans have to be updated for the new splits
+    for (int i = 0; i < sched->plans_capacity; i++) {
+        sched->plans[i].valid = false;
+    }
+
     struct ggml_init_params params = {
         /* .mem_size =   */ sched->context_buffer_size,
         /* .mem_buffer = */ sched->context_buffer,
@@ -1402,6 +1418,49 @@ static bool ggml_backend_sched_alloc_splits(ggml_backend_sched_t sched) {
     return true;
 }
 
+// compute a split, using a cached execution plan if the backend supports it
+static enum ggml_status ggml_backend_sched_compute_split(ggml_backend_sched_t sched, int split_id) {
+    struct ggml_backend_sched_split * split = &sched->splits[split_id];
+    ggml_backend_t split_backend = sched->backends[split->backend_id];
+
+    if (split_backend->iface.graph_plan_create == NULL || split_backend->iface.graph_plan_compute == NULL) {
+        return ggml_backend_graph_compute_async(split_backend, &split->graph);
+    }
+
+    if (split_id >= sched->plans_capacity) {
+        const int capacity = std::max(sched->splits_capacity, split_id + 1);
+        sched->plans = (ggml_backend_sched_plan *) realloc(sched->plans, capacity * sizeof(sched->plans[0]));
+        GGML_ASSERT(sched->plans != NULL);
+        memset(sched->plans + sched->plans_capacity, 0, (capacity - sched->plans_capacity) * sizeof(sched->plans[0]));
+        sched->plans_capacity = capacity;
+    }
+
+    struct ggml_backend_sched_plan * plan = &sched->plans[split_id];
+
+    if (plan->plan != NULL && !plan->valid) {
+        ggml_backend_t plan_backend = sched->backends[plan->backend_id];
+
+        if (plan->backend_id == split->backend_id && plan_backend->iface.graph_plan_update != NULL) {
+            plan_backend->iface.graph_plan_update(plan_backend, plan->plan, &split->graph);
+            plan->valid = true;
+        } else {
+            ggml_backend_graph_plan_free(plan_backend, plan->plan);
+            plan->plan = NULL;
+        }
+    }
+
+    if (plan->plan == NULL) {
+        plan->plan = ggml_backend_graph_plan_create(split_backend, &split->graph);
+        if (plan->plan == NULL) {
+            return ggml_backend_graph_compute_async(split_backend, &split->graph);
+        }
+        plan->backend_id = split->backend_id;
+        plan->valid      = true;
+    }
+
+    return ggml_backend_graph_plan_compute(split_backend, plan->plan);
+}
+
 static enum ggml_status ggml_backend_sched_compute_splits(ggml_backend_sched_t sched) {
     GGML_ASSERT(sched);
     struct ggml_backend_sched_split * splits = sched->splits;
@@ -1539,7 +1598,7 @@ static enum ggml_status ggml_backend_sched_compute_splits(ggml_backend_sched_t s
         }
 
         if (!sched->callback_eval) {
-            enum ggml_status ec = ggml_backend_graph_compute_async(split_backend, &split->graph);
+            enum ggml_status ec = ggml_backend_sched_compute_split(sched, split_id);
             if (ec != GGML_STATUS_SUCCESS) {
                 return ec;
             }
@@ -1655,10 +1714,16 @@ void ggml_backend_sched_free(ggml_backend_sched_t sched) {
             ggml_backend_event_free(sched->events[b][c]);
         }
     }
+    for (int i = 0; i < sched->plans_capacity; i++) {
+        if (sched->plans[i].plan != NULL) {
+            ggml_backend_graph_plan_free(sched->backends[sched->plans[i].backend_id], sched->plans[i].plan);
+        }
+    }
     ggml_gallocr_free(sched->galloc);
     ggml_free(sched->ctx);
     ggml_hash_set_free(&sched->hash_set);
     free(sched->splits);
+    free(sched->plans);
     free(sched->hv_tensor_backend_ids);
     free(sched->hv_tensor_copies);
     free(sched->node_backend_ids);
@@ -1938,6 +1938,89 @@ void ggml_gemv_q2_K_8x8_q8_K(int n, float * GGML_RESTRICT s, size_t bs, const vo
 #endif
 }
 
+#if defined(__AVX2__)
+// iq1s_grid_gpu with one byte per value (still biased by +1), so that a grid entry is a single 8-byte load
+static const uint64_t * iq1s_grid_u8(void) {
+    static const struct grid_u8 {
+        uint64_t v[NGRID_IQ1S];
+        grid_u8() {
+            for (int i = 0; i < NGRID_IQ1S; ++i) {
+                const uint64_t g = iq1s_grid_gpu[i];
+                v[i] = (g | (g << 28)) & 0x0F0F0F0F0F0F0F0FULL;
+            }
+        }
+    } grid;
+    return grid.v;
+}
+
+// the 4 grid indices of a row's sub-block, 16 bits each
+static inline uint64_t iq1s_grid_idx(const uint8_t * qs, uint16_t qh) {
+#if defined(__BMI2__)
+    uint32_t aux32;
+    memcpy(&aux32, qs, sizeof(aux32));
+    return _pdep_u64(aux32, 0x00FF00FF00FF00FFULL) | _pdep_u64(qh, 0x0700070007000700ULL);
+#else
+    return (uint64_t) (qs[0] | ((qh << 8) & 0x700))       | (uint64_t) (qs[1] | ((qh << 5) & 0x700)) << 16 |
+           (uint64_t) (qs[2] | ((qh << 2) & 0x700)) << 32 | (uint64_t) (qs[3] | ((qh >> 1) & 0x700)) << 48;
+#endif
+}
+#endif
+
+void ggml_gemv_iq1_s_4x8_q8_K(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
+#if defined(__AVX2__)
+    const int qk = QK_K;
+    const int nb = n / qk;
+    const int ncols_interleaved = 4;
+
+    assert(n % qk == 0);
+    assert(nc % ncols_interleaved == 0);
+
+    UNUSED(bs);
+    UNUSED(nr);
+
+    const __m128i m3b = _mm_set1_epi32(7);
+    const uint64_t * grid = iq1s_grid_u8();
+
+    const block_q8_K * a_ptr = (const block_q8_K *) vy;
+    for (int x = 0; x < nc / ncols_interleaved; x++) {
+        const block_iq1_sx4 * b_ptr = (const block_iq1_sx4 *) vx + (x * nb);
+
+        __m128 acc_row = _mm_setzero_ps();
+        for (int l = 0; l < nb; l++) {
+            __m256i sumi[4] = { _mm256_setzero_si256(), _mm256_setzero_si256(), _mm256_setzero_si256(), _mm256_setzero_si256() };
+            __m128i sumi1 = _mm_setzero_si128();
+            for (int ib = 0; ib < QK_K / 32; ib++) {
+                const __m256i q8 = _mm256_loadu_si256((const __m256i *)(a_ptr[l].qs + ib * 32));
+                const uint8_t  * qs = b_ptr[l].qs + ib * 16;
+                const uint16_t * qh = b_ptr[l].qh + ib * 4;
+                for (int j = 0; j < ncols_interleaved; j++) {
+                    const uint64_t idx = iq1s_grid_idx(qs + 4 * j, qh[j]);
+                    const __m256i q1 = _mm256_set_epi64x(grid[(uint16_t) (idx >> 48)], grid[(uint16_t) (idx >> 32)], grid[(uint16_t) (idx >> 16)], grid[(uint16_t) idx]);
+                    const __m256i dot = _mm256_maddubs_epi16(q1, q8);
+                    sumi[j] = _mm256_add_epi32(sumi[j], _mm256_madd_epi16(dot, _mm256_set1_epi16(2 * ((qh[j] >> 12) & 7) + 1)));
+                }
+                // the +1 bias and the +/-IQ1S_DELTA shift of the 4 rows, in units of IQ1S_DELTA: ls * (+/-1 - 8) * bsum
+                const __m128i h  = _mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i *) qh));
+                const __m128i ls = _mm_or_si128(_mm_slli_epi32(_mm_and_si128(_mm_srli_epi32(h, 12), m3b), 1), _mm_set1_epi32(1));
+                const __m128i sg = _mm_or_si128(_mm_srai_epi32(_mm_slli_epi32(h, 16), 31), _mm_set1_epi32(1));
+                const __m128i c  = _mm_mullo_epi32(ls, _mm_sub_epi32(sg, _mm_set1_epi32(8)));
+                sumi1 = _mm_add_epi32(sumi1, _mm_mullo_epi32(c, _mm_set1_epi32(a_ptr[l].bsums[2 * ib] + a_ptr[l].bsums[2 * ib + 1])));
+            }
+            const __m256i sumi0123 = _mm256_hadd_epi32(_mm256_hadd_epi32(sumi[0], sumi[1]), _mm256_hadd_epi32(sumi[2], sumi[3]));
+            const __m128i isum = _mm_add_epi32(_mm256_castsi256_si128(sumi0123), _mm256_extracti128_si256(sumi0123, 1));
+            const __m128 sumf = _mm_add_ps(_mm_cvtepi32_ps(isum), _mm_mul_ps(_mm_cvtepi32_ps(sumi1), _mm_set1_ps(IQ1S_DELTA)));
+            const __m128 d = _mm_mul_ps(_mm_set_ps(GGML_CPU_FP16_TO_FP32(b_ptr[l].d[3]), GGML_CPU_FP16_TO_FP32(b_ptr[l].d[2]),
+                                                   GGML_CPU_FP16_TO_FP32(b_ptr[l].d[1]), GGML_CPU_FP16_TO_FP32(b_ptr[l].d[0])), _mm_set1_ps(a_ptr[l].d));
+            acc_row = _mm_add_ps(acc_row, _mm_mul_ps(d, sumf));
+        }
+        _mm_storeu_ps(s + x * ncols_interleaved, acc_row);
+    }
+    return;
+#endif
+
+    ggml_gemv_iq1_s_4x8_q8_K_generic(n, s, bs, vx, vy, nr, nc);
+}
+
 void ggml_gemm_q4_0_8x8_q8_0(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
 #if defined(__AVX2__) || defined(__AVX512F__)
     {
@@ -6305,3 +6388,90 @@ void ggml_gemm_q2_K_8x8_q8_K(int n, float * GGML_RESTRICT s, size_t bs, const vo
 
 #endif
 }
+
+void ggml_gemm_iq1_s_4x8_q8_K(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
+#if defined(__AVX2__)
+    const int qk = QK_K;
+    const int nb = n / qk;
+    const int ncols_interleaved = 4;
+
+    assert(n % qk == 0);
+    assert(nr % 4 == 0);
+    assert(nc % ncols_interleaved == 0);
+
+    const __m128i m3b = _mm_set1_epi16(7);
+    const uint64_t * grid = iq1s_grid_u8();
+    // Duplicates the activation scales so that lanes 2m and 2m + 1 belong to activation row m
+    const __m256i scale_dup = _mm256_set_epi32(3, 3, 2, 2, 1, 1, 0, 0);
+    // Selects the delta coefficients of a weight row for two consecutive sub-blocks, matching the layout of the bsums
+    __m256i coef_mask[4];
+    for (int j = 0; j < ncols_interleaved; j++) {
+        const char b0 = 2 * j, b1 = 2 * j + 1, b2 = 2 * j + 8, b3 = 2 * j + 9;
+        coef_mask[j] = _mm256_setr_epi8(b0, b1, b0, b1, b2, b3, b2, b3, b0, b1, b0, b1, b2, b3, b2, b3,
+                                        b0, b1, b0, b1, b2, b3, b2, b3, b0, b1, b0, b1, b2, b3, b2, b3);
+    }
+
+    for (int y = 0; y < nr / 4; y++) {
+        const block_q8_Kx4 * a_ptr = (const block_q8_Kx4 *) vy + (y * nb);
+        for (int x = 0; x < nc / ncols_interleaved; x++) {
+            const block_iq1_sx4 * b_ptr = (const block_iq1_sx4 *) vx + (x * nb);
+
+            // One accumulator per weight row
+            __m256 acc_rows[4] = { _mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps() };
+            for (int l = 0; l < nb; l++) {
+                // Integer sums are kept in units of IQ1S_DELTA
+                __m256i iacc[4] = { _mm256_setzero_si256(), _mm256_setzero_si256(), _mm256_setzero_si256(), _mm256_setzero_si256() };
+                for (int ib = 0; ib < QK_K / 32; ib++) {
+                    const int8_t * q8 = a_ptr[l].qs + ib * 128;
+                    const __m256i q8_0 = _mm256_loadu_si256((const __m256i *)(q8 +  0));
+                    const __m256i q8_1 = _mm256_loadu_si256((const __m256i *)(q8 + 32));
+                    const __m256i q8_2 = _mm256_loadu_si256((const __m256i *)(q8 + 64));
+                    const __m256i q8_3 = _mm256_loadu_si256((const __m256i *)(q8 + 96));
+                    const uint8_t  * qs = b_ptr[l].qs + ib * 16;
+                    const uint16_t * qh = b_ptr[l].qh + ib * 4;
+                    for (int j = 0; j < ncols_interleaved; j++) {
+                        // Each grid entry is broadcast to the 8-byte chunks of all 4 rows of activations
+                        const uint64_t idx = iq1s_grid_idx(qs + 4 * j, qh[j]);
+                        const __m256i q1_0 = _mm256_set1_epi64x(grid[(uint16_t) idx]);
+                        const __m256i q1_1 = _mm256_set1_epi64x(grid[(uint16_t) (idx >> 16)]);
+                        const __m256i q1_2 = _mm256_set1_epi64x(grid[(uint16_t) (idx >> 32)]);
+                        const __m256i q1_3 = _mm256_set1_epi64x(grid[(uint16_t) (idx >> 48)]);
+                        const __m256i dot = _mm256_add_epi16(_mm256_add_epi16(_mm256_maddubs_epi16(q1_0, q8_0), _mm256_maddubs_epi16(q1_1, q8_1)),
+                                                             _mm256_add_epi16(_mm256_maddubs_epi16(q1_2, q8_2), _mm256_maddubs_epi16(q1_3, q8_3)));
+                        iacc[j] = _mm256_add_epi32(iacc[j], _mm256_madd_epi16(dot, _mm256_set1_epi16(8 * (2 * ((qh[j] >> 12) & 7) + 1))));
+                    }
+                }
+                // The +1 bias and the +/-IQ1S_DELTA shift: ls * (+/-1 - 8) * bsum, two sub-blocks at a time
+                for (int ib = 0; ib < QK_K / 32; ib += 2) {
+                    const __m128i h  = _mm_loadu_si128((const __m128i *)(b_ptr[l].qh + ib * 4));
+                    const __m128i ls = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(_mm_srli_epi16(h, 12), m3b), 1), _mm_set1_epi16(1));
+                    const __m128i sg = _mm_or_si128(_mm_srai_epi16(h, 15), _mm_set1_epi16(1));
+                    const __m128i c  = _mm_mullo_epi16(ls, _mm_sub_epi16(sg, _mm_set1_epi16(8)));
+                    const __m256i coef  = _mm256_broadcastsi128_si256(c);
+                    const __m256i bsums = _mm256_loadu_si256((const __m256i *)(a_ptr[l].bsums + ib * 8));
+                    for (int j = 0; j < ncols_interleaved; j++) {
+                        iacc[j] = _mm256_add_epi32(iacc[j], _mm256_madd_epi16(bsums, _mm256_shuffle_epi8(coef, coef_mask[j])));
+                    }
+                }
+                const __m256 col_scale = _mm256_permutevar8x32_ps(_mm256_castps128_ps256(_mm_loadu_ps(a_ptr[l].d)), scale_dup);
+                for (int j = 0; j < ncols_interleaved; j++) {
+                    const __m256 scale = _mm256_mul_ps(col_scale, _mm256_set1_ps(GGML_CPU_FP16_TO_FP32(b_ptr[l].d[j]) * IQ1S_DELTA));
+                    acc_rows[j] = _mm256_fmadd_ps(_mm256_cvtepi32_ps(iacc[j]), scale, acc_rows[j]);
+                }
+            }
+            // Reduce the lane pairs and transpose so that each activation row is stored contiguously
+            const __m256 sum01 = _mm256_hadd_ps(acc_rows[0], acc_rows[1]);
+            const __m256 sum23 = _mm256_hadd_ps(acc_rows[2], acc_rows[3]);
+            const __m256 out02 = _mm256_shuffle_ps(sum01, sum23, _MM_SHUFFLE(2, 0, 2, 0));
+            const __m256 out13 = _mm256_shuffle_ps(sum01, sum23, _MM_SHUFFLE(3, 1, 3, 1));
+            _mm_storeu_ps(s + (y * 4 + 0) * bs + x * ncols_interleaved, _mm256_castps256_ps128(out02));
+            _mm_storeu_ps(s + (y * 4 + 1) * bs + x * ncols_interleaved, _mm256_castps256_ps128(out13));
+            _mm_storeu_ps(s + (y * 4 + 2) * bs + x * ncols_interleaved, _mm256_extractf128_ps(out02, 1));
+            _mm_storeu_ps(s + (y * 4 + 3) * bs + x * ncols_interleaved, _mm256_extractf128_ps(out13, 1));
+        }
+    }
+    return;
+#endif
+
+    ggml_gemm_iq1_s_4x8_q8_K_generic(n, s, bs, vx, vy, nr, nc);
+}
@@ -1,4 +1,5 @@
 #include "binary-ops.h"
+#include "elementwise.h"
 
 #if defined(GGML_USE_ACCELERATE)
 #include <Accelerate/Accelerate.h>
@@ -6,47 +7,79 @@
 using vDSP_fn_t = void (*)(const float *, vDSP_Stride, const float *, vDSP_Stride, float *, vDSP_Stride, vDSP_Length);
 #endif
 
-static inline float op_add(float a, float b) {
-    return a + b;
-}
+struct op_add {
+    static constexpr bool has_vec = true;
+    static inline float apply(float a, float b) { return a + b; }
+#if defined(GGML_EW_EPR)
+    static inline ew_f32 apply(ew_f32 a, ew_f32 b) { return ew_add(a, b); }
+#endif
+};
 
-static inline float op_sub(float a, float b) {
-    return a - b;
-}
+struct op_sub {
+    static constexpr bool has_vec = true;
+    static inline float apply(float a, float b) { return a - b; }
+#if defined(GGML_EW_EPR)
+    static inline ew_f32 apply(ew_f32 a, ew_f32 b) { return ew_sub(a, b); }
+#endif
+};
 
-static inline float op_mul(float a, float b) {
-    return a * b;
-}
+struct op_mul {
+    static constexpr bool has_vec = true;
+    static inline float apply(float a, float b) { return a * b; }
+#if defined(GGML_EW_EPR)
+    static inline ew_f32 apply(ew_f32 a, ew_f32 b) { return ew_mul(a, b); }
+#endif
+};
 
-static inline float op_div(float a, float b) {
-    return a / b;
-}
+struct op_div {
+    static constexpr bool has_vec = true;
+    static inline float apply(float a, float b) { return a / b; }
+#if defined(GGML_EW_EPR)
+    static inline ew_f32 apply(ew_f32 a, ew_f32 b) { return ew_div(a, b); }
+#endif
+};
 
-template <float (*op)(float, float), typename src0_t, typename src1_t, typename dst_t>
+template <class op, typename src0_t, typename src1_t, typename dst_t>
 static inline void vec_binary_op_contiguous(const int64_t n, dst_t * z, const src0_t * x, const src1_t * y) {
-    constexpr auto src0_to_f32 = type_conversion_table<src0_t>::to_f32;
-    constexpr auto src1_to_f32 = type_conversion_table<src1_t>::to_f32;
-    constexpr auto f32_to_dst  = type_conversion_table<dst_t >::from_f32;
-
-    for (int i = 0; i < n; i++) {
-        z[i] = f32_to_dst(op(src0_to_f32(x[i]), src1_to_f32(y[i])));
+#ifdef GGML_USE_ACCELERATE
+    if constexpr (std::is_same_v<src0_t, float> && std::is_same_v<src1_t, float> && std::is_same_v<dst_t, float>) {
+        vDSP_fn_t vDSP_op = nullptr;
+        if constexpr (std::is_same_v<op, op_add>) {
+            vDSP_op = vDSP_vadd;
+        } else if constexpr (std::is_same_v<op, op_sub>) {
+            vDSP_op = vDSP_vsub;
+        } else if constexpr (std::is_same_v<op, op_mul>) {
+            vDSP_op = vDSP_vmul;
+        } else if constexpr (std::is_same_v<op, op_div>) {
+            vDSP_op = vDSP_vdiv;
+        }
+        if (vDSP_op != nullptr) {
+            vDSP_op(y, 1, x, 1, z, 1, n);
+            return;
+        }
     }
+#endif
+    ew_binary_vv<op>(n, z, x, y);
 }
 
-template <float (*op)(float, float), typename src0_t, typename src1_t, typename dst_t>
-static inline void vec_binary_op_non_contiguous(const int64_t n, const int64_t ne10, const int64_t nb10, dst_t * z, const src0_t * x, const src1_t * y) {
+// z[i] = op(x[i*nx], y[(i0 + i)%ne10*ny]) with the strides in bytes
+template <class op, typename src0_t, typename src1_t, typename dst_t>
+static inline void vec_binary_op_strided(const int64_t n, dst_t * z, const size_t nz, const src0_t * x, const size_t nx,
+        const int64_t i0, const int64_t ne10, const src1_t * y, const size_t ny) {
     constexpr auto src0_to_f32 = type_conversion_table<src0_t>::to_f32;
     constexpr auto src1_to_f32 = type_conversion_table<src1_t>::to_f32;
     constexpr auto f32_to_dst  = type_conversion_table<dst_t >::from_f32;
 
-    for (int i = 0; i < n; i++) {
-        int i10 = i % ne10;
-        const src1_t * y_ptr = (const src1_t *)((const char *)y + i10*nb10);
-        z[i] = f32_to_dst(op(src0_to_f32(x[i]), src1_to_f32(*y_ptr)));
+    for (int64_t i = 0; i < n; i++) {
+        const int64_t i10 = (i0 + i) % ne10;
+        const src0_t * x_ptr = (const src0_t *)((const char *)x + i*nx);
+        const src1_t * y_ptr = (const src1_t *)((const char *)y + i10*ny);
+        dst_t        * z_ptr = (dst_t        *)((char *)z + i*nz);
+        *z_ptr = f32_to_dst(op::apply(src0_to_f32(*x_ptr), src1_to_f32(*y_ptr)));
     }
 }
 
-template <float (*op)(float, float), typename src0_t, typename src1_t, typename dst_t>
+template <class op, typename src0_t, typename src1_t, typename dst_t>
 static void apply_binary_op(const ggml_compute_params * params, ggml_tensor * dst) {
     const ggml_tensor * src0 = dst->src[0];
     const ggml_tensor * src1 = dst->src[1];
@@ -55,33 +88,27 @@ static void apply_binary_op(const ggml_compute_params * params, ggml_tensor * ds
 
     GGML_TENSOR_BINARY_OP_LOCALS
 
-    GGML_ASSERT( nb0 == sizeof(dst_t));
-    GGML_ASSERT(nb00 == sizeof(src0_t));
-
-    const auto [ir0, ir1] = get_thread_range(params, src0);
-    const bool is_src1_contiguous = (nb10 == sizeof(src1_t));
-
-    if (!is_src1_contiguous) { // broadcast not implemented yet for non-contiguous
-        GGML_ASSERT(ggml_are_same_shape(src0, src1));
+    // the threads split the flattened elements instead of the rows, so that tensors with few rows use all threads
+    const auto [ie0, ie1] = get_thread_range_flat(params, ggml_nelements(dst));
+    if (ie0 >= ie1) {
+        return;
     }
 
-#ifdef GGML_USE_ACCELERATE
-    vDSP_fn_t vDSP_op = nullptr;
-    // TODO - avoid the f32-only check using type 'trait' lookup tables and row-based src-to-float conversion functions
-    if (src0->type == GGML_TYPE_F32 && src1->type == GGML_TYPE_F32 && dst->type == GGML_TYPE_F32) {
-        if (op == op_add) {
-            vDSP_op = vDSP_vadd;
-        } else if (op == op_sub) {
-            vDSP_op = vDSP_vsub;
-        } else if (op == op_mul) {
-            vDSP_op = vDSP_vmul;
-        } else if (op == op_div) {
-            vDSP_op = vDSP_vdiv;
-        }
+    if (ggml_is_contiguous(src0) && ggml_is_contiguous(src1) && ggml_is_contiguous(dst) && ggml_are_same_shape(src0, src1)) {
+        vec_binary_op_contiguous<op>(ie1 - ie0, (dst_t *) dst->data + ie0, (const src0_t *) src0->data + ie0, (const src1_t *) src1->data + ie0);
+        return;
     }
-#endif
 
-    for (int64_t ir = ir0; ir < ir1; ++ir) {
+    const bool is_contiguous_rows = nb0 == sizeof(dst_t) && nb00 == sizeof(src0_t) && nb10 == sizeof(src1_t);
+
+    for (int64_t ie = ie0; ie < ie1; ) {
+        const int64_t ir = ie/ne0;
+
+        // columns [i0, i1) of row ir
+        const int64_t i0 = ie - ir*ne0;
+        const int64_t i1 = std::min(ne0, i0 + (ie1 - ie));
+        ie += i1 - i0;
+
         const int64_t i03 = ir/(ne02*ne01);
         const int64_t i02 = (ir - i03*ne02*ne01)/ne01;
         const int64_t i01 = (ir - i03*ne02*ne01 - i02*ne01);
@@ -94,29 +121,26 @@ static void apply_binary_op(const ggml_compute_params * params, ggml_tensor * ds
         const src0_t * src0_ptr = (const src0_t *) ((const char *) src0->data + i03*nb03 + i02*nb02 + i01*nb01);
         const src1_t * src1_ptr = (const src1_t *) ((const char *) src1->data + i13*nb13 + i12*nb12 + i11*nb11);
 
-        if (is_src1_contiguous) {
-            // src1 is broadcastable across src0 and dst in i1, i2, i3
-            const int64_t nr0 = ne00 / ne10;
-
-            for (int64_t r = 0; r < nr0; ++r) {
-#ifdef GGML_USE_ACCELERATE
-                if constexpr (std::is_same_v<src0_t, float> && std::is_same_v<src1_t, float> && std::is_same_v<dst_t, float>) {
-                    if (vDSP_op != nullptr) {
-                        vDSP_op(src1_ptr, 1, src0_ptr + r*ne10, 1, dst_ptr + r*ne10, 1, ne10);
-                        continue;
-                    }
-                }
-#endif
-                vec_binary_op_contiguous<op>(ne10, dst_ptr + r*ne10, src0_ptr + r*ne10, src1_ptr);
-            }
+        if (!is_contiguous_rows) {
+            vec_binary_op_strided<op>(i1 - i0, (dst_t *) ((char *) dst_ptr + i0*nb0), nb0, (const src0_t *) ((const char *) src0_ptr + i0*nb00), nb00,
+                i0, ne10, src1_ptr, nb10);
+        } else if (ne10 == 1) {
+            // src1 is a scalar broadcast over the row
+            ew_binary_vs<op>(i1 - i0, dst_ptr + i0, src0_ptr + i0, type_conversion_table<src1_t>::to_f32(*src1_ptr));
         } else {
-            vec_binary_op_non_contiguous<op>(ne0, ne10, nb10, dst_ptr, src0_ptr, src1_ptr);
+            // src1 is broadcastable across src0 and dst in i0, i1, i2, i3
+            for (int64_t i = i0; i < i1; ) {
+                const int64_t i10 = i % ne10;
+                const int64_t n   = std::min(ne10 - i10, i1 - i);
+                vec_binary_op_contiguous<op>(n, dst_ptr + i, src0_ptr + i, src1_ptr + i10);
+                i += n;
+            }
         }
     }
 }
 
 // TODO: Use the 'traits' lookup table (for type conversion fns), instead of a mass of 'if' conditions with long templates
-template <float (*op)(float, float)>
+template <class op>
 static void binary_op(const ggml_compute_params * params, ggml_tensor * dst) {
     const ggml_tensor * src0 = dst->src[0];
     const ggml_tensor * src1 = dst->src[1];
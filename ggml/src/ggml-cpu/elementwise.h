@@ -0,0 +1,255 @@
+#pragma once
+
+// SIMD kernels for the element-wise ops in binary-ops.cpp and unary-ops.cpp
+//
+// the values are processed as f32 vectors of GGML_EW_EPR elements, F16 and BF16 operands are converted in registers
+// the ops are functors with a scalar and, if has_vec is set, a vector apply():
+//
+//   struct op_add {
+//       static constexpr bool has_vec = true;
+//       static inline float  apply(float  a, float  b) { return a + b; }
+//       static inline ew_f32 apply(ew_f32 a, ew_f32 b) { return ew_add(a, b); }
+//   };
+
+#include "common.h"
+#include "vec.h"
+
+#include <algorithm>
+#include <type_traits>
+
+#if defined(__AVX512F__)
+
+// GCC 12 reports the undefined passthrough of the unmasked AVX-512 intrinsics as uninitialized once they are inlined
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#define GGML_EW_DIAG_POP
+#endif
+
+#define GGML_EW_EPR 16
+#define GGML_EW_F16 1
+#if defined(__AVX512DQ__)
+#define GGML_EW_EXP 1 // ggml_v_expf
+#endif
+
+typedef __m512 ew_f32;
+
+static inline ew_f32 ew_set1(float x)              { return _mm512_set1_ps(x); }
+static inline ew_f32 ew_add (ew_f32 a, ew_f32 b)   { return _mm512_add_ps(a, b); }
+static inline ew_f32 ew_sub (ew_f32 a, ew_f32 b)   { return _mm512_sub_ps(a, b); }
+static inline ew_f32 ew_mul (ew_f32 a, ew_f32 b)   { return _mm512_mul_ps(a, b); }
+static inline ew_f32 ew_div (ew_f32 a, ew_f32 b)   { return _mm512_div_ps(a, b); }
+static inline ew_f32 ew_min (ew_f32 a, ew_f32 b)   { return _mm512_min_ps(a, b); } // b if a is NaN
+static inline ew_f32 ew_max (ew_f32 a, ew_f32 b)   { return _mm512_max_ps(a, b); } // b if a is NaN
+static inline ew_f32 ew_sqrt(ew_f32 x)             { return _mm512_sqrt_ps(x); }
+static inline ew_f32 ew_abs (ew_f32 x)             { return _mm512_castsi512_ps(_mm512_and_si512(_mm512_castps_si512(x), _mm512_set1_epi32(0x7fffffff))); }
+static inline ew_f32 ew_neg (ew_f32 x)             { return _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(x), _mm512_set1_epi32(0x80000000))); }
+static inline ew_f32 ew_step(ew_f32 x)             { return _mm512_maskz_mov_ps(_mm512_cmp_ps_mask(x, _mm512_setzero_ps(), _CMP_GT_OQ), _mm512_set1_ps(1.0f)); }
+
+static inline ew_f32 ew_load(const float * p)       { return _mm512_loadu_ps(p); }
+static inline ew_f32 ew_load(const ggml_fp16_t * p) { return _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i *) p)); }
+static inline ew_f32 ew_load(const ggml_bf16_t * p) {
+    return _mm512_castsi512_ps(_mm512_slli_epi32(_mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i *) p)), 16));
+}
+
+static inline void ew_store(float * p, ew_f32 v)       { _mm512_storeu_ps(p, v); }
+static inline void ew_store(ggml_fp16_t * p, ew_f32 v) { _mm256_storeu_si256((__m256i *) p, _mm512_cvtps_ph(v, 0)); }
+static inline void ew_store(ggml_bf16_t * p, ew_f32 v) {
+    // round to nearest even and quiet the NaNs, same as GGML_FP32_TO_BF16
+    const __m512i u   = _mm512_castps_si512(v);
+    const __m512i hi  = _mm512_srli_epi32(u, 16);
+    const __m512i lsb = _mm512_and_si512(hi, _mm512_set1_epi32(1));
+    __m512i r = _mm512_srli_epi32(_mm512_add_epi32(u, _mm512_add_epi32(lsb, _mm512_set1_epi32(0x7fff))), 16);
+    r = _mm512_mask_mov_epi32(r, _mm512_cmp_ps_mask(v, v, _CMP_UNORD_Q), _mm512_or_si512(hi, _mm512_set1_epi32(64)));
+    _mm256_storeu_si256((__m256i *) p, _mm512_cvtepi32_epi16(r));
+}
+
+#elif defined(__AVX2__)
+
+#define GGML_EW_EPR 8
+#if defined(__F16C__)
+#define GGML_EW_F16 1
+#endif
+#if defined(__FMA__)
+#define GGML_EW_EXP 1 // ggml_v_expf
+#endif
+
+typedef __m256 ew_f32;
+
+static inline ew_f32 ew_set1(float x)              { return _mm256_set1_ps(x); }
+static inline ew_f32 ew_add (ew_f32 a, ew_f32 b)   { return _mm256_add_ps(a, b); }
+static inline ew_f32 ew_sub (ew_f32 a, ew_f32 b)   { return _mm256_sub_ps(a, b); }
+static inline ew_f32 ew_mul (ew_f32 a, ew_f32 b)   { return _mm256_mul_ps(a, b); }
+static inline ew_f32 ew_div (ew_f32 a, ew_f32 b)   { return _mm256_div_ps(a, b); }
+static inline ew_f32 ew_min (ew_f32 a, ew_f32 b)   { return _mm256_min_ps(a, b); } // b if a is NaN
+static inline ew_f32 ew_max (ew_f32 a, ew_f32 b)   { return _mm256_max_ps(a, b); } // b if a is NaN
+static inline ew_f32 ew_sqrt(ew_f32 x)             { return _mm256_sqrt_ps(x); }
+static inline ew_f32 ew_abs (ew_f32 x)             { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), x); }
+static inline ew_f32 ew_neg (ew_f32 x)             { return _mm256_xor_ps(_mm256_set1_ps(-0.0f), x); }
+static inline ew_f32 ew_step(ew_f32 x)             { return _mm256_and_ps(_mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_GT_OQ), _mm256_set1_ps(1.0f)); }
+
+static inline ew_f32 ew_load(const float * p)       { return _mm256_loadu_ps(p); }
+#if defined(__F16C__)
+static inline ew_f32 ew_load(const ggml_fp16_t * p) { return _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *) p)); }
+#endif
+static inline ew_f32 ew_load(const ggml_bf16_t * p) {
+    return _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *) p)), 16));
+}
+
+static inline void ew_store(float * p, ew_f32 v)       { _mm256_storeu_ps(p, v); }
+#if defined(__F16C__)
+static inline void ew_store(ggml_fp16_t * p, ew_f32 v) { _mm_storeu_si128((__m128i *) p, _mm256_cvtps_ph(v, 0)); }
+#endif
+static inline void ew_store(ggml_bf16_t * p, ew_f32 v) {
+    // round to nearest even and quiet the NaNs, same as GGML_FP32_TO_BF16
+    const __m256i u   = _mm256_castps_si256(v);
+    const __m256i hi  = _mm256_srli_epi32(u, 16);
+    const __m256i lsb = _mm256_and_si256(hi, _mm256_set1_epi32(1));
+    __m256i r = _mm256_srli_epi32(_mm256_add_epi32(u, _mm256_add_epi32(lsb, _mm256_set1_epi32(0x7fff))), 16);
+    r = _mm256_blendv_epi8(r, _mm256_or_si256(hi, _mm256_set1_epi32(64)), _mm256_castps_si256(_mm256_cmp_ps(v, v, _CMP_UNORD_Q)));
+    r = _mm256_permute4x64_epi64(_mm256_packus_epi32(r, r), 0xD8);
+    _mm_storeu_si128((__m128i *) p, _mm256_castsi256_si128(r));
+}
+
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+
+#define GGML_EW_EPR 4
+#define GGML_EW_F16 1
+#if !defined(__ARM_FEATURE_SVE)
+#define GGML_EW_EXP 1 // ggml_v_expf
+#endif
+
+typedef float32x4_t ew_f32;
+
+static inline ew_f32 ew_set1(float x)              { return vdupq_n_f32(x); }
+static inline ew_f32 ew_add (ew_f32 a, ew_f32 b)   { return vaddq_f32(a, b); }
+static inline ew_f32 ew_sub (ew_f32 a, ew_f32 b)   { return vsubq_f32(a, b); }
+static inline ew_f32 ew_mul (ew_f32 a, ew_f32 b)   { return vmulq_f32(a, b); }
+static inline ew_f32 ew_div (ew_f32 a, ew_f32 b)   { return vdivq_f32(a, b); }
+static inline ew_f32 ew_min (ew_f32 a, ew_f32 b)   { return vminnmq_f32(a, b); } // b if a is NaN
+static inline ew_f32 ew_max (ew_f32 a, ew_f32 b)   { return vmaxnmq_f32(a, b); } // b if a is NaN
+static inline ew_f32 ew_sqrt(ew_f32 x)             { return vsqrtq_f32(x); }
+static inline ew_f32 ew_abs (ew_f32 x)             { return vabsq_f32(x); }
+static inline ew_f32 ew_neg (ew_f32 x)             { return vnegq_f32(x); }
+static inline ew_f32 ew_step(ew_f32 x)             { return vreinterpretq_f32_u32(vandq_u32(vcgtq_f32(x, vdupq_n_f32(0.0f)), vreinterpretq_u32_f32(vdupq_n_f32(1.0f)))); }
+
+static inline ew_f32 ew_load(const float * p)       { return vld1q_f32(p); }
+static inline ew_f32 ew_load(const ggml_fp16_t * p) { return vcvt_f32_f16(vld1_f16((const __fp16 *) p)); }
+static inline ew_f32 ew_load(const ggml_bf16_t * p) { return vreinterpretq_f32_u32(vshlq_n_u32(vmovl_u16(vld1_u16((const uint16_t *) p)), 16)); }
+
+static inline void ew_store(float * p, ew_f32 v)       { vst1q_f32(p, v); }
+static inline void ew_store(ggml_fp16_t * p, ew_f32 v) { vst1_f16((__fp16 *) p, vcvt_f16_f32(v)); }
+static inline void ew_store(ggml_bf16_t * p, ew_f32 v) {
+    // round to nearest even and quiet the NaNs, same as GGML_FP32_TO_BF16
+    const uint32x4_t u   = vreinterpretq_u32_f32(v);
+    const uint32x4_t hi  = vshrq_n_u32(u, 16);
+    const uint32x4_t lsb = vandq_u32(hi, vdupq_n_u32(1));
+    uint32x4_t r = vshrq_n_u32(vaddq_u32(u, vaddq_u32(lsb, vdupq_n_u32(0x7fff))), 16);
+    r = vbslq_u32(vmvnq_u32(vceqq_f32(v, v)), vorrq_u32(hi, vdupq_n_u32(64)), r);
+    vst1_u16((uint16_t *) p, vmovn_u32(r));
+}
+
+#endif
+
+#if defined(GGML_EW_EXP)
+static inline ew_f32 ew_exp(ew_f32 x) { return ggml_v_expf(x); }
+#endif
+
+// whether values of type T can be loaded and stored as vectors
+template <typename T>
+static constexpr bool ew_has_simd() {
+#if defined(GGML_EW_EPR)
+    if constexpr (std::is_same_v<T, ggml_fp16_t>) {
+#if defined(GGML_EW_F16)
+        return true;
+#else
+        return false;
+#endif
+    }
+    return std::is_same_v<T, float> || std::is_same_v<T, ggml_bf16_t> || std::is_same_v<T, ggml_fp16_t>;
+#else
+    return false;
+#endif
+}
+
+// range of the flattened elements [i0, i1) processed by this thread
+// the ranges are multiples of GGML_EW_BLCK elements so that the threads do not write to the same cache lines
+#define GGML_EW_BLCK 64
+
+static std::pair<int64_t, int64_t> get_thread_range_flat(const struct ggml_compute_params * params, int64_t n) {
+    const int64_t ith = params->ith;
+    const int64_t nth = params->nth;
+
+    const int64_t nb = (n + GGML_EW_BLCK - 1)/GGML_EW_BLCK;
+    const int64_t db = (nb + nth - 1)/nth;
+
+    const int64_t i0 = std::min(db*ith*GGML_EW_BLCK, n);
+    const int64_t i1 = std::min(i0 + db*GGML_EW_BLCK, n);
+
+    return {i0, i1};
+}
+
+// z[i] = op(x[i], y[i])
+template <class op, typename src0_t, typename src1_t, typename dst_t>
+static inline void ew_binary_vv(const int64_t n, dst_t * z, const src0_t * x, const src1_t * y) {
+    constexpr auto src0_to_f32 = type_conversion_table<src0_t>::to_f32;
+    constexpr auto src1_to_f32 = type_conversion_table<src1_t>::to_f32;
+    constexpr auto f32_to_dst  = type_conversion_table<dst_t >::from_f32;
+
+    int64_t i = 0;
+#if defined(GGML_EW_EPR)
+    if constexpr (op::has_vec && ew_has_simd<src0_t>() && ew_has_simd<src1_t>() && ew_has_simd<dst_t>()) {
+        for (; i + GGML_EW_EPR <= n; i += GGML_EW_EPR) {
+            ew_store(z + i, op::apply(ew_load(x + i), ew_load(y + i)));
+        }
+    }
+#endif
+    for (; i < n; ++i) {
+        z[i] = f32_to_dst(op::apply(src0_to_f32(x[i]), src1_to_f32(y[i])));
+    }
+}
+
+// z[i] = op(x[i], y), y is broadcast over the row
+template <class op, typename src0_t, typename dst_t>
+static inline void ew_binary_vs(const int64_t n, dst_t * z, const src0_t * x, const float y) {
+    constexpr auto src0_to_f32 = type_conversion_table<src0_t>::to_f32;
+    constexpr auto f32_to_dst  = type_conversion_table<dst_t >::from_f32;
+
+    int64_t i = 0;
+#if defined(GGML_EW_EPR)
+    if constexpr (op::has_vec && ew_has_simd<src0_t>() && ew_has_simd<dst_t>()) {
+        const ew_f32 vy = ew_set1(y);
+        for (; i + GGML_EW_EPR <= n; i += GGML_EW_EPR) {
+            ew_store(z + i, op::apply(ew_load(x + i), vy));
+        }
+    }
+#endif
+    for (; i < n; ++i) {
+        z[i] = f32_to_dst(op::apply(src0_to_f32(x[i]), y));
+    }
+}
+
+// y[i] = op(x[i])
+template <class op, typename src0_t, typename dst_t>
+static inline void ew_unary(const int64_t n, dst_t * y, const src0_t * x) {
+    constexpr auto src0_to_f32 = type_conversion_table<src0_t>::to_f32;
+    constexpr auto f32_to_dst  = type_conversion_table<dst_t >::from_f32;
+
+    int64_t i = 0;
+#if defined(GGML_EW_EPR)
+    if constexpr (op::has_vec && ew_has_simd<src0_t>() && ew_has_simd<dst_t>()) {
+        for (; i + GGML_EW_EPR <= n; i += GGML_EW_EPR) {
+            ew_store(y + i, op::apply(ew_load(x + i)));
+        }
+    }
+#endif
+    for (; i < n; ++i) {
+        y[i] = f32_to_dst(op::apply(src0_to_f32(x[i])));
+    }
+}
+
+#if defined(GGML_EW_DIAG_POP)
+#pragma GCC diagnostic pop
+#undef GGML_EW_DIAG_POP
+#endif
@@ -400,6 +400,7 @@ typedef SRWLOCK            ggml_mutex_t;
 #define ggml_cond_init(c)    InitializeConditionVariable(c)
 #define ggml_cond_destroy(c)
 #define ggml_cond_wait(c, m) SleepConditionVariableSRW(c, m, INFINITE, CONDITION_VARIABLE_LOCKMODE_SHARED)
+#define ggml_cond_wait_exclusive(c, m) SleepConditionVariableSRW(c, m, INFINITE, 0)
 #define ggml_cond_broadcast(c) WakeAllConditionVariable(c)
 
 #define ggml_thread_create pthread_create
@@ -430,6 +431,7 @@ typedef pthread_mutex_t    ggml_mutex_t;
 #define ggml_cond_init(c)      pthread_cond_init(c, NULL)
 #define ggml_cond_destroy(c)   pthread_cond_destroy(c)
 #define ggml_cond_wait(c, m)   pthread_cond_wait(c, m)
+#define ggml_cond_wait_exclusive(c, m) pthread_cond_wait(c, m)
 #define ggml_cond_broadcast(c) pthread_cond_broadcast(c)
 
 #define ggml_thread_create pthread_create
@@ -464,6 +466,12 @@ struct ggml_threadpool {
     uint32_t     poll;        // Polling level (0 - no polling)
 
     enum ggml_status ec;
+
+    // graphs submitted concurrently (e.g. by multiple contexts sharing the threadpool) are computed one at a time
+    ggml_mutex_t exec_mutex;
+    ggml_cond_t  exec_cond;
+    bool         exec_busy;
+    int          exec_n_waiting[GGML_SCHED_PRIO_REALTIME - GGML_SCHED_PRIO_LOW + 1]; // per graph priority
 };
 
 // Per-thread state
@@ -1653,6 +1661,68 @@ static void ggml_compute_forward_mul_mat_id(
     }
 }
 
+// ggml_compute_forward_mul_mat_sel
+
+static void ggml_compute_forward_mul_mat_sel(
+        const struct ggml_compute_params * params,
+              struct ggml_tensor * dst) {
+
+    const struct ggml_tensor * src0 = dst->src[0];
+    const struct ggml_tensor * src1 = dst->src[1];
+    const struct ggml_tensor * ids  = dst->src[2];
+
+    GGML_TENSOR_BINARY_OP_LOCALS
+
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    const enum ggml_type type = src0->type;
+
+    enum ggml_type    const vec_dot_type = type_traits_cpu[type].vec_dot_type;
+    ggml_from_float_t const from_float   = type_traits_cpu[vec_dot_type].from_float;
+    ggml_vec_dot_t    const vec_dot      = type_traits_cpu[type].vec_dot;
+
+    GGML_ASSERT(nb00 == ggml_type_size(type));
+    GGML_ASSERT(nb10 == ggml_type_size(src1->type));
+    GGML_ASSERT(nb0  == sizeof(float));
+
+    const int64_t n_sel = ids->ne[0];
+
+    const size_t row_size = ggml_row_size(vec_dot_type, ne10);
+
+    const char * wdata = src1->data;
+    size_t       nbw1  = nb11;
+
+    if (src1->type != vec_dot_type) {
+        for (int64_t i11 = ith; i11 < ne11; i11 += nth) {
+            from_float((const float *) ((const char *) src1->data + i11*nb11), (char *) params->wdata + i11*row_size, ne10);
+        }
+
+        wdata = params->wdata;
+        nbw1  = row_size;
+
+        ggml_barrier(params->threadpool);
+    }
+
+    // one dot product per selected row and column of src1
+    const int64_t nr  = n_sel*ne11;
+    const int64_t dr  = (nr + nth - 1)/nth;
+    const int64_t ir0 = dr*ith;
+    const int64_t ir1 = MIN(ir0 + dr, nr);
+
+    for (int64_t ir = ir0; ir < ir1; ++ir) {
+        const int64_t i11 = ir/n_sel;
+        const int64_t i   = ir - i11*n_sel;
+
+        const int32_t i01 = *(const int32_t *) ((const char *) ids->data + i*ids->nb[0] + i11*ids->nb[1]);
+        GGML_ASSERT(i01 >= 0 && i01 < ne01);
+
+        vec_dot(ne00, (float *) ((char *) dst->data + i*nb0 + i11*nb1), 0,
+                (const char *) src0->data + i01*nb01, 0,
+                wdata + i11*nbw1, 0, 1);
+    }
+}
+
 /////////////////////////////////
 
 static void ggml_compute_forward(struct ggml_compute_params * params, struct ggml_tensor * tensor) {
@@ -1788,6 +1858,14 @@ static void ggml_compute_forward(struct ggml_compute_params * params, struct ggm
             {
                 ggml_compute_forward_out_prod(params, tensor);
             } break;
+        case GGML_OP_MUL_MAT_SEL:
+            {
+                ggml_compute_forward_mul_mat_sel(params, tensor);
+            } break;
+        case GGML_OP_OUT_PROD_SEL:
+            {
+                ggml_compute_forward_out_prod_sel(params, tensor);
+            } break;
         case GGML_OP_SCALE:
             {
                 ggml_compute_forward_scale(params, tensor);
@@ -1932,6 +2010,10 @@ static void ggml_compute_forward(struct ggml_compute_params * params, struct ggm
             {
                 ggml_compute_forward_argsort(params, tensor);
             } break;
+        case GGML_OP_MOE_ROUTE:
+            {
+                ggml_compute_forward_moe_route(params, tensor);
+            } break;
         case GGML_OP_LEAKY_RELU:
             {
                 ggml_compute_forward_leaky_relu(params, tensor);
@@ -2133,15 +2215,15 @@ static int ggml_get_n_tasks(struct ggml_tensor * node, int n_threads) {
         case GGML_OP_ADD_ID:
         case GGML_OP_ADD1:
         case GGML_OP_ACC:
-            {
-                n_tasks = n_threads;
-            } break;
         case GGML_OP_SUB:
         case GGML_OP_SQR:
         case GGML_OP_SQRT:
         case GGML_OP_LOG:
         case GGML_OP_SIN:
         case GGML_OP_COS:
+            {
+                n_tasks = n_threads;
+            } break;
         case GGML_OP_SUM:
         case GGML_OP_SUM_ROWS:
         case GGML_OP_MEAN:
@@ -2172,10 +2254,6 @@ static int ggml_get_n_tasks(struct ggml_tensor * node, int n_threads) {
                 case GGML_UNARY_OP_HARDSWISH:
                 case GGML_UNARY_OP_HARDSIGMOID:
                 case GGML_UNARY_OP_EXP:
-                    {
-                        n_tasks = 1;
-                    } break;
-
                 case GGML_UNARY_OP_GELU:
                 case GGML_UNARY_OP_GELU_ERF:
                 case GGML_UNARY_OP_GELU_QUICK:
@@ -2214,6 +2292,8 @@ static int ggml_get_n_tasks(struct ggml_tensor * node, int n_threads) {
         case GGML_OP_MUL_MAT:
         case GGML_OP_MUL_MAT_ID:
         case GGML_OP_OUT_PROD:
+        case GGML_OP_MUL_MAT_SEL:
+        case GGML_OP_OUT_PROD_SEL:
             {
                 n_tasks = n_threads;
             } break;
@@ -2250,6 +2330,7 @@ static int ggml_get_n_tasks(struct ggml_tensor * node, int n_threads) {
                 n_tasks = 1; //TODO
             } break;
         case GGML_OP_SOFT_MAX:
+        case GGML_OP_MOE_ROUTE:
             {
                 n_tasks = MIN(n_threads, ggml_nrows(node->src[0]));
             } break;
@@ -2610,6 +2691,9 @@ void ggml_threadpool_free(struct ggml_threadpool* threadpool) {
     ggml_cond_destroy(&threadpool->cond);
 #endif // GGML_USE_OPENMP
 
+    ggml_mutex_destroy(&threadpool->exec_mutex);
+    ggml_cond_destroy(&threadpool->exec_cond);
+
     const size_t workers_size = sizeof(struct ggml_compute_state) * n_threads;
     ggml_aligned_free(threadpool->workers, workers_size);
     ggml_aligned_free(threadpool, sizeof(struct ggml_threadpool));
@@ -2742,16 +2826,35 @@ struct ggml_cplan ggml_graph_plan(
                     } break;
                 case GGML_OP_OUT_PROD:
                     {
-                        if (ggml_is_quantized(node->src[0]->type)) {
+                        if (node->src[0]->type != GGML_TYPE_F32) {
                             cur = ggml_type_size(GGML_TYPE_F32) * node->src[0]->ne[0] * n_tasks;
                         }
                     } break;
+                case GGML_OP_MUL_MAT_SEL:
+                    {
+                        const enum ggml_type vec_dot_type = type_traits_cpu[node->src[0]->type].vec_dot_type;
+
+                        if (node->src[1]->type != vec_dot_type) {
+                            cur = ggml_row_size(vec_dot_type, ggml_nelements(node->src[1]));
+                        }
+                    } break;
+                case GGML_OP_OUT_PROD_SEL:
+                    {
+                        if (node->src[0]->type != GGML_TYPE_F32) {
+                            cur = ggml_type_size(GGML_TYPE_F32) * (node->src[0]->ne[0] + CACHE_LINE_SIZE_F32) * n_tasks;
+                        }
+                    } break;
                 case GGML_OP_SOFT_MAX:
                 case GGML_OP_ROPE:
                 case GGML_OP_ROPE_BACK:
                     {
                         cur = ggml_type_size(GGML_TYPE_F32) * node->ne[0] * n_tasks;
                     } break;
+                case GGML_OP_MOE_ROUTE:
+                    {
+                        // probabilities, selection scores and (score, id) pairs for large selections
+                        cur = ggml_type_size(GGML_TYPE_F32) * (4*node->src[0]->ne[0] + CACHE_LINE_SIZE_F32) * n_tasks;
+                    } break;
                 case GGML_OP_CONV_TRANSPOSE_1D:
                     {
                         GGML_ASSERT(node->src[0]->ne[3] == 1);
@@ -3056,8 +3159,13 @@ static struct ggml_threadpool * ggml_threadpool_new_impl(
         threadpool->poll             = tpp->poll;
         threadpool->prio             = tpp->prio;
         threadpool->ec               = GGML_STATUS_SUCCESS;
+        threadpool->exec_busy        = false;
+        memset(threadpool->exec_n_waiting, 0, sizeof(threadpool->exec_n_waiting));
     }
 
+    ggml_mutex_init(&threadpool->exec_mutex);
+    ggml_cond_init(&threadpool->exec_cond);
+
     // Allocate and init workers state
     const size_t workers_size = sizeof(struct ggml_compute_state) * tpp->n_threads;
     struct ggml_compute_state * workers = ggml_aligned_malloc(workers_size);
@@ -3104,6 +3212,39 @@ struct ggml_threadpool * ggml_threadpool_new(struct ggml_threadpool_params * tpp
     return ggml_threadpool_new_impl(tpp, NULL, NULL);
 }
 
+// wait until the threadpool is free and no graph with a higher priority is waiting for it
+static void ggml_threadpool_exec_begin(struct ggml_threadpool * threadpool, enum ggml_sched_priority priority) {
+    const int n_prio = GGML_SCHED_PRIO_REALTIME - GGML_SCHED_PRIO_LOW + 1;
+    const int i_prio = MAX(0, MIN(n_prio - 1, (int) priority - GGML_SCHED_PRIO_LOW));
+
+    ggml_mutex_lock(&threadpool->exec_mutex);
+
+    threadpool->exec_n_waiting[i_prio]++;
+
+    while (true) {
+        bool ready = !threadpool->exec_busy;
+        for (int i = i_prio + 1; ready && i < n_prio; i++) {
+            ready = threadpool->exec_n_waiting[i] == 0;
+        }
+        if (ready) {
+            break;
+        }
+        ggml_cond_wait_exclusive(&threadpool->exec_cond, &threadpool->exec_mutex);
+    }
+
+    threadpool->exec_n_waiting[i_prio]--;
+    threadpool->exec_busy = true;
+
+    ggml_mutex_unlock(&threadpool->exec_mutex);
+}
+
+static void ggml_threadpool_exec_end(struct ggml_threadpool * threadpool) {
+    ggml_mutex_lock(&threadpool->exec_mutex);
+    threadpool->exec_busy = false;
+    ggml_cond_broadcast(&threadpool->exec_cond);
+    ggml_mutex_unlock(&threadpool->exec_mutex);
+}
+
 enum ggml_status ggml_graph_compute(struct ggml_cgraph * cgraph, struct ggml_cplan * cplan) {
     ggml_cpu_init();
 
@@ -3123,6 +3264,8 @@ enum ggml_status ggml_graph_compute(struct ggml_cgraph * cgraph, struct ggml_cpl
         struct ggml_threadpool_params ttp = ggml_threadpool_params_default(n_threads);
         threadpool = ggml_threadpool_new_impl(&ttp, cgraph, cplan);
     } else {
+        ggml_threadpool_exec_begin(threadpool, cplan->priority);
+
         // Reset some of the parameters that need resetting
         // No worker threads should be accessing the parameters below at this stage
         threadpool->cgraph           = cgraph;
@@ -3169,6 +3312,8 @@ enum ggml_status ggml_graph_compute(struct ggml_cgraph * cgraph, struct ggml_cpl
 
     if (disposable_threadpool) {
         ggml_threadpool_free(threadpool);
+    } else {
+        ggml_threadpool_exec_end(threadpool);
     }
 
     return ret;
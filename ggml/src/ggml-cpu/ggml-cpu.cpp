@@ -95,6 +95,8 @@ struct ggml_backend_cpu_context {
 
     ggml_abort_callback abort_callback;
     void *              abort_callback_data;
+
+    enum ggml_sched_priority priority;
 };
 
 static const char * ggml_backend_cpu_get_name(ggml_backend_t backend) {
@@ -110,29 +112,45 @@ static void ggml_backend_cpu_free(ggml_backend_t backend) {
     delete backend;
 }
 
+// grow the work buffer of the backend if needed
+static bool ggml_backend_cpu_alloc_work(struct ggml_backend_cpu_context * cpu_ctx, size_t work_size) {
+    if (cpu_ctx->work_size < work_size) {
+        delete[] cpu_ctx->work_data;
+        cpu_ctx->work_data = new uint8_t[work_size];
+        if (cpu_ctx->work_data == NULL) {
+            cpu_ctx->work_size = 0;
+            return false;
+        }
+        cpu_ctx->work_size = work_size;
+    }
+    return true;
+}
+
+// a plan caches the result of ggml_graph_plan so that graphs that are computed multiple times (e.g. reused by the scheduler)
+// are not re-planned on every evaluation
+// the work buffer is shared with the backend context
 struct ggml_backend_plan_cpu {
     struct ggml_cplan cplan;
     struct ggml_cgraph cgraph;
+
+    // thread settings used to create the plan
+    int               n_threads;
+    ggml_threadpool_t threadpool;
 };
 
+static void ggml_backend_cpu_graph_plan_init(struct ggml_backend_cpu_context * cpu_ctx, struct ggml_backend_plan_cpu * cpu_plan, const struct ggml_cgraph * cgraph) {
+    cpu_plan->cplan      = ggml_graph_plan(cgraph, cpu_ctx->n_threads, cpu_ctx->threadpool);
+    cpu_plan->cgraph     = *cgraph; // FIXME: deep copy
+    cpu_plan->n_threads  = cpu_ctx->n_threads;
+    cpu_plan->threadpool = cpu_ctx->threadpool;
+}
+
 static ggml_backend_graph_plan_t ggml_backend_cpu_graph_plan_create(ggml_backend_t backend, const struct ggml_cgraph * cgraph) {
     struct ggml_backend_cpu_context * cpu_ctx = (struct ggml_backend_cpu_context *)backend->context;
 
     struct ggml_backend_plan_cpu * cpu_plan = new ggml_backend_plan_cpu;
 
-    cpu_plan->cplan = ggml_graph_plan(cgraph, cpu_ctx->n_threads, cpu_ctx->threadpool);
-    cpu_plan->cgraph = *cgraph; // FIXME: deep copy
-
-    if (cpu_plan->cplan.work_size > 0) {
-        cpu_plan->cplan.work_data = new uint8_t[cpu_plan->cplan.work_size];
-        if (cpu_plan->cplan.work_data == NULL) {
-            delete cpu_plan;
-            return NULL;
-        }
-    }
-
-    cpu_plan->cplan.abort_callback      = cpu_ctx->abort_callback;
-    cpu_plan->cplan.abort_callback_data = cpu_ctx->abort_callback_data;
+    ggml_backend_cpu_graph_plan_init(cpu_ctx, cpu_plan, cgraph);
 
     return cpu_plan;
 }
@@ -140,18 +158,37 @@ static ggml_backend_graph_plan_t ggml_backend_cpu_graph_plan_create(ggml_backend
 static void ggml_backend_cpu_graph_plan_free(ggml_backend_t backend, ggml_backend_graph_plan_t plan) {
     struct ggml_backend_plan_cpu * cpu_plan = (struct ggml_backend_plan_cpu *)plan;
 
-    delete[] cpu_plan->cplan.work_data;
     delete cpu_plan;
 
     GGML_UNUSED(backend);
 }
 
+static void ggml_backend_cpu_graph_plan_update(ggml_backend_t backend, ggml_backend_graph_plan_t plan, const struct ggml_cgraph * cgraph) {
+    struct ggml_backend_cpu_context * cpu_ctx = (struct ggml_backend_cpu_context *)backend->context;
+    struct ggml_backend_plan_cpu * cpu_plan = (struct ggml_backend_plan_cpu *)plan;
+
+    ggml_backend_cpu_graph_plan_init(cpu_ctx, cpu_plan, cgraph);
+}
+
 static enum ggml_status ggml_backend_cpu_graph_plan_compute(ggml_backend_t backend, ggml_backend_graph_plan_t plan) {
+    struct ggml_backend_cpu_context * cpu_ctx = (struct ggml_backend_cpu_context *)backend->context;
     struct ggml_backend_plan_cpu * cpu_plan = (struct ggml_backend_plan_cpu *)plan;
 
-    return ggml_graph_compute(&cpu_plan->cgraph, &cpu_plan->cplan);
+    // the number of threads affects the work size - re-plan if it changed since the plan was created
+    if (cpu_plan->n_threads != cpu_ctx->n_threads || cpu_plan->threadpool != cpu_ctx->threadpool) {
+        ggml_backend_cpu_graph_plan_init(cpu_ctx, cpu_plan, &cpu_plan->cgraph);
+    }
 
-    GGML_UNUSED(backend);
+    if (!ggml_backend_cpu_alloc_work(cpu_ctx, cpu_plan->cplan.work_size)) {
+        return GGML_STATUS_ALLOC_FAILED;
+    }
+    cpu_plan->cplan.work_data = (uint8_t *)cpu_ctx->work_data;
+
+    cpu_plan->cplan.abort_callback      = cpu_ctx->abort_callback;
+    cpu_plan->cplan.abort_callback_data = cpu_ctx->abort_callback_data;
+    cpu_plan->cplan.priority            = cpu_ctx->priority;
+
+    return ggml_graph_compute(&cpu_plan->cgraph, &cpu_plan->cplan);
 }
 
 static enum ggml_status ggml_backend_cpu_graph_compute(ggml_backend_t backend, struct ggml_cgraph * cgraph) {
@@ -159,19 +196,14 @@ static enum ggml_status ggml_backend_cpu_graph_compute(ggml_backend_t backend, s
 
     struct ggml_cplan cplan = ggml_graph_plan(cgraph, cpu_ctx->n_threads, cpu_ctx->threadpool);
 
-    if (cpu_ctx->work_size < cplan.work_size) {
-        delete[] cpu_ctx->work_data;
-        cpu_ctx->work_data = new uint8_t[cplan.work_size];
-        if (cpu_ctx->work_data == NULL) {
-            cpu_ctx->work_size = 0;
-            return GGML_STATUS_ALLOC_FAILED;
-        }
-        cpu_ctx->work_size = cplan.work_size;
+    if (!ggml_backend_cpu_alloc_work(cpu_ctx, cplan.work_size)) {
+        return GGML_STATUS_ALLOC_FAILED;
     }
     cplan.work_data = (uint8_t *)cpu_ctx->work_data;
 
     cplan.abort_callback      = cpu_ctx->abort_callback;
     cplan.abort_callback_data = cpu_ctx->abort_callback_data;
+    cplan.priority            = cpu_ctx->priority;
 
     return ggml_graph_compute(cgraph, &cplan);
 }
@@ -185,7 +217,7 @@ static const struct ggml_backend_i ggml_backend_cpu_i = {
     /* .synchronize             = */ NULL,
     /* .graph_plan_create       = */ ggml_backend_cpu_graph_plan_create,
     /* .graph_plan_free         = */ ggml_backend_cpu_graph_plan_free,
-    /* .graph_plan_update       = */ NULL,
+    /* .graph_plan_update       = */ ggml_backend_cpu_graph_plan_update,
     /* .graph_plan_compute      = */ ggml_backend_cpu_graph_plan_compute,
     /* .graph_compute           = */ ggml_backend_cpu_graph_compute,
     /* .event_record            = */ NULL,
@@ -212,6 +244,7 @@ ggml_backend_t ggml_backend_cpu_init(void) {
     ctx->work_size           = 0;
     ctx->abort_callback      = NULL;
     ctx->abort_callback_data = NULL;
+    ctx->priority            = GGML_SCHED_PRIO_NORMAL;
 
     ggml_backend_t cpu_backend = new ggml_backend {
         /* .guid    = */ ggml_backend_cpu_guid(),
@@ -259,6 +292,13 @@ void ggml_backend_cpu_set_abort_callback(ggml_backend_t backend_cpu, ggml_abort_
     ctx->abort_callback_data = abort_callback_data;
 }
 
+void ggml_backend_cpu_set_priority(ggml_backend_t backend_cpu, enum ggml_sched_priority priority) {
+    GGML_ASSERT(ggml_backend_is_cpu(backend_cpu));
+
+    struct ggml_backend_cpu_context * ctx = (struct ggml_backend_cpu_context *)backend_cpu->context;
+    ctx->priority = priority;
+}
+
 // CPU backend - device
 
 struct ggml_backend_cpu_device_context {
@@ -439,7 +479,9 @@ static bool ggml_backend_cpu_device_supports_op(ggml_backend_dev_t dev, const st
         case GGML_OP_GET_ROWS_BACK:
             return src0->type == GGML_TYPE_F32 || src0->type == GGML_TYPE_F16;
         case GGML_OP_OUT_PROD:
-            return (src0->type == GGML_TYPE_F32 || (ggml_is_quantized(src0->type) && src0->ne[2] == src1->ne[2] && src0->ne[3] == src1->ne[3])) &&
+            return (src0->type == GGML_TYPE_F32 ||
+                    ((ggml_is_quantized(src0->type) || src0->type == GGML_TYPE_F16 || src0->type == GGML_TYPE_BF16) &&
+                     src0->ne[2] == src1->ne[2] && src0->ne[3] == src1->ne[3])) &&
                 src1->type == GGML_TYPE_F32 && op->type == GGML_TYPE_F32;
         default:
             return true;
@@ -643,6 +685,9 @@ static void * ggml_backend_cpu_get_proc_address(ggml_backend_reg_t reg, const ch
     if (strcmp(name, "ggml_backend_cpu_set_threadpool") == 0) {
         return (void *)ggml_backend_cpu_set_threadpool;
     }
+    if (strcmp(name, "ggml_backend_cpu_set_priority") == 0) {
+        return (void *)ggml_backend_cpu_set_priority;
+    }
 
     return NULL;
 
@@ -9,6 +9,7 @@
 
 #include <float.h>
 #include <algorithm>
+#include <cmath>
 
 // ggml_compute_forward_dup
 
@@ -4778,14 +4779,11 @@ void ggml_compute_forward_out_prod(
         case GGML_TYPE_IQ4_XS:
         case GGML_TYPE_IQ3_S:
         case GGML_TYPE_IQ2_S:
+        case GGML_TYPE_F16:
+        case GGML_TYPE_BF16:
             {
                 ggml_compute_forward_out_prod_q_f32(params, dst);
             } break;
-        case GGML_TYPE_F16:
-            {
-                GGML_ABORT("fatal error"); // todo
-                // ggml_compute_forward_out_prod_f16_f32(params, dst);
-            }
         case GGML_TYPE_F32:
             {
                 ggml_compute_forward_out_prod_f32(params, dst);
@@ -4797,6 +4795,72 @@ void ggml_compute_forward_out_prod(
     }
 }
 
+// ggml_compute_forward_out_prod_sel
+
+void ggml_compute_forward_out_prod_sel(
+        const ggml_compute_params * params,
+        ggml_tensor * dst) {
+
+    const ggml_tensor * src0 = dst->src[0];
+    const ggml_tensor * src1 = dst->src[1];
+    const ggml_tensor * ids  = dst->src[2];
+
+    GGML_TENSOR_BINARY_OP_LOCALS
+
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    const ggml_type type = src0->type;
+    ggml_to_float_t const to_float = ggml_get_type_traits(type)->to_float;
+
+    GGML_ASSERT(type == GGML_TYPE_F32 || to_float);
+    GGML_ASSERT(nb00 == ggml_type_size(type));
+    GGML_ASSERT(nb10 == sizeof(float));
+    GGML_ASSERT(nb0  == sizeof(float));
+
+    // parallelize by blocks of dst columns, so that each thread dequantizes whole blocks of the selected rows
+    const int64_t blck = ggml_blck_size(type);
+    const int64_t nbk  = ne00/blck;
+    const int64_t ib0  = (nbk*ith)/nth;
+    const int64_t ib1  = (nbk*(ith + 1))/nth;
+
+    if (ib0 == ib1) {
+        return;
+    }
+
+    const int64_t i00 = ib0*blck;
+    const int64_t n   = (ib1 - ib0)*blck;
+
+    float * wdata = (float *) params->wdata + (ne00 + CACHE_LINE_SIZE_F32)*ith;
+
+    for (int64_t i1 = 0; i1 < ne1; ++i1) {
+        float * d = (float *) ((char *) dst->data + i1*nb1) + i00;
+
+        ggml_vec_set_f32(n, d, 0.0f);
+
+        for (int64_t i = 0; i < ne10; ++i) {
+            const float w = *(const float *) ((const char *) src1->data + i*nb10 + i1*nb11);
+
+            // the selected rows of a sparse activation are often zero
+            if (w == 0.0f) {
+                continue;
+            }
+
+            const int32_t i01 = *(const int32_t *) ((const char *) ids->data + i*ids->nb[0] + i1*ids->nb[1]);
+            GGML_ASSERT(i01 >= 0 && i01 < ne01);
+
+            const char * s0 = (const char *) src0->data + i01*nb01 + ib0*ggml_type_size(type);
+
+            if (type == GGML_TYPE_F32) {
+                ggml_vec_mad_f32(n, d, (const float *) s0, w);
+            } else {
+                to_float(s0, wdata, n);
+                ggml_vec_mad_f32(n, d, wdata, w);
+            }
+        }
+    }
+}
+
 // ggml_compute_forward_scale
 
 static void ggml_compute_forward_scale_f32(
@@ -8306,6 +8370,156 @@ void ggml_compute_forward_argsort(
     }
 }
 
+// ggml_compute_forward_moe_route
+
+static void ggml_compute_forward_moe_route_f32(
+    const ggml_compute_params * params,
+    ggml_tensor * dst) {
+
+    const ggml_tensor * src0 = dst->src[0];
+    const ggml_tensor * src1 = dst->src[1];
+
+    GGML_ASSERT(src0->nb[0] == sizeof(float));
+    GGML_ASSERT(dst->type == GGML_TYPE_I32);
+
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    const int64_t n_expert      = src0->ne[0];
+    const int64_t n_tokens      = src0->ne[1];
+    const int64_t n_expert_used = dst->ne[0];
+
+    const ggml_moe_gating gating = (ggml_moe_gating) ggml_get_op_params_i32(dst, 0);
+    const bool            norm   = ggml_get_op_params_i32(dst, 1) != 0;
+    const float           scale  = ggml_get_op_params_f32(dst, 2);
+
+    const float * bias = src1 ? (const float *) src1->data : nullptr;
+
+    float * probs = (float *) params->wdata + (4*n_expert + CACHE_LINE_SIZE_F32)*ith;
+    float * score = probs + n_expert;
+
+    for (int64_t i = ith; i < n_tokens; i += nth) {
+        const float * logits = (const float *) ((const char *) src0->data + i*src0->nb[1]);
+
+        int32_t * ids     = (int32_t *) ((char *) dst->data + i*dst->nb[1]);
+        float   * weights = (float   *) ((char *) dst->data + i*dst->nb[1] + dst->nb[2]);
+
+        switch (gating) {
+            case GGML_MOE_GATING_SOFTMAX:
+                {
+                    float max = -INFINITY;
+                    ggml_vec_max_f32(n_expert, &max, logits);
+                    const ggml_float sum = ggml_vec_soft_max_f32(n_expert, probs, logits, max);
+                    ggml_vec_scale_f32(n_expert, probs, 1.0/sum);
+                } break;
+            case GGML_MOE_GATING_SIGMOID:
+                {
+                    for (int64_t j = 0; j < n_expert; ++j) {
+                        probs[j] = 1.0f/(1.0f + expf(-logits[j]));
+                    }
+                } break;
+            case GGML_MOE_GATING_SOFTMAX_WEIGHT:
+                {
+                    memcpy(probs, logits, n_expert*sizeof(float));
+                } break;
+            default:
+                GGML_ABORT("invalid gating function");
+        }
+
+        // the selection bias only affects which experts are selected, not their weights
+        const float * sel = probs;
+        if (bias) {
+            for (int64_t j = 0; j < n_expert; ++j) {
+                score[j] = probs[j] + bias[j];
+            }
+            sel = score;
+        }
+
+        // partial selection: keep the n_expert_used best experts sorted in descending order
+        // on ties, the expert with the lower index comes first (same as ggml_top_k)
+        if (n_expert_used <= 32) {
+            int64_t n_sel = 0;
+            for (int64_t j = 0; j < n_expert; ++j) {
+                const float v = sel[j];
+                if (n_sel == n_expert_used && !(v > sel[ids[n_sel - 1]])) {
+                    continue;
+                }
+
+                int64_t k = n_sel < n_expert_used ? n_sel++ : n_sel - 1;
+                while (k > 0 && sel[ids[k - 1]] < v) {
+                    ids[k] = ids[k - 1];
+                    --k;
+                }
+                ids[k] = (int32_t) j;
+            }
+        } else {
+            // large selections (e.g. the neurons of a sparse FFN): the insertion above is quadratic in n_expert_used
+            // NaNs are ordered last to keep the comparison a strict weak ordering
+            struct score_id {
+                float   v;
+                int32_t i;
+            };
+
+            score_id * tmp = (score_id *) (score + n_expert);
+            for (int64_t j = 0; j < n_expert; ++j) {
+                tmp[j] = { std::isnan(sel[j]) ? -INFINITY : sel[j], (int32_t) j };
+            }
+
+            const auto cmp = [](const score_id & a, const score_id & b) {
+                return a.v > b.v || (a.v == b.v && a.i < b.i);
+            };
+
+            std::nth_element(tmp, tmp + n_expert_used - 1, tmp + n_expert, cmp);
+            std::sort(tmp, tmp + n_expert_used, cmp);
+
+            for (int64_t k = 0; k < n_expert_used; ++k) {
+                ids[k] = tmp[k].i;
+            }
+        }
+
+        for (int64_t k = 0; k < n_expert_used; ++k) {
+            weights[k] = probs[ids[k]];
+        }
+
+        if (gating == GGML_MOE_GATING_SOFTMAX_WEIGHT) {
+            float max = -INFINITY;
+            ggml_vec_max_f32(n_expert_used, &max, weights);
+            const ggml_float sum = ggml_vec_soft_max_f32(n_expert_used, weights, weights, max);
+            ggml_vec_scale_f32(n_expert_used, weights, 1.0/sum);
+        }
+
+        if (norm) {
+            ggml_float sum = 0.0;
+            for (int64_t k = 0; k < n_expert_used; ++k) {
+                sum += weights[k];
+            }
+            ggml_vec_scale_f32(n_expert_used, weights, 1.0/sum);
+        }
+
+        if (scale != 1.0f) {
+            ggml_vec_scale_f32(n_expert_used, weights, scale);
+        }
+    }
+}
+
+void ggml_compute_forward_moe_route(
+    const ggml_compute_params * params,
+    ggml_tensor * dst) {
+
+    const ggml_tensor * src0 = dst->src[0];
+
+    switch (src0->type) {
+        case GGML_TYPE_F32:
+            {
+                ggml_compute_forward_moe_route_f32(params, dst);
+            } break;
+        default:
+            {
+                GGML_ABORT("fatal error");
+            }
+    }
+}
+
 // ggml_compute_forward_flash_attn_ext
 
 static void ggml_compute_forward_flash_attn_ext_f16(
@@ -10458,7 +10672,7 @@ static void ggml_compute_forward_opt_step_adamw_f32(
     GGML_ASSERT(ggml_are_same_shape(src0, src0_grad));
     GGML_ASSERT(ggml_are_same_shape(src0, src0_grad_m));
     GGML_ASSERT(ggml_are_same_shape(src0, src0_grad_v));
-    GGML_ASSERT(ggml_nelements(adamw_params) == 7);
+    GGML_ASSERT(ggml_nelements(adamw_params) == 7 || ggml_nelements(adamw_params) == 8);
 
     const int ith = params->ith;
     const int nth = params->nth;
@@ -10512,16 +10726,205 @@ static void ggml_compute_forward_opt_step_adamw_f32(
     }
 }
 
+// converts n values of a row of type to/from F32, n must be a multiple of the block size
+static void ggml_opt_step_row_to_f32(ggml_type type, const void * x, float * y, int64_t n) {
+    if (type == GGML_TYPE_F32) {
+        memcpy(y, x, n*sizeof(float));
+    } else {
+        ggml_get_type_traits(type)->to_float(x, y, n);
+    }
+}
+
+static void ggml_opt_step_row_from_f32(ggml_type type, const float * x, void * y, int64_t n) {
+    if (type == GGML_TYPE_F32) {
+        memcpy(y, x, n*sizeof(float));
+    } else {
+        ggml_get_type_traits_cpu(type)->from_float(x, y, n);
+    }
+}
+
+// writes updated F16/BF16 weights with stochastic rounding: rounding to nearest would discard
+// every update smaller than half an ulp, which for BF16 is most of them late in training
+static inline uint32_t ggml_opt_step_hash(uint32_t x) {
+    x ^= x >> 16; x *= 0x7feb352dU;
+    x ^= x >> 15; x *= 0x846ca68bU;
+    x ^= x >> 16;
+    return x;
+}
+
+static void ggml_opt_step_row_from_f32_sr(ggml_type type, const float * x, void * y, int64_t n, uint32_t seed) {
+    switch (type) {
+        case GGML_TYPE_F16:
+            {
+                ggml_fp16_t * y16 = (ggml_fp16_t *) y;
+                for (int64_t i = 0; i < n; ++i) {
+                    uint32_t bits;
+                    memcpy(&bits, &x[i], sizeof(bits));
+                    if (x[i] == 0.0f) {
+                        y16[i] = GGML_CPU_FP32_TO_FP16(x[i]);
+                        continue;
+                    }
+                    const float u = ((ggml_opt_step_hash(bits ^ (seed + (uint32_t) i*0x9e3779b9U)) >> 8) + 0.5f) * (1.0f/16777216.0f);
+
+                    // add uniform noise of one F16 ulp, then round to nearest
+                    int e;
+                    frexpf(x[i], &e);
+                    const float ulp = ldexpf(1.0f, MAX(e, -13) - 11);
+                    y16[i] = GGML_CPU_FP32_TO_FP16(x[i] + (u - 0.5f)*ulp);
+                }
+            } break;
+        case GGML_TYPE_BF16:
+            {
+                ggml_bf16_t * y16 = (ggml_bf16_t *) y;
+                for (int64_t i = 0; i < n; ++i) {
+                    uint32_t bits;
+                    memcpy(&bits, &x[i], sizeof(bits));
+                    if ((bits & 0x7fffffff) >= 0x7f800000) { // inf/nan
+                        y16[i] = GGML_FP32_TO_BF16(x[i]);
+                        continue;
+                    }
+                    // add random bits below the BF16 mantissa, then truncate
+                    const uint32_t r = ggml_opt_step_hash(bits ^ (seed + (uint32_t) i*0x9e3779b9U)) & 0xffff;
+                    y16[i].bits = (uint16_t) ((bits + r) >> 16);
+                }
+            } break;
+        default:
+            ggml_opt_step_row_from_f32(type, x, y, n);
+    }
+}
+
+// AdamW for F16/BF16 weights and/or 8-bit momenta: the values are converted to F32 in chunks,
+// updated in F32 and converted back, so the only loss of precision is in what is stored.
+// Quantized momenta are stored companded as sign(m)*sqrt(|m|) and v^(1/4): with a linear
+// block-wise quantization the moments of the small gradients in a block would be flushed to zero.
+static void ggml_compute_forward_opt_step_adamw_mixed(
+        const ggml_compute_params * params,
+        ggml_tensor * dst) {
+
+    const ggml_tensor * src0         = dst->src[0];
+    const ggml_tensor * src0_grad    = dst->src[1];
+    const ggml_tensor * src0_grad_m  = dst->src[2];
+    const ggml_tensor * src0_grad_v  = dst->src[3];
+    const ggml_tensor * adamw_params = dst->src[4];
+
+    GGML_ASSERT(ggml_are_same_shape(src0, src0_grad));
+    GGML_ASSERT(ggml_are_same_shape(src0, src0_grad_m));
+    GGML_ASSERT(ggml_are_same_shape(src0, src0_grad_v));
+    GGML_ASSERT(ggml_nelements(adamw_params) == 7 || ggml_nelements(adamw_params) == 8);
+    GGML_ASSERT(src0_grad->type == GGML_TYPE_F32);
+    GGML_ASSERT(src0_grad_m->type == src0_grad_v->type);
+
+    const ggml_type type_w  = src0->type;
+    const ggml_type type_mv = src0_grad_m->type;
+    const bool      compand = type_mv != GGML_TYPE_F32;
+
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    const int nr  = ggml_nrows(src0);
+
+    GGML_TENSOR_UNARY_OP_LOCALS
+    GGML_ASSERT(nb00 == ggml_type_size(type_w));
+    GGML_ASSERT(ne00 % ggml_blck_size(type_mv) == 0);
+
+    // rows per thread
+    const int dr = (nr + nth - 1)/nth;
+
+    // row range for this thread
+    const int ir0 = dr*ith;
+    const int ir1 = MIN(ir0 + dr, nr);
+
+    const float * adamw_params_ptr = ggml_get_data_f32(adamw_params);
+
+    const float alpha  = adamw_params_ptr[0];
+    const float beta1  = adamw_params_ptr[1];
+    const float beta2  = adamw_params_ptr[2];
+    const float eps    = adamw_params_ptr[3];
+    const float wd     = adamw_params_ptr[4];
+    const float beta1h = adamw_params_ptr[5];
+    const float beta2h = adamw_params_ptr[6];
+    const float keep   = 1.f - alpha * wd;
+
+    // the step number changes the rounding noise from one step to the next
+    const uint32_t seed = ggml_nelements(adamw_params) > 7 ? ggml_opt_step_hash((uint32_t) adamw_params_ptr[7]) : 0;
+
+    constexpr int64_t chunk = 256;
+    GGML_ASSERT(chunk % ggml_blck_size(type_mv) == 0);
+
+    float w[chunk];
+    float m[chunk];
+    float v[chunk];
+
+    for (int ir = ir0; ir < ir1; ++ir) {
+        const int64_t i03 = ir/(ne02*ne01);
+        const int64_t i02 = (ir - i03*ne02*ne01)/ne01;
+        const int64_t i01 = (ir - i03*ne02*ne01 - i02*ne01);
+
+        char        * w_row = (char        *) src0->data        + i03*nb03 + i02*nb02 + i01*nb01;
+        const float * g_row = (const float *) ((const char *) src0_grad->data +
+            i03*src0_grad->nb[3] + i02*src0_grad->nb[2] + i01*src0_grad->nb[1]);
+        char        * m_row = (char        *) src0_grad_m->data +
+            i03*src0_grad_m->nb[3] + i02*src0_grad_m->nb[2] + i01*src0_grad_m->nb[1];
+        char        * v_row = (char        *) src0_grad_v->data +
+            i03*src0_grad_v->nb[3] + i02*src0_grad_v->nb[2] + i01*src0_grad_v->nb[1];
+
+        for (int64_t i0 = 0; i0 < ne00; i0 += chunk) {
+            const int64_t n = MIN(chunk, ne00 - i0);
+
+            void * w_chunk = w_row + i0*ggml_type_size(type_w);
+            void * m_chunk = m_row + ggml_row_size(type_mv, i0);
+            void * v_chunk = v_row + ggml_row_size(type_mv, i0);
+            const float * g = g_row + i0;
+
+            ggml_opt_step_row_to_f32(type_w,  w_chunk, w, n);
+            ggml_opt_step_row_to_f32(type_mv, m_chunk, m, n);
+            ggml_opt_step_row_to_f32(type_mv, v_chunk, v, n);
+
+            for (int64_t i = 0; i < n; ++i) {
+                const float m_prev = compand ? m[i]*fabsf(m[i])        : m[i];
+                const float v_prev = compand ? (v[i]*v[i])*(v[i]*v[i]) : v[i];
+
+                m[i] = m_prev*beta1 +    g[i]*(1.0f - beta1);
+                v[i] = v_prev*beta2 + g[i]*g[i]*(1.0f - beta2);
+
+                const float mh =       m[i]*beta1h;
+                const float vh = sqrtf(v[i]*beta2h) + eps;
+
+                w[i] = w[i] * keep - alpha * mh / vh;
+
+                if (compand) {
+                    m[i] = copysignf(sqrtf(fabsf(m[i])), m[i]);
+                    v[i] = sqrtf(sqrtf(v[i]));
+                }
+            }
+
+            ggml_opt_step_row_from_f32_sr(type_w, w, w_chunk, n, seed + (uint32_t) (ir*ne00 + i0));
+            ggml_opt_step_row_from_f32(type_mv, m, m_chunk, n);
+            ggml_opt_step_row_from_f32(type_mv, v, v_chunk, n);
+        }
+    }
+}
+
 void ggml_compute_forward_opt_step_adamw(
         const ggml_compute_params * params,
         ggml_tensor * dst) {
 
-    const ggml_tensor * src0 = dst->src[0];
+    const ggml_tensor * src0   = dst->src[0];
+    const ggml_tensor * grad_m = dst->src[2];
 
     switch (src0->type) {
         case GGML_TYPE_F32:
             {
-                ggml_compute_forward_opt_step_adamw_f32(params, dst);
+                if (grad_m->type == GGML_TYPE_F32) {
+                    ggml_compute_forward_opt_step_adamw_f32(params, dst);
+                } else {
+                    ggml_compute_forward_opt_step_adamw_mixed(params, dst);
+                }
+            } break;
+        case GGML_TYPE_F16:
+        case GGML_TYPE_BF16:
+            {
+                ggml_compute_forward_opt_step_adamw_mixed(params, dst);
             } break;
         default:
             {
@@ -10536,7 +10939,7 @@ static void ggml_compute_forward_opt_step_sgd_f32(const ggml_compute_params * pa
     const ggml_tensor * sgd_params = dst->src[2];
 
     GGML_ASSERT(ggml_are_same_shape(src0, src0_grad));
-    GGML_ASSERT(ggml_nelements(sgd_params) == 2);
+    GGML_ASSERT(ggml_nelements(sgd_params) == 2 || ggml_nelements(sgd_params) == 3);
 
     const int ith = params->ith;
     const int nth = params->nth;
@@ -10574,6 +10977,66 @@ static void ggml_compute_forward_opt_step_sgd_f32(const ggml_compute_params * pa
     }
 }
 
+static void ggml_compute_forward_opt_step_sgd_mixed(const ggml_compute_params * params, ggml_tensor * dst) {
+    const ggml_tensor * src0       = dst->src[0];
+    const ggml_tensor * src0_grad  = dst->src[1];
+    const ggml_tensor * sgd_params = dst->src[2];
+
+    GGML_ASSERT(ggml_are_same_shape(src0, src0_grad));
+    GGML_ASSERT(ggml_nelements(sgd_params) == 2 || ggml_nelements(sgd_params) == 3);
+    GGML_ASSERT(src0_grad->type == GGML_TYPE_F32);
+
+    const ggml_type type_w = src0->type;
+
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    const int nr = ggml_nrows(src0);
+
+    GGML_TENSOR_UNARY_OP_LOCALS
+    GGML_ASSERT(nb00 == ggml_type_size(type_w));
+
+    // rows per thread
+    const int dr = (nr + nth - 1) / nth;
+
+    // row range for this thread
+    const int ir0 = dr * ith;
+    const int ir1 = MIN(ir0 + dr, nr);
+
+    const float * sgd_params_ptr   = ggml_get_data_f32(sgd_params);
+    const float   alpha            = sgd_params_ptr[0];
+    const float   keep             = 1.f - alpha * sgd_params_ptr[1];
+
+    // the step number changes the rounding noise from one step to the next
+    const uint32_t seed = ggml_nelements(sgd_params) > 2 ? ggml_opt_step_hash((uint32_t) sgd_params_ptr[2]) : 0;
+
+    constexpr int64_t chunk = 256;
+    float w[chunk];
+
+    for (int ir = ir0; ir < ir1; ++ir) {
+        const int64_t i03 = ir / (ne02 * ne01);
+        const int64_t i02 = (ir - i03 * ne02 * ne01) / ne01;
+        const int64_t i01 = (ir - i03 * ne02 * ne01 - i02 * ne01);
+
+        char        * w_row = (char *) src0->data + i03 * nb03 + i02 * nb02 + i01 * nb01;
+        const float * g_row = (const float *) ((const char *) src0_grad->data +
+            i03 * src0_grad->nb[3] + i02 * src0_grad->nb[2] + i01 * src0_grad->nb[1]);
+
+        for (int64_t i0 = 0; i0 < ne00; i0 += chunk) {
+            const int64_t n = MIN(chunk, ne00 - i0);
+
+            void * w_chunk = w_row + i0 * ggml_type_size(type_w);
+            const float * g = g_row + i0;
+
+            ggml_opt_step_row_to_f32(type_w, w_chunk, w, n);
+            for (int64_t i = 0; i < n; ++i) {
+                w[i] = w[i] * keep - alpha * g[i];
+            }
+            ggml_opt_step_row_from_f32_sr(type_w, w, w_chunk, n, seed + (uint32_t) (ir * ne00 + i0));
+        }
+    }
+}
+
 void ggml_compute_forward_opt_step_sgd(const ggml_compute_params * params, ggml_tensor * dst) {
     const ggml_tensor * src0 = dst->src[0];
 
@@ -10583,9 +11046,15 @@ void ggml_compute_forward_opt_step_sgd(const ggml_compute_params * params, ggml_
                 ggml_compute_forward_opt_step_sgd_f32(params, dst);
             }
             break;
+        case GGML_TYPE_F16:
+        case GGML_TYPE_BF16:
+            {
+                ggml_compute_forward_opt_step_sgd_mixed(params, dst);
+            }
+            break;
         default:
             {
-                GGML_ABORT("fatal error - sgd is F32 only");
+                GGML_ABORT("fatal error - sgd is F32/F16/BF16 only");
             }
     }
 }
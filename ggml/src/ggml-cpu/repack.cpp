@@ -563,6 +563,57 @@ void ggml_gemv_iq4_nl_8x8_q8_0_generic(int n, float * GGML_RESTRICT s, size_t bs
     }
 }
 
+void ggml_gemv_iq1_s_4x8_q8_K_generic(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
+    const int qk = QK_K;
+    const int nb = n / qk;
+    const int ncols_interleaved = 4;
+    const int blocklen = 8;
+
+    assert(nr == 1);
+    assert(n % qk == 0);
+    assert(nc % ncols_interleaved == 0);
+
+    UNUSED(bs);
+    UNUSED(nr);
+    UNUSED(blocklen);
+
+    float sumf[4];
+    int sumi;
+    int sumi1;
+
+    const block_q8_K * a_ptr = (const block_q8_K *) vy;
+    for (int x = 0; x < nc / ncols_interleaved; x++) {
+        const block_iq1_sx4 * b_ptr = (const block_iq1_sx4 *) vx + (x * nb);
+
+        for (int j = 0; j < ncols_interleaved; j++) sumf[j] = 0.0;
+        for (int l = 0; l < nb; l++) {
+            for (int j = 0; j < ncols_interleaved; j++) {
+                sumi  = 0;
+                sumi1 = 0;
+                for (int ib = 0; ib < QK_K / 32; ib++) {
+                    const uint8_t * qs = b_ptr[l].qs + (ib * ncols_interleaved + j) * 4;
+                    const uint16_t  qh = b_ptr[l].qh[ib * ncols_interleaved + j];
+                    const int8_t  * q8 = a_ptr[l].qs + ib * 32;
+                    int lsum = 0;
+                    for (int k = 0; k < 4; k++) {
+                        // grid values are stored as 4-bit nibbles biased by +1
+                        const uint32_t grid = iq1s_grid_gpu[qs[k] | (((qh >> 3 * k) & 7) << 8)];
+                        for (int i = 0; i < 4; i++) {
+                            lsum += ((grid >> (8 * i    )) & 0xF) * q8[k * blocklen + i];
+                            lsum += ((grid >> (8 * i + 4)) & 0xF) * q8[k * blocklen + i + 4];
+                        }
+                    }
+                    const int ls = 2 * ((qh >> 12) & 7) + 1;
+                    sumi  += ls * lsum;
+                    sumi1 += ls * ((qh & 0x8000) ? -9 : -7) * (a_ptr[l].bsums[2 * ib] + a_ptr[l].bsums[2 * ib + 1]);
+                }
+                sumf[j] += (sumi + IQ1S_DELTA * sumi1) * GGML_CPU_FP16_TO_FP32(b_ptr[l].d[j]) * a_ptr[l].d;
+            }
+        }
+        for (int j = 0; j < ncols_interleaved; j++) s[x * ncols_interleaved + j] = sumf[j];
+    }
+}
+
 void ggml_gemm_q4_0_4x4_q8_0_generic(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
     const int qk = QK8_0;
     const int nb = n / qk;
@@ -1007,6 +1058,61 @@ void ggml_gemm_iq4_nl_8x8_q8_0_generic(int n, float * GGML_RESTRICT s, size_t bs
     }
 }
 
+void ggml_gemm_iq1_s_4x8_q8_K_generic(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
+    const int qk = QK_K;
+    const int nb = n / qk;
+    const int ncols_interleaved = 4;
+    const int blocklen = 8;
+
+    assert(n % qk == 0);
+    assert(nr % 4 == 0);
+    assert(nc % ncols_interleaved == 0);
+
+    float sumf[4][4];
+    int sumi;
+    int sumi1;
+
+    for (int y = 0; y < nr / 4; y++) {
+        const block_q8_Kx4 * a_ptr = (const block_q8_Kx4 *) vy + (y * nb);
+        for (int x = 0; x < nc / ncols_interleaved; x++) {
+            const block_iq1_sx4 * b_ptr = (const block_iq1_sx4 *) vx + (x * nb);
+            for (int m = 0; m < 4; m++) {
+                for (int j = 0; j < ncols_interleaved; j++) sumf[m][j] = 0.0;
+            }
+            for (int l = 0; l < nb; l++) {
+                for (int m = 0; m < 4; m++) {
+                    for (int j = 0; j < ncols_interleaved; j++) {
+                        sumi  = 0;
+                        sumi1 = 0;
+                        for (int ib = 0; ib < QK_K / 32; ib++) {
+                            const uint8_t * qs = b_ptr[l].qs + (ib * ncols_interleaved + j) * 4;
+                            const uint16_t  qh = b_ptr[l].qh[ib * ncols_interleaved + j];
+                            int lsum = 0;
+                            for (int k = 0; k < 4; k++) {
+                                const uint32_t grid = iq1s_grid_gpu[qs[k] | (((qh >> 3 * k) & 7) << 8)];
+                                const int8_t * q8 = a_ptr[l].qs + (ib * 4 + k) * 4 * blocklen + m * blocklen;
+                                for (int i = 0; i < 4; i++) {
+                                    lsum += ((grid >> (8 * i    )) & 0xF) * q8[i];
+                                    lsum += ((grid >> (8 * i + 4)) & 0xF) * q8[i + 4];
+                                }
+                            }
+                            const int16_t * bsums = a_ptr[l].bsums + (ib * 8) + (m * 4) - ((ib % 2) * 6);
+                            const int ls = 2 * ((qh >> 12) & 7) + 1;
+                            sumi  += ls * lsum;
+                            sumi1 += ls * ((qh & 0x8000) ? -9 : -7) * (bsums[0] + bsums[1]);
+                        }
+                        sumf[m][j] += (sumi + IQ1S_DELTA * sumi1) * GGML_CPU_FP16_TO_FP32(b_ptr[l].d[j]) * a_ptr[l].d[m];
+                    }
+                }
+            }
+            for (int m = 0; m < 4; m++) {
+                for (int j = 0; j < ncols_interleaved; j++)
+                    s[(y * 4 + m) * bs + x * ncols_interleaved + j] = sumf[m][j];
+            }
+        }
+    }
+}
+
 } // extern "C"
 
 static block_q4_0x4 make_block_q4_0x4(block_q4_0 * in, unsigned int blck_size_interleave) {
@@ -1446,6 +1552,56 @@ static int repack_iq4_nl_to_iq4_nl_8_bl(struct ggml_tensor * t, int interleave_b
     GGML_UNUSED(data_size);
 }
 
+static block_iq1_sx4 make_block_iq1_sx4(block_iq1_s * in) {
+    block_iq1_sx4 out;
+
+    for (int i = 0; i < 4; i++) {
+        out.d[i] = in[i].d;
+    }
+
+    // The 4 grid index bytes and the qh word of each 32-value sub-block are interleaved row by row,
+    // so the rows of a sub-block can be decoded against the same activations
+    for (int ib = 0; ib < QK_K / 32; ib++) {
+        for (int i = 0; i < 4; i++) {
+            memcpy(&out.qs[(ib * 4 + i) * 4], &in[i].qs[ib * 4], 4);
+            out.qh[ib * 4 + i] = in[i].qh[ib];
+        }
+    }
+
+    return out;
+}
+
+static int repack_iq1_s_to_iq1_s_4_bl(struct ggml_tensor * t, int interleave_block, const void * GGML_RESTRICT data, size_t data_size) {
+    GGML_ASSERT(t->type == GGML_TYPE_IQ1_S);
+    GGML_ASSERT(interleave_block == 8);
+    constexpr int nrows_interleaved = 4;
+
+    block_iq1_sx4 * dst = (block_iq1_sx4 *)t->data;
+    const block_iq1_s * src = (const block_iq1_s *) data;
+    block_iq1_s dst_tmp[4];
+    int nrow = ggml_nrows(t);
+    int nblocks = t->ne[0] / QK_K;
+
+    GGML_ASSERT(data_size == nrow * nblocks * sizeof(block_iq1_s));
+
+    if (t->ne[1] % nrows_interleaved != 0) {
+        return -1;
+    }
+
+    for (int b = 0; b < nrow; b += nrows_interleaved) {
+        for (int64_t x = 0; x < nblocks; x++) {
+            for (int i = 0; i < nrows_interleaved; i++) {
+                dst_tmp[i] = src[x + i * nblocks];
+            }
+            *dst++ = make_block_iq1_sx4(dst_tmp);
+        }
+        src += nrows_interleaved * nblocks;
+    }
+    return 0;
+
+    GGML_UNUSED(data_size);
+}
+
 namespace ggml::cpu::repack {
 // repack
 template <typename BLOC_TYPE, int64_t INTER_SIZE, int64_t NB_COLS>
@@ -1485,6 +1641,10 @@ template <> int repack<block_iq4_nl, 8, 8>(struct ggml_tensor * t, const void *
     return repack_iq4_nl_to_iq4_nl_8_bl(t, 8, data, data_size);
 }
 
+template <> int repack<block_iq1_s, 8, 4>(struct ggml_tensor * t, const void * data, size_t data_size) {
+    return repack_iq1_s_to_iq1_s_4_bl(t, 8, data, data_size);
+}
+
 // gemv
 template <typename BLOC_TYPE, int64_t INTER_SIZE, int64_t NB_COLS, ggml_type PARAM_TYPE>
 void gemv(int, float *, size_t, const void *, const void *, int, int);
@@ -1517,6 +1677,10 @@ template <> void gemv<block_iq4_nl, 8, 8, GGML_TYPE_Q8_0>(int n, float * s, size
     ggml_gemv_iq4_nl_8x8_q8_0(n, s, bs, vx, vy, nr, nc);
 }
 
+template <> void gemv<block_iq1_s, 8, 4, GGML_TYPE_Q8_K>(int n, float * s, size_t bs, const void * vx, const void * vy, int nr, int nc) {
+    ggml_gemv_iq1_s_4x8_q8_K(n, s, bs, vx, vy, nr, nc);
+}
+
 // gemm
 template <typename BLOC_TYPE, int64_t INTER_SIZE, int64_t NB_COLS, ggml_type PARAM_TYPE>
 void gemm(int, float *, size_t, const void *, const void *, int, int);
@@ -1549,6 +1713,10 @@ template <> void gemm<block_iq4_nl, 8, 8, GGML_TYPE_Q8_0>(int n, float * s, size
     ggml_gemm_iq4_nl_8x8_q8_0(n, s, bs, vx, vy, nr, nc);
 }
 
+template <> void gemm<block_iq1_s, 8, 4, GGML_TYPE_Q8_K>(int n, float * s, size_t bs, const void * vx, const void * vy, int nr, int nc) {
+    ggml_gemm_iq1_s_4x8_q8_K(n, s, bs, vx, vy, nr, nc);
+}
+
 class tensor_traits_base : public ggml::cpu::tensor_traits {
   public:
     virtual int repack(struct ggml_tensor * t, const void * data, size_t data_size) = 0;
@@ -1825,6 +1993,9 @@ static const ggml::cpu::tensor_traits * ggml_repack_get_optimal_repack_type(cons
     static const ggml::cpu::repack::tensor_traits<block_iq4_nl, 4, 4, GGML_TYPE_Q8_0> iq4_nl_4x4_q8_0;
     static const ggml::cpu::repack::tensor_traits<block_iq4_nl, 8, 8, GGML_TYPE_Q8_0> iq4_nl_8x8_q8_0;
 
+    // instance for IQ1
+    static const ggml::cpu::repack::tensor_traits<block_iq1_s, 8, 4, GGML_TYPE_Q8_K> iq1_s_4x8_q8_K;
+
     if (cur->type == GGML_TYPE_Q4_0) {
         if (ggml_cpu_has_avx2() || (ggml_cpu_has_sve() && ggml_cpu_has_matmul_int8() && ggml_cpu_get_sve_cnt() == QK8_0)) {
             if (cur->ne[1] % 8 == 0) {
@@ -1864,6 +2035,12 @@ static const ggml::cpu::tensor_traits * ggml_repack_get_optimal_repack_type(cons
                 return &iq4_nl_4x4_q8_0;
             }
         }
+    } else if (cur->type == GGML_TYPE_IQ1_S) {
+        if (ggml_cpu_has_avx2()) {
+            if (cur->ne[1] % 4 == 0) {
+                return &iq1_s_4x8_q8_K;
+            }
+        }
     }
 
     return nullptr;
@@ -1,93 +1,165 @@
 #include "unary-ops.h"
-
-static inline float op_abs(float x) {
-    return fabsf(x);
-}
-
-static inline float op_sgn(float x) {
-    return (x > 0.f) ? 1.f : ((x < 0.f) ? -1.f : 0.f);
-}
-
-static inline float op_neg(float x) {
-    return -x;
-}
-
-static inline float op_step(float x) {
-    return (x > 0.f) ? 1.f : 0.f;
-}
-
-static inline float op_tanh(float x) {
-    return tanhf(x);
-}
-
-static inline float op_elu(float x) {
-    return (x > 0.f) ? x : expm1f(x);
-}
-
-static inline float op_relu(float x) {
-    return (x > 0.f) ? x : 0.f;
-}
-
-static inline float op_sigmoid(float x) {
-    return 1.f / (1.f + expf(-x));
-}
-
-static inline float op_hardsigmoid(float x) {
-    return fminf(1.0f, fmaxf(0.0f, (x + 3.0f) / 6.0f));
-}
-
-static inline float op_exp(float x) {
-    return expf(x);
-}
-
-static inline float op_hardswish(float x) {
-    return x * fminf(1.0f, fmaxf(0.0f, (x + 3.0f) / 6.0f));
-}
-
-static inline float op_sqr(float x) {
-    return x * x;
-}
-
-static inline float op_sqrt(float x) {
-    return sqrtf(x);
-}
-
-static inline float op_sin(float x) {
-    return sinf(x);
-}
-
-static inline float op_cos(float x) {
-    return cosf(x);
-}
-
-static inline float op_log(float x) {
-    return logf(x);
-}
-
-template <float (*op)(float), typename src0_t, typename dst_t>
-static inline void vec_unary_op(int64_t n, dst_t * y, const src0_t * x) {
+#include "elementwise.h"
+
+struct op_abs {
+    static constexpr bool has_vec = true;
+    static inline float apply(float x) { return fabsf(x); }
+#if defined(GGML_EW_EPR)
+    static inline ew_f32 apply(ew_f32 x) { return ew_abs(x); }
+#endif
+};
+
+struct op_sgn {
+    static constexpr bool has_vec = true;
+    static inline float apply(float x) { return (x > 0.f) ? 1.f : ((x < 0.f) ? -1.f : 0.f); }
+#if defined(GGML_EW_EPR)
+    static inline ew_f32 apply(ew_f32 x) { return ew_sub(ew_step(x), ew_step(ew_neg(x))); }
+#endif
+};
+
+struct op_neg {
+    static constexpr bool has_vec = true;
+    static inline float apply(float x) { return -x; }
+#if defined(GGML_EW_EPR)
+    static inline ew_f32 apply(ew_f32 x) { return ew_neg(x); }
+#endif
+};
+
+struct op_step {
+    static constexpr bool has_vec = true;
+    static inline float apply(float x) { return (x > 0.f) ? 1.f : 0.f; }
+#if defined(GGML_EW_EPR)
+    static inline ew_f32 apply(ew_f32 x) { return ew_step(x); }
+#endif
+};
+
+struct op_tanh {
+    static constexpr bool has_vec = false;
+    static inline float apply(float x) { return tanhf(x); }
+};
+
+struct op_elu {
+    static constexpr bool has_vec = false;
+    static inline float apply(float x) { return (x > 0.f) ? x : expm1f(x); }
+};
+
+struct op_relu {
+    static constexpr bool has_vec = true;
+    static inline float apply(float x) { return (x > 0.f) ? x : 0.f; }
+#if defined(GGML_EW_EPR)
+    static inline ew_f32 apply(ew_f32 x) { return ew_max(x, ew_set1(0.0f)); }
+#endif
+};
+
+struct op_sigmoid {
+#if defined(GGML_EW_EXP)
+    static constexpr bool has_vec = true;
+    static inline ew_f32 apply(ew_f32 x) { return ew_div(ew_set1(1.0f), ew_add(ew_set1(1.0f), ew_exp(ew_neg(x)))); }
+#else
+    static constexpr bool has_vec = false;
+#endif
+    static inline float apply(float x) { return 1.f / (1.f + expf(-x)); }
+};
+
+struct op_hardsigmoid {
+    static constexpr bool has_vec = true;
+    static inline float apply(float x) { return fminf(1.0f, fmaxf(0.0f, (x + 3.0f) / 6.0f)); }
+#if defined(GGML_EW_EPR)
+    static inline ew_f32 apply(ew_f32 x) { return ew_min(ew_max(ew_div(ew_add(x, ew_set1(3.0f)), ew_set1(6.0f)), ew_set1(0.0f)), ew_set1(1.0f)); }
+#endif
+};
+
+struct op_exp {
+#if defined(GGML_EW_EXP)
+    static constexpr bool has_vec = true;
+    static inline ew_f32 apply(ew_f32 x) { return ew_exp(x); }
+#else
+    static constexpr bool has_vec = false;
+#endif
+    static inline float apply(float x) { return expf(x); }
+};
+
+struct op_hardswish {
+    static constexpr bool has_vec = true;
+    static inline float apply(float x) { return x * fminf(1.0f, fmaxf(0.0f, (x + 3.0f) / 6.0f)); }
+#if defined(GGML_EW_EPR)
+    static inline ew_f32 apply(ew_f32 x) { return ew_mul(x, ew_min(ew_max(ew_div(ew_add(x, ew_set1(3.0f)), ew_set1(6.0f)), ew_set1(0.0f)), ew_set1(1.0f))); }
+#endif
+};
+
+struct op_sqr {
+    static constexpr bool has_vec = true;
+    static inline float apply(float x) { return x * x; }
+#if defined(GGML_EW_EPR)
+    static inline ew_f32 apply(ew_f32 x) { return ew_mul(x, x); }
+#endif
+};
+
+struct op_sqrt {
+    static constexpr bool has_vec = true;
+    static inline float apply(float x) { return sqrtf(x); }
+#if defined(GGML_EW_EPR)
+    static inline ew_f32 apply(ew_f32 x) { return ew_sqrt(x); }
+#endif
+};
+
+struct op_sin {
+    static constexpr bool has_vec = false;
+    static inline float apply(float x) { return sinf(x); }
+};
+
+struct op_cos {
+    static constexpr bool has_vec = false;
+    static inline float apply(float x) { return cosf(x); }
+};
+
+struct op_log {
+    static constexpr bool has_vec = false;
+    static inline float apply(float x) { return logf(x); }
+};
+
+// y[i*ny] = op(x[i*nx]) with the strides in bytes
+template <class op, typename src0_t, typename dst_t>
+static inline void vec_unary_op_strided(const int64_t n, dst_t * y, const size_t ny, const src0_t * x, const size_t nx) {
     constexpr auto src0_to_f32 = type_conversion_table<src0_t>::to_f32;
     constexpr auto f32_to_dst  = type_conversion_table<dst_t >::from_f32;
 
-    for (int i = 0; i < n; i++) {
-        y[i] = f32_to_dst(op(src0_to_f32(x[i])));
+    for (int64_t i = 0; i < n; i++) {
+        const src0_t * x_ptr = (const src0_t *)((const char *)x + i*nx);
+        dst_t        * y_ptr = (dst_t        *)((char *)y + i*ny);
+        *y_ptr = f32_to_dst(op::apply(src0_to_f32(*x_ptr)));
     }
 }
 
-template <float (*op)(float), typename src0_t, typename dst_t>
+template <class op, typename src0_t, typename dst_t>
 static void apply_unary_op(const ggml_compute_params * params, ggml_tensor * dst) {
     const ggml_tensor * src0 = dst->src[0];
 
-    GGML_ASSERT(ggml_is_contiguous_1(src0) && ggml_is_contiguous_1(dst) && ggml_are_same_shape(src0, dst));
+    GGML_ASSERT(ggml_are_same_shape(src0, dst));
 
     GGML_TENSOR_UNARY_OP_LOCALS
 
-    GGML_ASSERT( nb0 == sizeof(dst_t));
-    GGML_ASSERT(nb00 == sizeof(src0_t));
+    // the threads split the flattened elements instead of the rows, so that tensors with few rows use all threads
+    const auto [ie0, ie1] = get_thread_range_flat(params, ggml_nelements(dst));
+    if (ie0 >= ie1) {
+        return;
+    }
+
+    if (ggml_is_contiguous(src0) && ggml_is_contiguous(dst)) {
+        ew_unary<op>(ie1 - ie0, (dst_t *) dst->data + ie0, (const src0_t *) src0->data + ie0);
+        return;
+    }
+
+    const bool is_contiguous_rows = nb0 == sizeof(dst_t) && nb00 == sizeof(src0_t);
+
+    for (int64_t ie = ie0; ie < ie1; ) {
+        const int64_t ir = ie/ne0;
 
-    const auto [ir0, ir1] = get_thread_range(params, src0);
+        // columns [i0, i1) of row ir
+        const int64_t i0 = ie - ir*ne0;
+        const int64_t i1 = std::min(ne0, i0 + (ie1 - ie));
+        ie += i1 - i0;
 
-    for (int64_t ir = ir0; ir < ir1; ++ir) {
         const int64_t i03 = ir/(ne02*ne01);
         const int64_t i02 = (ir - i03*ne02*ne01)/ne01;
         const int64_t i01 = (ir - i03*ne02*ne01 - i02*ne01);
@@ -95,12 +167,16 @@ static void apply_unary_op(const ggml_compute_params * params, ggml_tensor * dst
         dst_t        * dst_ptr  = (dst_t  *)       ((char *)       dst->data  + i03*nb3  + i02*nb2  + i01*nb1 );
         const src0_t * src0_ptr = (const src0_t *) ((const char *) src0->data + i03*nb03 + i02*nb02 + i01*nb01);
 
-        vec_unary_op<op>(ne0, dst_ptr, src0_ptr);
+        if (is_contiguous_rows) {
+            ew_unary<op>(i1 - i0, dst_ptr + i0, src0_ptr + i0);
+        } else {
+            vec_unary_op_strided<op>(i1 - i0, (dst_t *) ((char *) dst_ptr + i0*nb0), nb0, (const src0_t *) ((const char *) src0_ptr + i0*nb00), nb00);
+        }
     }
 }
 
 // TODO: Use the 'traits' lookup table (for type conversion fns), instead of a mass of 'if' conditions with long templates
-template <float (*op)(float)>
+template <class op>
 static void unary_op(const ggml_compute_params * params, ggml_tensor * dst) {
     const ggml_tensor * src0 = dst->src[0];
 
@@ -3585,9 +3585,11 @@ static bool ggml_backend_cuda_device_supports_op(ggml_backend_dev_t dev, const g
             return ggml_cuda_flash_attn_ext_supported(dev_ctx->device, op);
         case GGML_OP_CROSS_ENTROPY_LOSS:
         case GGML_OP_CROSS_ENTROPY_LOSS_BACK:
+            return true;
         case GGML_OP_OPT_STEP_ADAMW:
+            return op->src[0]->type == GGML_TYPE_F32 && op->src[2]->type == GGML_TYPE_F32;
         case GGML_OP_OPT_STEP_SGD:
-            return true;
+            return op->src[0]->type == GGML_TYPE_F32;
         default:
             return false;
     }
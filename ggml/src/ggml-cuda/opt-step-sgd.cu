@@ -35,7 +35,7 @@ void ggml_cuda_opt_step_sgd(ggml_backend_cuda_context & ctx, ggml_tensor * dst)
     GGML_ASSERT(ggml_is_contiguous(src0_grad));
     GGML_ASSERT(ggml_is_contiguous(params));
     GGML_ASSERT(ggml_are_same_shape(src0, src0_grad));
-    GGML_ASSERT(ggml_nelements(params) == 2);
+    GGML_ASSERT(ggml_nelements(params) == 2 || ggml_nelements(params) == 3);
 
     float       * src0_d      = (float       *) src0->data;
     const float * src0_grad_d = (const float *) src0_grad->data;
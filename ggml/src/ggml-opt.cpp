@@ -68,7 +68,13 @@ struct ggml_opt_context {
     void *                        get_opt_pars_ud = nullptr;
     struct ggml_tensor *          opt_step_params = nullptr; // Stores output of get_opt_pars.
 
-    enum ggml_opt_optimizer_type optimizer = GGML_OPT_OPTIMIZER_TYPE_ADAMW;
+    enum ggml_opt_optimizer_type optimizer    = GGML_OPT_OPTIMIZER_TYPE_ADAMW;
+    enum ggml_type               momenta_type = GGML_TYPE_F32;
+
+    int32_t               dp_rank       = 0;
+    int32_t               dp_size       = 1;
+    ggml_opt_all_reduce_t all_reduce    = nullptr;
+    void *                all_reduce_ud = nullptr;
 };
 
 struct ggml_opt_result {
@@ -256,9 +262,39 @@ struct ggml_opt_params ggml_opt_default_params(
         /*get_opt_pars    =*/ ggml_opt_get_default_optimizer_params,
         /*get_opt_pars_ud =*/ nullptr,
         /*optimizer       =*/ GGML_OPT_OPTIMIZER_TYPE_ADAMW,
+        /*momenta_type    =*/ GGML_TYPE_F32,
+        /*dp_rank         =*/ 0,
+        /*dp_size         =*/ 1,
+        /*all_reduce      =*/ nullptr,
+        /*all_reduce_ud   =*/ nullptr,
     };
 }
 
+// averages the gradients of the data-parallel workers, runs on the host in a single thread
+static void ggml_opt_all_reduce_op(struct ggml_tensor * dst, const struct ggml_tensor * a, int ith, int nth, void * userdata) {
+    GGML_UNUSED(nth);
+    if (ith != 0) {
+        return;
+    }
+    const ggml_opt_context_t opt_ctx = (ggml_opt_context_t) userdata;
+
+    GGML_ASSERT(dst->type == GGML_TYPE_F32 && a->type == GGML_TYPE_F32);
+    GGML_ASSERT(ggml_is_contiguous(dst) && ggml_is_contiguous(a));
+
+    float * data = (float *) dst->data;
+    const int64_t n = ggml_nelements(dst);
+    if (data != a->data) {
+        memcpy(data, a->data, ggml_nbytes(dst));
+    }
+
+    opt_ctx->all_reduce(data, n, opt_ctx->all_reduce_ud);
+
+    const float scale = 1.0f/opt_ctx->dp_size;
+    for (int64_t i = 0; i < n; ++i) {
+        data[i] *= scale;
+    }
+}
+
 static ggml_tensor * map_tensor(std::map<ggml_tensor *, ggml_tensor *> & tensor_map, ggml_context * ctx, ggml_tensor * tensor) {
     if (!tensor) {
         return nullptr;
@@ -475,8 +511,10 @@ static void ggml_opt_build(ggml_opt_context_t opt_ctx) {
             for (int i = 0; i < n_nodes; ++i) {
                 ggml_tensor * node = opt_ctx->gf->nodes[i];
                 if (node->flags & GGML_TENSOR_FLAG_PARAM) {
-                    opt_ctx->grad_m[i] = ggml_new_tensor(opt_ctx->ctx_static, GGML_TYPE_F32, GGML_MAX_DIMS, node->ne);
-                    opt_ctx->grad_v[i] = ggml_new_tensor(opt_ctx->ctx_static, GGML_TYPE_F32, GGML_MAX_DIMS, node->ne);
+                    const ggml_type type = node->ne[0] % ggml_blck_size(opt_ctx->momenta_type) == 0 ?
+                        opt_ctx->momenta_type : GGML_TYPE_F32;
+                    opt_ctx->grad_m[i] = ggml_new_tensor(opt_ctx->ctx_static, type, GGML_MAX_DIMS, node->ne);
+                    opt_ctx->grad_v[i] = ggml_new_tensor(opt_ctx->ctx_static, type, GGML_MAX_DIMS, node->ne);
                 } else {
                     opt_ctx->grad_m[i] = nullptr;
                     opt_ctx->grad_v[i] = nullptr;
@@ -503,7 +541,7 @@ static void ggml_opt_build(ggml_opt_context_t opt_ctx) {
     // gb_opt == graph backward optimize, forward pass, then backward pass to calculate gradients, then optimizer step.
     opt_ctx->gb_opt = ggml_graph_dup(opt_ctx->ctx_compute, opt_ctx->gb_grad, /*force_grads =*/ true);
 
-    opt_ctx->opt_step_params = ggml_new_tensor_1d(opt_ctx->ctx_cpu, GGML_TYPE_F32, need_momenta ? 7 : 2);
+    opt_ctx->opt_step_params = ggml_new_tensor_1d(opt_ctx->ctx_cpu, GGML_TYPE_F32, need_momenta ? 8 : 3);
     ggml_tensor * adamw_params = opt_ctx->opt_step_params;
     ggml_set_input(adamw_params);
     const char * optimizer_name = ggml_opt_optimizer_name(opt_ctx->optimizer);
@@ -513,6 +551,12 @@ static void ggml_opt_build(ggml_opt_context_t opt_ctx) {
         struct ggml_tensor * grad = ggml_graph_get_grad(opt_ctx->gb_opt, node);
 
         if (grad && (node->flags & GGML_TENSOR_FLAG_PARAM)) {
+            if (opt_ctx->all_reduce && opt_ctx->dp_size > 1) {
+                // not in-place, the gradient accumulator may be in a buffer the host cannot write to
+                grad = ggml_map_custom1(opt_ctx->ctx_compute, grad, ggml_opt_all_reduce_op, 1, opt_ctx);
+                ggml_format_name(grad, "all-reduce for %s", node->name);
+            }
+
             struct ggml_tensor * m = nullptr;
             struct ggml_tensor * v = nullptr;
             if (need_momenta) {
@@ -559,8 +603,16 @@ ggml_opt_context_t ggml_opt_init(struct ggml_opt_params params) {
     result->get_opt_pars     = params.get_opt_pars;
     result->get_opt_pars_ud  = params.get_opt_pars_ud;
     result->optimizer        = params.optimizer;
+    result->momenta_type     = params.momenta_type;
+    result->dp_rank          = params.dp_rank;
+    result->dp_size          = params.dp_size;
+    result->all_reduce       = params.all_reduce;
+    result->all_reduce_ud    = params.all_reduce_ud;
 
     GGML_ASSERT(result->opt_period >= 1);
+    GGML_ASSERT(result->momenta_type == GGML_TYPE_F32 || result->momenta_type == GGML_TYPE_Q8_0);
+    GGML_ASSERT(result->dp_size >= 1 && result->dp_rank >= 0 && result->dp_rank < result->dp_size);
+    GGML_ASSERT(result->dp_size == 1 || result->all_reduce);
 
     result->static_graphs = result->ctx_compute;
 
@@ -806,6 +858,7 @@ void ggml_opt_eval(ggml_opt_context_t opt_ctx, ggml_opt_result_t result) {
                 adamw_par_data[4] = opt_pars.adamw.wd;
                 adamw_par_data[5] = beta1h;
                 adamw_par_data[6] = beta2h;
+                adamw_par_data[7] = opt_ctx->iter % (1 << 24); // exact as a float, seeds the stochastic rounding
             } break;
             case GGML_OPT_OPTIMIZER_TYPE_SGD: {
                 GGML_ASSERT(opt_pars.sgd.alpha > 0.0f);
@@ -814,6 +867,7 @@ void ggml_opt_eval(ggml_opt_context_t opt_ctx, ggml_opt_result_t result) {
                 float * sgd = ggml_get_data_f32(opt_ctx->opt_step_params);
                 sgd[0] = opt_pars.sgd.alpha;
                 sgd[1] = opt_pars.sgd.wd;
+                sgd[2] = opt_ctx->iter % (1 << 24);
             } break;
             default:
                 GGML_ABORT("fatal error");
@@ -901,23 +955,29 @@ void ggml_opt_epoch(
     GGML_ASSERT(idata_split % ndata_batch == 0);
     const int64_t ibatch_split = idata_split / ndata_batch;
 
-    int64_t ibatch = 0;
+    // with data parallelism each worker takes every dp_size-th batch,
+    // all workers must do the same number of optimizer steps so the remainder is dropped
+    const int64_t dp_rank = opt_ctx->dp_rank;
+    const int64_t dp_size = opt_ctx->dp_size;
+    const int64_t nbatch_train = ibatch_split / dp_size;
+    const int64_t nbatch_eval  = (nbatches - ibatch_split) / dp_size;
+
     int64_t t_loop_start = ggml_time_us();
-    for (; ibatch < ibatch_split; ++ibatch) {
+    for (int64_t ibatch = 0; ibatch < nbatch_train; ++ibatch) {
         ggml_opt_alloc(opt_ctx, /*backward =*/ true);
-        ggml_opt_dataset_get_batch(dataset, inputs, labels, ibatch);
+        ggml_opt_dataset_get_batch(dataset, inputs, labels, ibatch*dp_size + dp_rank);
         ggml_opt_eval(opt_ctx, result_train);
         if (callback_train) {
-            callback_train(true, opt_ctx, dataset, result_train, ibatch+1, ibatch_split, t_loop_start);
+            callback_train(true, opt_ctx, dataset, result_train, ibatch+1, nbatch_train, t_loop_start);
         }
     }
     t_loop_start = ggml_time_us();
-    for (; ibatch < nbatches; ++ibatch) {
+    for (int64_t ibatch = 0; ibatch < nbatch_eval; ++ibatch) {
         ggml_opt_alloc(opt_ctx, /*backward =*/ false);
-        ggml_opt_dataset_get_batch(dataset, inputs, labels, ibatch);
+        ggml_opt_dataset_get_batch(dataset, inputs, labels, ibatch_split + ibatch*dp_size + dp_rank);
         ggml_opt_eval(opt_ctx, result_eval);
         if (callback_eval) {
-            callback_eval(false, opt_ctx, dataset, result_eval, ibatch+1-ibatch_split, nbatches-ibatch_split, t_loop_start);
+            callback_eval(false, opt_ctx, dataset, result_eval, ibatch+1, nbatch_eval, t_loop_start);
         }
     }
 }
@@ -1081,6 +1141,14 @@ enum ggml_opt_optimizer_type ggml_opt_context_optimizer_type(ggml_opt_context_t
     return c->optimizer;
 }
 
+int32_t ggml_opt_dp_rank(ggml_opt_context_t opt_ctx) {
+    return opt_ctx->dp_rank;
+}
+
+int32_t ggml_opt_dp_size(ggml_opt_context_t opt_ctx) {
+    return opt_ctx->dp_size;
+}
+
 GGML_API const char * ggml_opt_optimizer_name(enum ggml_opt_optimizer_type o) {
     switch (o) {
         case GGML_OPT_OPTIMIZER_TYPE_ADAMW:
@@ -8,6 +8,8 @@
 #include <vector>
 #include <memory>
 #include <mutex>
+#include <thread>
+#include <chrono>
 #include <unordered_map>
 #include <unordered_set>
 #ifdef _WIN32
@@ -1653,6 +1655,203 @@ void ggml_backend_rpc_start_server(ggml_backend_t backend, const char * endpoint
 #endif
 }
 
+// ring interface
+
+struct ggml_backend_rpc_ring {
+    int rank = 0;
+    int size = 1;
+
+    std::shared_ptr<socket_t> server; // listening socket of this worker
+    std::shared_ptr<socket_t> next;   // connection to worker rank + 1
+    std::shared_ptr<socket_t> prev;   // connection from worker rank - 1
+
+    std::vector<float> buf; // receive buffer for the reduce-scatter phase
+};
+
+ggml_backend_rpc_ring_t ggml_backend_rpc_ring_init(const char * endpoints, int rank) {
+    std::vector<std::string> eps;
+    {
+        std::string s = endpoints;
+        size_t pos = 0;
+        while (true) {
+            const size_t end = s.find(',', pos);
+            eps.push_back(s.substr(pos, end == std::string::npos ? std::string::npos : end - pos));
+            if (end == std::string::npos) {
+                break;
+            }
+            pos = end + 1;
+        }
+    }
+
+    const int size = (int) eps.size();
+    if (rank < 0 || rank >= size) {
+        fprintf(stderr, "Invalid ring rank %d for %d workers\n", rank, size);
+        return nullptr;
+    }
+
+    auto * ring = new ggml_backend_rpc_ring;
+    ring->rank = rank;
+    ring->size = size;
+
+    if (size == 1) {
+        return ring;
+    }
+
+#ifdef _WIN32
+    {
+        WSADATA wsaData;
+        int res = WSAStartup(MAKEWORD(2, 2), &wsaData);
+        if (res != 0) {
+            fprintf(stderr, "WSAStartup failed: %d\n", res);
+            delete ring;
+            return nullptr;
+        }
+    }
+#endif
+
+    std::string host;
+    int port;
+    if (!parse_endpoint(eps[rank], host, port)) {
+        fprintf(stderr, "Invalid endpoint: %s\n", eps[rank].c_str());
+        delete ring;
+        return nullptr;
+    }
+    ring->server = create_server_socket(host.c_str(), port);
+    if (ring->server == nullptr) {
+        fprintf(stderr, "Failed to create ring socket on %s\n", eps[rank].c_str());
+        delete ring;
+        return nullptr;
+    }
+
+    // the other workers may not be listening yet - keep trying for a while
+    const std::string & ep_next = eps[(rank + 1) % size];
+    if (!parse_endpoint(ep_next, host, port)) {
+        fprintf(stderr, "Invalid endpoint: %s\n", ep_next.c_str());
+        delete ring;
+        return nullptr;
+    }
+    for (int attempt = 0; attempt < 600 && ring->next == nullptr; ++attempt) {
+        ring->next = socket_connect(host.c_str(), port);
+        if (ring->next == nullptr) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(500));
+        }
+    }
+    if (ring->next == nullptr) {
+        fprintf(stderr, "Failed to connect to the next worker %s\n", ep_next.c_str());
+        delete ring;
+        return nullptr;
+    }
+    const int32_t rank_self = rank;
+    if (!send_data(ring->next->fd, &rank_self, sizeof(rank_self))) {
+        delete ring;
+        return nullptr;
+    }
+
+    ring->prev = socket_accept(ring->server->fd);
+    int32_t rank_prev = -1;
+    if (ring->prev == nullptr || !recv_data(ring->prev->fd, &rank_prev, sizeof(rank_prev)) || rank_prev != (rank + size - 1) % size) {
+        fprintf(stderr, "Failed to accept the previous worker (rank %d)\n", (int) rank_prev);
+        delete ring;
+        return nullptr;
+    }
+
+    return ring;
+}
+
+void ggml_backend_rpc_ring_free(ggml_backend_rpc_ring_t ring) {
+    delete ring;
+}
+
+int ggml_backend_rpc_ring_size(ggml_backend_rpc_ring_t ring) {
+    return ring->size;
+}
+
+void ggml_backend_rpc_ring_all_reduce(float * data, int64_t n, void * user_data) {
+    auto * ring = (ggml_backend_rpc_ring *) user_data;
+
+    const int size = ring->size;
+    const int rank = ring->rank;
+
+    if (size == 1 || n == 0) {
+        return;
+    }
+
+    // chunk i is [n*i/size, n*(i+1)/size)
+    auto chunk_begin = [&](int i) { return n*i/size; };
+    auto chunk_size  = [&](int i) { return chunk_begin(i + 1) - chunk_begin(i); };
+
+    // send to the next worker while receiving from the previous one, otherwise large chunks would fill the socket
+    // buffers of all workers at the same time and deadlock
+    auto exchange = [&](int i_send, float * dst, int i_recv) {
+        bool ok_send = true;
+        std::thread sender([&]() {
+            ok_send = send_data(ring->next->fd, data + chunk_begin(i_send), chunk_size(i_send)*sizeof(float));
+        });
+        const bool ok_recv = recv_data(ring->prev->fd, dst, chunk_size(i_recv)*sizeof(float));
+        sender.join();
+        if (!ok_send || !ok_recv) {
+            GGML_ABORT("ring all-reduce: connection to a worker lost");
+        }
+    };
+
+    ring->buf.resize(n/size + 1);
+
+    // reduce-scatter: after size - 1 steps, this worker holds the sum of chunk rank + 1
+    for (int step = 0; step < size - 1; ++step) {
+        const int i_send = (rank - step     + size) % size;
+        const int i_recv = (rank - step - 1 + size) % size;
+
+        exchange(i_send, ring->buf.data(), i_recv);
+
+        float * dst = data + chunk_begin(i_recv);
+        for (int64_t j = 0; j < chunk_size(i_recv); ++j) {
+            dst[j] += ring->buf[j];
+        }
+    }
+
+    // all-gather: pass the reduced chunks around the ring
+    for (int step = 0; step < size - 1; ++step) {
+        const int i_send = (rank - step + 1 + size) % size;
+        const int i_recv = (rank - step     + size) % size;
+
+        exchange(i_send, data + chunk_begin(i_recv), i_recv);
+    }
+}
+
+void ggml_backend_rpc_ring_all_gather(void * data, const size_t * sizes, void * user_data) {
+    auto * ring = (ggml_backend_rpc_ring *) user_data;
+
+    const int size = ring->size;
+    const int rank = ring->rank;
+
+    if (size == 1) {
+        return;
+    }
+
+    std::vector<size_t> offs(size + 1, 0);
+    for (int i = 0; i < size; ++i) {
+        offs[i + 1] = offs[i] + sizes[i];
+    }
+
+    uint8_t * buf = (uint8_t *) data;
+
+    // at each step, pass on the block received in the previous step
+    for (int step = 0; step < size - 1; ++step) {
+        const int i_send = (rank - step     + size) % size;
+        const int i_recv = (rank - step - 1 + size) % size;
+
+        bool ok_send = true;
+        std::thread sender([&]() {
+            ok_send = send_data(ring->next->fd, buf + offs[i_send], sizes[i_send]);
+        });
+        const bool ok_recv = recv_data(ring->prev->fd, buf + offs[i_recv], sizes[i_recv]);
+        sender.join();
+        if (!ok_send || !ok_recv) {
+            GGML_ABORT("ring all-gather: connection to a worker lost");
+        }
+    }
+}
+
 // device interface
 
 struct ggml_backend_rpc_device_context {
@@ -1778,6 +1977,21 @@ static void * ggml_backend_rpc_get_proc_address(ggml_backend_reg_t reg, const ch
     if (std::strcmp(name, "ggml_backend_rpc_start_server") == 0) {
         return (void *)ggml_backend_rpc_start_server;
     }
+    if (std::strcmp(name, "ggml_backend_rpc_ring_init") == 0) {
+        return (void *)ggml_backend_rpc_ring_init;
+    }
+    if (std::strcmp(name, "ggml_backend_rpc_ring_free") == 0) {
+        return (void *)ggml_backend_rpc_ring_free;
+    }
+    if (std::strcmp(name, "ggml_backend_rpc_ring_size") == 0) {
+        return (void *)ggml_backend_rpc_ring_size;
+    }
+    if (std::strcmp(name, "ggml_backend_rpc_ring_all_reduce") == 0) {
+        return (void *)ggml_backend_rpc_ring_all_reduce;
+    }
+    if (std::strcmp(name, "ggml_backend_rpc_ring_all_gather") == 0) {
+        return (void *)ggml_backend_rpc_ring_all_gather;
+    }
     return NULL;
 
     GGML_UNUSED(reg);
@@ -951,6 +951,8 @@ static const char * GGML_OP_NAME[GGML_OP_COUNT] = {
     "MUL_MAT",
     "MUL_MAT_ID",
     "OUT_PROD",
+    "MUL_MAT_SEL",
+    "OUT_PROD_SEL",
 
     "SCALE",
     "SET",
@@ -988,6 +990,7 @@ static const char * GGML_OP_NAME[GGML_OP_COUNT] = {
     "ARANGE",
     "TIMESTEP_EMBEDDING",
     "ARGSORT",
+    "MOE_ROUTE",
     "LEAKY_RELU",
 
     "FLASH_ATTN_EXT",
@@ -1018,7 +1021,7 @@ static const char * GGML_OP_NAME[GGML_OP_COUNT] = {
     "GLU",
 };
 
-static_assert(GGML_OP_COUNT == 89, "GGML_OP_COUNT != 89");
+static_assert(GGML_OP_COUNT == 92, "GGML_OP_COUNT != 92");
 
 static const char * GGML_OP_SYMBOL[GGML_OP_COUNT] = {
     "none",
@@ -1054,6 +1057,8 @@ static const char * GGML_OP_SYMBOL[GGML_OP_COUNT] = {
     "X*Y",
     "X[i]*Y",
     "X*Y",
+    "X[i]*Y",
+    "X*Y[i]",
 
     "x*v",
     "y-\\>view(x)",
@@ -1091,6 +1096,7 @@ static const char * GGML_OP_SYMBOL[GGML_OP_COUNT] = {
     "arange(start, stop, step)",
     "timestep_embedding(timesteps, dim, max_period)",
     "argsort(x)",
+    "moe_route(x)",
     "leaky_relu(x)",
 
     "flash_attn_ext(x)",
@@ -1121,7 +1127,7 @@ static const char * GGML_OP_SYMBOL[GGML_OP_COUNT] = {
     "glu(x)",
 };
 
-static_assert(GGML_OP_COUNT == 89, "GGML_OP_COUNT != 89");
+static_assert(GGML_OP_COUNT == 92, "GGML_OP_COUNT != 92");
 
 static_assert(GGML_OP_POOL_COUNT == 2, "GGML_OP_POOL_COUNT != 2");
 
@@ -3109,6 +3115,53 @@ struct ggml_tensor * ggml_out_prod(
     return result;
 }
 
+// ggml_mul_mat_sel
+
+struct ggml_tensor * ggml_mul_mat_sel(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a,
+        struct ggml_tensor  * b,
+        struct ggml_tensor  * ids) {
+    GGML_ASSERT(ggml_is_matrix(a) && ggml_is_matrix(b) && ggml_is_matrix(ids));
+    GGML_ASSERT(!ggml_is_transposed(a));
+    GGML_ASSERT(b->type == GGML_TYPE_F32);
+    GGML_ASSERT(ids->type == GGML_TYPE_I32);
+    GGML_ASSERT(a->ne[0] == b->ne[0]);
+    GGML_ASSERT(ids->ne[1] == b->ne[1]);
+
+    struct ggml_tensor * result = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, ids->ne[0], b->ne[1]);
+
+    result->op     = GGML_OP_MUL_MAT_SEL;
+    result->src[0] = a;
+    result->src[1] = b;
+    result->src[2] = ids;
+
+    return result;
+}
+
+// ggml_out_prod_sel
+
+struct ggml_tensor * ggml_out_prod_sel(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a,
+        struct ggml_tensor  * b,
+        struct ggml_tensor  * ids) {
+    GGML_ASSERT(ggml_is_matrix(a) && ggml_is_matrix(b) && ggml_is_matrix(ids));
+    GGML_ASSERT(!ggml_is_transposed(a));
+    GGML_ASSERT(b->type == GGML_TYPE_F32);
+    GGML_ASSERT(ids->type == GGML_TYPE_I32);
+    GGML_ASSERT(ggml_are_same_shape(b, ids));
+
+    struct ggml_tensor * result = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, a->ne[0], b->ne[1]);
+
+    result->op     = GGML_OP_OUT_PROD_SEL;
+    result->src[0] = a;
+    result->src[1] = b;
+    result->src[2] = ids;
+
+    return result;
+}
+
 // ggml_scale
 
 static struct ggml_tensor * ggml_scale_impl(
@@ -4861,6 +4914,68 @@ struct ggml_tensor * ggml_top_k(
     return result;
 }
 
+// ggml_moe_route
+
+struct ggml_tensor * ggml_moe_route(
+        struct ggml_context  * ctx,
+        struct ggml_tensor   * a,
+        struct ggml_tensor   * b,
+        int                    n_expert_used,
+        enum ggml_moe_gating   gating,
+        bool                   norm,
+        float                  scale) {
+    GGML_ASSERT(a->type == GGML_TYPE_F32);
+    GGML_ASSERT(ggml_is_matrix(a));
+    GGML_ASSERT(n_expert_used > 0 && a->ne[0] >= n_expert_used);
+
+    if (b) {
+        GGML_ASSERT(b->type == GGML_TYPE_F32);
+        GGML_ASSERT(ggml_is_contiguous(b));
+        GGML_ASSERT(ggml_nelements(b) == a->ne[0]);
+    }
+
+    // the ids and the weights are stored in two planes of the same tensor
+    struct ggml_tensor * result = ggml_new_tensor_3d(ctx, GGML_TYPE_I32, n_expert_used, a->ne[1], 2);
+
+    ggml_set_op_params_i32(result, 0, (int32_t) gating);
+    ggml_set_op_params_i32(result, 1, (int32_t) norm);
+    ggml_set_op_params_f32(result, 2, scale);
+
+    result->op     = GGML_OP_MOE_ROUTE;
+    result->src[0] = a;
+    result->src[1] = b;
+
+    return result;
+}
+
+struct ggml_tensor * ggml_moe_route_ids(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * route) {
+    GGML_ASSERT(route->op == GGML_OP_MOE_ROUTE);
+
+    return ggml_view_2d(ctx, route, route->ne[0], route->ne[1], route->nb[1], 0);
+}
+
+struct ggml_tensor * ggml_moe_route_weights(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * route) {
+    GGML_ASSERT(route->op == GGML_OP_MOE_ROUTE);
+
+    // F32 view of the second plane
+    const int64_t ne[3] = { 1, route->ne[0], route->ne[1] };
+    const size_t offset = route->nb[2];
+
+    struct ggml_tensor * result = ggml_new_tensor_impl(ctx, GGML_TYPE_F32, 3, ne, route, offset);
+    ggml_format_name(result, "%s (weights)", route->name);
+
+    ggml_set_op_params(result, &offset, sizeof(offset));
+
+    result->op     = GGML_OP_VIEW;
+    result->src[0] = route;
+
+    return result;
+}
+
 // ggml_flash_attn_ext
 
 struct ggml_tensor * ggml_flash_attn_ext(
@@ -5643,8 +5758,10 @@ struct ggml_tensor * ggml_opt_step_adamw(
     GGML_ASSERT(ggml_are_same_shape(a, grad));
     GGML_ASSERT(ggml_are_same_shape(a, m));
     GGML_ASSERT(ggml_are_same_shape(a, v));
+    GGML_ASSERT(m->type == v->type);
+    GGML_ASSERT(m->type == GGML_TYPE_F32 || (m->type == GGML_TYPE_Q8_0 && a->ne[0] % ggml_blck_size(m->type) == 0));
     GGML_ASSERT(adamw_params->type == GGML_TYPE_F32);
-    GGML_ASSERT(ggml_nelements(adamw_params) == 7);
+    GGML_ASSERT(ggml_nelements(adamw_params) == 7 || ggml_nelements(adamw_params) == 8);
 
     struct ggml_tensor * result = ggml_view_tensor(ctx, a);
 
@@ -5668,7 +5785,7 @@ struct ggml_tensor * ggml_opt_step_sgd(
     GGML_ASSERT(a->flags & GGML_TENSOR_FLAG_PARAM);
     GGML_ASSERT(ggml_are_same_shape(a, grad));
     GGML_ASSERT(params->type == GGML_TYPE_F32);
-    GGML_ASSERT(ggml_nelements(params) == 2);
+    GGML_ASSERT(ggml_nelements(params) == 2 || ggml_nelements(params) == 3);
 
     struct ggml_tensor * result = ggml_view_tensor(ctx, a);
 
@@ -6435,7 +6552,7 @@ void ggml_build_backward_expand(
             if (!node->src[j] || ignore_src[j] || !grads_needed[ggml_hash_find(&cgraph->visited_hash_set, node->src[j])]) {
                 continue;
             }
-            GGML_ASSERT(node->src[j]->type == GGML_TYPE_F32 || node->src[j]->type == GGML_TYPE_F16);
+            GGML_ASSERT(node->src[j]->type == GGML_TYPE_F32 || node->src[j]->type == GGML_TYPE_F16 || node->src[j]->type == GGML_TYPE_BF16);
             node_needs_grad = true;
             break;
         }
@@ -440,6 +440,9 @@ class MODEL_TENSOR(IntEnum):
     FFN_DOWN_SHEXP       = auto()
     FFN_UP_SHEXP         = auto()
     FFN_EXP_PROBS_B      = auto()
+    FFN_PRED_UP          = auto()
+    FFN_PRED_DOWN        = auto()
+    FFN_DOWN_T           = auto()
     ATTN_Q_NORM          = auto()
     ATTN_K_NORM          = auto()
     LAYER_OUT_NORM       = auto()
@@ -777,6 +780,9 @@ TENSOR_NAMES: dict[MODEL_TENSOR, str] = {
     MODEL_TENSOR.FFN_DOWN_EXP:              "blk.{bid}.ffn_down_exps",
     MODEL_TENSOR.FFN_UP_EXP:                "blk.{bid}.ffn_up_exps",
     MODEL_TENSOR.FFN_EXP_PROBS_B:           "blk.{bid}.exp_probs_b",
+    MODEL_TENSOR.FFN_PRED_UP:               "blk.{bid}.ffn_pred_up",
+    MODEL_TENSOR.FFN_PRED_DOWN:             "blk.{bid}.ffn_pred_down",
+    MODEL_TENSOR.FFN_DOWN_T:                "blk.{bid}.ffn_down_t",
     MODEL_TENSOR.LAYER_OUT_NORM:            "blk.{bid}.layer_output_norm",
     MODEL_TENSOR.PER_LAYER_TOKEN_EMBD:      "per_layer_token_embd",           # gemma3n
     MODEL_TENSOR.PER_LAYER_MODEL_PROJ:      "per_layer_model_proj",           # gemma3n
@@ -1046,6 +1052,9 @@ MODEL_TENSORS: dict[MODEL_ARCH, list[MODEL_TENSOR]] = {
         MODEL_TENSOR.FFN_GATE_EXP,
         MODEL_TENSOR.FFN_DOWN_EXP,
         MODEL_TENSOR.FFN_UP_EXP,
+        MODEL_TENSOR.FFN_PRED_UP,
+        MODEL_TENSOR.FFN_PRED_DOWN,
+        MODEL_TENSOR.FFN_DOWN_T,
     ],
     MODEL_ARCH.LLAMA4: [
         MODEL_TENSOR.TOKEN_EMBD,
@@ -296,6 +296,9 @@ extern "C" {
         bool use_mlock;       // force system to keep model in RAM
         bool check_tensors;   // validate model tensor data
         bool use_extra_bufts; // use extra buffer types (used for weight repacking)
+        bool fuse_weights;    // [EXPERIMENTAL] fuse Q/K/V and gate/up weights into single matrices at load time (disables mmap for these weights)
+        bool stream_weights;  // [EXPERIMENTAL] read the memory-mapped weights of the next layers ahead of the computation (for models larger than the RAM)
+        bool sparse_ffn;      // [EXPERIMENTAL] load the activation predictors of the model, if any, for llama_context_params::sparse_ffn
     };
 
     // NOTE: changing the default values of parameters marked as [EXPERIMENTAL] may cause crashes or incorrect results in certain configurations
@@ -322,6 +325,10 @@ extern "C" {
         float    yarn_beta_slow;   // YaRN high correction dim
         uint32_t yarn_orig_ctx;    // YaRN original context size
         float    defrag_thold;     // [DEPRECATED] defragment the KV cache if holes/size > thold, <= 0 disabled (default)
+        float    sparse_ffn;       // fraction of the FFN neurons computed per token in layers with an activation predictor (see llama_model_params::sparse_ffn), 0 = dense [EXPERIMENTAL]
+        uint32_t kv_budget;        // max. number of KV cells per sequence, the least attended cells are evicted beyond it, 0 = disabled [EXPERIMENTAL]
+        uint32_t kv_n_sink;        // number of cells with the lowest positions of each sequence that are never evicted
+        uint32_t kv_n_recent;      // number of cells with the highest positions of each sequence that are never evicted
 
         ggml_backend_sched_eval_callback cb_eval;
         void * cb_eval_user_data;
@@ -335,6 +342,11 @@ extern "C" {
         ggml_abort_callback abort_callback;
         void *              abort_callback_data;
 
+        // path of a file used as backing storage for the KV cache [EXPERIMENTAL]
+        // the CPU KV buffers are memory-mapped from this file so that the context size is not bounded by the RAM
+        // the file is created (or truncated) when the context is created; NULL to keep the KV cache in RAM
+        const char * kv_cache_path;
+
         // Keep the booleans together and at the end of the struct to avoid misalignment during copy-by-value.
         bool embeddings;  // if true, extract embeddings (together with logits)
         bool offload_kqv; // offload the KQV ops (including the KV cache) to GPU
@@ -409,6 +421,10 @@ extern "C" {
 
     LLAMA_API void llama_detach_threadpool(struct llama_context * ctx);
 
+    // Set the priority of the graphs of this context on a threadpool that is shared with other contexts
+    // Graphs submitted concurrently to the same threadpool are computed one at a time, highest priority first
+    LLAMA_API void llama_set_threadpool_priority(struct llama_context * ctx, enum ggml_sched_priority priority);
+
     DEPRECATED(LLAMA_API struct llama_model * llama_load_model_from_file(
                              const char * path_model,
               struct llama_model_params   params),
@@ -686,6 +702,12 @@ extern "C" {
             llama_memory_t mem,
               llama_seq_id seq_id);
 
+    // Returns the number of memory cells occupied by the specified sequence
+    // With a KV budget (see llama_context_params::kv_budget), this is lower than the number of positions
+    LLAMA_API int32_t llama_memory_seq_n_cells(
+            llama_memory_t mem,
+              llama_seq_id seq_id);
+
     // Check if the memory supports shifting
     LLAMA_API bool llama_memory_can_shift(llama_memory_t mem);
 
@@ -891,6 +913,23 @@ extern "C" {
     // Set abort callback
     LLAMA_API void llama_set_abort_callback(struct llama_context * ctx, ggml_abort_callback abort_callback, void * abort_callback_data);
 
+    // Concatenate the blocks of all workers in place: data holds blocks of sizes[0], ..., sizes[n_workers - 1] bytes
+    // back to back, the block of this worker is filled by the caller (e.g. ggml_backend_rpc_ring_all_gather)
+    typedef void (*llama_all_gather_t)(void * data, const size_t * sizes, void * user_data);
+
+    // [EXPERIMENTAL] Context-parallel prefill over n_workers contexts of the same model, this context is worker rank
+    // All workers must call llama_decode() with the same batches. The rows of each ubatch without outputs are split
+    // in n_workers contiguous blocks and each worker computes one block, the K/V of all blocks are exchanged for each
+    // layer with all_gather so that every worker ends up with the full KV cache. Ubatches with outputs are computed
+    // in full by every worker without communication.
+    // Only supported with a single-stream KV cache without SWA, other configurations ignore it. n_workers <= 1 disables it
+    LLAMA_API void llama_set_context_parallel(
+            struct llama_context * ctx,
+                         int32_t   rank,
+                         int32_t   n_workers,
+              llama_all_gather_t   all_gather,
+                            void * all_gather_ud);
+
     // Wait until all computations are finished
     // This is automatically done when using one of the functions below to obtain the computation results
     // and is not necessary to call it explicitly in most cases
@@ -1374,6 +1413,14 @@ extern "C" {
         void * get_opt_pars_ud;                     // userdata for calculating optimizer parameters
 
         enum ggml_opt_optimizer_type optimizer_type;
+        enum ggml_type               momenta_type; // AdamW momenta: GGML_TYPE_F32 or GGML_TYPE_Q8_0 (8-bit)
+
+        // data-parallel training over dp_size workers, see ggml_opt_params
+        // each worker trains on every dp_size-th datapoint, the gradients are averaged with all_reduce
+        int32_t               dp_rank;
+        int32_t               dp_size;       // 0 or 1 disables data parallelism
+        ggml_opt_all_reduce_t all_reduce;
+        void *                all_reduce_ud;
     };
 
     LLAMA_API void llama_opt_init(struct llama_context * lctx, struct llama_model * model, struct llama_opt_params lopt_params);
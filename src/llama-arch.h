@@ -291,6 +291,9 @@ enum llm_tensor {
     LLM_TENSOR_FFN_GATE_SHEXP,
     LLM_TENSOR_FFN_UP_SHEXP,
     LLM_TENSOR_FFN_EXP_PROBS_B,
+    LLM_TENSOR_FFN_PRED_UP,   // activation predictor of the sparse FFN
+    LLM_TENSOR_FFN_PRED_DOWN,
+    LLM_TENSOR_FFN_DOWN_T,    // transposed ffn_down, one row per neuron
     LLM_TENSOR_ATTN_Q_NORM,
     LLM_TENSOR_ATTN_K_NORM,
     LLM_TENSOR_LAYER_OUT_NORM,
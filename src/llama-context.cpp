@@ -3,6 +3,7 @@
 #include "llama-impl.h"
 #include "llama-batch.h"
 #include "llama-io.h"
+#include "llama-kv-cache.h"
 #include "llama-memory.h"
 #include "llama-mmap.h"
 #include "llama-model.h"
@@ -56,6 +57,11 @@ llama_context::llama_context(
     cparams.cb_eval           = params.cb_eval;
     cparams.cb_eval_user_data = params.cb_eval_user_data;
 
+    cparams.cp_rank          = 0;
+    cparams.cp_size          = 1;
+    cparams.cp_all_gather    = nullptr;
+    cparams.cp_all_gather_ud = nullptr;
+
     auto rope_scaling_type = params.rope_scaling_type;
     if (rope_scaling_type == LLAMA_ROPE_SCALING_TYPE_UNSPECIFIED) {
         rope_scaling_type = hparams.rope_scaling_type_train;
@@ -102,6 +108,11 @@ llama_context::llama_context(
 
     cparams.op_offload = params.op_offload;
     cparams.kv_unified = params.kv_unified;
+    cparams.sparse_ffn = std::min(std::max(params.sparse_ffn, 0.0f), 1.0f);
+
+    cparams.kv_budget   = params.kv_budget;
+    cparams.kv_n_sink   = params.kv_n_sink;
+    cparams.kv_n_recent = params.kv_n_recent;
 
     {
         const char * LLAMA_GRAPH_REUSE_DISABLE = getenv("LLAMA_GRAPH_REUSE_DISABLE");
@@ -197,9 +208,15 @@ llama_context::llama_context(
             /*.type_k   =*/ params.type_k,
             /*.type_v   =*/ params.type_v,
             /*.swa_full =*/ params.swa_full,
+            /*.kv_path  =*/ params.kv_cache_path ? params.kv_cache_path : "",
         };
 
         memory.reset(model.create_memory(params_mem, cparams));
+
+        if (cparams.kv_budget > 0 && !dynamic_cast<llama_kv_cache *>(memory.get())) {
+            LLAMA_LOG_WARN("%s: kv_budget is only supported with a plain KV cache - disabling\n", __func__);
+            cparams.kv_budget = 0;
+        }
     }
 
     // init backends
@@ -648,6 +665,12 @@ void llama_context::detach_threadpool() {
     this->threadpool_batch = nullptr;
 }
 
+void llama_context::set_threadpool_priority(ggml_sched_priority priority) {
+    LLAMA_LOG_DEBUG("%s: call\n", __func__);
+
+    this->threadpool_priority = priority;
+}
+
 void llama_context::set_n_threads(int32_t n_threads, int32_t n_threads_batch) {
     LLAMA_LOG_DEBUG("%s: n_threads = %d, n_threads_batch = %d\n", __func__, n_threads, n_threads_batch);
 
@@ -676,6 +699,22 @@ void llama_context::set_embeddings(bool value) {
     cparams.embeddings = value;
 }
 
+void llama_context::set_context_parallel(int32_t rank, int32_t n_workers, llama_all_gather_t all_gather, void * all_gather_ud) {
+    LLAMA_LOG_DEBUG("%s: rank = %d, n_workers = %d\n", __func__, rank, n_workers);
+
+    if (n_workers > 1) {
+        GGML_ASSERT(rank >= 0 && rank < n_workers && all_gather != nullptr);
+    }
+
+    cparams.cp_rank          = n_workers > 1 ? rank : 0;
+    cparams.cp_size          = std::max(n_workers, 1);
+    cparams.cp_all_gather    = all_gather;
+    cparams.cp_all_gather_ud = all_gather_ud;
+
+    // the topology of the graphs changes
+    gf_res_prev->reset();
+}
+
 void llama_context::set_causal_attn(bool value) {
     LLAMA_LOG_DEBUG("%s: value = %d\n", __func__, value);
 
@@ -748,7 +787,11 @@ llm_graph_result * llama_context::process_ubatch(const llama_ubatch & ubatch, ll
         res->reset();
 
         ggml_backend_sched_reset(sched.get());
-        ggml_backend_sched_set_eval_callback(sched.get(), cparams.cb_eval, cparams.cb_eval_user_data);
+        if (model.has_weight_ranges()) {
+            ggml_backend_sched_set_eval_callback(sched.get(), graph_stream_cb, this);
+        } else {
+            ggml_backend_sched_set_eval_callback(sched.get(), cparams.cb_eval, cparams.cb_eval_user_data);
+        }
 
         //const auto t_start_us = ggml_time_us();
 
@@ -1062,6 +1105,13 @@ int llama_context::decode(const llama_batch & batch_inp) {
 
     int64_t n_outputs_prev = 0;
 
+    // number of processed ubatches, the attention statistics of ubatch i are in kv_score[i]
+    uint32_t n_ubatch = 0;
+
+    for (auto & score : kv_score) {
+        score.clear();
+    }
+
     do {
         const auto & ubatch = mctx->get_ubatch();
 
@@ -1197,9 +1247,40 @@ int llama_context::decode(const llama_batch & batch_inp) {
             }
         }
 
+        // extract the attention statistics of the KV cells, they are accumulated after the last ubatch
+        if (auto * t_kv_score = res->get_kv_score()) {
+            ggml_backend_t backend_score = ggml_backend_sched_get_tensor_backend(sched.get(), t_kv_score);
+            GGML_ASSERT(backend_score != nullptr);
+
+            // note: moving the outer vector keeps the buffers of the pending reads in place
+            if (kv_score.size() <= n_ubatch) {
+                kv_score.resize(n_ubatch + 1);
+            }
+
+            auto & score = kv_score[n_ubatch];
+
+            score.resize(ggml_nelements(t_kv_score));
+            ggml_backend_tensor_get_async(backend_score, t_kv_score, score.data(), 0, ggml_nbytes(t_kv_score));
+        }
+
         n_outputs_prev += n_outputs;
+        n_ubatch++;
     } while (mctx->next());
 
+    // evict the least attended cells of the sequences that exceed the KV budget
+    if (cparams.kv_budget > 0) {
+        ggml_backend_sched_synchronize(sched.get());
+
+        const auto * kv_ctx = static_cast<const llama_kv_cache_context *>(mctx.get());
+        for (uint32_t i = 0; i < std::min<uint32_t>(n_ubatch, kv_score.size()); ++i) {
+            if (!kv_score[i].empty()) {
+                kv_ctx->score_add(i, kv_score[i]);
+            }
+        }
+
+        static_cast<llama_kv_cache *>(memory.get())->evict(cparams.kv_budget, cparams.kv_n_sink, cparams.kv_n_recent);
+    }
+
     // set to total number of outputs in the batch, for use in llama_get_logits_ith
     n_outputs = n_outputs_all;
 
@@ -1444,6 +1525,11 @@ ggml_status llama_context::graph_compute(
         auto * reg = ggml_backend_dev_backend_reg(ggml_backend_get_device(backend_cpu));
         auto * set_threadpool_fn = (decltype(ggml_backend_cpu_set_threadpool) *) ggml_backend_reg_get_proc_address(reg, "ggml_backend_cpu_set_threadpool");
         set_threadpool_fn(backend_cpu, tp);
+
+        auto * set_priority_fn = (decltype(ggml_backend_cpu_set_priority) *) ggml_backend_reg_get_proc_address(reg, "ggml_backend_cpu_set_priority");
+        if (set_priority_fn) {
+            set_priority_fn(backend_cpu, threadpool_priority);
+        }
     }
 
     // set the number of threads for all the backends
@@ -1451,6 +1537,14 @@ ggml_status llama_context::graph_compute(
         set_n_threads_fn.second(set_n_threads_fn.first, n_threads);
     }
 
+    if (model.has_weight_ranges()) {
+        // the following layers are requested by graph_stream_cb as the computation progresses
+        stream_il = -1;
+        for (int32_t il = 0; il < n_stream_ahead; ++il) {
+            model.prefetch_weights(il);
+        }
+    }
+
     auto status = ggml_backend_sched_graph_compute_async(sched.get(), gf);
     if (status != GGML_STATUS_SUCCESS) {
         LLAMA_LOG_ERROR("%s: ggml_backend_sched_graph_compute_async failed with error %d\n", __func__, status);
@@ -1461,6 +1555,58 @@ ggml_status llama_context::graph_compute(
     return status;
 }
 
+// returns the layer index of a graph node named by graph_get_cb() ("name-il"), or -1
+static int32_t llama_node_layer(const char * name) {
+    const char * p = strrchr(name, '-');
+    if (p == nullptr || p[1] == '\0') {
+        return -1;
+    }
+
+    int32_t il = 0;
+    for (++p; *p != '\0'; ++p) {
+        if (*p < '0' || *p > '9') {
+            return -1;
+        }
+        il = 10*il + (*p - '0');
+    }
+
+    return il;
+}
+
+bool llama_context::graph_stream_cb(ggml_tensor * t, bool ask, void * user_data) {
+    auto * ctx = (llama_context *) user_data;
+
+    const auto & cparams = ctx->cparams;
+
+    // stop the scheduler at the first node of each layer
+    const bool is_layer_start = llama_node_layer(t->name) > ctx->stream_il;
+
+    if (ask) {
+        return is_layer_start || (cparams.cb_eval && cparams.cb_eval(t, true, cparams.cb_eval_user_data));
+    }
+
+    if (is_layer_start) {
+        const int32_t il = llama_node_layer(t->name);
+
+        // the layers before il are done for this graph - read the weights of layer il + n_stream_ahead while il computes
+        // (note: the output tensors are handled as layer n_layer)
+        for (int32_t i = ctx->stream_il + n_stream_ahead + 1; i <= il + n_stream_ahead; ++i) {
+            ctx->model.prefetch_weights(i);
+        }
+        for (int32_t i = std::max(ctx->stream_il, 0); i < il; ++i) {
+            ctx->model.release_weights(i);
+        }
+
+        ctx->stream_il = il;
+    }
+
+    if (cparams.cb_eval && cparams.cb_eval(t, true, cparams.cb_eval_user_data)) {
+        return cparams.cb_eval(t, false, cparams.cb_eval_user_data);
+    }
+
+    return true;
+}
+
 llm_graph_cb llama_context::graph_get_cb() const {
     return [&](const llama_ubatch & ubatch, ggml_tensor * cur, const char * name, int il) {
         if (il >= 0) {
@@ -2026,7 +2172,8 @@ void llama_context::perf_reset() {
 //
 
 static void llama_set_param(struct ggml_tensor * tensor, llama_opt_param_filter param_filter, void * userdata) {
-    if (!tensor || tensor->type != GGML_TYPE_F32) {
+    // F16/BF16 weights are trained in place: the gradients and the optimizer step are computed in F32
+    if (!tensor || (tensor->type != GGML_TYPE_F32 && tensor->type != GGML_TYPE_F16 && tensor->type != GGML_TYPE_BF16)) {
         return;
     }
     if (!param_filter(tensor, userdata)) {
@@ -2054,6 +2201,13 @@ void llama_context::opt_init(struct llama_model * model, struct llama_opt_params
     opt_params.get_opt_pars    = lopt_params.get_opt_pars;
     opt_params.get_opt_pars_ud = lopt_params.get_opt_pars_ud;
     opt_params.optimizer       = lopt_params.optimizer_type;
+    opt_params.momenta_type    = lopt_params.momenta_type;
+    if (lopt_params.dp_size > 1) {
+        opt_params.dp_rank       = lopt_params.dp_rank;
+        opt_params.dp_size       = lopt_params.dp_size;
+        opt_params.all_reduce    = lopt_params.all_reduce;
+        opt_params.all_reduce_ud = lopt_params.all_reduce_ud;
+    }
     opt_ctx = ggml_opt_init(opt_params);
 
     llama_opt_param_filter param_filter = lopt_params.param_filter;
@@ -2211,13 +2365,19 @@ void llama_context::opt_epoch(
     std::vector<llama_token>        tokens(n_ctx);
     std::vector<llama_token> labels_sparse(n_ctx);
 
-    int64_t idata = 0;
+    // data parallelism: each worker takes every dp_size-th datapoint,
+    // the remainder is dropped so that all workers do the same number of optimizer steps
+    const int64_t dp_rank     = ggml_opt_dp_rank(opt_ctx);
+    const int64_t dp_size     = ggml_opt_dp_size(opt_ctx);
+    const int64_t ndata_train = idata_split / dp_size;
+    const int64_t ndata_eval  = (ndata - idata_split) / dp_size;
 
     int64_t t_loop_start = ggml_time_us();
-    int64_t ndata_in_loop = idata_split*ubatch_per_ctx;
-    for (; idata < idata_split; ++idata) {
+    int64_t ndata_in_loop = ndata_train*ubatch_per_ctx;
+    for (int64_t i = 0; i < ndata_train; ++i) {
         constexpr bool train = true;
-        const int64_t idata_in_loop = idata*ubatch_per_ctx;
+        const int64_t idata_in_loop = i*ubatch_per_ctx;
+        const int64_t idata = i*dp_size + dp_rank;
 
         ggml_opt_dataset_get_batch_host(dataset, tokens.data(), n_ctx*sizeof(llama_token), labels_sparse.data(), idata);
         opt_epoch_iter(dataset, result_train, tokens, labels_sparse, batch,
@@ -2225,10 +2385,11 @@ void llama_context::opt_epoch(
     }
 
     t_loop_start = ggml_time_us();
-    ndata_in_loop = (ndata - idata_split)*ubatch_per_ctx;
-    for (; idata < ndata; ++idata) {
+    ndata_in_loop = ndata_eval*ubatch_per_ctx;
+    for (int64_t i = 0; i < ndata_eval; ++i) {
         constexpr bool train = false;
-        const int64_t idata_in_loop = (idata - idata_split)*ubatch_per_ctx;
+        const int64_t idata_in_loop = i*ubatch_per_ctx;
+        const int64_t idata = idata_split + i*dp_size + dp_rank;
 
         ggml_opt_dataset_get_batch_host(dataset, tokens.data(), n_ctx*sizeof(llama_token), labels_sparse.data(), idata);
         opt_epoch_iter(dataset, result_eval, tokens, labels_sparse, batch,
@@ -2262,12 +2423,17 @@ llama_context_params llama_context_default_params() {
         /*.yarn_beta_slow              =*/ 1.0f,
         /*.yarn_orig_ctx               =*/ 0,
         /*.defrag_thold                =*/ -1.0f,
+        /*.sparse_ffn                  =*/ 0.0f,
+        /*.kv_budget                   =*/ 0,
+        /*.kv_n_sink                   =*/ 4,
+        /*.kv_n_recent                 =*/ 256,
         /*.cb_eval                     =*/ nullptr,
         /*.cb_eval_user_data           =*/ nullptr,
         /*.type_k                      =*/ GGML_TYPE_F16,
         /*.type_v                      =*/ GGML_TYPE_F16,
         /*.abort_callback              =*/ nullptr,
         /*.abort_callback_data         =*/ nullptr,
+        /*.kv_cache_path               =*/ nullptr,
         /*.embeddings                  =*/ false,
         /*.offload_kqv                 =*/ true,
         /*.no_perf                     =*/ true,
@@ -2302,6 +2468,12 @@ llama_context * llama_init_from_model(
         params.flash_attn_type = LLAMA_FLASH_ATTN_TYPE_DISABLED;
     }
 
+    if (params.flash_attn_type != LLAMA_FLASH_ATTN_TYPE_DISABLED && params.kv_budget > 0) {
+        // the attention statistics used for the eviction are taken from the explicit KQ softmax
+        LLAMA_LOG_WARN("%s: flash_attn is not compatible with kv_budget - forcing off\n", __func__);
+        params.flash_attn_type = LLAMA_FLASH_ATTN_TYPE_DISABLED;
+    }
+
     if (params.flash_attn_type == LLAMA_FLASH_ATTN_TYPE_AUTO && ggml_is_quantized(params.type_k)) {
         const uint32_t blck_size = ggml_blck_size(params.type_k);
         if (model->hparams.n_embd_head_k % blck_size != 0) {
@@ -2381,6 +2553,10 @@ void llama_detach_threadpool(llama_context * ctx) {
     ctx->detach_threadpool();
 }
 
+void llama_set_threadpool_priority(llama_context * ctx, ggml_sched_priority priority) {
+    ctx->set_threadpool_priority(priority);
+}
+
 void llama_set_n_threads(llama_context * ctx, int32_t n_threads, int32_t n_threads_batch) {
     ctx->set_n_threads(n_threads, n_threads_batch);
 }
@@ -2397,6 +2573,15 @@ void llama_set_abort_callback(llama_context * ctx, bool (*abort_callback)(void *
     ctx->set_abort_callback(abort_callback, abort_callback_data);
 }
 
+void llama_set_context_parallel(
+        llama_context * ctx,
+              int32_t   rank,
+              int32_t   n_workers,
+   llama_all_gather_t   all_gather,
+                 void * all_gather_ud) {
+    ctx->set_context_parallel(rank, n_workers, all_gather, all_gather_ud);
+}
+
 void llama_set_embeddings(llama_context * ctx, bool embeddings) {
     ctx->set_embeddings(embeddings);
 }
@@ -2575,6 +2760,16 @@ llama_pos llama_memory_seq_pos_max(
     return mem->seq_pos_max(seq_id);
 }
 
+int32_t llama_memory_seq_n_cells(
+        llama_memory_t mem,
+          llama_seq_id seq_id) {
+    if (!mem) {
+        return 0;
+    }
+
+    return mem->seq_n_cells(seq_id);
+}
+
 bool llama_memory_can_shift(llama_memory_t mem) {
     if (!mem) {
         return false;
@@ -64,10 +64,14 @@ struct llama_context {
 
     void detach_threadpool();
 
+    void set_threadpool_priority(ggml_sched_priority priority);
+
     void set_n_threads(int32_t n_threads, int32_t n_threads_batch);
 
     void set_abort_callback(bool (*abort_callback)(void * data), void * abort_callback_data);
 
+    void set_context_parallel(int32_t rank, int32_t n_workers, llama_all_gather_t all_gather, void * all_gather_ud);
+
     void set_embeddings (bool value);
     void set_causal_attn(bool value);
     void set_warmup(bool value);
@@ -207,6 +211,9 @@ private:
 
     llm_graph_cb graph_get_cb() const;
 
+    // weight streaming: eval callback that observes the first node of each layer, chained with cparams.cb_eval
+    static bool graph_stream_cb(ggml_tensor * t, bool ask, void * user_data);
+
     // TODO: read/write lora adapters and cvec
     size_t state_write_data(llama_io_write_i & io);
     size_t state_read_data (llama_io_read_i  & io);
@@ -241,6 +248,10 @@ private:
     // populated only when pooling_type != LLAMA_POOLING_TYPE_NONE
     std::map<llama_seq_id, std::vector<float>> embd_seq;
 
+    // attention mass of the KV cells in each ubatch of the last batch, used for the KV eviction (see cparams.kv_budget)
+    // read asynchronously with the other outputs: the buffers must not move until the end of decode()
+    std::vector<std::vector<float>> kv_score;
+
     // reuse the batch_allocr to avoid unnecessary memory allocations
     std::unique_ptr<llama_batch_allocr> balloc;
 
@@ -266,6 +277,8 @@ private:
     ggml_threadpool_t threadpool       = nullptr;
     ggml_threadpool_t threadpool_batch = nullptr;
 
+    ggml_sched_priority threadpool_priority = GGML_SCHED_PRIO_NORMAL;
+
     ggml_abort_callback abort_callback      = nullptr;
     void *              abort_callback_data = nullptr;
 
@@ -286,6 +299,11 @@ private:
     // env: LLAMA_GRAPH_REUSE_DISABLE
     bool graph_reuse_disable = false;
 
+    // weight streaming: number of layers to read ahead and the layer of the node that is being computed
+    static constexpr int32_t n_stream_ahead = 2;
+
+    int32_t stream_il = -1;
+
     // perf
     mutable int64_t t_start_us  = 0;
     mutable int64_t t_load_us   = 0;
@@ -25,6 +25,13 @@ struct llama_cparams {
     float yarn_beta_fast;
     float yarn_beta_slow;
 
+    float sparse_ffn; // fraction of the FFN neurons computed per token with an activation predictor, 0 = dense
+
+    // KV eviction, see llama_kv_cache::evict()
+    uint32_t kv_budget;   // 0 = disabled
+    uint32_t kv_n_sink;
+    uint32_t kv_n_recent;
+
     bool embeddings;
     bool causal_attn;
     bool offload_kqv;
@@ -38,4 +45,10 @@ struct llama_cparams {
 
     ggml_backend_sched_eval_callback cb_eval;
     void * cb_eval_user_data;
+
+    // context-parallel prefill, see llama_set_context_parallel()
+    int32_t cp_rank;
+    int32_t cp_size;
+    llama_all_gather_t cp_all_gather;
+    void * cp_all_gather_ud;
 };
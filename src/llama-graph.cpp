@@ -71,6 +71,8 @@ void llm_graph_input_attn_temp::set_input(const llama_ubatch * ubatch) {
     if (ubatch->pos && attn_scale) {
         const int64_t n_tokens = ubatch->n_tokens;
 
+        GGML_ASSERT(ggml_nelements(attn_scale) == n_tokens);
+
         std::vector<float> attn_scale_data(n_tokens, 0.0f);
         for (int i = 0; i < n_tokens; ++i) {
             const float pos = ubatch->pos[i];
@@ -204,7 +206,10 @@ void llm_graph_input_cls::set_input(const llama_ubatch * ubatch) {
         std::vector<int> target_pos(n_seqs_unq, -1);
         std::vector<int> target_row(n_seqs_unq, -1);
 
-        bool last = cparams.pooling_type == LLAMA_POOLING_TYPE_LAST;
+        // decoder-based rerankers score the sequence from its last token
+        const bool last =
+            cparams.pooling_type == LLAMA_POOLING_TYPE_LAST ||
+            (cparams.pooling_type == LLAMA_POOLING_TYPE_RANK && cparams.causal_attn);
 
         for (int i = 0; i < n_tokens; ++i) {
             const llama_pos pos = ubatch->pos[i];
@@ -412,6 +417,7 @@ void llm_graph_result::reset() {
     t_logits      = nullptr;
     t_embd        = nullptr;
     t_embd_pooled = nullptr;
+    t_kv_score    = nullptr;
 
     params = {};
 
@@ -481,6 +487,66 @@ void llm_graph_result::set_params(const llm_graph_params & params) {
 // llm_graph_context
 //
 
+// context-parallel prefill: the ubatch is split in blocks of this many rows, the last block can be smaller
+// the blocks are padded to GGML_KQ_MASK_PAD so that each worker can use a slice of the KQ mask
+static int64_t llm_graph_cp_block_size(int64_t n_tokens, int32_t n_workers) {
+    return GGML_PAD((n_tokens + n_workers - 1)/n_workers, GGML_KQ_MASK_PAD);
+}
+
+// first row of the ubatch computed by this worker, or -1 if the whole ubatch is computed
+// all workers have the same ubatches and therefore make the same decision
+static int64_t llm_graph_cp_row0(const llm_graph_params & params) {
+    const auto & cparams = params.cparams;
+    const auto & ubatch  = params.ubatch;
+
+    if (cparams.cp_size <= 1 || params.n_outputs > 0) {
+        return -1;
+    }
+
+    // encoder-decoder models have other per-token inputs
+    if (params.gtype == LLM_GRAPH_TYPE_ENCODER || (params.cross && !params.cross->v_embd.empty())) {
+        return -1;
+    }
+
+    // the rows of a block must be contiguous in the inputs and in the KQ mask
+    if (!dynamic_cast<const llama_kv_cache_context *>(params.mctx) || params.hparams.n_pos_per_embd() != 1 ||
+        !(cparams.kv_unified || ubatch.n_seqs_unq == 1)) {
+        return -1;
+    }
+
+    // every worker must have at least one row
+    const int64_t n_block = llm_graph_cp_block_size(ubatch.n_tokens, cparams.cp_size);
+    if ((int64_t) ubatch.n_tokens <= (cparams.cp_size - 1)*n_block) {
+        return -1;
+    }
+
+    return cparams.cp_rank*n_block;
+}
+
+static int64_t llm_graph_cp_n_rows(int64_t row0, int64_t n_tokens, int32_t n_workers) {
+    if (row0 < 0) {
+        return n_tokens;
+    }
+
+    return std::min(llm_graph_cp_block_size(n_tokens, n_workers), n_tokens - row0);
+}
+
+// the buffer belongs to the CPU backend, so the ops that read the tensor run on the CPU
+// note: ggml_backend_buffer_is_host alone is not enough, it is also true for the host buffers of the GPU backends
+static bool llm_graph_buffer_is_cpu(ggml_backend_buffer_t buf) {
+    if (buf == nullptr) {
+        return false;
+    }
+
+    ggml_backend_dev_t dev = ggml_backend_buft_get_device(ggml_backend_buffer_get_type(buf));
+    if (dev == nullptr) {
+        // the plain CPU buffer types (including the mmap buffers) have no device
+        return ggml_backend_buffer_is_host(buf);
+    }
+
+    return ggml_backend_dev_type(dev) == GGML_BACKEND_DEVICE_TYPE_CPU;
+}
+
 llm_graph_context::llm_graph_context(const llm_graph_params & params) :
     arch             (params.arch),
     hparams          (params.hparams),
@@ -506,7 +572,8 @@ llm_graph_context::llm_graph_context(const llm_graph_params & params) :
     beta_slow        (cparams.yarn_beta_slow),
     norm_eps         (hparams.f_norm_eps),
     norm_rms_eps     (hparams.f_norm_rms_eps),
-    n_tokens         (ubatch.n_tokens),
+    cp_i0            (llm_graph_cp_row0(params)),
+    n_tokens         (llm_graph_cp_n_rows(cp_i0, ubatch.n_tokens, cparams.cp_size)),
     n_outputs        (params.n_outputs),
     n_ctx_orig       (cparams.n_ctx_orig_yarn),
     pooling_type     (cparams.pooling_type),
@@ -562,6 +629,24 @@ ggml_tensor * llm_graph_context::build_lora_mm(
     return res;
 }
 
+bool llm_graph_context::can_use_fused(
+          ggml_tensor * w_fused,
+          std::initializer_list<ggml_tensor *> parts) const {
+    if (w_fused == nullptr) {
+        return false;
+    }
+
+    for (const auto & lora : *loras) {
+        for (ggml_tensor * w : parts) {
+            if (lora.first->get_weight(w) != nullptr) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
 ggml_tensor * llm_graph_context::build_lora_mm_id(
           ggml_tensor * w,   // ggml_tensor * as
           ggml_tensor * cur, // ggml_tensor * b
@@ -639,7 +724,17 @@ ggml_tensor * llm_graph_context::build_ffn(
          ggml_tensor * act_scales,
      llm_ffn_op_type   type_op,
    llm_ffn_gate_type   type_gate,
-                 int   il) const {
+                 int   il,
+         ggml_tensor * pred_up,
+         ggml_tensor * pred_down,
+         ggml_tensor * down_t) const {
+    if (pred_up && cparams.sparse_ffn > 0.0f && !up_b && !up_s && !gate_b && !gate_s && !down_s && !act_scales) {
+        ggml_tensor * res = build_ffn_sparse(cur, up, gate, down, down_t, down_b, pred_up, pred_down, type_op, type_gate, il);
+        if (res) {
+            return res;
+        }
+    }
+
     ggml_tensor * tmp = up ? build_lora_mm(up, cur) : cur;
     cb(tmp, "ffn_up", il);
 
@@ -769,6 +864,108 @@ ggml_tensor * llm_graph_context::build_ffn(
     return cur;
 }
 
+ggml_tensor * llm_graph_context::build_ffn_sparse(
+         ggml_tensor * cur,
+         ggml_tensor * up,
+         ggml_tensor * gate,
+         ggml_tensor * down,
+         ggml_tensor * down_t,
+         ggml_tensor * down_b,
+         ggml_tensor * pred_up,
+         ggml_tensor * pred_down,
+     llm_ffn_op_type   type_op,
+   llm_ffn_gate_type   type_gate,
+                 int   il) const {
+    if (!up || !down_t || !pred_down || (gate && type_gate != LLM_FFN_PAR)) {
+        return nullptr;
+    }
+
+    switch (type_op) {
+        case LLM_FFN_SILU:
+        case LLM_FFN_GELU:
+        case LLM_FFN_RELU:
+        case LLM_FFN_RELU_SQR:
+            break;
+        default:
+            return nullptr;
+    }
+
+    // the selected rows are read directly from the weights: no repacked or device buffers (including the
+    // host buffers of the GPU backends), no LoRA adapters (an adapter of ffn_down would not apply to ffn_down_t)
+    for (ggml_tensor * w : { up, gate, down_t }) {
+        if (w && (!llm_graph_buffer_is_cpu(w->buffer) || !ggml_backend_buffer_is_host(w->buffer))) {
+            return nullptr;
+        }
+    }
+
+    for (const auto & lora : *loras) {
+        for (ggml_tensor * w : { up, gate, down }) {
+            if (w && lora.first->get_weight(w) != nullptr) {
+                return nullptr;
+            }
+        }
+    }
+
+    const int64_t n_ff  = up->ne[1];
+    const int64_t n_sel = std::max<int64_t>(1, std::lround(cparams.sparse_ffn*n_ff));
+
+    // with larger batches the union of the selected neurons approaches the full FFN and the dense matmuls are faster
+    if (n_sel*cur->ne[1] > n_ff) {
+        return nullptr;
+    }
+
+    // predicted activations of the neurons
+    ggml_tensor * pred = build_lora_mm(pred_up, cur);
+    pred = ggml_relu(ctx0, pred);
+    pred = build_lora_mm(pred_down, pred);
+    cb(pred, "ffn_pred", il);
+
+    // only the ids are used - the softmax over the selected neurons is cheaper than gating all of them
+    ggml_tensor * ids = ggml_moe_route_ids(ctx0, ggml_moe_route(ctx0, pred, nullptr, n_sel, GGML_MOE_GATING_SOFTMAX_WEIGHT, false, 1.0f));
+    cb(ids, "ffn_sel", il);
+
+    ggml_tensor * tmp = ggml_mul_mat_sel(ctx0, up, cur, ids);
+    cb(tmp, "ffn_up_sel", il);
+
+    if (gate) {
+        cur = ggml_mul_mat_sel(ctx0, gate, cur, ids);
+        cb(cur, "ffn_gate_sel", il);
+    } else {
+        cur = tmp;
+    }
+
+    switch (type_op) {
+        case LLM_FFN_SILU:
+            cur = gate ? ggml_swiglu_split(ctx0, cur, tmp) : ggml_silu(ctx0, cur);
+            break;
+        case LLM_FFN_GELU:
+            cur = gate ? ggml_geglu_split(ctx0, cur, tmp) : ggml_gelu(ctx0, cur);
+            break;
+        case LLM_FFN_RELU:
+            cur = gate ? ggml_reglu_split(ctx0, cur, tmp) : ggml_relu(ctx0, cur);
+            break;
+        case LLM_FFN_RELU_SQR:
+            cur = ggml_sqr(ctx0, ggml_relu(ctx0, cur));
+            if (gate) {
+                cur = ggml_mul(ctx0, cur, tmp);
+            }
+            break;
+        default:
+            GGML_ABORT("fatal error");
+    }
+    cb(cur, "ffn_act_sel", il);
+
+    // the neurons that turned out inactive (zero after ReLU) are skipped
+    cur = ggml_out_prod_sel(ctx0, down_t, cur, ids);
+    cb(cur, "ffn_down", il);
+
+    if (down_b) {
+        cur = ggml_add(ctx0, cur, down_b);
+    }
+
+    return cur;
+}
+
 ggml_tensor * llm_graph_context::build_moe_ffn(
          ggml_tensor * cur,
          ggml_tensor * gate_inp,
@@ -842,69 +1039,97 @@ ggml_tensor * llm_graph_context::build_moe_ffn(
         cb(logits, "ffn_moe_logits_biased", il);
     }
 
-    ggml_tensor * probs = nullptr;
-    switch (gating_op) {
-        case LLAMA_EXPERT_GATING_FUNC_TYPE_SOFTMAX:
-            {
-                probs = ggml_soft_max(ctx0, logits); // [n_expert, n_tokens]
-            } break;
-        case LLAMA_EXPERT_GATING_FUNC_TYPE_SIGMOID:
-            {
-                probs = ggml_sigmoid(ctx0, logits); // [n_expert, n_tokens]
-            } break;
-        case LLAMA_EXPERT_GATING_FUNC_TYPE_SOFTMAX_WEIGHT:
-            {
-                probs = logits; // [n_expert, n_tokens]
-            } break;
-        default:
-            GGML_ABORT("fatal error");
-    }
-    cb(probs, "ffn_moe_probs", il);
+    // use the fused routing op when the router runs on the CPU - gating, selection and normalization in a single node
+    // note: llama4 selects the experts by the logits and applies the sigmoid only to the weights, which is equivalent
+    const bool use_moe_route = gate_inp && llm_graph_buffer_is_cpu(gate_inp->buffer) &&
+        (arch != LLM_ARCH_LLAMA4 || exp_probs_b == nullptr);
 
-    // add experts selection bias - introduced in DeepSeek V3
-    // leave probs unbiased as it's later used to get expert weights
-    ggml_tensor * selection_probs = probs;
-    if (exp_probs_b != nullptr) {
-        selection_probs = ggml_add(ctx0, probs, exp_probs_b);
-        cb(selection_probs, "ffn_moe_probs_biased", il);
-    }
+    ggml_tensor * selected_experts = nullptr; // [n_expert_used, n_tokens]
+    ggml_tensor * weights          = nullptr; // [1, n_expert_used, n_tokens]
 
-    // llama4 doesn't have exp_probs_b, and sigmoid is only used after top_k
-    // see: https://github.com/meta-llama/llama-models/blob/699a02993512fb36936b1b0741e13c06790bcf98/models/llama4/moe.py#L183-L198
-    if (arch == LLM_ARCH_LLAMA4) {
-        selection_probs = logits;
-    }
+    if (use_moe_route) {
+        ggml_moe_gating gating;
+        switch (gating_op) {
+            case LLAMA_EXPERT_GATING_FUNC_TYPE_SOFTMAX:        gating = GGML_MOE_GATING_SOFTMAX;        break;
+            case LLAMA_EXPERT_GATING_FUNC_TYPE_SIGMOID:        gating = GGML_MOE_GATING_SIGMOID;        break;
+            case LLAMA_EXPERT_GATING_FUNC_TYPE_SOFTMAX_WEIGHT: gating = GGML_MOE_GATING_SOFTMAX_WEIGHT; break;
+            default:
+                GGML_ABORT("fatal error");
+        }
 
-    // select experts
-    ggml_tensor * selected_experts = ggml_top_k(ctx0, selection_probs, n_expert_used); // [n_expert_used, n_tokens]
-    cb(selected_experts->src[0], "ffn_moe_argsort", il);
-    cb(selected_experts, "ffn_moe_topk", il);
+        ggml_tensor * route = ggml_moe_route(ctx0, logits, exp_probs_b, n_expert_used, gating, norm_w, scale_w ? w_scale : 1.0f);
+        cb(route, "ffn_moe_route", il);
 
-    ggml_tensor * weights = ggml_get_rows(ctx0,
-            ggml_reshape_3d(ctx0, probs, 1, n_expert, n_tokens), selected_experts); // [1, n_expert_used, n_tokens]
-    cb(weights, "ffn_moe_weights", il);
+        selected_experts = ggml_moe_route_ids(ctx0, route);
+        cb(selected_experts, "ffn_moe_topk", il);
 
-    if (gating_op == LLAMA_EXPERT_GATING_FUNC_TYPE_SOFTMAX_WEIGHT) {
-        weights = ggml_reshape_2d(ctx0, weights, n_expert_used, n_tokens);
-        weights = ggml_soft_max(ctx0, weights); // [n_expert_used, n_tokens]
-        weights = ggml_reshape_3d(ctx0, weights, 1, n_expert_used, n_tokens);
-        cb(weights, "ffn_moe_weights_softmax", il);
-    }
+        weights = ggml_moe_route_weights(ctx0, route);
+        cb(weights, "ffn_moe_weights", il);
+    } else {
+        ggml_tensor * probs = nullptr;
+        switch (gating_op) {
+            case LLAMA_EXPERT_GATING_FUNC_TYPE_SOFTMAX:
+                {
+                    probs = ggml_soft_max(ctx0, logits); // [n_expert, n_tokens]
+                } break;
+            case LLAMA_EXPERT_GATING_FUNC_TYPE_SIGMOID:
+                {
+                    probs = ggml_sigmoid(ctx0, logits); // [n_expert, n_tokens]
+                } break;
+            case LLAMA_EXPERT_GATING_FUNC_TYPE_SOFTMAX_WEIGHT:
+                {
+                    probs = logits; // [n_expert, n_tokens]
+                } break;
+            default:
+                GGML_ABORT("fatal error");
+        }
+        cb(probs, "ffn_moe_probs", il);
+
+        // add experts selection bias - introduced in DeepSeek V3
+        // leave probs unbiased as it's later used to get expert weights
+        ggml_tensor * selection_probs = probs;
+        if (exp_probs_b != nullptr) {
+            selection_probs = ggml_add(ctx0, probs, exp_probs_b);
+            cb(selection_probs, "ffn_moe_probs_biased", il);
+        }
 
-    if (norm_w) {
-        weights = ggml_reshape_2d(ctx0, weights, n_expert_used, n_tokens);
+        // llama4 doesn't have exp_probs_b, and sigmoid is only used after top_k
+        // see: https://github.com/meta-llama/llama-models/blob/699a02993512fb36936b1b0741e13c06790bcf98/models/llama4/moe.py#L183-L198
+        if (arch == LLM_ARCH_LLAMA4) {
+            selection_probs = logits;
+        }
 
-        ggml_tensor * weights_sum = ggml_sum_rows(ctx0, weights); // [1, n_tokens]
-        cb(weights_sum, "ffn_moe_weights_sum", il);
+        // select experts
+        selected_experts = ggml_top_k(ctx0, selection_probs, n_expert_used); // [n_expert_used, n_tokens]
+        cb(selected_experts->src[0], "ffn_moe_argsort", il);
+        cb(selected_experts, "ffn_moe_topk", il);
 
-        weights = ggml_div(ctx0, weights, weights_sum); // [n_expert_used, n_tokens]
-        cb(weights, "ffn_moe_weights_norm", il);
+        weights = ggml_get_rows(ctx0,
+                ggml_reshape_3d(ctx0, probs, 1, n_expert, n_tokens), selected_experts); // [1, n_expert_used, n_tokens]
+        cb(weights, "ffn_moe_weights", il);
 
-        weights = ggml_reshape_3d(ctx0, weights, 1, n_expert_used, n_tokens);
-    }
-    if (scale_w) {
-        weights = ggml_scale(ctx0, weights, w_scale);
-        cb(weights, "ffn_moe_weights_scaled", il);
+        if (gating_op == LLAMA_EXPERT_GATING_FUNC_TYPE_SOFTMAX_WEIGHT) {
+            weights = ggml_reshape_2d(ctx0, weights, n_expert_used, n_tokens);
+            weights = ggml_soft_max(ctx0, weights); // [n_expert_used, n_tokens]
+            weights = ggml_reshape_3d(ctx0, weights, 1, n_expert_used, n_tokens);
+            cb(weights, "ffn_moe_weights_softmax", il);
+        }
+
+        if (norm_w) {
+            weights = ggml_reshape_2d(ctx0, weights, n_expert_used, n_tokens);
+
+            ggml_tensor * weights_sum = ggml_sum_rows(ctx0, weights); // [1, n_tokens]
+            cb(weights_sum, "ffn_moe_weights_sum", il);
+
+            weights = ggml_div(ctx0, weights, weights_sum); // [n_expert_used, n_tokens]
+            cb(weights, "ffn_moe_weights_norm", il);
+
+            weights = ggml_reshape_3d(ctx0, weights, 1, n_expert_used, n_tokens);
+        }
+        if (scale_w) {
+            weights = ggml_scale(ctx0, weights, w_scale);
+            cb(weights, "ffn_moe_weights_scaled", il);
+        }
     }
 
     cur = ggml_reshape_3d(ctx0, cur, n_embd, 1, n_tokens);
@@ -1032,7 +1257,12 @@ ggml_tensor * llm_graph_context::build_inp_embd(ggml_tensor * tok_embd) const {
         ggml_set_input(inp->tokens);
         res->t_tokens = inp->tokens;
 
-        cur = ggml_get_rows(ctx0, tok_embd, inp->tokens);
+        ggml_tensor * tokens = inp->tokens;
+        if (cp_i0 >= 0) {
+            tokens = ggml_view_1d(ctx0, tokens, n_tokens, cp_i0*ggml_element_size(tokens));
+        }
+
+        cur = ggml_get_rows(ctx0, tok_embd, tokens);
 
         // apply lora for embedding tokens if needed
         for (const auto & lora : *loras) {
@@ -1046,7 +1276,7 @@ ggml_tensor * llm_graph_context::build_inp_embd(ggml_tensor * tok_embd) const {
 
             ggml_tensor * inpL_delta = ggml_scale(ctx0, ggml_mul_mat(
                         ctx0, lw->b, // non-transposed lora_b
-                        ggml_get_rows(ctx0, lw->a, inp->tokens)
+                        ggml_get_rows(ctx0, lw->a, tokens)
                         ), scale);
 
             cur = ggml_add(ctx0, cur, inpL_delta);
@@ -1056,6 +1286,9 @@ ggml_tensor * llm_graph_context::build_inp_embd(ggml_tensor * tok_embd) const {
         ggml_set_input(inp->embd);
 
         cur = inp->embd;
+        if (cp_i0 >= 0) {
+            cur = ggml_view_2d(ctx0, cur, n_embd, n_tokens, cur->nb[1], cp_i0*cur->nb[1]);
+        }
     }
 
     // For Granite architecture
@@ -1075,12 +1308,17 @@ ggml_tensor * llm_graph_context::build_inp_pos() const {
 
     auto & cur = inp->pos;
 
-    cur = ggml_new_tensor_1d(ctx0, GGML_TYPE_I32, (int64_t)n_tokens*hparams.n_pos_per_embd());
+    cur = ggml_new_tensor_1d(ctx0, GGML_TYPE_I32, (int64_t)ubatch.n_tokens*hparams.n_pos_per_embd());
     ggml_set_input(cur);
 
+    ggml_tensor * pos = cur;
+    if (cp_i0 >= 0) {
+        pos = ggml_view_1d(ctx0, pos, n_tokens, cp_i0*ggml_element_size(pos));
+    }
+
     res->add_input(std::move(inp));
 
-    return cur;
+    return pos;
 }
 
 ggml_tensor * llm_graph_context::build_inp_attn_scale() const {
@@ -1089,12 +1327,18 @@ ggml_tensor * llm_graph_context::build_inp_attn_scale() const {
     auto & cur = inp->attn_scale;
 
     // this need to be 1x1xN for broadcasting
-    cur = ggml_new_tensor_3d(ctx0, GGML_TYPE_F32, 1, 1, n_tokens);
+    // set_input() writes the scales of all the tokens of the ubatch, as for the positions
+    cur = ggml_new_tensor_3d(ctx0, GGML_TYPE_F32, 1, 1, ubatch.n_tokens);
     ggml_set_input(cur);
 
+    ggml_tensor * attn_scale = cur;
+    if (cp_i0 >= 0) {
+        attn_scale = ggml_view_3d(ctx0, attn_scale, 1, 1, n_tokens, attn_scale->nb[1], attn_scale->nb[2], cp_i0*ggml_element_size(attn_scale));
+    }
+
     res->add_input(std::move(inp));
 
-    return cur;
+    return attn_scale;
 }
 
 ggml_tensor * llm_graph_context::build_inp_out_ids() const {
@@ -1222,7 +1466,8 @@ ggml_tensor * llm_graph_context::build_attn_mha(
          ggml_tensor * sinks,
          ggml_tensor * v_mla,
                float   kq_scale,
-                 int   il) const {
+                 int   il,
+                bool   kv_score) const {
     const bool v_trans = v->nb[1] > v->nb[2];
 
     // split the batch into streams if needed
@@ -1319,6 +1564,20 @@ ggml_tensor * llm_graph_context::build_attn_mha(
         ggml_soft_max_add_sinks(kq, sinks);
         cb(kq, "kq_soft_max", il);
 
+        if (kv_score) {
+            // [n_kv, n_tokens, n_head, n_stream] -> [n_kv, n_stream]
+            // the sum over the tokens and heads is an out_prod with a vector of ones, which avoids a transposed copy of kq
+            ggml_tensor * score = ggml_reshape_3d(ctx0, kq, kq->ne[0], kq->ne[1]*kq->ne[2], kq->ne[3]);
+            ggml_tensor * ones  = ggml_repeat_4d(ctx0, ggml_arange(ctx0, 1.0f, 2.0f, 1.0f), 1, score->ne[1], score->ne[2], 1);
+            score = ggml_out_prod(ctx0, score, ones);
+            score = ggml_reshape_2d(ctx0, score, score->ne[0], score->ne[2]);
+            cb(score, "kv_score", il);
+
+            res->t_kv_score = res->t_kv_score ? ggml_add(ctx0, res->t_kv_score, score) : score;
+            ggml_set_output(res->t_kv_score);
+            ggml_build_forward_expand(gf, res->t_kv_score);
+        }
+
         if (!v_trans) {
             // note: avoid this branch
             v = ggml_cont(ctx0, ggml_transpose(ctx0, v));
@@ -1410,6 +1669,48 @@ ggml_tensor * llm_graph_context::build_attn(
     return cur;
 }
 
+// copies the block of this worker into place and exchanges the blocks with the other workers
+static void llm_graph_cp_all_gather_op(ggml_tensor * dst, int ith, int nth, void * userdata) {
+    GGML_ASSERT(ith == 0);
+    GGML_UNUSED(nth);
+
+    const auto * cparams = (const llama_cparams *) userdata;
+    const ggml_tensor * src = dst->src[0];
+
+    const int32_t n_workers = cparams->cp_size;
+    const int64_t n_tokens  = dst->ne[2];
+    const int64_t n_block   = llm_graph_cp_block_size(n_tokens, n_workers);
+    const size_t  row_size  = dst->nb[2];
+
+    std::vector<size_t> sizes(n_workers);
+    for (int32_t i = 0; i < n_workers; ++i) {
+        sizes[i] = std::max<int64_t>(0, std::min(n_block, n_tokens - i*n_block))*row_size;
+    }
+    GGML_ASSERT(sizes[cparams->cp_rank] == ggml_nbytes(src));
+
+    memcpy((char *) dst->data + cparams->cp_rank*n_block*row_size, src->data, ggml_nbytes(src));
+
+    cparams->cp_all_gather(dst->data, sizes.data(), cparams->cp_all_gather_ud);
+}
+
+ggml_tensor * llm_graph_context::build_cp_all_gather(ggml_tensor * cur, int il) const {
+    if (cur->type != GGML_TYPE_F32) {
+        cur = ggml_cast(ctx0, cur, GGML_TYPE_F32);
+    } else if (!ggml_is_contiguous(cur)) {
+        cur = ggml_cont(ctx0, cur);
+    }
+    cur = ggml_reshape_3d(ctx0, cur, cur->ne[0], cur->ne[1], n_tokens);
+
+    ggml_tensor * args[] = { cur };
+
+    // runs on a single thread: the time is spent waiting for the other workers
+    cur = ggml_custom_4d(ctx0, GGML_TYPE_F32, cur->ne[0], cur->ne[1], ubatch.n_tokens, 1,
+            args, 1, llm_graph_cp_all_gather_op, 1, const_cast<llama_cparams *>(&cparams));
+    cb(cur, "cp_all_gather", il);
+
+    return cur;
+}
+
 static std::unique_ptr<llm_graph_input_attn_kv> build_attn_inp_kv_impl(
            ggml_context * ctx0,
      const llama_ubatch & ubatch,
@@ -1466,6 +1767,12 @@ ggml_tensor * llm_graph_context::build_attn(
 
     const auto * mctx_cur = inp->mctx;
 
+    // context-parallel prefill: every worker stores the K/V of the whole ubatch
+    if (cp_i0 >= 0) {
+        k_cur = build_cp_all_gather(k_cur, il);
+        v_cur = build_cp_all_gather(v_cur, il);
+    }
+
     // store to KV cache
     {
         const auto & k_idxs = inp->get_k_idxs();
@@ -1475,13 +1782,19 @@ ggml_tensor * llm_graph_context::build_attn(
         ggml_build_forward_expand(gf, mctx_cur->cpy_v(ctx0, v_cur, v_idxs, il));
     }
 
-    const auto & kq_mask = inp->get_kq_mask();
+    ggml_tensor * kq_mask = inp->get_kq_mask();
+    if (cp_i0 >= 0) {
+        // the rows of the queries of this worker
+        kq_mask = ggml_view_4d(ctx0, kq_mask,
+                kq_mask->ne[0], GGML_PAD(n_tokens, GGML_KQ_MASK_PAD), kq_mask->ne[2], kq_mask->ne[3],
+                kq_mask->nb[1], kq_mask->nb[2], kq_mask->nb[3], cp_i0*kq_mask->nb[1]);
+    }
 
     ggml_tensor * q = q_cur;
     ggml_tensor * k = mctx_cur->get_k(ctx0, il);
     ggml_tensor * v = mctx_cur->get_v(ctx0, il);
 
-    ggml_tensor * cur = build_attn_mha(q, k, v, kq_b, kq_mask, sinks, v_mla, kq_scale, il);
+    ggml_tensor * cur = build_attn_mha(q, k, v, kq_b, kq_mask, sinks, v_mla, kq_scale, il, cparams.kv_budget > 0);
     cb(cur, "kqv_out", il);
 
     if (wo) {
@@ -464,6 +464,7 @@ public:
     ggml_tensor * get_logits()      const { return t_logits; }
     ggml_tensor * get_embd()        const { return t_embd; }
     ggml_tensor * get_embd_pooled() const { return t_embd_pooled; }
+    ggml_tensor * get_kv_score()    const { return t_kv_score; }
 
     ggml_cgraph  * get_gf()  const { return gf; }
     ggml_context * get_ctx() const { return ctx_compute.get(); }
@@ -490,6 +491,7 @@ public:
     ggml_tensor * t_logits      = nullptr;
     ggml_tensor * t_embd        = nullptr;
     ggml_tensor * t_embd_pooled = nullptr;
+    ggml_tensor * t_kv_score    = nullptr; // [n_kv, n_stream] attention mass per KV cell, summed over layers, heads and tokens
 
     std::vector<llm_graph_input_ptr> inputs;
 
@@ -550,7 +552,8 @@ struct llm_graph_context {
     const float norm_eps;
     const float norm_rms_eps;
 
-    const int64_t n_tokens;
+    const int64_t cp_i0;     // context-parallel prefill: first row of the ubatch computed by this worker, -1 if disabled
+    const int64_t n_tokens;  // number of rows computed by the graph (a block of the ubatch with context-parallel prefill)
     const int64_t n_outputs;
     const int32_t n_ctx_orig; // yarn
 
@@ -591,6 +594,12 @@ struct llm_graph_context {
               ggml_tensor * w,
               ggml_tensor * cur) const;
 
+    // check if a weight fused at load time can be used in place of its parts
+    // (not the case when a lora adapter is applied to any of the parts)
+    bool can_use_fused(
+              ggml_tensor * w_fused,
+              std::initializer_list<ggml_tensor *> parts) const;
+
     // do mat_mul_id, while optionally apply lora
     ggml_tensor * build_lora_mm_id(
               ggml_tensor * w,   // ggml_tensor * as
@@ -617,6 +626,24 @@ struct llm_graph_context {
              ggml_tensor * down_s,
              ggml_tensor * act_scales,
          llm_ffn_op_type   type_op,
+       llm_ffn_gate_type   type_gate,
+                     int   il,
+             ggml_tensor * pred_up   = nullptr,  // optional activation predictor and transposed down projection,
+             ggml_tensor * pred_down = nullptr,  // used for the sparse FFN (see llama_context_params::sparse_ffn)
+             ggml_tensor * down_t    = nullptr) const;
+
+    // FFN computed only for the neurons with the highest predicted activations
+    // returns nullptr if the sparse path cannot be used for these weights or this batch
+    ggml_tensor * build_ffn_sparse(
+             ggml_tensor * cur,
+             ggml_tensor * up,
+             ggml_tensor * gate,
+             ggml_tensor * down,
+             ggml_tensor * down_t,
+             ggml_tensor * down_b,
+             ggml_tensor * pred_up,
+             ggml_tensor * pred_down,
+         llm_ffn_op_type   type_op,
        llm_ffn_gate_type   type_gate,
                      int   il) const;
 
@@ -679,6 +706,10 @@ struct llm_graph_context {
     // attention
     //
 
+    // context-parallel prefill: concatenate the rows [n_embd_0, n_embd_1, n_tokens] of all workers
+    // returns [n_embd_0, n_embd_1, ubatch.n_tokens]
+    ggml_tensor * build_cp_all_gather(ggml_tensor * cur, int il) const;
+
     ggml_tensor * build_attn_mha(
             ggml_tensor * q,       // [n_embd_head_q, n_head_q, n_tokens]
             ggml_tensor * k,       // [n_embd_head_k, n_head_k, n_tokens]
@@ -688,7 +719,8 @@ struct llm_graph_context {
             ggml_tensor * sinks,   // [n_head_q]
             ggml_tensor * v_mla,   // [n_embd_head_v_mla, n_embd_head_v, n_head_v]
                   float   kq_scale,
-                    int   il) const;
+                    int   il,
+                   bool   kv_score = false) const; // accumulate the attention mass of the KV cells in res->t_kv_score
 
     llm_graph_input_attn_no_cache * build_attn_inp_no_cache() const;
 
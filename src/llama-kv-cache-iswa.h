@@ -25,6 +25,7 @@ public:
                      uint32_t   n_seq_max,
                      uint32_t   n_ubatch,
                      uint32_t   n_pad,
+        const     std::string & path,
         const layer_filter_cb & filter,
         const  layer_reuse_cb & reuse);
 
@@ -55,6 +56,7 @@ public:
 
     llama_pos seq_pos_min(llama_seq_id seq_id) const override;
     llama_pos seq_pos_max(llama_seq_id seq_id) const override;
+    uint32_t  seq_n_cells(llama_seq_id seq_id) const override;
 
     // state write/load
 
@@ -5,6 +5,8 @@
 #include "llama-model.h"
 #include "llama-context.h"
 
+#include "ggml-alloc.h"
+
 #include <algorithm>
 #include <cassert>
 #include <cmath>
@@ -28,6 +30,7 @@ llama_kv_cache::llama_kv_cache(
                  uint32_t   n_pad,
                  uint32_t   n_swa,
            llama_swa_type   swa_type,
+    const     std::string & path,
     const layer_filter_cb & filter,
     const  layer_reuse_cb & reuse) :
     model(model), hparams(model.hparams), v_trans(v_trans),
@@ -174,6 +177,17 @@ llama_kv_cache::llama_kv_cache(
         auto * buft = it.first;
         auto * ctx  = it.second;
 
+        // only host memory can be backed by a file - the buffers of other devices are allocated as usual
+        if (!path.empty() && buft == ggml_backend_cpu_buffer_type()) {
+            ggml_backend_buffer_t buf = alloc_file_buffer(path, ctx, buft);
+
+            LLAMA_LOG_INFO("%s: %10s KV buffer size = %8.2f MiB (file: %s)\n", __func__, ggml_backend_buffer_name(buf), ggml_backend_buffer_get_size(buf)/1024.0/1024.0, path.c_str());
+
+            // the file has just been created and reads as zeros
+            bufs.emplace_back(buf);
+            continue;
+        }
+
         ggml_backend_buffer_t buf = ggml_backend_alloc_ctx_tensors_from_buft(ctx, buft);
         if (!buf) {
             throw std::runtime_error("failed to allocate buffer for kv cache");
@@ -185,6 +199,10 @@ llama_kv_cache::llama_kv_cache(
         bufs.emplace_back(buf);
     }
 
+    if (!path.empty() && !file) {
+        LLAMA_LOG_WARN("%s: the KV cache is not stored in host memory - ignoring the KV cache file '%s'\n", __func__, path.c_str());
+    }
+
     {
         const size_t memory_size_k = size_k_bytes();
         const size_t memory_size_v = size_v_bytes();
@@ -207,6 +225,13 @@ void llama_kv_cache::clear(bool data) {
 
     if (data) {
         for (auto & buf : bufs) {
+            if (mapping && ggml_backend_buffer_get_base(buf.get()) == mapping->addr()) {
+                // drop the blocks of the file instead of writing zeros to the whole cache
+                // note: the file cannot be truncated while it is mapped (this fails on Windows)
+                mapping->zero(0, mapping->size());
+                continue;
+            }
+
             ggml_backend_buffer_clear(buf.get(), 0);
         }
     }
@@ -473,6 +498,14 @@ llama_pos llama_kv_cache::seq_pos_max(llama_seq_id seq_id) const {
     return cells.seq_pos_max(seq_id);
 }
 
+uint32_t llama_kv_cache::seq_n_cells(llama_seq_id seq_id) const {
+    GGML_ASSERT(seq_id >= 0 && (size_t) seq_id < seq_to_stream.size());
+
+    const auto & cells = v_cells[seq_to_stream[seq_id]];
+
+    return cells.seq_n_cells(seq_id);
+}
+
 llama_memory_context_ptr llama_kv_cache::init_batch(
             llama_batch_allocr & balloc,
             uint32_t n_ubatch,
@@ -923,6 +956,88 @@ void llama_kv_cache::apply_ubatch(const slot_info & sinfo, const llama_ubatch &
 
         head = sinfo.idxs[s].back() + 1;
     }
+
+    if (mapping) {
+        prefetch_hot(sinfo);
+    }
+}
+
+ggml_backend_buffer_t llama_kv_cache::alloc_file_buffer(const std::string & path, ggml_context * ctx, ggml_backend_buffer_type_t buft) {
+    GGML_ASSERT(!file && "only one buffer of the KV cache can be backed by a file");
+
+    const size_t align = ggml_backend_buft_get_alignment(buft);
+
+    size_t size = 0;
+    for (ggml_tensor * t = ggml_get_first_tensor(ctx); t != nullptr; t = ggml_get_next_tensor(ctx, t)) {
+        if (t->view_src == nullptr) {
+            size += GGML_PAD(ggml_backend_buft_get_alloc_size(buft, t), align);
+        }
+    }
+
+    // the file is extended without writing to it, so on most filesystems the blocks are only allocated when the
+    // corresponding cells are written for the first time
+    file.reset(new llama_file(path.c_str(), "w+b"));
+    file->resize(size);
+
+    mapping.reset(new llama_mmap(file.get(), /* prefetch */ 0, /* numa */ false, /* writable */ true));
+
+    ggml_backend_buffer_t buf = ggml_backend_cpu_buffer_from_ptr(mapping->addr(), size);
+    if (!buf) {
+        throw std::runtime_error("failed to create buffer for the kv cache file");
+    }
+
+    ggml_tallocr talloc = ggml_tallocr_new(buf);
+
+    for (ggml_tensor * t = ggml_get_first_tensor(ctx); t != nullptr; t = ggml_get_next_tensor(ctx, t)) {
+        if (t->view_src == nullptr) {
+            if (ggml_tallocr_alloc(&talloc, t) != GGML_STATUS_SUCCESS) {
+                ggml_backend_buffer_free(buf);
+                throw std::runtime_error("failed to allocate tensor in the kv cache file");
+            }
+        }
+    }
+
+    for (ggml_tensor * t = ggml_get_first_tensor(ctx); t != nullptr; t = ggml_get_next_tensor(ctx, t)) {
+        if (t->view_src != nullptr && t->buffer == nullptr) {
+            ggml_backend_view_init(t);
+        }
+    }
+
+    return buf;
+}
+
+void llama_kv_cache::prefetch_hot(const slot_info & sinfo) const {
+    // the attention reads the cells [0, n_kv) of each layer front to back, which the kernel readahead handles well
+    // (the mapping is advised as sequential), but it also evicts the pages behind the reader - ask for the attention
+    // sinks and the cells around the head to be brought back before the next ubatch, since these are hit every time
+    const uint8_t * base = (const uint8_t *) mapping->addr();
+    const uint8_t * end  = base + mapping->size();
+
+    for (uint32_t s = 0; s < sinfo.n_stream(); ++s) {
+        const uint32_t strm = sinfo.strm[s];
+
+        const uint32_t i1 = *std::max_element(sinfo.idxs[s].begin(), sinfo.idxs[s].end()) + 1;
+        const uint32_t i0 = i1 > n_file_hot ? i1 - n_file_hot : 0;
+
+        for (const auto & layer : layers) {
+            for (const ggml_tensor * t : { layer.k, layer.v }) {
+                // the rows of the transposed V cache are strided over the whole cache - rely on the readahead
+                if (t == layer.v && v_trans) {
+                    continue;
+                }
+
+                const uint8_t * data = (const uint8_t *) t->data + strm*t->nb[2];
+                if (data < base || data >= end) {
+                    continue;
+                }
+
+                const size_t offs = data - base;
+
+                mapping->prefetch(offs,                std::min(n_file_sink, i0)*t->nb[1]);
+                mapping->prefetch(offs + i0*t->nb[1], (i1 - i0)*t->nb[1]);
+            }
+        }
+    }
 }
 
 bool llama_kv_cache::get_can_shift() const {
@@ -949,6 +1064,46 @@ bool llama_kv_cache::get_has_shift() const {
     return result;
 }
 
+void llama_kv_cache::score_add(const slot_info & sinfo, uint32_t n_kv, const float * data) {
+    for (uint32_t s = 0; s < sinfo.n_stream(); ++s) {
+        auto & cells = v_cells[sinfo.strm[s]];
+
+        const float * score = data + (size_t) s*n_kv;
+
+        for (uint32_t i = 0; i < std::min(n_kv, cells.size()); ++i) {
+            if (!cells.is_empty(i)) {
+                cells.score_add(i, score[i]);
+            }
+        }
+    }
+}
+
+void llama_kv_cache::evict(uint32_t n_budget, uint32_t n_sink, uint32_t n_recent) {
+    GGML_ASSERT(n_budget > 0);
+
+    for (llama_seq_id seq_id = 0; seq_id < (llama_seq_id) n_seq_max; ++seq_id) {
+        auto & cells = v_cells[seq_to_stream[seq_id]];
+        auto & head  = v_heads[seq_to_stream[seq_id]];
+
+        uint32_t new_head = cells.size();
+
+        const uint32_t n_cells = cells.seq_n_cells(seq_id);
+        const uint32_t n_evict = cells.seq_evict(seq_id, n_budget, n_sink, n_recent, new_head);
+        if (n_evict == 0) {
+            continue;
+        }
+
+        if (debug > 0) {
+            LLAMA_LOG_DEBUG("%s: seq_id = %d, evicted %u of %u cells\n", __func__, seq_id, n_evict, n_cells);
+        }
+
+        // If we freed up a slot, set head to it so searching can start there.
+        if (new_head != cells.size() && new_head < head) {
+            head = new_head;
+        }
+    }
+}
+
 uint32_t llama_kv_cache::get_n_kv(const slot_info & sinfo) const {
     uint32_t result = 0;
 
@@ -1944,6 +2099,12 @@ uint32_t llama_kv_cache_context::get_n_kv() const {
     return n_kv;
 }
 
+void llama_kv_cache_context::score_add(uint32_t i_ubatch, const std::vector<float> & data) const {
+    const auto & sinfo = sinfos.at(i_ubatch);
+
+    kv->score_add(sinfo, data.size()/sinfo.n_stream(), data.data());
+}
+
 ggml_tensor * llama_kv_cache_context::get_k(ggml_context * ctx, int32_t il) const {
     return kv->get_k(ctx, il, n_kv, sinfos[i_cur]);
 }
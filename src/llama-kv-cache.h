@@ -4,6 +4,7 @@
 #include "llama-graph.h"
 #include "llama-kv-cells.h"
 #include "llama-memory.h"
+#include "llama-mmap.h"
 
 #include <unordered_map>
 #include <vector>
@@ -90,6 +91,7 @@ public:
                      uint32_t   n_pad,
                      uint32_t   n_swa,
                llama_swa_type   swa_type,
+        const     std::string & path,
         const layer_filter_cb & filter,
         const  layer_reuse_cb & reuse);
 
@@ -120,6 +122,7 @@ public:
 
     llama_pos seq_pos_min(llama_seq_id seq_id) const override;
     llama_pos seq_pos_max(llama_seq_id seq_id) const override;
+    uint32_t  seq_n_cells(llama_seq_id seq_id) const override;
 
     // state write/load
 
@@ -135,6 +138,18 @@ public:
 
     bool get_has_shift() const;
 
+    //
+    // eviction API
+    //
+
+    // accumulate the attention mass received by the cells [0, n_kv) of the streams of sinfo
+    // data is [n_kv, n_stream], as produced by the "kv_score" node of the graph
+    void score_add(const slot_info & sinfo, uint32_t n_kv, const float * data);
+
+    // remove the least attended cells of every sequence that occupies more than n_budget cells
+    // the n_sink cells with the lowest positions and the n_recent cells with the highest positions are always kept
+    void evict(uint32_t n_budget, uint32_t n_sink, uint32_t n_recent);
+
     //
     // graph_build API
     //
@@ -214,9 +229,18 @@ private:
 
     const llama_swa_type swa_type = LLAMA_SWA_TYPE_NONE;
 
+    // backing storage of the host KV buffer when a KV cache file is used
+    // note: declared before bufs so that the mapping outlives the buffer that points into it
+    std::unique_ptr<llama_file> file;
+    std::unique_ptr<llama_mmap> mapping;
+
     std::vector<ggml_context_ptr>        ctxs;
     std::vector<ggml_backend_buffer_ptr> bufs;
 
+    // number of leading (attention sinks) and trailing cells of the file-backed cache to prefetch after each ubatch
+    static constexpr uint32_t n_file_sink = 64;
+    static constexpr uint32_t n_file_hot  = 4096;
+
     // the current index from where we start searching for a free slot in the ring buffer of KV cells (see find_slot())
     // note: this is not part of the KV state and it's only used to speed-up the find_slot() method
     std::vector<uint32_t> v_heads;
@@ -236,6 +260,12 @@ private:
 
     size_t total_size() const;
 
+    // allocate the tensors of ctx in a buffer that is memory-mapped from a newly created file
+    ggml_backend_buffer_t alloc_file_buffer(const std::string & path, ggml_context * ctx, ggml_backend_buffer_type_t buft);
+
+    // hint the kernel to bring the hot cells of the file-backed cache into memory
+    void prefetch_hot(const slot_info & sinfo) const;
+
     size_t size_k_bytes() const;
     size_t size_v_bytes() const;
 
@@ -311,6 +341,9 @@ public:
 
     uint32_t get_n_kv() const;
 
+    // accumulate the attention mass of the cells used by the ubatch i_ubatch, data is [n_kv, n_stream]
+    void score_add(uint32_t i_ubatch, const std::vector<float> & data) const;
+
     // get views of the current state of the cache
     ggml_tensor * get_k(ggml_context * ctx, int32_t il) const;
     ggml_tensor * get_v(ggml_context * ctx, int32_t il) const;
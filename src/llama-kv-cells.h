@@ -3,6 +3,7 @@
 #include "llama.h"
 #include "llama-cparams.h"
 
+#include <algorithm>
 #include <bitset>
 #include <cassert>
 #include <vector>
@@ -17,6 +18,7 @@ public:
         for (uint32_t i = 0; i < pos.size(); ++i) {
             pos[i]   = -1;
             shift[i] =  0;
+            score[i] =  0.0f;
             seq[i].reset();
         }
 
@@ -26,6 +28,7 @@ public:
 
         for (uint32_t s = 0; s < LLAMA_MAX_SEQ; ++s) {
             seq_pos[s].clear();
+            seq_n[s] = 0;
         }
     }
 
@@ -44,6 +47,7 @@ public:
     void resize(uint32_t n) {
         pos.resize(n);
         shift.resize(n);
+        score.resize(n);
         seq.resize(n);
 
         reset();
@@ -153,8 +157,9 @@ public:
                 seq_pos_rm(i + j);
             }
 
-            pos[idx] = other.pos[j];
-            seq[idx] = other.seq[j];
+            pos[idx]   = other.pos[j];
+            seq[idx]   = other.seq[j];
+            score[idx] = 0.0f;
 
             if (pos[idx] != -1) {
                 seq_pos_add(i + j);
@@ -183,8 +188,9 @@ public:
                 seq_pos_rm(idx);
             }
 
-            pos[idx] = other.pos[j];
-            seq[idx] = other.seq[j];
+            pos[idx]   = other.pos[j];
+            seq[idx]   = other.seq[j];
+            score[idx] = 0.0f;
 
             if (pos[idx] != -1) {
                 seq_pos_add(idx);
@@ -317,6 +323,14 @@ public:
         return seq_pos[seq_id].begin()->first;
     }
 
+    // the number of cells that contain seq_id
+    uint32_t seq_n_cells(llama_seq_id seq_id) const {
+        assert(seq_id >= 0);
+        assert(seq_id < LLAMA_MAX_SEQ);
+
+        return seq_n[seq_id];
+    }
+
     // the maximum position of sequence seq_id currently present in any of the cells
     // return -1 if the sequence is not present
     llama_pos seq_pos_max(llama_seq_id seq_id) const {
@@ -363,7 +377,8 @@ public:
         assert(pos[i] == -1);
         assert(seq[i].none());
 
-        pos[i] = p;
+        pos[i]   = p;
+        score[i] = 0.0f;
 
         used.insert(i);
     }
@@ -416,6 +431,72 @@ public:
         has_shift = true;
     }
 
+    // accumulated attention mass received by the cell (used for KV eviction)
+    // note: call only if the cell is not empty
+    float score_get(uint32_t i) const {
+        assert(i < pos.size());
+        assert(pos[i] != -1);
+
+        return score[i];
+    }
+
+    void score_add(uint32_t i, float v) {
+        assert(i < pos.size());
+        assert(pos[i] != -1);
+
+        score[i] += v;
+    }
+
+    // remove seq_id from its least attended cells until it occupies n_budget cells
+    // the n_sink cells with the lowest positions and the n_recent cells with the highest positions are always kept
+    // return the number of cells removed from the sequence, idx_free is set to the lowest index of a cell that became empty, or size()
+    uint32_t seq_evict(llama_seq_id seq_id, uint32_t n_budget, uint32_t n_sink, uint32_t n_recent, uint32_t & idx_free) {
+        assert(seq_id >= 0);
+        assert(seq_id < LLAMA_MAX_SEQ);
+
+        idx_free = pos.size();
+
+        const uint32_t n_cells = seq_n[seq_id];
+        if (n_cells <= n_budget || n_cells <= n_sink + n_recent) {
+            return 0;
+        }
+
+        // candidate cells of the sequence: (pos, idx)
+        std::vector<std::pair<llama_pos, uint32_t>> cand;
+        cand.reserve(n_cells);
+
+        for (const uint32_t i : used) {
+            if (seq[i].test(seq_id)) {
+                cand.emplace_back(pos[i], i);
+            }
+        }
+
+        assert(cand.size() == n_cells);
+
+        std::sort(cand.begin(), cand.end());
+
+        // only the cells between the sinks and the recent window can be evicted
+        auto c0 = cand.begin() + n_sink;
+        auto c1 = cand.end()   - n_recent;
+
+        const uint32_t n_evict = std::min<uint32_t>(n_cells - n_budget, c1 - c0);
+
+        std::nth_element(c0, c0 + n_evict, c1, [this](const auto & a, const auto & b) {
+            const float sa = score[a.second];
+            const float sb = score[b.second];
+
+            return sa < sb || (sa == sb && a.first < b.first);
+        });
+
+        for (auto it = c0; it != c0 + n_evict; ++it) {
+            if (seq_rm(it->second, seq_id)) {
+                idx_free = std::min(idx_free, it->second);
+            }
+        }
+
+        return n_evict;
+    }
+
 private:
     bool has_shift = false;
 
@@ -441,6 +522,10 @@ private:
     //
     std::vector<llama_pos> shift;
 
+    // the attention mass that the cell received since it was set, see llama_kv_cache::score_add()
+    // not part of the saved state
+    std::vector<float> score;
+
     using seq_set_t = std::bitset<LLAMA_MAX_SEQ>;
 
     // the bitset seq[i] tells us which sequences are currently occupying the i-th cell
@@ -456,6 +541,9 @@ private:
     //
     std::map<llama_pos, int> seq_pos[LLAMA_MAX_SEQ];
 
+    // the number of cells of each sequence, i.e. the sum of the counts in seq_pos[s]
+    uint32_t seq_n[LLAMA_MAX_SEQ] = {};
+
     // helper functions for updating `seq_pos`, once cell at a time:
 
     void seq_pos_dec(llama_seq_id s, llama_pos p) {
@@ -465,10 +553,13 @@ private:
         if (--it->second == 0) {
             seq_pos[s].erase(it);
         }
+
+        seq_n[s]--;
     }
 
     void seq_pos_inc(llama_seq_id s, llama_pos p) {
         seq_pos[s][p]++;
+        seq_n[s]++;
     }
 
     // remove cell i
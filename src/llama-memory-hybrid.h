@@ -67,6 +67,7 @@ public:
 
     llama_pos seq_pos_min(llama_seq_id seq_id) const override;
     llama_pos seq_pos_max(llama_seq_id seq_id) const override;
+    uint32_t  seq_n_cells(llama_seq_id seq_id) const override;
 
     // state write/load
 
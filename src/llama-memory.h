@@ -4,6 +4,7 @@
 
 #include <memory>
 #include <functional>
+#include <string>
 
 struct llama_ubatch;
 
@@ -19,6 +20,9 @@ struct llama_memory_params {
 
     // use full-size SWA cache
     bool swa_full;
+
+    // back the KV cache buffers with a memory-mapped file at this path (empty = RAM)
+    std::string kv_path;
 };
 
 enum llama_memory_status {
@@ -108,6 +112,9 @@ struct llama_memory_i {
     virtual llama_pos seq_pos_min(llama_seq_id seq_id) const = 0;
     virtual llama_pos seq_pos_max(llama_seq_id seq_id) const = 0;
 
+    // number of cells occupied by the sequence (lower than the number of positions after a KV eviction)
+    virtual uint32_t seq_n_cells(llama_seq_id seq_id) const = 0;
+
     //
     // state write/read
     //
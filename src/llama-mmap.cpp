@@ -153,6 +153,16 @@ struct llama_file::impl {
         write_raw(&val, sizeof(val));
     }
 
+    void resize(size_t new_size) {
+        std::fflush(fp);
+        seek(new_size, SEEK_SET);
+        if (!SetEndOfFile(fp_win32)) {
+            throw std::runtime_error(format("resize error: %s", GetErrorMessageWin32(GetLastError()).c_str()));
+        }
+        seek(0, SEEK_SET);
+        size = new_size;
+    }
+
     ~impl() {
         if (fp) {
             std::fclose(fp);
@@ -230,6 +240,20 @@ struct llama_file::impl {
         write_raw(&val, sizeof(val));
     }
 
+    void resize(size_t new_size) {
+#if defined(_POSIX_MAPPED_FILES)
+        std::fflush(fp);
+        if (ftruncate(fileno(fp), (off_t) new_size) != 0) {
+            throw std::runtime_error(format("resize error: %s", strerror(errno)));
+        }
+        size = new_size;
+#else
+        GGML_UNUSED(new_size);
+
+        throw std::runtime_error("resize not supported");
+#endif
+    }
+
     ~impl() {
         if (fp) {
             std::fclose(fp);
@@ -267,16 +291,19 @@ uint32_t llama_file::read_u32() const { return pimpl->read_u32(); }
 void llama_file::write_raw(const void * ptr, size_t len) const { pimpl->write_raw(ptr, len); }
 void llama_file::write_u32(uint32_t val) const { pimpl->write_u32(val); }
 
+void llama_file::resize(size_t size) { pimpl->resize(size); }
+
 // llama_mmap
 
 struct llama_mmap::impl {
 #ifdef _POSIX_MAPPED_FILES
     std::vector<std::pair<size_t, size_t>> mapped_fragments;
 
-    impl(struct llama_file * file, size_t prefetch, bool numa) {
+    impl(struct llama_file * file, size_t prefetch, bool numa, bool writable) {
         size = file->size();
         int fd = file->file_id();
         int flags = MAP_SHARED;
+        int prot  = writable ? PROT_READ | PROT_WRITE : PROT_READ;
         if (numa) { prefetch = 0; }
 #ifdef __linux__
         if (posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL)) {
@@ -285,11 +312,20 @@ struct llama_mmap::impl {
         }
         if (prefetch) { flags |= MAP_POPULATE; }
 #endif
-        addr = mmap(NULL, file->size(), PROT_READ, flags, fd, 0);
+        addr = mmap(NULL, file->size(), prot, flags, fd, 0);
         if (addr == MAP_FAILED) {
             throw std::runtime_error(format("mmap failed: %s", strerror(errno)));
         }
 
+        if (writable) {
+            // writable mappings are used as backing storage that is larger than the RAM
+            // let the kernel read ahead aggressively and evict pages behind the current position
+            if (posix_madvise(addr, file->size(), POSIX_MADV_SEQUENTIAL)) {
+                LLAMA_LOG_WARN("warning: posix_madvise(.., POSIX_MADV_SEQUENTIAL) failed: %s\n",
+                        strerror(errno));
+            }
+        }
+
         if (prefetch > 0) {
             if (posix_madvise(addr, std::min(file->size(), prefetch), POSIX_MADV_WILLNEED)) {
                 LLAMA_LOG_WARN("warning: posix_madvise(.., POSIX_MADV_WILLNEED) failed: %s\n",
@@ -318,6 +354,68 @@ struct llama_mmap::impl {
         }
     }
 
+    void prefetch(size_t offset, size_t len) const {
+        const size_t page_size = sysconf(_SC_PAGESIZE);
+
+        size_t first = offset & ~(page_size - 1);
+        size_t last  = std::min(offset + len, size);
+        if (last <= first) {
+            return;
+        }
+
+        if (posix_madvise((uint8_t *) addr + first, last - first, POSIX_MADV_WILLNEED)) {
+            LLAMA_LOG_WARN("warning: posix_madvise(.., POSIX_MADV_WILLNEED) failed: %s\n",
+                    strerror(errno));
+        }
+    }
+
+    void release(size_t offset, size_t len) const {
+        const size_t page_size = sysconf(_SC_PAGESIZE);
+
+        // only whole pages inside the range
+        size_t first = offset;
+        size_t last  = std::min(offset + len, size);
+        align_range(&first, &last, page_size);
+        if (last <= first) {
+            return;
+        }
+
+#ifdef MADV_COLD
+        // deactivate the pages: they stay cached, but are the first to be reclaimed under memory pressure
+        if (madvise((uint8_t *) addr + first, last - first, MADV_COLD) == 0) {
+            return;
+        }
+#endif
+        if (posix_madvise((uint8_t *) addr + first, last - first, POSIX_MADV_DONTNEED)) {
+            LLAMA_LOG_WARN("warning: posix_madvise(.., POSIX_MADV_DONTNEED) failed: %s\n",
+                    strerror(errno));
+        }
+    }
+
+    void zero(size_t offset, size_t len) {
+        const size_t end = std::min(offset + len, size);
+        if (end <= offset) {
+            return;
+        }
+
+#ifdef MADV_REMOVE
+        // punch a hole in the file for the whole pages, they read back as zeros
+        const size_t page_size = sysconf(_SC_PAGESIZE);
+
+        size_t first = offset;
+        size_t last  = end;
+        align_range(&first, &last, page_size);
+
+        if (last > first && madvise((uint8_t *) addr + first, last - first, MADV_REMOVE) == 0) {
+            memset((uint8_t *) addr + offset, 0, first - offset);
+            memset((uint8_t *) addr + last,   0, end - last);
+            return;
+        }
+#endif
+
+        memset((uint8_t *) addr + offset, 0, end - offset);
+    }
+
     void unmap_fragment(size_t first, size_t last) {
         int page_size = sysconf(_SC_PAGESIZE);
         align_range(&first, &last, page_size);
@@ -362,21 +460,21 @@ struct llama_mmap::impl {
         }
     }
 #elif defined(_WIN32)
-    impl(struct llama_file * file, size_t prefetch, bool numa) {
+    impl(struct llama_file * file, size_t prefetch, bool numa, bool writable) {
         GGML_UNUSED(numa);
 
         size = file->size();
 
         HANDLE hFile = (HANDLE) _get_osfhandle(file->file_id());
 
-        HANDLE hMapping = CreateFileMappingA(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+        HANDLE hMapping = CreateFileMappingA(hFile, NULL, writable ? PAGE_READWRITE : PAGE_READONLY, 0, 0, NULL);
 
         if (hMapping == NULL) {
             DWORD error = GetLastError();
             throw std::runtime_error(format("CreateFileMappingA failed: %s", llama_format_win_err(error).c_str()));
         }
 
-        addr = MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+        addr = MapViewOfFile(hMapping, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, 0);
         DWORD error = GetLastError();
         CloseHandle(hMapping);
 
@@ -406,6 +504,40 @@ struct llama_mmap::impl {
         }
     }
 
+    void prefetch(size_t offset, size_t len) const {
+#if _WIN32_WINNT >= 0x602
+        BOOL (WINAPI *pPrefetchVirtualMemory) (HANDLE, ULONG_PTR, PWIN32_MEMORY_RANGE_ENTRY, ULONG);
+        HMODULE hKernel32 = GetModuleHandleW(L"kernel32.dll");
+
+        pPrefetchVirtualMemory = (decltype(pPrefetchVirtualMemory))(void *) GetProcAddress(hKernel32, "PrefetchVirtualMemory");
+
+        if (pPrefetchVirtualMemory && offset < size) {
+            WIN32_MEMORY_RANGE_ENTRY range;
+            range.VirtualAddress = (uint8_t *) addr + offset;
+            range.NumberOfBytes = (SIZE_T) std::min(len, size - offset);
+            if (!pPrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0)) {
+                LLAMA_LOG_WARN("warning: PrefetchVirtualMemory failed: %s\n",
+                        llama_format_win_err(GetLastError()).c_str());
+            }
+        }
+#else
+        GGML_UNUSED(offset);
+        GGML_UNUSED(len);
+#endif
+    }
+
+    void release(size_t offset, size_t len) const {
+        GGML_UNUSED(offset);
+        GGML_UNUSED(len);
+    }
+
+    void zero(size_t offset, size_t len) {
+        // the file cannot be resized or have holes punched in it while it is mapped
+        if (offset < size) {
+            memset((uint8_t *) addr + offset, 0, std::min(len, size - offset));
+        }
+    }
+
     void unmap_fragment(size_t first, size_t last) {
         GGML_UNUSED(first);
         GGML_UNUSED(last);
@@ -418,10 +550,28 @@ struct llama_mmap::impl {
         }
     }
 #else
-    impl(struct llama_file * file, size_t prefetch, bool numa) {
+    impl(struct llama_file * file, size_t prefetch, bool numa, bool writable) {
         GGML_UNUSED(file);
         GGML_UNUSED(prefetch);
         GGML_UNUSED(numa);
+        GGML_UNUSED(writable);
+
+        throw std::runtime_error("mmap not supported");
+    }
+
+    void prefetch(size_t offset, size_t len) const {
+        GGML_UNUSED(offset);
+        GGML_UNUSED(len);
+    }
+
+    void release(size_t offset, size_t len) const {
+        GGML_UNUSED(offset);
+        GGML_UNUSED(len);
+    }
+
+    void zero(size_t offset, size_t len) {
+        GGML_UNUSED(offset);
+        GGML_UNUSED(len);
 
         throw std::runtime_error("mmap not supported");
     }
@@ -438,7 +588,7 @@ struct llama_mmap::impl {
     size_t size;
 };
 
-llama_mmap::llama_mmap(struct llama_file * file, size_t prefetch, bool numa) : pimpl(std::make_unique<impl>(file, prefetch, numa)) {}
+llama_mmap::llama_mmap(struct llama_file * file, size_t prefetch, bool numa, bool writable) : pimpl(std::make_unique<impl>(file, prefetch, numa, writable)) {}
 llama_mmap::~llama_mmap() = default;
 
 size_t llama_mmap::size() const { return pimpl->size; }
@@ -446,6 +596,10 @@ void * llama_mmap::addr() const { return pimpl->addr; }
 
 void llama_mmap::unmap_fragment(size_t first, size_t last) { pimpl->unmap_fragment(first, last); }
 
+void llama_mmap::prefetch(size_t offset, size_t len) const { pimpl->prefetch(offset, len); }
+void llama_mmap::release (size_t offset, size_t len) const { pimpl->release (offset, len); }
+void llama_mmap::zero    (size_t offset, size_t len)       { pimpl->zero    (offset, len); }
+
 #if defined(_POSIX_MEMLOCK_RANGE) || defined(_WIN32)
 const bool llama_mmap::SUPPORTED  = true;
 #else
@@ -29,6 +29,9 @@ struct llama_file {
     void write_raw(const void * ptr, size_t len) const;
     void write_u32(uint32_t val) const;
 
+    // extend or truncate the file to the given size (the extension is sparse where supported)
+    void resize(size_t size);
+
 private:
     struct impl;
     std::unique_ptr<impl> pimpl;
@@ -36,7 +39,7 @@ private:
 
 struct llama_mmap {
     llama_mmap(const llama_mmap &) = delete;
-    llama_mmap(struct llama_file * file, size_t prefetch = (size_t) -1, bool numa = false);
+    llama_mmap(struct llama_file * file, size_t prefetch = (size_t) -1, bool numa = false, bool writable = false);
     ~llama_mmap();
 
     size_t size() const;
@@ -44,6 +47,16 @@ struct llama_mmap {
 
     void unmap_fragment(size_t first, size_t last);
 
+    // hint that the range [offset, offset + len) will be accessed soon
+    void prefetch(size_t offset, size_t len) const;
+
+    // hint that the range [offset, offset + len) will not be accessed for a while and can be reclaimed first
+    void release(size_t offset, size_t len) const;
+
+    // fill the range [offset, offset + len) of a writable mapping with zeros
+    // the storage of the whole pages in the range is freed where supported, instead of being written
+    void zero(size_t offset, size_t len);
+
     static const bool SUPPORTED;
 
 private:
@@ -17,6 +17,7 @@
 #include <cassert>
 #include <cmath>
 #include <cfloat>
+#include <cstdio>
 #include <cstring>
 #include <cmath>
 #include <functional>
@@ -190,6 +191,18 @@ static bool weight_buft_supported(const llama_hparams & hparams, ggml_tensor * w
                 ggml_tensor * ids = ggml_new_tensor_2d(ctx, GGML_TYPE_I32, n_expert_used, 512);
                 op_tensor = ggml_mul_mat_id(ctx, w, b, ids);
             } break;
+        case GGML_OP_MUL_MAT_SEL:
+            {
+                ggml_tensor * b = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, w->ne[0], 512);
+                ggml_tensor * ids = ggml_new_tensor_2d(ctx, GGML_TYPE_I32, w->ne[1], 512);
+                op_tensor = ggml_mul_mat_sel(ctx, w, b, ids);
+            } break;
+        case GGML_OP_OUT_PROD_SEL:
+            {
+                ggml_tensor * b = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, w->ne[1], 512);
+                ggml_tensor * ids = ggml_new_tensor_2d(ctx, GGML_TYPE_I32, w->ne[1], 512);
+                op_tensor = ggml_out_prod_sel(ctx, w, b, ids);
+            } break;
         case GGML_OP_ADD:
             {
                 ggml_tensor * a = ggml_new_tensor_4d(ctx, GGML_TYPE_F32, w->ne[0], w->ne[1], w->ne[2], w->ne[3]);
@@ -410,6 +423,9 @@ struct llama_model::impl {
     // model memory mapped files
     llama_mmaps mappings;
 
+    // ranges of the mapped files that hold the weights of each layer (+ the output), used for weight streaming
+    std::vector<std::vector<weight_range>> weight_ranges;
+
     // objects representing data potentially being locked in memory
     llama_mlocks mlock_bufs;
     llama_mlocks mlock_mmaps;
@@ -2052,6 +2068,44 @@ bool llama_model::load_tensors(llama_model_loader & ml) {
         return it->second;
     };
 
+    // fused weights are not present in the model file and cannot be mapped, so they use separate contexts
+    std::map<ggml_backend_buffer_type_t, ggml_context *> ctx_map_fused;
+    auto ctx_for_buft_fused = [&](ggml_backend_buffer_type_t buft) -> ggml_context * {
+        auto it = ctx_map_fused.find(buft);
+        if (it == ctx_map_fused.end()) {
+            ggml_init_params params = {
+                /*.mem_size   =*/ ctx_size,
+                /*.mem_buffer =*/ NULL,
+                /*.no_alloc   =*/ true,
+            };
+
+            ggml_context * ctx = ggml_init(params);
+            if (!ctx) {
+                throw std::runtime_error(format("failed to create ggml context"));
+            }
+
+            ctx_map_fused[buft] = ctx;
+            pimpl->ctxs.emplace_back(ctx);
+
+            return ctx;
+        }
+        return it->second;
+    };
+
+    bool fuse_weights = false;
+    if (params.fuse_weights) {
+        switch (arch) {
+            case LLM_ARCH_LLAMA:
+            case LLM_ARCH_QWEN2:
+            case LLM_ARCH_QWEN3:
+                fuse_weights = true;
+                break;
+            default:
+                LLAMA_LOG_WARN("%s: weight fusion is not supported for arch %s, ignoring\n", __func__, llm_arch_name(arch));
+                break;
+        }
+    }
+
     const auto TENSOR_DUPLICATED   = llama_model_loader::TENSOR_DUPLICATED;
     const auto TENSOR_NOT_REQUIRED = llama_model_loader::TENSOR_NOT_REQUIRED;
     const auto TENSOR_SKIP         = llama_model_loader::TENSOR_SKIP;
@@ -2084,7 +2138,85 @@ bool llama_model::load_tensors(llama_model_loader & ml) {
         ggml_backend_buffer_type_t first_moved_from_buft = nullptr;
         ggml_backend_buffer_type_t first_moved_to_buft = nullptr;
 
+        // select the buffer type for a weight, taking into account the buffer type overrides
+        auto select_tensor_buft = [&](const LLM_TN_IMPL & tn, ggml_tensor * t_meta, ggml_op op, const llm_tensor_info & info, buft_list_t *& buft_list) -> ggml_backend_buffer_type_t {
+            switch (info.layer) {
+                case LLM_TENSOR_LAYER_INPUT:
+                    buft_list = pimpl->dev_input.buft_list;
+                    break;
+                case LLM_TENSOR_LAYER_OUTPUT:
+                    buft_list = pimpl->dev_output.buft_list;
+                    break;
+                case LLM_TENSOR_LAYER_REPEATING:
+                    buft_list = pimpl->dev_layer.at(tn.bid).buft_list;
+                    break;
+                default:
+                    GGML_ABORT("invalid layer %d for tensor %s", info.layer, tn.str().c_str());
+            }
+
+            // the sparse FFN of the CPU layers reads rows of ffn_up/ffn_gate directly, which rules out the repacked buffer types
+            if (params.sparse_ffn && op == GGML_OP_MUL_MAT && (tn.tensor == LLM_TENSOR_FFN_UP || tn.tensor == LLM_TENSOR_FFN_GATE) &&
+                ggml_backend_dev_type(pimpl->dev_layer.at(tn.bid).dev) == GGML_BACKEND_DEVICE_TYPE_CPU &&
+                ml.get_tensor_meta(LLM_TN(arch)(LLM_TENSOR_FFN_PRED_UP, "weight", tn.bid).str().c_str())) {
+                op = GGML_OP_MUL_MAT_SEL;
+            }
+
+            ggml_backend_buffer_type_t buft = nullptr;
+
+            // check overrides
+            if (ml.tensor_buft_overrides) {
+                std::string tensor_name = tn.str();
+                for (const auto * overrides = ml.tensor_buft_overrides; overrides->pattern != nullptr; ++overrides) {
+                    std::regex pattern(overrides->pattern);
+                    if (std::regex_search(tensor_name, pattern)) {
+                        if (overrides->buft == ggml_backend_cpu_buffer_type()) {
+                            // when overriding to a CPU buffer, consider the extra buffer types
+                            buft = select_weight_buft(hparams, t_meta, op, pimpl->cpu_buft_list);
+                        } else {
+                            buft = overrides->buft;
+                        }
+
+                        LLAMA_LOG_DEBUG("tensor %s (%zu MiB %s) buffer type overridden to %s\n",
+                                tensor_name.c_str(),
+                                ggml_nbytes(t_meta) / 1024 / 1024, ggml_type_name(t_meta->type),
+                                ggml_backend_buft_name(buft));
+                        break;
+                    }
+                }
+            }
+
+            if (!buft) {
+                buft = select_weight_buft(hparams, t_meta, op, *buft_list);
+                if (!buft) {
+                    throw std::runtime_error(format("failed to find a compatible buffer type for tensor %s", tn.str().c_str()));
+                }
+            }
+
+            // avoid using a host buffer when using mmap
+            auto * buft_dev = ggml_backend_buft_get_device(buft);
+            if (ml.use_mmap && buft_dev && buft == ggml_backend_dev_host_buffer_type(buft_dev)) {
+                auto * cpu_dev = ggml_backend_dev_by_type(GGML_BACKEND_DEVICE_TYPE_CPU);
+                if (!cpu_dev) {
+                    throw std::runtime_error("no CPU backend found");
+                }
+                buft = ggml_backend_dev_buffer_type(cpu_dev);
+            }
+
+            return buft;
+        };
+
+        // tensors that have already been created as views of a fused tensor
+        std::unordered_map<std::string, ggml_tensor *> fused_views;
+
         auto create_tensor = [&](const LLM_TN_IMPL & tn, const std::initializer_list<int64_t> & ne, int flags) -> ggml_tensor * {
+            {
+                auto it = fused_views.find(tn.str());
+                if (it != fused_views.end()) {
+                    ml.check_tensor_dims(it->first, ne, true);
+                    return it->second;
+                }
+            }
+
             ggml_tensor * t_meta = ml.get_tensor_meta(tn.str().c_str());
 
             if (!t_meta) {
@@ -2144,62 +2276,8 @@ bool llama_model::load_tensors(llama_model_loader & ml) {
                 }
             }
 
-            // select the buffer type for this tensor
-            buft_list_t * buft_list;
-            switch (info.layer) {
-                case LLM_TENSOR_LAYER_INPUT:
-                    buft_list = pimpl->dev_input.buft_list;
-                    break;
-                case LLM_TENSOR_LAYER_OUTPUT:
-                    buft_list = pimpl->dev_output.buft_list;
-                    break;
-                case LLM_TENSOR_LAYER_REPEATING:
-                    buft_list = pimpl->dev_layer.at(tn.bid).buft_list;
-                    break;
-                default:
-                    GGML_ABORT("invalid layer %d for tensor %s", info.layer, tn.str().c_str());
-            }
-
-            ggml_backend_buffer_type_t buft = nullptr;
-
-            // check overrides
-            if (ml.tensor_buft_overrides) {
-                std::string tensor_name = tn.str();
-                for (const auto * overrides = ml.tensor_buft_overrides; overrides->pattern != nullptr; ++overrides) {
-                    std::regex pattern(overrides->pattern);
-                    if (std::regex_search(tensor_name, pattern)) {
-                        if (overrides->buft == ggml_backend_cpu_buffer_type()) {
-                            // when overriding to a CPU buffer, consider the extra buffer types
-                            buft = select_weight_buft(hparams, t_meta, op, pimpl->cpu_buft_list);
-                        } else {
-                            buft = overrides->buft;
-                        }
-
-                        LLAMA_LOG_DEBUG("tensor %s (%zu MiB %s) buffer type overridden to %s\n",
-                                tensor_name.c_str(),
-                                ggml_nbytes(t_meta) / 1024 / 1024, ggml_type_name(t_meta->type),
-                                ggml_backend_buft_name(buft));
-                        break;
-                    }
-                }
-            }
-
-            if (!buft) {
-                buft = select_weight_buft(hparams, t_meta, op, *buft_list);
-                if (!buft) {
-                    throw std::runtime_error(format("failed to find a compatible buffer type for tensor %s", tn.str().c_str()));
-                }
-            }
-
-            // avoid using a host buffer when using mmap
-            auto * buft_dev = ggml_backend_buft_get_device(buft);
-            if (ml.use_mmap && buft_dev && buft == ggml_backend_dev_host_buffer_type(buft_dev)) {
-                auto * cpu_dev = ggml_backend_dev_by_type(GGML_BACKEND_DEVICE_TYPE_CPU);
-                if (!cpu_dev) {
-                    throw std::runtime_error("no CPU backend found");
-                }
-                buft = ggml_backend_dev_buffer_type(cpu_dev);
-            }
+            buft_list_t * buft_list = nullptr;
+            ggml_backend_buffer_type_t buft = select_tensor_buft(tn, t_meta, op, info, buft_list);
 
             if (buft != buft_list->front().second) {
                 n_moved_tensors++;
@@ -2226,6 +2304,97 @@ bool llama_model::load_tensors(llama_model_loader & ml) {
 
         // TODO: move to a separate function
         const auto tn = LLM_TN(arch);
+
+        // load-time fusion of weights that are multiplied with the same input
+        // the fused tensor is allocated in its own context and the original tensors are created as views of it,
+        // so that the data of each part is loaded directly into the fused buffer (and repacked for the CPU extra buffer types)
+        // returns nullptr if the parts are not compatible
+        auto create_fused_tensor = [&](const std::string & name, const std::vector<LLM_TN_IMPL> & parts, ggml_op op) -> ggml_tensor * {
+            std::vector<ggml_tensor *> metas;
+            ggml_backend_buffer_type_t buft = nullptr;
+
+            for (const auto & part : parts) {
+                ggml_tensor * t_meta = ml.get_tensor_meta(part.str().c_str());
+                if (!t_meta || ggml_n_dims(t_meta) > 2) {
+                    return nullptr;
+                }
+
+                const bool is_bias = ggml_n_dims(t_meta) == 1;
+                if (!metas.empty() && (t_meta->type != metas[0]->type || (!is_bias && t_meta->ne[0] != metas[0]->ne[0]))) {
+                    return nullptr;
+                }
+
+                // the repacked layouts interleave up to 8 rows, each part must start at a row group boundary
+                if (!is_bias && t_meta->ne[1] % 8 != 0) {
+                    return nullptr;
+                }
+
+                buft_list_t * buft_list = nullptr;
+                ggml_backend_buffer_type_t part_buft = select_tensor_buft(part, t_meta, op, llm_tensor_info_for(part.tensor), buft_list);
+                if (buft && part_buft != buft) {
+                    return nullptr;
+                }
+                buft = part_buft;
+
+                metas.push_back(t_meta);
+            }
+
+            ggml_context * ctx = ctx_for_buft_fused(buft);
+
+            const bool is_bias = ggml_n_dims(metas[0]) == 1;
+
+            int64_t ne_fused = 0;
+            for (const auto * t_meta : metas) {
+                ne_fused += is_bias ? t_meta->ne[0] : t_meta->ne[1];
+            }
+
+            ggml_tensor * fused = is_bias
+                ? ggml_new_tensor_1d(ctx, metas[0]->type, ne_fused)
+                : ggml_new_tensor_2d(ctx, metas[0]->type, metas[0]->ne[0], ne_fused);
+            ggml_set_name(fused, name.c_str());
+
+            size_t offset = 0;
+            for (size_t i = 0; i < parts.size(); ++i) {
+                const std::string part_name = parts[i].str();
+                fused_views[part_name] = ml.create_tensor_as_view(ctx, fused, part_name, { metas[i]->ne[0], metas[i]->ne[1] }, offset);
+                offset += ggml_nbytes(metas[i]);
+            }
+
+            return fused;
+        };
+
+        if (fuse_weights) {
+            int n_fused = 0;
+
+            for (int i = 0; i < n_layer; ++i) {
+                auto & layer = layers[i];
+
+                const auto has_tensor = [&](const LLM_TN_IMPL & t) {
+                    return ml.get_tensor_meta(t.str().c_str()) != nullptr;
+                };
+
+                // Q, K, V - the biases (if any) are fused as well
+                const int n_qkv_b = has_tensor(tn(LLM_TENSOR_ATTN_Q, "bias", i)) + has_tensor(tn(LLM_TENSOR_ATTN_K, "bias", i)) + has_tensor(tn(LLM_TENSOR_ATTN_V, "bias", i));
+                if (n_qkv_b == 3) {
+                    layer.bqkv = create_fused_tensor(format("blk.%d.attn_qkv_fused.bias", i),
+                            { tn(LLM_TENSOR_ATTN_Q, "bias", i), tn(LLM_TENSOR_ATTN_K, "bias", i), tn(LLM_TENSOR_ATTN_V, "bias", i) }, GGML_OP_ADD);
+                }
+                if (n_qkv_b == 0 || layer.bqkv) {
+                    layer.wqkv = create_fused_tensor(format("blk.%d.attn_qkv_fused.weight", i),
+                            { tn(LLM_TENSOR_ATTN_Q, "weight", i), tn(LLM_TENSOR_ATTN_K, "weight", i), tn(LLM_TENSOR_ATTN_V, "weight", i) }, GGML_OP_MUL_MAT);
+                }
+
+                // gate, up - the order matches the split done by ggml_swiglu
+                if (!has_tensor(tn(LLM_TENSOR_FFN_GATE, "bias", i)) && !has_tensor(tn(LLM_TENSOR_FFN_UP, "bias", i))) {
+                    layer.ffn_gate_up = create_fused_tensor(format("blk.%d.ffn_gate_up_fused.weight", i),
+                            { tn(LLM_TENSOR_FFN_GATE, "weight", i), tn(LLM_TENSOR_FFN_UP, "weight", i) }, GGML_OP_MUL_MAT);
+                }
+
+                n_fused += (layer.wqkv != nullptr) + (layer.ffn_gate_up != nullptr);
+            }
+
+            LLAMA_LOG_INFO("%s: fused %d weight groups\n", __func__, n_fused);
+        }
         switch (arch) {
             case LLM_ARCH_LLAMA:
             case LLM_ARCH_REFACT:
@@ -2279,6 +2448,17 @@ bool llama_model::load_tensors(llama_model_loader & ml) {
                             layer.ffn_gate_b = create_tensor(tn(LLM_TENSOR_FFN_GATE, "bias", i), {n_ff}, TENSOR_NOT_REQUIRED);
                             layer.ffn_down_b = create_tensor(tn(LLM_TENSOR_FFN_DOWN, "bias", i), {n_embd}, TENSOR_NOT_REQUIRED);
                             layer.ffn_up_b   = create_tensor(tn(LLM_TENSOR_FFN_UP,   "bias", i), {n_ff}, TENSOR_NOT_REQUIRED);
+
+                            // optional activation predictor for the sparse FFN, not loaded unless requested
+                            const ggml_tensor * pred_meta = ml.get_tensor_meta(tn(LLM_TENSOR_FFN_PRED_UP, "weight", i).str().c_str());
+                            if (pred_meta) {
+                                const int64_t n_pred = pred_meta->ne[1];
+                                const int     skip   = params.sparse_ffn ? 0 : TENSOR_SKIP;
+
+                                layer.ffn_pred_up   = create_tensor(tn(LLM_TENSOR_FFN_PRED_UP,   "weight", i), {n_embd, n_pred}, skip);
+                                layer.ffn_pred_down = create_tensor(tn(LLM_TENSOR_FFN_PRED_DOWN, "weight", i), {n_pred,   n_ff}, skip);
+                                layer.ffn_down_t    = create_tensor(tn(LLM_TENSOR_FFN_DOWN_T,    "weight", i), {n_embd,   n_ff}, skip);
+                            }
                         } else {
                             layer.ffn_gate_inp  = create_tensor(tn(LLM_TENSOR_FFN_GATE_INP,  "weight", i), {n_embd, n_expert}, 0);
                             layer.ffn_gate_exps = create_tensor(tn(LLM_TENSOR_FFN_GATE_EXPS, "weight", i), {n_embd,   n_ff, n_expert}, TENSOR_NOT_REQUIRED);
@@ -3042,6 +3222,9 @@ bool llama_model::load_tensors(llama_model_loader & ml) {
                         output = create_tensor(tn(LLM_TENSOR_TOKEN_EMBD, "weight"), {n_embd, n_vocab}, TENSOR_DUPLICATED);
                     }
 
+                    // output rerank head (decoder-based rerankers)
+                    cls_out = create_tensor(tn(LLM_TENSOR_CLS_OUT, "weight"), {n_embd, hparams.n_cls_out}, TENSOR_NOT_REQUIRED);
+
                     for (int i = 0; i < n_layer; ++i) {
                         auto & layer = layers[i];
 
@@ -5711,21 +5894,27 @@ bool llama_model::load_tensors(llama_model_loader & ml) {
 
     ml.done_getting_tensors();
 
-    ml.init_mappings(true, use_mlock ? &pimpl->mlock_mmaps : nullptr);
+    // when streaming, the weights are read layer by layer during the computation instead of all at once
+    ml.init_mappings(!params.stream_weights, use_mlock ? &pimpl->mlock_mmaps : nullptr);
     pimpl->mappings.reserve(ml.mappings.size());
 
     // create the backend buffers
+    std::vector<std::pair<ggml_backend_buffer_type_t, ggml_context *>> ctx_list(ctx_map.begin(), ctx_map.end());
+    ctx_list.insert(ctx_list.end(), ctx_map_fused.begin(), ctx_map_fused.end());
+
     std::vector<std::pair<ggml_context *, llama_buf_map>> ctx_bufs;
-    ctx_bufs.reserve(ctx_map.size());
+    ctx_bufs.reserve(ctx_list.size());
 
     // Ensure we have enough capacity for the maximum backend buffer we will potentially create
-    const size_t n_max_backend_buffer = ctx_map.size() * ml.files.size();
+    const size_t n_max_backend_buffer = ctx_list.size() * ml.files.size();
     pimpl->bufs.reserve(n_max_backend_buffer);
 
-    for (auto & it : ctx_map) {
+    for (auto & it : ctx_list) {
         ggml_backend_buffer_type_t buft = it.first;
         ggml_context * ctx              = it.second;
 
+        const bool is_fused = ctx_map_fused.count(buft) && ctx_map_fused.at(buft) == ctx;
+
         // skip contexts without tensors
         if (ggml_get_first_tensor(ctx) == nullptr) {
             continue;
@@ -5748,7 +5937,7 @@ bool llama_model::load_tensors(llama_model_loader & ml) {
         bool buffer_from_host_ptr_supported = props.caps.buffer_from_host_ptr;
         bool is_default_buft = buft == ggml_backend_dev_buffer_type(dev);
 
-        if (ml.use_mmap && use_mmap_buffer && buffer_from_host_ptr_supported && is_default_buft) {
+        if (ml.use_mmap && use_mmap_buffer && buffer_from_host_ptr_supported && is_default_buft && !is_fused) {
             for (uint32_t idx = 0; idx < ml.files.size(); idx++) {
                 // only the mmap region containing the tensors in the model is mapped to the backend buffer
                 // this is important for metal with apple silicon: if the entire model could be mapped to a metal buffer, then we could just use metal for all layers
@@ -5839,9 +6028,96 @@ bool llama_model::load_tensors(llama_model_loader & ml) {
         }
     }
 
+    if (params.stream_weights) {
+        init_weight_ranges();
+    }
+
     return true;
 }
 
+void llama_model::init_weight_ranges() {
+    // one unit per layer + one for the output tensors
+    pimpl->weight_ranges.assign(hparams.n_layer + 1, {});
+
+    size_t n_mapped = 0;
+
+    for (const auto & it : tensors_by_name) {
+        const std::string & name = it.first;
+        const ggml_tensor  * t   = it.second;
+
+        // the token embeddings are only accessed sparsely by get_rows
+        if (name.rfind("token_embd.", 0) == 0) {
+            continue;
+        }
+
+        int il = hparams.n_layer;
+        if (std::sscanf(name.c_str(), "blk.%d.", &il) == 1 && (il < 0 || il >= (int) hparams.n_layer)) {
+            continue;
+        }
+
+        // only the tensors that are used directly from the mapped files can be streamed
+        for (size_t idx = 0; idx < pimpl->mappings.size(); ++idx) {
+            const auto & mapping = pimpl->mappings[idx];
+
+            const uint8_t * addr = (const uint8_t *) mapping->addr();
+            const uint8_t * data = (const uint8_t *) t->data;
+
+            if (data < addr || data >= addr + mapping->size()) {
+                continue;
+            }
+
+            const size_t first = data - addr;
+            const size_t last  = first + ggml_nbytes(t);
+
+            auto & ranges = pimpl->weight_ranges[il];
+
+            auto rit = std::find_if(ranges.begin(), ranges.end(), [&](const weight_range & r) { return r.idx == idx; });
+            if (rit == ranges.end()) {
+                ranges.push_back({ idx, first, last });
+            } else {
+                rit->first = std::min(rit->first, first);
+                rit->last  = std::max(rit->last,  last);
+            }
+
+            n_mapped += ggml_nbytes(t);
+            break;
+        }
+    }
+
+    if (n_mapped == 0) {
+        // e.g. --no-mmap, or all the weights were copied to device buffers
+        LLAMA_LOG_WARN("%s: no memory-mapped weights to stream\n", __func__);
+        pimpl->weight_ranges.clear();
+        return;
+    }
+
+    LLAMA_LOG_INFO("%s: streaming %.2f MiB of memory-mapped weights\n", __func__, n_mapped/1024.0/1024.0);
+}
+
+void llama_model::prefetch_weights(int il) const {
+    if (il < 0 || il >= (int) pimpl->weight_ranges.size()) {
+        return;
+    }
+
+    for (const auto & r : pimpl->weight_ranges[il]) {
+        pimpl->mappings[r.idx]->prefetch(r.first, r.last - r.first);
+    }
+}
+
+void llama_model::release_weights(int il) const {
+    if (il < 0 || il >= (int) pimpl->weight_ranges.size()) {
+        return;
+    }
+
+    for (const auto & r : pimpl->weight_ranges[il]) {
+        pimpl->mappings[r.idx]->release(r.first, r.last - r.first);
+    }
+}
+
+bool llama_model::has_weight_ranges() const {
+    return !pimpl->weight_ranges.empty();
+}
+
 std::string llama_model::arch_name() const {
     return llm_arch_name(arch);
 }
@@ -6165,30 +6441,48 @@ struct llm_build_llama : public llm_graph_context {
                 ggml_tensor * rope_factors = model.get_rope_factors(cparams, il);
 
                 // compute Q and K and RoPE them
-                ggml_tensor * Qcur = build_lora_mm(model.layers[il].wq, cur);
-                cb(Qcur, "Qcur", il);
-                if (model.layers[il].bq) {
-                    Qcur = ggml_add(ctx0, Qcur, model.layers[il].bq);
+                ggml_tensor * Qcur = nullptr;
+                ggml_tensor * Kcur = nullptr;
+                ggml_tensor * Vcur = nullptr;
+
+                if (can_use_fused(model.layers[il].wqkv, { model.layers[il].wq, model.layers[il].wk, model.layers[il].wv })) {
+                    ggml_tensor * qkv = build_lora_mm(model.layers[il].wqkv, cur);
+                    cb(qkv, "wqkv", il);
+                    if (model.layers[il].bqkv) {
+                        qkv = ggml_add(ctx0, qkv, model.layers[il].bqkv);
+                        cb(qkv, "bqkv", il);
+                    }
+
+                    Qcur = ggml_view_3d(ctx0, qkv, n_embd_head, n_head,    n_tokens, n_embd_head*sizeof(float), qkv->nb[1], 0);
+                    Kcur = ggml_view_3d(ctx0, qkv, n_embd_head, n_head_kv, n_tokens, n_embd_head*sizeof(float), qkv->nb[1], n_embd_head*n_head*sizeof(float));
+                    Vcur = ggml_view_2d(ctx0, qkv, n_embd_head*n_head_kv, n_tokens, qkv->nb[1], n_embd_head*(n_head + n_head_kv)*sizeof(float));
+                    Vcur = ggml_cont_3d(ctx0, Vcur, n_embd_head, n_head_kv, n_tokens);
+                } else {
+                    Qcur = build_lora_mm(model.layers[il].wq, cur);
                     cb(Qcur, "Qcur", il);
-                }
+                    if (model.layers[il].bq) {
+                        Qcur = ggml_add(ctx0, Qcur, model.layers[il].bq);
+                        cb(Qcur, "Qcur", il);
+                    }
 
-                ggml_tensor * Kcur = build_lora_mm(model.layers[il].wk, cur);
-                cb(Kcur, "Kcur", il);
-                if (model.layers[il].bk) {
-                    Kcur = ggml_add(ctx0, Kcur, model.layers[il].bk);
+                    Kcur = build_lora_mm(model.layers[il].wk, cur);
                     cb(Kcur, "Kcur", il);
-                }
+                    if (model.layers[il].bk) {
+                        Kcur = ggml_add(ctx0, Kcur, model.layers[il].bk);
+                        cb(Kcur, "Kcur", il);
+                    }
 
-                ggml_tensor * Vcur = build_lora_mm(model.layers[il].wv, cur);
-                cb(Vcur, "Vcur", il);
-                if (model.layers[il].bv) {
-                    Vcur = ggml_add(ctx0, Vcur, model.layers[il].bv);
+                    Vcur = build_lora_mm(model.layers[il].wv, cur);
                     cb(Vcur, "Vcur", il);
-                }
+                    if (model.layers[il].bv) {
+                        Vcur = ggml_add(ctx0, Vcur, model.layers[il].bv);
+                        cb(Vcur, "Vcur", il);
+                    }
 
-                Qcur = ggml_reshape_3d(ctx0, Qcur, n_embd_head, n_head,    n_tokens);
-                Kcur = ggml_reshape_3d(ctx0, Kcur, n_embd_head, n_head_kv, n_tokens);
-                Vcur = ggml_reshape_3d(ctx0, Vcur, n_embd_head, n_head_kv, n_tokens);
+                    Qcur = ggml_reshape_3d(ctx0, Qcur, n_embd_head, n_head,    n_tokens);
+                    Kcur = ggml_reshape_3d(ctx0, Kcur, n_embd_head, n_head_kv, n_tokens);
+                    Vcur = ggml_reshape_3d(ctx0, Vcur, n_embd_head, n_head_kv, n_tokens);
+                }
 
                 Qcur = ggml_rope_ext(
                         ctx0, Qcur, inp_pos, rope_factors,
@@ -6228,12 +6522,25 @@ struct llm_build_llama : public llm_graph_context {
                         LLM_NORM_RMS, il);
                 cb(cur, "ffn_norm", il);
 
-                cur = build_ffn(cur,
-                        model.layers[il].ffn_up,   model.layers[il].ffn_up_b,   NULL,
-                        model.layers[il].ffn_gate, model.layers[il].ffn_gate_b, NULL,
-                        model.layers[il].ffn_down, model.layers[il].ffn_down_b, NULL,
-                        NULL,
-                        LLM_FFN_SILU, LLM_FFN_PAR, il);
+                // the sparse FFN uses the separate gate/up weights
+                const bool sparse_ffn = cparams.sparse_ffn > 0.0f && model.layers[il].ffn_pred_up;
+
+                if (!sparse_ffn && can_use_fused(model.layers[il].ffn_gate_up, { model.layers[il].ffn_gate, model.layers[il].ffn_up })) {
+                    cur = build_ffn(cur,
+                            model.layers[il].ffn_gate_up, NULL,                        NULL,
+                            NULL,                         NULL,                        NULL,
+                            model.layers[il].ffn_down,    model.layers[il].ffn_down_b, NULL,
+                            NULL,
+                            LLM_FFN_SWIGLU, LLM_FFN_SEQ, il);
+                } else {
+                    cur = build_ffn(cur,
+                            model.layers[il].ffn_up,   model.layers[il].ffn_up_b,   NULL,
+                            model.layers[il].ffn_gate, model.layers[il].ffn_gate_b, NULL,
+                            model.layers[il].ffn_down, model.layers[il].ffn_down_b, NULL,
+                            NULL,
+                            LLM_FFN_SILU, LLM_FFN_PAR, il,
+                            model.layers[il].ffn_pred_up, model.layers[il].ffn_pred_down, model.layers[il].ffn_down_t);
+                }
                 cb(cur, "ffn_out", il);
             } else {
                 // MoE branch
@@ -8330,21 +8637,39 @@ struct llm_build_qwen2 : public llm_graph_context {
             // self-attention
             {
                 // compute Q and K and RoPE them
-                ggml_tensor * Qcur = build_lora_mm(model.layers[il].wq, cur);
-                Qcur = ggml_add(ctx0, Qcur, model.layers[il].bq);
-                cb(Qcur, "Qcur", il);
+                ggml_tensor * Qcur = nullptr;
+                ggml_tensor * Kcur = nullptr;
+                ggml_tensor * Vcur = nullptr;
 
-                ggml_tensor * Kcur = build_lora_mm(model.layers[il].wk, cur);
-                Kcur = ggml_add(ctx0, Kcur, model.layers[il].bk);
-                cb(Kcur, "Kcur", il);
+                if (can_use_fused(model.layers[il].wqkv, { model.layers[il].wq, model.layers[il].wk, model.layers[il].wv })) {
+                    ggml_tensor * qkv = build_lora_mm(model.layers[il].wqkv, cur);
+                    cb(qkv, "wqkv", il);
+                    if (model.layers[il].bqkv) {
+                        qkv = ggml_add(ctx0, qkv, model.layers[il].bqkv);
+                        cb(qkv, "bqkv", il);
+                    }
 
-                ggml_tensor * Vcur = build_lora_mm(model.layers[il].wv, cur);
-                Vcur = ggml_add(ctx0, Vcur, model.layers[il].bv);
-                cb(Vcur, "Vcur", il);
+                    Qcur = ggml_view_3d(ctx0, qkv, n_embd_head, n_head,    n_tokens, n_embd_head*sizeof(float), qkv->nb[1], 0);
+                    Kcur = ggml_view_3d(ctx0, qkv, n_embd_head, n_head_kv, n_tokens, n_embd_head*sizeof(float), qkv->nb[1], n_embd_head*n_head*sizeof(float));
+                    Vcur = ggml_view_2d(ctx0, qkv, n_embd_head*n_head_kv, n_tokens, qkv->nb[1], n_embd_head*(n_head + n_head_kv)*sizeof(float));
+                    Vcur = ggml_cont_3d(ctx0, Vcur, n_embd_head, n_head_kv, n_tokens);
+                } else {
+                    Qcur = build_lora_mm(model.layers[il].wq, cur);
+                    Qcur = ggml_add(ctx0, Qcur, model.layers[il].bq);
+                    cb(Qcur, "Qcur", il);
 
-                Qcur = ggml_reshape_3d(ctx0, Qcur, n_embd_head, n_head,    n_tokens);
-                Kcur = ggml_reshape_3d(ctx0, Kcur, n_embd_head, n_head_kv, n_tokens);
-                Vcur = ggml_reshape_3d(ctx0, Vcur, n_embd_head, n_head_kv, n_tokens);
+                    Kcur = build_lora_mm(model.layers[il].wk, cur);
+                    Kcur = ggml_add(ctx0, Kcur, model.layers[il].bk);
+                    cb(Kcur, "Kcur", il);
+
+                    Vcur = build_lora_mm(model.layers[il].wv, cur);
+                    Vcur = ggml_add(ctx0, Vcur, model.layers[il].bv);
+                    cb(Vcur, "Vcur", il);
+
+                    Qcur = ggml_reshape_3d(ctx0, Qcur, n_embd_head, n_head,    n_tokens);
+                    Kcur = ggml_reshape_3d(ctx0, Kcur, n_embd_head, n_head_kv, n_tokens);
+                    Vcur = ggml_reshape_3d(ctx0, Vcur, n_embd_head, n_head_kv, n_tokens);
+                }
 
                 Qcur = ggml_rope_ext(
                         ctx0, Qcur, inp_pos, nullptr,
@@ -8381,12 +8706,21 @@ struct llm_build_qwen2 : public llm_graph_context {
                     LLM_NORM_RMS, il);
             cb(cur, "ffn_norm", il);
 
-            cur = build_ffn(cur,
-                    model.layers[il].ffn_up,   NULL, NULL,
-                    model.layers[il].ffn_gate, NULL, NULL,
-                    model.layers[il].ffn_down, NULL, NULL,
-                    NULL,
-                    LLM_FFN_SILU, LLM_FFN_PAR, il);
+            if (can_use_fused(model.layers[il].ffn_gate_up, { model.layers[il].ffn_gate, model.layers[il].ffn_up })) {
+                cur = build_ffn(cur,
+                        model.layers[il].ffn_gate_up, NULL, NULL,
+                        NULL,                         NULL, NULL,
+                        model.layers[il].ffn_down,    NULL, NULL,
+                        NULL,
+                        LLM_FFN_SWIGLU, LLM_FFN_SEQ, il);
+            } else {
+                cur = build_ffn(cur,
+                        model.layers[il].ffn_up,   NULL, NULL,
+                        model.layers[il].ffn_gate, NULL, NULL,
+                        model.layers[il].ffn_down, NULL, NULL,
+                        NULL,
+                        LLM_FFN_SILU, LLM_FFN_PAR, il);
+            }
             cb(cur, "ffn_out", il);
 
             cur = ggml_add(ctx0, cur, ffn_inp);
@@ -8937,18 +9271,36 @@ struct llm_build_qwen3 : public llm_graph_context {
             // self-attention
             {
                 // compute Q and K and RoPE them
-                ggml_tensor * Qcur = build_lora_mm(model.layers[il].wq, cur);
-                cb(Qcur, "Qcur", il);
+                ggml_tensor * Qcur = nullptr;
+                ggml_tensor * Kcur = nullptr;
+                ggml_tensor * Vcur = nullptr;
 
-                ggml_tensor * Kcur = build_lora_mm(model.layers[il].wk, cur);
-                cb(Kcur, "Kcur", il);
+                if (can_use_fused(model.layers[il].wqkv, { model.layers[il].wq, model.layers[il].wk, model.layers[il].wv })) {
+                    ggml_tensor * qkv = build_lora_mm(model.layers[il].wqkv, cur);
+                    cb(qkv, "wqkv", il);
+                    if (model.layers[il].bqkv) {
+                        qkv = ggml_add(ctx0, qkv, model.layers[il].bqkv);
+                        cb(qkv, "bqkv", il);
+                    }
 
-                ggml_tensor * Vcur = build_lora_mm(model.layers[il].wv, cur);
-                cb(Vcur, "Vcur", il);
+                    Qcur = ggml_view_3d(ctx0, qkv, n_embd_head, n_head,    n_tokens, n_embd_head*sizeof(float), qkv->nb[1], 0);
+                    Kcur = ggml_view_3d(ctx0, qkv, n_embd_head, n_head_kv, n_tokens, n_embd_head*sizeof(float), qkv->nb[1], n_embd_head*n_head*sizeof(float));
+                    Vcur = ggml_view_2d(ctx0, qkv, n_embd_head*n_head_kv, n_tokens, qkv->nb[1], n_embd_head*(n_head + n_head_kv)*sizeof(float));
+                    Vcur = ggml_cont_3d(ctx0, Vcur, n_embd_head, n_head_kv, n_tokens);
+                } else {
+                    Qcur = build_lora_mm(model.layers[il].wq, cur);
+                    cb(Qcur, "Qcur", il);
 
-                Qcur = ggml_reshape_3d(ctx0, Qcur, n_embd_head, n_head,    n_tokens);
-                Kcur = ggml_reshape_3d(ctx0, Kcur, n_embd_head, n_head_kv, n_tokens);
-                Vcur = ggml_reshape_3d(ctx0, Vcur, n_embd_head, n_head_kv, n_tokens);
+                    Kcur = build_lora_mm(model.layers[il].wk, cur);
+                    cb(Kcur, "Kcur", il);
+
+                    Vcur = build_lora_mm(model.layers[il].wv, cur);
+                    cb(Vcur, "Vcur", il);
+
+                    Qcur = ggml_reshape_3d(ctx0, Qcur, n_embd_head, n_head,    n_tokens);
+                    Kcur = ggml_reshape_3d(ctx0, Kcur, n_embd_head, n_head_kv, n_tokens);
+                    Vcur = ggml_reshape_3d(ctx0, Vcur, n_embd_head, n_head_kv, n_tokens);
+                }
 
                 Qcur = build_norm(Qcur, model.layers[il].attn_q_norm, NULL, LLM_NORM_RMS, il);
                 cb(Qcur, "Qcur_normed", il);
@@ -8991,12 +9343,21 @@ struct llm_build_qwen3 : public llm_graph_context {
                     LLM_NORM_RMS, il);
             cb(cur, "ffn_norm", il);
 
-            cur = build_ffn(cur,
-                    model.layers[il].ffn_up,   NULL, NULL,
-                    model.layers[il].ffn_gate, NULL, NULL,
-                    model.layers[il].ffn_down, NULL, NULL,
-                    NULL,
-                    LLM_FFN_SILU, LLM_FFN_PAR, il);
+            if (can_use_fused(model.layers[il].ffn_gate_up, { model.layers[il].ffn_gate, model.layers[il].ffn_up })) {
+                cur = build_ffn(cur,
+                        model.layers[il].ffn_gate_up, NULL, NULL,
+                        NULL,                         NULL, NULL,
+                        model.layers[il].ffn_down,    NULL, NULL,
+                        NULL,
+                        LLM_FFN_SWIGLU, LLM_FFN_SEQ, il);
+            } else {
+                cur = build_ffn(cur,
+                        model.layers[il].ffn_up,   NULL, NULL,
+                        model.layers[il].ffn_gate, NULL, NULL,
+                        model.layers[il].ffn_down, NULL, NULL,
+                        NULL,
+                        LLM_FFN_SILU, LLM_FFN_PAR, il);
+            }
             cb(cur, "ffn_out", il);
 
             cur = ggml_add(ctx0, cur, ffn_inp);
@@ -18521,6 +18882,10 @@ llama_memory_i * llama_model::create_memory(const llama_memory_params & params,
 
                     cparams.n_ctx = GGML_PAD(cparams.n_ctx, padding);
 
+                    if (!params.kv_path.empty()) {
+                        LLAMA_LOG_WARN("%s: file-backed KV cache is not supported for hybrid models - using RAM\n", __func__);
+                    }
+
                     res = new llama_memory_hybrid(
                         /* model             */ *this,
                         /* attn_type_k       */ params.type_k,
@@ -18583,6 +18948,7 @@ llama_memory_i * llama_model::create_memory(const llama_memory_params & params,
                                 cparams.n_seq_max,
                                 cparams.n_ubatch,
                                 padding,
+                                params.kv_path,
                                 nullptr,
                                 reuse);
                     } else {
@@ -18600,6 +18966,7 @@ llama_memory_i * llama_model::create_memory(const llama_memory_params & params,
                                 padding,
                                 hparams.n_swa,
                                 hparams.swa_type,
+                                params.kv_path,
                                 nullptr,
                                 nullptr);
                     }
@@ -19006,6 +19373,9 @@ llama_model_params llama_model_default_params() {
         /*.use_mlock                   =*/ false,
         /*.check_tensors               =*/ false,
         /*.use_extra_bufts             =*/ true,
+        /*.fuse_weights                =*/ false,
+        /*.stream_weights              =*/ false,
+        /*.sparse_ffn                  =*/ false,
     };
 
     return result;
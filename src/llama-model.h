@@ -251,6 +251,7 @@ struct llama_layer {
     struct ggml_tensor * ffn_gate     = nullptr; // w1
     struct ggml_tensor * ffn_down     = nullptr; // w2
     struct ggml_tensor * ffn_up       = nullptr; // w3
+    struct ggml_tensor * ffn_gate_up  = nullptr; // w1 and w3 fused at load time
     struct ggml_tensor * ffn_gate_enc = nullptr;
     struct ggml_tensor * ffn_down_enc = nullptr;
     struct ggml_tensor * ffn_up_enc   = nullptr;
@@ -265,6 +266,11 @@ struct llama_layer {
     struct ggml_tensor * ffn_down_exps_b = nullptr;
     struct ggml_tensor * ffn_up_exps_b   = nullptr;
 
+    // ff sparse (activation predictor and transposed down projection)
+    struct ggml_tensor * ffn_pred_up   = nullptr;
+    struct ggml_tensor * ffn_pred_down = nullptr;
+    struct ggml_tensor * ffn_down_t    = nullptr;
+
     // ff shared expert (shexp)
     struct ggml_tensor * ffn_gate_inp_shexp = nullptr;
     struct ggml_tensor * ffn_gate_shexp     = nullptr;
@@ -468,6 +474,12 @@ struct llama_model {
 
     const struct ggml_tensor * get_tensor(const char * name) const;
 
+    // weight streaming: hint the OS to read ahead or to deprioritize the memory-mapped weights of a layer
+    // il == n_layer refers to the output tensors
+    bool has_weight_ranges() const;
+    void prefetch_weights(int il) const;
+    void release_weights (int il) const;
+
     float get_rope_freq_base (const llama_cparams & cparams, int il) const;
     float get_rope_freq_scale(const llama_cparams & cparams, int il) const;
 
@@ -483,6 +495,14 @@ struct llama_model {
 private:
     struct impl;
     std::unique_ptr<impl> pimpl;
+
+    struct weight_range {
+        size_t idx;   // index of the mapped file
+        size_t first; // byte range in the file
+        size_t last;
+    };
+
+    void init_weight_ranges();
 };
 
 const char * llm_type_name(llm_type type);
@@ -32,6 +32,7 @@
 #include <ctime>
 #include <future>
 #include <memory>
+#include <numeric>
 #include <random>
 #include <regex>
 #include <string>
@@ -282,6 +283,15 @@ static std::string var_to_str(ggml_scale_mode mode) {
     }
 }
 
+static std::string var_to_str(ggml_moe_gating gating) {
+    switch (gating) {
+        case GGML_MOE_GATING_SOFTMAX:        return "softmax";
+        case GGML_MOE_GATING_SIGMOID:        return "sigmoid";
+        case GGML_MOE_GATING_SOFTMAX_WEIGHT: return "softmax_weight";
+        default:                             return std::to_string(gating);
+    }
+}
+
 #define VAR_TO_STR(x) (#x "=" + var_to_str(x))
 
 #define VARS_TO_STR1(a) VAR_TO_STR(a)
@@ -3407,6 +3417,106 @@ struct test_out_prod : public test_case {
     }
 };
 
+// fills I32 tensors with distinct row indices in [0, n_rows) in random order
+static void init_sel_ids(ggml_context * ctx, int64_t n_rows) {
+    std::random_device rd;
+    std::default_random_engine rng(rd());
+    for (ggml_tensor * t = ggml_get_first_tensor(ctx); t != NULL; t = ggml_get_next_tensor(ctx, t)) {
+        if (t->type == GGML_TYPE_I32) {
+            std::vector<int32_t> all(n_rows);
+            std::iota(all.begin(), all.end(), 0);
+            for (int64_t r = 0; r < ggml_nrows(t); r++) {
+                std::shuffle(all.begin(), all.end(), rng);
+                ggml_backend_tensor_set(t, all.data(), r * t->nb[1], t->ne[0] * sizeof(int32_t));
+            }
+        } else {
+            init_tensor_uniform(t);
+        }
+    }
+}
+
+// GGML_OP_MUL_MAT_SEL
+struct test_mul_mat_sel : public test_case {
+    const ggml_type type_a;
+    const int64_t k;     // row length
+    const int64_t m;     // number of rows of a
+    const int64_t n_sel; // selected rows per column of b
+    const int64_t n;     // columns of b
+
+    std::string vars() override {
+        return VARS_TO_STR5(type_a, k, m, n_sel, n);
+    }
+
+    double max_nmse_err() override {
+        return 5e-4;
+    }
+
+    test_mul_mat_sel(ggml_type type_a = GGML_TYPE_F32, int64_t k = 256, int64_t m = 64, int64_t n_sel = 16, int64_t n = 3)
+        : type_a(type_a), k(k), m(m), n_sel(n_sel), n(n) {}
+
+    ggml_tensor * build_graph(ggml_context * ctx) override {
+        ggml_tensor * a = ggml_new_tensor_2d(ctx, type_a, k, m);
+        ggml_set_name(a, "a");
+
+        ggml_tensor * b = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, k, n);
+        ggml_set_name(b, "b");
+
+        ggml_tensor * ids = ggml_new_tensor_2d(ctx, GGML_TYPE_I32, n_sel, n);
+        ggml_set_name(ids, "ids");
+
+        ggml_tensor * out = ggml_mul_mat_sel(ctx, a, b, ids);
+        ggml_set_name(out, "out");
+
+        return out;
+    }
+
+    void initialize_tensors(ggml_context * ctx) override {
+        init_sel_ids(ctx, m);
+    }
+};
+
+// GGML_OP_OUT_PROD_SEL
+struct test_out_prod_sel : public test_case {
+    const ggml_type type_a;
+    const int64_t k;     // row length
+    const int64_t m;     // number of rows of a
+    const int64_t n_sel; // selected rows per column of b
+    const int64_t n;     // columns of b
+
+    std::string vars() override {
+        return VARS_TO_STR5(type_a, k, m, n_sel, n);
+    }
+
+    double max_nmse_err() override {
+        return 5e-4;
+    }
+
+    test_out_prod_sel(ggml_type type_a = GGML_TYPE_F32, int64_t k = 256, int64_t m = 64, int64_t n_sel = 16, int64_t n = 3)
+        : type_a(type_a), k(k), m(m), n_sel(n_sel), n(n) {}
+
+    ggml_tensor * build_graph(ggml_context * ctx) override {
+        ggml_tensor * a = ggml_new_tensor_2d(ctx, type_a, k, m);
+        ggml_set_name(a, "a");
+
+        // ReLU-like weights, some of them zero
+        ggml_tensor * b = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, n_sel, n);
+        ggml_set_name(b, "b");
+        b = ggml_relu(ctx, b);
+
+        ggml_tensor * ids = ggml_new_tensor_2d(ctx, GGML_TYPE_I32, n_sel, n);
+        ggml_set_name(ids, "ids");
+
+        ggml_tensor * out = ggml_out_prod_sel(ctx, a, b, ids);
+        ggml_set_name(out, "out");
+
+        return out;
+    }
+
+    void initialize_tensors(ggml_context * ctx) override {
+        init_sel_ids(ctx, m);
+    }
+};
+
 // GGML_OP_SQR
 struct test_sqr : public test_case {
     const ggml_type type;
@@ -4334,6 +4444,57 @@ struct test_argsort : public test_case {
     }
 };
 
+// GGML_OP_MOE_ROUTE
+struct test_moe_route : public test_case {
+    const int64_t n_expert;
+    const int64_t n_expert_used;
+    const int64_t n_tokens;
+    const ggml_moe_gating gating;
+    const bool with_bias;
+    const bool norm;
+    const float scale;
+
+    std::string vars() override {
+        return VARS_TO_STR7(n_expert, n_expert_used, n_tokens, gating, with_bias, norm, scale);
+    }
+
+    test_moe_route(int64_t n_expert = 32, int64_t n_expert_used = 4, int64_t n_tokens = 10,
+            ggml_moe_gating gating = GGML_MOE_GATING_SOFTMAX, bool with_bias = false, bool norm = false, float scale = 1.0f)
+        : n_expert(n_expert), n_expert_used(n_expert_used), n_tokens(n_tokens), gating(gating), with_bias(with_bias), norm(norm), scale(scale) {}
+
+    ggml_tensor * build_graph(ggml_context * ctx) override {
+        ggml_tensor * logits = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, n_expert, n_tokens);
+        ggml_set_name(logits, "logits");
+
+        ggml_tensor * bias = nullptr;
+        if (with_bias) {
+            bias = ggml_new_tensor_1d(ctx, GGML_TYPE_F32, n_expert);
+            ggml_set_name(bias, "bias");
+        }
+
+        ggml_tensor * out = ggml_moe_route(ctx, logits, bias, n_expert_used, gating, norm, scale);
+        ggml_set_name(out, "out");
+
+        return out;
+    }
+
+    void initialize_tensors(ggml_context * ctx) override {
+        std::random_device rd;
+        std::default_random_engine rng(rd());
+        for (ggml_tensor * t = ggml_get_first_tensor(ctx); t != NULL; t = ggml_get_next_tensor(ctx, t)) {
+            // initialize with unique values to avoid ties in the expert selection
+            for (int64_t r = 0; r < ggml_nrows(t); r++) {
+                std::vector<float> data(t->ne[0]);
+                for (int i = 0; i < t->ne[0]; i++) {
+                    data[i] = (i - t->ne[0]/2) * 0.1f;
+                }
+                std::shuffle(data.begin(), data.end(), rng);
+                ggml_backend_tensor_set(t, data.data(), r * t->nb[1], t->ne[0] * sizeof(float));
+            }
+        }
+    }
+};
+
 // GGML_OP_SUM
 struct test_sum : public test_case {
     const ggml_type type;
@@ -4962,27 +5123,29 @@ struct test_cross_entropy_loss_back : public test_case {
 struct test_opt_step_adamw : public test_case {
     const ggml_type type;
     const std::array<int64_t, 4> ne;
+    const ggml_type type_m; // type of the momenta
 
     std::string vars() override {
-        return VARS_TO_STR2(type, ne);
+        return VARS_TO_STR3(type, ne, type_m);
     }
 
     test_opt_step_adamw(ggml_type type = GGML_TYPE_F32,
-            std::array<int64_t, 4> ne = {10, 5, 4, 3})
-        : type(type), ne(ne) {}
+            std::array<int64_t, 4> ne = {10, 5, 4, 3},
+            ggml_type type_m = GGML_TYPE_F32)
+        : type(type), ne(ne), type_m(type_m) {}
 
     ggml_tensor * build_graph(ggml_context * ctx) override {
         ggml_tensor * a = ggml_new_tensor_4d(ctx, type, ne[0], ne[1], ne[2], ne[3]);
         ggml_set_param(a); // Despite tensor a having gradients the output tensor will not.
         ggml_set_name(a, "a");
 
-        ggml_tensor * grad = ggml_new_tensor_4d(ctx, type, ne[0], ne[1], ne[2], ne[3]);
+        ggml_tensor * grad = ggml_new_tensor_4d(ctx, GGML_TYPE_F32, ne[0], ne[1], ne[2], ne[3]);
         ggml_set_name(grad, "grad");
 
-        ggml_tensor * grad_m = ggml_new_tensor_4d(ctx, type, ne[0], ne[1], ne[2], ne[3]);
+        ggml_tensor * grad_m = ggml_new_tensor_4d(ctx, type_m, ne[0], ne[1], ne[2], ne[3]);
         ggml_set_name(grad_m, "grad_m");
 
-        ggml_tensor * grad_v = ggml_new_tensor_4d(ctx, type, ne[0], ne[1], ne[2], ne[3]);
+        ggml_tensor * grad_v = ggml_new_tensor_4d(ctx, type_m, ne[0], ne[1], ne[2], ne[3]);
         ggml_set_name(grad_v, "grad_v");
 
         ggml_tensor * adamw_params = ggml_new_tensor_1d(ctx, GGML_TYPE_F32, 7);
@@ -5020,7 +5183,7 @@ struct test_opt_step_sgd : public test_case {
         ggml_set_param(a);  // Despite tensor a having gradients the output tensor will not.
         ggml_set_name(a, "a");
 
-        ggml_tensor * grad = ggml_new_tensor_4d(ctx, type, ne[0], ne[1], ne[2], ne[3]);
+        ggml_tensor * grad = ggml_new_tensor_4d(ctx, GGML_TYPE_F32, ne[0], ne[1], ne[2], ne[3]);
         ggml_set_name(grad, "grad");
 
         ggml_tensor * sgd_params = ggml_new_tensor_1d(ctx, GGML_TYPE_F32, 2);
@@ -6157,6 +6320,13 @@ static std::vector<std::unique_ptr<test_case>> make_test_cases_eval() {
         }
     }
 
+    for (ggml_type type_a : base_types) {
+        for (int n : {1, 5}) {
+            test_cases.emplace_back(new test_mul_mat_sel (type_a, 256, 96, 24, n));
+            test_cases.emplace_back(new test_out_prod_sel(type_a, 256, 96, 24, n));
+        }
+    }
+
     // add_id
     for (ggml_type type_a : {GGML_TYPE_F32}) {
         for (ggml_type type_b : {GGML_TYPE_F32}) {
@@ -6311,6 +6481,17 @@ static std::vector<std::unique_ptr<test_case>> make_test_cases_eval() {
         test_cases.emplace_back(new test_argsort(GGML_TYPE_F32, {1024, 1, 1, 1}, order));
     }
 
+    for (ggml_moe_gating gating : {GGML_MOE_GATING_SOFTMAX, GGML_MOE_GATING_SIGMOID, GGML_MOE_GATING_SOFTMAX_WEIGHT}) {
+        for (bool with_bias : {false, true}) {
+            for (bool norm : {false, true}) {
+                test_cases.emplace_back(new test_moe_route(32,  4, 10, gating, with_bias, norm, 1.0f));
+                test_cases.emplace_back(new test_moe_route(128, 8,  1, gating, with_bias, norm, 2.5f)); // qwen3moe
+            }
+        }
+    }
+    test_cases.emplace_back(new test_moe_route(256, 8, 33, GGML_MOE_GATING_SIGMOID, true, true, 2.5f)); // deepseek v3
+    test_cases.emplace_back(new test_moe_route(4096, 512, 2, GGML_MOE_GATING_SOFTMAX_WEIGHT, false, false, 1.0f)); // sparse FFN
+
     for (ggml_scale_mode mode : {GGML_SCALE_MODE_NEAREST, GGML_SCALE_MODE_BILINEAR}) {
         test_cases.emplace_back(new test_upscale(GGML_TYPE_F32, {512, 512, 3, 2}, 2, mode));
         test_cases.emplace_back(new test_upscale(GGML_TYPE_F32, {512, 512, 3, 2}, 2, mode, true));
@@ -6396,7 +6577,13 @@ static std::vector<std::unique_ptr<test_case>> make_test_cases_eval() {
     test_cases.emplace_back(new test_cross_entropy_loss_back(GGML_TYPE_F32, {30000, 1, 1, 1}));
 
     test_cases.emplace_back(new test_opt_step_adamw(GGML_TYPE_F32, {10, 5, 4, 3}));
+    for (ggml_type type : {GGML_TYPE_F32, GGML_TYPE_F16, GGML_TYPE_BF16}) {
+        test_cases.emplace_back(new test_opt_step_adamw(type, {64, 5, 4, 3}, GGML_TYPE_F32));
+        test_cases.emplace_back(new test_opt_step_adamw(type, {64, 5, 4, 3}, GGML_TYPE_Q8_0));
+    }
     test_cases.emplace_back(new test_opt_step_sgd(GGML_TYPE_F32, {10, 5, 4, 3}));
+    test_cases.emplace_back(new test_opt_step_sgd(GGML_TYPE_F16, {10, 5, 4, 3}));
+    test_cases.emplace_back(new test_opt_step_sgd(GGML_TYPE_BF16, {10, 5, 4, 3}));
 
 #if 0
     // these tests are disabled to save execution time, sbut they can be handy for debugging
@@ -0,0 +1,193 @@
+// context-parallel prefill: the workers run in threads of this process and exchange the K/V with an in-memory
+// all-gather, the logits after the prompt must match the ones of a single context
+
+#include "llama.h"
+#include "get-model.h"
+
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct cp_group {
+    int n_workers;
+
+    std::mutex              mutex;
+    std::condition_variable cv;
+    int n_arrived = 0;
+    int phase     = 0;
+
+    std::vector<uint8_t> buf;
+    std::vector<int>     n_calls;
+
+    void barrier() {
+        std::unique_lock<std::mutex> lock(mutex);
+        const int cur = phase;
+        if (++n_arrived == n_workers) {
+            n_arrived = 0;
+            phase++;
+            cv.notify_all();
+        } else {
+            cv.wait(lock, [&] { return phase != cur; });
+        }
+    }
+};
+
+struct cp_worker {
+    cp_group * group;
+    int        rank;
+};
+
+static void all_gather(void * data, const size_t * sizes, void * user_data) {
+    auto * worker = (cp_worker *) user_data;
+    auto * group  = worker->group;
+
+    size_t offs = 0;
+    size_t size = 0;
+    for (int i = 0; i < group->n_workers; ++i) {
+        offs += i < worker->rank ? sizes[i] : 0;
+        size += sizes[i];
+    }
+
+    if (worker->rank == 0) {
+        group->buf.resize(size);
+    }
+    group->barrier();
+
+    memcpy(group->buf.data() + offs, (const uint8_t *) data + offs, sizes[worker->rank]);
+    group->n_calls[worker->rank]++;
+    group->barrier();
+
+    memcpy(data, group->buf.data(), size);
+    group->barrier();
+}
+
+// process the prompt the way llama-cli does with --cp-ring: only the last token requests logits and it is
+// decoded alone, the other ubatches are split between the workers
+static std::vector<float> eval_prompt(llama_model * model, const std::vector<llama_token> & prompt, bool flash_attn, cp_worker * worker) {
+    const int n_batch = 512;
+
+    llama_context_params cparams = llama_context_default_params();
+    cparams.n_ctx           = 1024;
+    cparams.n_batch         = n_batch;
+    cparams.n_ubatch        = n_batch;
+    cparams.n_threads       = 1;
+    cparams.n_threads_batch = 1;
+    cparams.flash_attn_type = flash_attn ? LLAMA_FLASH_ATTN_TYPE_ENABLED : LLAMA_FLASH_ATTN_TYPE_DISABLED;
+
+    llama_context * ctx = llama_init_from_model(model, cparams);
+    if (worker) {
+        llama_set_context_parallel(ctx, worker->rank, worker->group->n_workers, all_gather, worker);
+    }
+
+    const int n_prompt = (int) prompt.size();
+
+    llama_batch batch = llama_batch_init(n_batch, 0, 1);
+    for (int i = 0; i < n_prompt; ) {
+        const int n_eval = i + 1 == n_prompt ? 1 : std::min(n_batch, n_prompt - 1 - i);
+
+        batch.n_tokens = 0;
+        for (int j = 0; j < n_eval; ++j) {
+            batch.token   [j]    = prompt[i + j];
+            batch.pos     [j]    = i + j;
+            batch.n_seq_id[j]    = 1;
+            batch.seq_id  [j][0] = 0;
+            batch.logits  [j]    = i + j + 1 == n_prompt;
+            batch.n_tokens++;
+        }
+
+        GGML_ASSERT(llama_decode(ctx, batch) == 0);
+        i += n_eval;
+    }
+
+    const int n_vocab = llama_vocab_n_tokens(llama_model_get_vocab(model));
+    const float * logits = llama_get_logits_ith(ctx, -1);
+
+    std::vector<float> res(logits, logits + n_vocab);
+
+    llama_batch_free(batch);
+    llama_free(ctx);
+
+    return res;
+}
+
+static bool test_context_parallel(llama_model * model, const std::vector<llama_token> & prompt, int n_workers, bool flash_attn) {
+    const std::vector<float> ref = eval_prompt(model, prompt, flash_attn, nullptr);
+
+    cp_group group;
+    group.n_workers = n_workers;
+    group.n_calls.assign(n_workers, 0);
+
+    std::vector<cp_worker> workers(n_workers);
+    std::vector<std::vector<float>> res(n_workers);
+    std::vector<std::thread> threads;
+    for (int r = 0; r < n_workers; ++r) {
+        workers[r] = { &group, r };
+        threads.emplace_back([&, r] { res[r] = eval_prompt(model, prompt, flash_attn, &workers[r]); });
+    }
+    for (auto & t : threads) {
+        t.join();
+    }
+
+    bool ok = true;
+    for (int r = 0; r < n_workers; ++r) {
+        double max_err = 0.0;
+        double max_ref = 0.0;
+        for (size_t i = 0; i < ref.size(); ++i) {
+            max_err = std::max(max_err, (double) fabsf(res[r][i] - ref[i]));
+            max_ref = std::max(max_ref, (double) fabsf(ref[i]));
+        }
+
+        // the workers must have split the prompt ubatches
+        const bool ok_r = max_err <= 1e-4*std::max(1.0, max_ref) && group.n_calls[r] > 0;
+
+        printf("  n_prompt = %d, n_workers = %d, flash_attn = %d, rank %d: max_err = %g, all-gathers = %d: %s\n",
+                (int) prompt.size(), n_workers, flash_attn, r, max_err, group.n_calls[r], ok_r ? "OK" : "FAIL");
+        ok = ok && ok_r;
+    }
+
+    return ok;
+}
+
+int main(int argc, char ** argv) {
+    auto * model_path = get_model_or_exit(argc, argv);
+
+    llama_backend_init();
+
+    llama_model * model = llama_model_load_from_file(model_path, llama_model_default_params());
+    if (model == nullptr) {
+        fprintf(stderr, "failed to load the model %s\n", model_path);
+        return 1;
+    }
+
+    const int n_vocab = llama_vocab_n_tokens(llama_model_get_vocab(model));
+
+    // the prompt is decoded in batches of 512 and 88 tokens: the blocks of rows are padded to GGML_KQ_MASK_PAD,
+    // so with 3 workers the second batch is too small to be split and is computed in full
+    std::vector<llama_token> prompt(601);
+    for (size_t i = 0; i < prompt.size(); ++i) {
+        prompt[i] = (llama_token) ((i*7919 + 13) % std::min(n_vocab, 1000));
+    }
+
+    int n_fail = 0;
+    for (int n_workers : { 2, 3 }) {
+        for (bool flash_attn : { false, true }) {
+            n_fail += !test_context_parallel(model, prompt, n_workers, flash_attn);
+        }
+    }
+
+    llama_model_free(model);
+    llama_backend_free();
+
+    if (n_fail > 0) {
+        printf("%d tests failed\n", n_fail);
+        return 1;
+    }
+
+    printf("OK\n");
+    return 0;
+}
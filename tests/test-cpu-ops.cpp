@@ -0,0 +1,844 @@
+// tests of the ops that are only implemented by the CPU backend
+// test-backend-ops compares the other backends with the CPU backend and cannot check these ops,
+// so each op is compared here with an equivalent graph of generic ops, or with a scalar reference
+
+#include "ggml.h"
+#include "ggml-alloc.h"
+#include "ggml-backend.h"
+#include "ggml-cpu.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if defined(_MSC_VER)
+#pragma warning(disable: 4244 4267) // possible loss of data
+#endif
+
+static std::mt19937 rng(42);
+
+static ggml_context * make_ctx() {
+    ggml_init_params params = {
+        /* .mem_size   = */ 256*1024*1024,
+        /* .mem_buffer = */ NULL,
+        /* .no_alloc   = */ false,
+    };
+
+    return ggml_init(params);
+}
+
+static void init_tensor_normal(ggml_tensor * t, float sigma = 1.0f) {
+    std::normal_distribution<float> dist(0.0f, sigma);
+
+    std::vector<float> data(ggml_nelements(t));
+    for (auto & x : data) {
+        x = dist(rng);
+    }
+
+    GGML_ASSERT(t->type == GGML_TYPE_F32);
+    memcpy(t->data, data.data(), data.size()*sizeof(float));
+}
+
+// normalized mean squared error of a with respect to b, the tensors can have any layout
+static double nmse(const ggml_tensor * a, const ggml_tensor * b) {
+    GGML_ASSERT(ggml_are_same_shape(a, b));
+
+    double err = 0.0;
+    double ref = 0.0;
+
+    for (int64_t i3 = 0; i3 < a->ne[3]; ++i3) {
+        for (int64_t i2 = 0; i2 < a->ne[2]; ++i2) {
+            for (int64_t i1 = 0; i1 < a->ne[1]; ++i1) {
+                for (int64_t i0 = 0; i0 < a->ne[0]; ++i0) {
+                    const double va = ggml_get_f32_nd(a, i0, i1, i2, i3);
+                    const double vb = ggml_get_f32_nd(b, i0, i1, i2, i3);
+                    err += (va - vb)*(va - vb);
+                    ref += vb*vb;
+                }
+            }
+        }
+    }
+
+    return ref > 0.0 ? err/ref : err;
+}
+
+static bool check(bool ok, const std::string & desc) {
+    printf("  %-80s %s\n", desc.c_str(), ok ? "OK" : "FAIL");
+    return ok;
+}
+
+//
+// GGML_OP_MOE_ROUTE
+//
+
+// reference: the unfused chain of build_moe_ffn - gating, top_k, get_rows and normalization
+static bool test_moe_route(int64_t n_expert, int n_expert_used, int64_t n_tokens, ggml_moe_gating gating, bool with_bias, bool norm, float scale, int n_threads) {
+    ggml_context * ctx = make_ctx();
+
+    ggml_tensor * logits = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, n_expert, n_tokens);
+    init_tensor_normal(logits);
+
+    ggml_tensor * bias = nullptr;
+    if (with_bias) {
+        bias = ggml_new_tensor_1d(ctx, GGML_TYPE_F32, n_expert);
+        init_tensor_normal(bias, 0.3f);
+    }
+
+    ggml_tensor * route = ggml_moe_route(ctx, logits, bias, n_expert_used, gating, norm, scale);
+    ggml_tensor * ids   = ggml_cont(ctx, ggml_moe_route_ids(ctx, route));
+    ggml_tensor * w     = ggml_cont(ctx, ggml_moe_route_weights(ctx, route));
+
+    ggml_tensor * probs = nullptr;
+    switch (gating) {
+        case GGML_MOE_GATING_SOFTMAX:        probs = ggml_soft_max(ctx, logits); break;
+        case GGML_MOE_GATING_SIGMOID:        probs = ggml_sigmoid (ctx, logits); break;
+        case GGML_MOE_GATING_SOFTMAX_WEIGHT: probs = logits;                     break;
+    }
+
+    ggml_tensor * selection = bias ? ggml_add(ctx, probs, bias) : probs;
+
+    ggml_tensor * ids_ref = ggml_top_k(ctx, selection, n_expert_used);
+    ggml_tensor * w_ref   = ggml_get_rows(ctx, ggml_reshape_3d(ctx, probs, 1, n_expert, n_tokens), ids_ref);
+
+    if (gating == GGML_MOE_GATING_SOFTMAX_WEIGHT) {
+        w_ref = ggml_soft_max(ctx, ggml_reshape_2d(ctx, w_ref, n_expert_used, n_tokens));
+        w_ref = ggml_reshape_3d(ctx, w_ref, 1, n_expert_used, n_tokens);
+    }
+
+    if (norm) {
+        ggml_tensor * w2 = ggml_reshape_2d(ctx, w_ref, n_expert_used, n_tokens);
+        w_ref = ggml_reshape_3d(ctx, ggml_div(ctx, w2, ggml_sum_rows(ctx, w2)), 1, n_expert_used, n_tokens);
+    }
+
+    w_ref = ggml_scale(ctx, w_ref, scale);
+
+    ggml_cgraph * gf = ggml_new_graph(ctx);
+    ggml_build_forward_expand(gf, ids);
+    ggml_build_forward_expand(gf, w);
+    ggml_build_forward_expand(gf, ids_ref);
+    ggml_build_forward_expand(gf, w_ref);
+
+    ggml_graph_compute_with_ctx(ctx, gf, n_threads);
+
+    int64_t n_mismatch = 0;
+    for (int64_t t = 0; t < n_tokens; ++t) {
+        for (int k = 0; k < n_expert_used; ++k) {
+            n_mismatch += ggml_get_i32_nd(ids, k, t, 0, 0) != ggml_get_i32_nd(ids_ref, k, t, 0, 0);
+        }
+    }
+
+    const double err = nmse(w, w_ref);
+
+    ggml_free(ctx);
+
+    char desc[256];
+    snprintf(desc, sizeof(desc), "moe_route(n_expert=%" PRId64 ", k=%d, n_tokens=%" PRId64 ", gating=%d, bias=%d, norm=%d, nt=%d)",
+            n_expert, n_expert_used, n_tokens, (int) gating, with_bias, norm, n_threads);
+
+    return check(n_mismatch == 0 && err < 1e-10, desc);
+}
+
+//
+// GGML_OP_MUL_MAT_SEL, GGML_OP_OUT_PROD_SEL
+//
+
+// reference: mul_mat over all the rows followed by get_rows of the selected results, and
+// out_prod of the rows selected with get_rows
+static bool test_sel(ggml_type type, int64_t n, int64_t m, int64_t k, int64_t n_tokens, int n_threads) {
+    ggml_context * ctx = make_ctx();
+
+    ggml_tensor * a_f32 = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, n, m);
+    init_tensor_normal(a_f32);
+
+    ggml_tensor * a = ggml_new_tensor_2d(ctx, type, n, m);
+    if (type == GGML_TYPE_F32) {
+        memcpy(a->data, a_f32->data, ggml_nbytes(a));
+    } else {
+        ggml_quantize_chunk(type, (const float *) a_f32->data, a->data, 0, m, n, nullptr);
+    }
+
+    ggml_tensor * b = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, n, n_tokens);
+    ggml_tensor * c = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, k, n_tokens);
+    init_tensor_normal(b);
+    init_tensor_normal(c);
+
+    // zero weights are skipped by out_prod_sel
+    float * cd = ggml_get_data_f32(c);
+    for (int64_t i = 0; i < ggml_nelements(c); i += 3) {
+        cd[i] = 0.0f;
+    }
+
+    ggml_tensor * ids = ggml_new_tensor_2d(ctx, GGML_TYPE_I32, k, n_tokens);
+    std::vector<int32_t> rows(m);
+    for (int64_t t = 0; t < n_tokens; ++t) {
+        for (int64_t i = 0; i < m; ++i) {
+            rows[i] = i;
+        }
+        std::shuffle(rows.begin(), rows.end(), rng);
+        memcpy((int32_t *) ids->data + t*k, rows.data(), k*sizeof(int32_t));
+    }
+
+    ggml_tensor * mm  = ggml_mul_mat_sel (ctx, a, b, ids);
+    ggml_tensor * op  = ggml_out_prod_sel(ctx, a, c, ids);
+
+    ggml_tensor * mm_all = ggml_mul_mat(ctx, a, b);
+    ggml_tensor * mm_ref = ggml_get_rows(ctx, ggml_reshape_3d(ctx, mm_all, 1, m, n_tokens), ids);
+    mm_ref = ggml_reshape_2d(ctx, mm_ref, k, n_tokens);
+
+    ggml_tensor * a_sel  = ggml_get_rows(ctx, a, ggml_reshape_1d(ctx, ids, k*n_tokens));
+    ggml_tensor * op_ref = ggml_out_prod(ctx, ggml_reshape_3d(ctx, a_sel, n, k, n_tokens), ggml_reshape_3d(ctx, c, 1, k, n_tokens));
+    op_ref = ggml_reshape_2d(ctx, op_ref, n, n_tokens);
+
+    ggml_cgraph * gf = ggml_new_graph(ctx);
+    ggml_build_forward_expand(gf, mm);
+    ggml_build_forward_expand(gf, op);
+    ggml_build_forward_expand(gf, mm_ref);
+    ggml_build_forward_expand(gf, op_ref);
+
+    ggml_graph_compute_with_ctx(ctx, gf, n_threads);
+
+    const double err_mm = nmse(mm, mm_ref);
+    const double err_op = nmse(op, op_ref);
+
+    ggml_free(ctx);
+
+    char desc[256];
+    snprintf(desc, sizeof(desc), "mul_mat_sel, out_prod_sel(type=%s, n=%" PRId64 ", m=%" PRId64 ", k=%" PRId64 ", n_tokens=%" PRId64 ", nt=%d)",
+            ggml_type_name(type), n, m, k, n_tokens, n_threads);
+
+    return check(err_mm < 1e-10 && err_op < 1e-10, desc);
+}
+
+//
+// GGML_OP_OPT_STEP_ADAMW, GGML_OP_OPT_STEP_SGD with F16/BF16 weights
+//
+
+static float ulp_of(ggml_type type, float x) {
+    int e;
+    frexpf(x, &e);
+    return type == GGML_TYPE_F16 ? ldexpf(1.0f, std::max(e, -13) - 11) : ldexpf(1.0f, e - 8);
+}
+
+static ggml_tensor * new_opt_params(ggml_context * ctx, bool adamw, float alpha, int step) {
+    ggml_tensor * p = ggml_new_tensor_1d(ctx, GGML_TYPE_F32, adamw ? 8 : 3);
+    float * d = ggml_get_data_f32(p);
+    if (adamw) {
+        const float beta1 = 0.9f;
+        const float beta2 = 0.999f;
+        d[0] = alpha;
+        d[1] = beta1;
+        d[2] = beta2;
+        d[3] = 1e-8f;
+        d[4] = 0.1f;
+        d[5] = 1.0f/(1.0f - powf(beta1, step));
+        d[6] = 1.0f/(1.0f - powf(beta2, step));
+        d[7] = step;
+    } else {
+        d[0] = alpha;
+        d[1] = 0.1f;
+        d[2] = step;
+    }
+    return p;
+}
+
+// reference: the same step with F32 weights and momenta; the F16/BF16 result must be one of
+// the two representable values around the F32 result, and the momenta must match
+static bool test_opt_step_mixed(bool adamw, ggml_type type_w, ggml_type type_mv, int64_t ne0, int64_t ne1, int n_threads) {
+    ggml_context * ctx = make_ctx();
+
+    ggml_tensor * w_ref = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, ne0, ne1);
+    ggml_tensor * w     = ggml_new_tensor_2d(ctx, type_w,        ne0, ne1);
+    ggml_tensor * g     = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, ne0, ne1);
+    init_tensor_normal(w_ref);
+    init_tensor_normal(g);
+
+    // start from weights that are exact in the 16-bit type
+    if (type_w == GGML_TYPE_F16) {
+        ggml_fp32_to_fp16_row((const float *) w_ref->data, (ggml_fp16_t *) w->data, ggml_nelements(w));
+        ggml_fp16_to_fp32_row((const ggml_fp16_t *) w->data, (float *) w_ref->data, ggml_nelements(w));
+    } else {
+        ggml_fp32_to_bf16_row((const float *) w_ref->data, (ggml_bf16_t *) w->data, ggml_nelements(w));
+        ggml_bf16_to_fp32_row((const ggml_bf16_t *) w->data, (float *) w_ref->data, ggml_nelements(w));
+    }
+    ggml_set_param(w_ref);
+    ggml_set_param(w);
+
+    ggml_tensor * out_ref = nullptr;
+    ggml_tensor * out     = nullptr;
+    ggml_tensor * m_ref   = nullptr;
+    ggml_tensor * m       = nullptr;
+    ggml_tensor * v_ref   = nullptr;
+    ggml_tensor * v       = nullptr;
+
+    if (adamw) {
+        m_ref = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, ne0, ne1);
+        v_ref = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, ne0, ne1);
+        init_tensor_normal(m_ref, 0.1f);
+        init_tensor_normal(v_ref, 0.1f);
+        float * vd = ggml_get_data_f32(v_ref);
+        for (int64_t i = 0; i < ggml_nelements(v_ref); ++i) {
+            vd[i] = vd[i]*vd[i];
+        }
+
+        m = ggml_new_tensor_2d(ctx, type_mv, ne0, ne1);
+        v = ggml_new_tensor_2d(ctx, type_mv, ne0, ne1);
+        if (type_mv == GGML_TYPE_F32) {
+            memcpy(m->data, m_ref->data, ggml_nbytes(m));
+            memcpy(v->data, v_ref->data, ggml_nbytes(v));
+        } else {
+            // quantized momenta are stored companded, the reference starts from the values they represent
+            const int64_t n = ggml_nelements(m);
+            float * md = ggml_get_data_f32(m_ref);
+            std::vector<float> mc(n);
+            std::vector<float> vc(n);
+            for (int64_t i = 0; i < n; ++i) {
+                mc[i] = copysignf(sqrtf(fabsf(md[i])), md[i]);
+                vc[i] = sqrtf(sqrtf(vd[i]));
+            }
+            ggml_quantize_chunk(type_mv, mc.data(), m->data, 0, ne1, ne0, nullptr);
+            ggml_quantize_chunk(type_mv, vc.data(), v->data, 0, ne1, ne0, nullptr);
+
+            ggml_get_type_traits(type_mv)->to_float(m->data, mc.data(), n);
+            ggml_get_type_traits(type_mv)->to_float(v->data, vc.data(), n);
+            for (int64_t i = 0; i < n; ++i) {
+                md[i] = mc[i]*fabsf(mc[i]);
+                vd[i] = (vc[i]*vc[i])*(vc[i]*vc[i]);
+            }
+        }
+
+        out_ref = ggml_opt_step_adamw(ctx, w_ref, g, m_ref, v_ref, new_opt_params(ctx, true, 1e-3f, 3));
+        out     = ggml_opt_step_adamw(ctx, w,     g, m,     v,     new_opt_params(ctx, true, 1e-3f, 3));
+    } else {
+        out_ref = ggml_opt_step_sgd(ctx, w_ref, g, new_opt_params(ctx, false, 1e-3f, 3));
+        out     = ggml_opt_step_sgd(ctx, w,     g, new_opt_params(ctx, false, 1e-3f, 3));
+    }
+
+    ggml_cgraph * gf = ggml_new_graph(ctx);
+    ggml_build_forward_expand(gf, out_ref);
+    ggml_build_forward_expand(gf, out);
+
+    ggml_graph_compute_with_ctx(ctx, gf, n_threads);
+
+    int64_t n_bad = 0;
+    for (int64_t i1 = 0; i1 < ne1; ++i1) {
+        for (int64_t i0 = 0; i0 < ne0; ++i0) {
+            const float x_ref = ggml_get_f32_nd(w_ref, i0, i1, 0, 0);
+            const float x     = ggml_get_f32_nd(w,     i0, i1, 0, 0);
+            n_bad += !(fabsf(x - x_ref) < ulp_of(type_w, x_ref));
+        }
+    }
+
+    double err_mv = 0.0;
+    if (adamw && type_mv == GGML_TYPE_F32) {
+        err_mv = std::max(nmse(m, m_ref), nmse(v, v_ref));
+    } else if (adamw) {
+        // dequantize and undo the companding of the quantized momenta
+        const int64_t n = ggml_nelements(m);
+        std::vector<float> mq(n);
+        std::vector<float> vq(n);
+        ggml_get_type_traits(type_mv)->to_float(m->data, mq.data(), n);
+        ggml_get_type_traits(type_mv)->to_float(v->data, vq.data(), n);
+
+        const float * mr = ggml_get_data_f32(m_ref);
+        const float * vr = ggml_get_data_f32(v_ref);
+
+        double err = 0.0;
+        double ref = 0.0;
+        for (int64_t i = 0; i < n; ++i) {
+            const double md = (double) mq[i]*fabsf(mq[i]);
+            const double vd = (double) vq[i]*vq[i]*vq[i]*vq[i];
+            err += (md - mr[i])*(md - mr[i]) + (vd - vr[i])*(vd - vr[i]);
+            ref += (double) mr[i]*mr[i] + (double) vr[i]*vr[i];
+        }
+        err_mv = err/ref;
+    }
+    const double max_err_mv = type_mv == GGML_TYPE_F32 ? 1e-12 : 1e-3;
+
+    ggml_free(ctx);
+
+    char desc[256];
+    snprintf(desc, sizeof(desc), "opt_step_%s(type_w=%s, type_mv=%s, ne=[%" PRId64 ", %" PRId64 "], nt=%d)",
+            adamw ? "adamw" : "sgd", ggml_type_name(type_w), ggml_type_name(type_mv), ne0, ne1, n_threads);
+
+    return check(n_bad == 0 && err_mv < max_err_mv, desc);
+}
+
+// the stochastic rounding is unbiased: an update of a fraction of an ulp is applied to that
+// fraction of the weights, and the step number gives a different rounding at each step
+static bool test_opt_step_mixed_sr(bool adamw, ggml_type type_w, int n_threads) {
+    const int64_t ne0  = 256;
+    const int64_t ne1  = 256;
+    const float   w0   = 1.0f;
+    const float   frac = 0.3f;
+    const float   upd  = frac*ulp_of(type_w, w0);
+
+    std::vector<std::vector<float>> results;
+    for (int step : { 1, 1, 2 }) {
+        ggml_context * ctx = make_ctx();
+
+        ggml_tensor * w = ggml_new_tensor_2d(ctx, type_w,        ne0, ne1);
+        ggml_tensor * g = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, ne0, ne1);
+        ggml_set_param(w);
+
+        for (int64_t i1 = 0; i1 < ne1; ++i1) {
+            for (int64_t i0 = 0; i0 < ne0; ++i0) {
+                ggml_set_f32_nd(w, i0, i1, 0, 0, w0);
+            }
+        }
+
+        // without weight decay and moments, both optimizers move the weights up by upd
+        ggml_tensor * out = nullptr;
+        ggml_tensor * p   = new_opt_params(ctx, adamw, upd, step);
+        float * pd = ggml_get_data_f32(p);
+        if (adamw) {
+            ggml_tensor * m = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, ne0, ne1);
+            ggml_tensor * v = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, ne0, ne1);
+            ggml_set_zero(m);
+            ggml_set_zero(v);
+            ggml_set_f32(g, -1.0f);
+            pd[1] = 0.0f; pd[2] = 0.0f; pd[3] = 0.0f; pd[4] = 0.0f; pd[5] = 1.0f; pd[6] = 1.0f;
+            out = ggml_opt_step_adamw(ctx, w, g, m, v, p);
+        } else {
+            ggml_set_f32(g, -1.0f);
+            pd[1] = 0.0f;
+            out = ggml_opt_step_sgd(ctx, w, g, p);
+        }
+
+        ggml_cgraph * gf = ggml_new_graph(ctx);
+        ggml_build_forward_expand(gf, out);
+        ggml_graph_compute_with_ctx(ctx, gf, n_threads);
+
+        std::vector<float> res(ne0*ne1);
+        for (int64_t i1 = 0; i1 < ne1; ++i1) {
+            for (int64_t i0 = 0; i0 < ne0; ++i0) {
+                res[i1*ne0 + i0] = ggml_get_f32_nd(w, i0, i1, 0, 0);
+            }
+        }
+        results.push_back(std::move(res));
+
+        ggml_free(ctx);
+    }
+
+    double  mean   = 0.0;
+    int64_t n_same = 0;
+    int64_t n_diff = 0;
+    for (size_t i = 0; i < results[0].size(); ++i) {
+        mean   += results[0][i] - w0;
+        n_same += results[0][i] == results[1][i];
+        n_diff += results[0][i] != results[2][i];
+    }
+    mean /= results[0].size();
+
+    const double n = results[0].size();
+
+    char desc[256];
+    snprintf(desc, sizeof(desc), "opt_step_%s stochastic rounding(type_w=%s, nt=%d)",
+            adamw ? "adamw" : "sgd", ggml_type_name(type_w), n_threads);
+
+    // the fraction rounded up has a standard deviation of about 0.002 of its mean here;
+    // two different steps round about 2*frac*(1 - frac) of the weights differently
+    return check(fabs(mean/upd - 1.0) < 0.05 && n_same == n && n_diff > 0.3*n, desc);
+}
+
+//
+// GGML_OP_ADD, GGML_OP_SUB, GGML_OP_MUL, GGML_OP_DIV, GGML_OP_SQR, GGML_OP_SQRT, GGML_OP_UNARY
+//
+
+// the element-wise ops are compared with the scalar functions applied to every element,
+// so that the vector bodies, the tails and the thread ranges of the kernels are all checked
+
+enum ew_layout {
+    EW_CONT,         // contiguous operands of the same shape
+    EW_BCAST_ROWS,   // src1 is one row repeated over the rows
+    EW_BCAST_SCALAR, // src1 has one element per row
+    EW_BCAST_INNER,  // src1 is repeated within the rows
+    EW_PADDED,       // the rows of src0 are contiguous but not adjacent
+    EW_PERMUTED,     // the elements of the rows of src0 are not adjacent
+};
+
+static const char * ew_layout_name(ew_layout layout) {
+    switch (layout) {
+        case EW_CONT:         return "cont";
+        case EW_BCAST_ROWS:   return "bcast_rows";
+        case EW_BCAST_SCALAR: return "bcast_scalar";
+        case EW_BCAST_INNER:  return "bcast_inner";
+        case EW_PADDED:       return "padded";
+        case EW_PERMUTED:     return "permuted";
+    }
+    return "";
+}
+
+// fill t with normal values, optionally mixed with NaNs and signed zeros
+static void init_tensor_ew(ggml_tensor * t, bool special) {
+    std::normal_distribution<float> dist(0.0f, 2.0f);
+    std::uniform_int_distribution<int> pick(0, 15);
+
+    for (int64_t i3 = 0; i3 < t->ne[3]; ++i3) {
+        for (int64_t i2 = 0; i2 < t->ne[2]; ++i2) {
+            for (int64_t i1 = 0; i1 < t->ne[1]; ++i1) {
+                for (int64_t i0 = 0; i0 < t->ne[0]; ++i0) {
+                    float x = dist(rng);
+                    if (special) {
+                        switch (pick(rng)) {
+                            case 0: x = NAN;   break;
+                            case 1: x = 0.0f;  break;
+                            case 2: x = -0.0f; break;
+                            default:           break;
+                        }
+                    }
+                    ggml_set_f32_nd(t, i0, i1, i2, i3, x);
+                }
+            }
+        }
+    }
+}
+
+// a tensor with the shape ne stored in the given layout
+static ggml_tensor * new_tensor_ew(ggml_context * ctx, ggml_type type, const int64_t * ne, ew_layout layout, bool special) {
+    ggml_tensor * t = nullptr;
+    switch (layout) {
+        case EW_PADDED:
+            t = ggml_new_tensor_4d(ctx, type, ne[0] + 3, ne[1], ne[2], ne[3]);
+            init_tensor_ew(t, special);
+            return ggml_view_4d(ctx, t, ne[0], ne[1], ne[2], ne[3], t->nb[1], t->nb[2], t->nb[3], 0);
+        case EW_PERMUTED:
+            t = ggml_new_tensor_4d(ctx, type, ne[1], ne[0], ne[2], ne[3]);
+            init_tensor_ew(t, special);
+            return ggml_transpose(ctx, t);
+        default:
+            t = ggml_new_tensor_4d(ctx, type, ne[0], ne[1], ne[2], ne[3]);
+            init_tensor_ew(t, special);
+            return t;
+    }
+}
+
+static float ew_round(ggml_type type, float x) {
+    switch (type) {
+        case GGML_TYPE_F16:  return ggml_fp16_to_fp32(ggml_fp32_to_fp16(x));
+        case GGML_TYPE_BF16: return ggml_bf16_to_fp32(ggml_fp32_to_bf16(x));
+        default:             return x;
+    }
+}
+
+// the vector exp is an approximation, a 16-bit result can round to the other neighbour of the exact value
+static bool ew_close(ggml_type type, float res, float ref) {
+    if (std::isnan(ref) || std::isnan(res)) {
+        return std::isnan(ref) && std::isnan(res);
+    }
+    if (res == ref) {
+        return true;
+    }
+    const float tol = type == GGML_TYPE_F32 ? 1e-6f*std::max(1.0f, fabsf(ref)) : ulp_of(type, ref);
+    return fabsf(res - ref) <= tol;
+}
+
+// compare every element of out with ref(i0, i1, i2, i3)
+template <typename F>
+static int64_t ew_count_mismatch(const ggml_tensor * out, F ref) {
+    int64_t n_mismatch = 0;
+    for (int64_t i3 = 0; i3 < out->ne[3]; ++i3) {
+        for (int64_t i2 = 0; i2 < out->ne[2]; ++i2) {
+            for (int64_t i1 = 0; i1 < out->ne[1]; ++i1) {
+                for (int64_t i0 = 0; i0 < out->ne[0]; ++i0) {
+                    const float res = ggml_get_f32_nd(out, i0, i1, i2, i3);
+                    n_mismatch += !ew_close(out->type, res, ew_round(out->type, ref(i0, i1, i2, i3)));
+                }
+            }
+        }
+    }
+    return n_mismatch;
+}
+
+static bool test_binary(ggml_op op, ggml_type type0, ggml_type type1, ew_layout layout, const std::vector<int64_t> & ne, int n_threads) {
+    ggml_context * ctx = make_ctx();
+
+    int64_t ne1[4] = { ne[0], ne[1], ne[2], ne[3] };
+    switch (layout) {
+        case EW_BCAST_ROWS:   ne1[1] = 1;                         break;
+        case EW_BCAST_SCALAR: ne1[0] = 1; ne1[2] = 1;             break;
+        case EW_BCAST_INNER:  ne1[0] = ne[0]/3; ne1[1] = 1;       break;
+        default:                                                  break;
+    }
+
+    ggml_tensor * a = new_tensor_ew(ctx, type0, ne.data(), layout == EW_PADDED || layout == EW_PERMUTED ? layout : EW_CONT, false);
+    ggml_tensor * b = new_tensor_ew(ctx, type1, ne1, EW_CONT, false);
+
+    ggml_tensor * out = nullptr;
+    switch (op) {
+        case GGML_OP_ADD: out = ggml_add(ctx, a, b); break;
+        case GGML_OP_SUB: out = ggml_sub(ctx, a, b); break;
+        case GGML_OP_MUL: out = ggml_mul(ctx, a, b); break;
+        case GGML_OP_DIV: out = ggml_div(ctx, a, b); break;
+        default: GGML_ABORT("unsupported op");
+    }
+
+    ggml_cgraph * gf = ggml_new_graph(ctx);
+    ggml_build_forward_expand(gf, out);
+
+    ggml_graph_compute_with_ctx(ctx, gf, n_threads);
+
+    const int64_t n_mismatch = ew_count_mismatch(out, [&](int64_t i0, int64_t i1, int64_t i2, int64_t i3) {
+        const float x = ggml_get_f32_nd(a, i0, i1, i2, i3);
+        const float y = ggml_get_f32_nd(b, i0 % ne1[0], i1 % ne1[1], i2 % ne1[2], i3 % ne1[3]);
+        switch (op) {
+            case GGML_OP_ADD: return x + y;
+            case GGML_OP_SUB: return x - y;
+            case GGML_OP_MUL: return x * y;
+            default:          return x / y;
+        }
+    });
+
+    char desc[256];
+    snprintf(desc, sizeof(desc), "%s(type0=%s, type1=%s, layout=%s, ne=[%" PRId64 ",%" PRId64 ",%" PRId64 "], nt=%d)",
+            ggml_op_desc(out), ggml_type_name(type0), ggml_type_name(type1), ew_layout_name(layout), ne[0], ne[1], ne[2], n_threads);
+
+    ggml_free(ctx);
+
+    return check(n_mismatch == 0, desc);
+}
+
+static float unary_ref(ggml_op op, ggml_unary_op uop, float x) {
+    switch (op) {
+        case GGML_OP_SQR:  return x*x;
+        case GGML_OP_SQRT: return sqrtf(x);
+        default:           break;
+    }
+    switch (uop) {
+        case GGML_UNARY_OP_ABS:         return fabsf(x);
+        case GGML_UNARY_OP_SGN:         return (x > 0.f) ? 1.f : ((x < 0.f) ? -1.f : 0.f);
+        case GGML_UNARY_OP_NEG:         return -x;
+        case GGML_UNARY_OP_STEP:        return (x > 0.f) ? 1.f : 0.f;
+        case GGML_UNARY_OP_TANH:        return tanhf(x);
+        case GGML_UNARY_OP_RELU:        return (x > 0.f) ? x : 0.f;
+        case GGML_UNARY_OP_SIGMOID:     return 1.f / (1.f + expf(-x));
+        case GGML_UNARY_OP_HARDSIGMOID: return fminf(1.0f, fmaxf(0.0f, (x + 3.0f) / 6.0f));
+        case GGML_UNARY_OP_EXP:         return expf(x);
+        case GGML_UNARY_OP_HARDSWISH:   return x * fminf(1.0f, fmaxf(0.0f, (x + 3.0f) / 6.0f));
+        default: GGML_ABORT("unsupported op");
+    }
+}
+
+// the inputs contain NaNs: the vector min, max and compares must give the same results as the scalar functions
+static bool test_unary(ggml_op op, ggml_unary_op uop, ggml_type type, ew_layout layout, const std::vector<int64_t> & ne, int n_threads) {
+    ggml_context * ctx = make_ctx();
+
+    ggml_tensor * a = new_tensor_ew(ctx, type, ne.data(), layout, true);
+
+    ggml_tensor * out = nullptr;
+    switch (op) {
+        case GGML_OP_SQR:  out = ggml_sqr (ctx, a);      break;
+        case GGML_OP_SQRT: out = ggml_sqrt(ctx, a);      break;
+        default:           out = ggml_unary(ctx, a, uop); break;
+    }
+
+    ggml_cgraph * gf = ggml_new_graph(ctx);
+    ggml_build_forward_expand(gf, out);
+
+    ggml_graph_compute_with_ctx(ctx, gf, n_threads);
+
+    const int64_t n_mismatch = ew_count_mismatch(out, [&](int64_t i0, int64_t i1, int64_t i2, int64_t i3) {
+        return unary_ref(op, uop, ggml_get_f32_nd(a, i0, i1, i2, i3));
+    });
+
+    char desc[256];
+    snprintf(desc, sizeof(desc), "%s(type=%s, layout=%s, ne=[%" PRId64 ",%" PRId64 ",%" PRId64 "], nt=%d)",
+            ggml_op_desc(out), ggml_type_name(type), ew_layout_name(layout), ne[0], ne[1], ne[2], n_threads);
+
+    ggml_free(ctx);
+
+    return check(n_mismatch == 0, desc);
+}
+
+//
+// GGML_OP_MUL_MAT with IQ1_S weights repacked by the CPU_REPACK buffer type
+//
+
+static ggml_backend_buffer_type_t get_repack_buft() {
+    ggml_backend_dev_t dev = ggml_backend_dev_by_type(GGML_BACKEND_DEVICE_TYPE_CPU);
+    auto get_extra_bufts = (ggml_backend_dev_get_extra_bufts_t)
+        ggml_backend_reg_get_proc_address(ggml_backend_dev_backend_reg(dev), "ggml_backend_dev_get_extra_bufts");
+
+    for (ggml_backend_buffer_type_t * buft = get_extra_bufts ? get_extra_bufts(dev) : nullptr; buft && *buft; ++buft) {
+        if (strcmp(ggml_backend_buft_name(*buft), "CPU_REPACK") == 0) {
+            return *buft;
+        }
+    }
+    return nullptr;
+}
+
+// reference: the same weights in a CPU buffer, multiplied with the vec_dot kernel of the type
+// n = 1 uses the GEMV kernel, multiples of 4 the GEMM kernel, the other rows of the activations fall back to the GEMV
+static bool test_repack(ggml_backend_t backend, ggml_backend_buffer_type_t buft_repack, ggml_type type, int64_t k, int64_t m, int64_t n, int n_threads) {
+    ggml_init_params params = {
+        /* .mem_size   = */ 16*ggml_tensor_overhead() + ggml_graph_overhead(),
+        /* .mem_buffer = */ NULL,
+        /* .no_alloc   = */ true,
+    };
+    ggml_context * ctx_repack = ggml_init(params);
+    ggml_context * ctx        = ggml_init(params);
+
+    ggml_tensor * w     = ggml_new_tensor_2d(ctx_repack, type,          k, m);
+    ggml_tensor * w_ref = ggml_new_tensor_2d(ctx,        type,          k, m);
+    ggml_tensor * x     = ggml_new_tensor_2d(ctx,        GGML_TYPE_F32, k, n);
+
+    ggml_backend_buffer_t buf_repack = ggml_backend_alloc_ctx_tensors_from_buft(ctx_repack, buft_repack);
+    ggml_backend_buffer_t buf        = ggml_backend_alloc_ctx_tensors(ctx, backend);
+
+    {
+        std::normal_distribution<float> dist(0.0f, 1.0f);
+
+        std::vector<float> data(k*m);
+        for (auto & v : data) {
+            v = dist(rng);
+        }
+        const std::vector<float> imatrix(k, 1.0f);
+
+        std::vector<uint8_t> q(ggml_nbytes(w));
+        ggml_quantize_chunk(type, data.data(), q.data(), 0, m, k, imatrix.data());
+
+        // the CPU_REPACK buffer repacks the data while it is set
+        ggml_backend_tensor_set(w,     q.data(), 0, q.size());
+        ggml_backend_tensor_set(w_ref, q.data(), 0, q.size());
+
+        data.resize(k*n);
+        for (auto & v : data) {
+            v = dist(rng);
+        }
+        ggml_backend_tensor_set(x, data.data(), 0, ggml_nbytes(x));
+    }
+
+    ggml_tensor * out     = ggml_mul_mat(ctx, w,     x);
+    ggml_tensor * out_ref = ggml_mul_mat(ctx, w_ref, x);
+
+    ggml_cgraph * gf = ggml_new_graph(ctx);
+    ggml_build_forward_expand(gf, out);
+    ggml_build_forward_expand(gf, out_ref);
+
+    ggml_gallocr_t galloc = ggml_gallocr_new(ggml_backend_get_default_buffer_type(backend));
+    GGML_ASSERT(ggml_gallocr_alloc_graph(galloc, gf));
+
+    ggml_backend_cpu_set_n_threads(backend, n_threads);
+    const bool ok_compute = ggml_backend_graph_compute(backend, gf) == GGML_STATUS_SUCCESS;
+
+    const double err = ok_compute ? nmse(out, out_ref) : INFINITY;
+
+    char desc[256];
+    snprintf(desc, sizeof(desc), "mul_mat repack(type=%s, k=%" PRId64 ", m=%" PRId64 ", n=%" PRId64 ", nt=%d), nmse = %.2e",
+            ggml_type_name(type), k, m, n, n_threads, err);
+
+    ggml_gallocr_free(galloc);
+    ggml_backend_buffer_free(buf);
+    ggml_backend_buffer_free(buf_repack);
+    ggml_free(ctx);
+    ggml_free(ctx_repack);
+
+    return check(err < 1e-10, desc);
+}
+
+int main(int /*argc*/, const char ** /*argv*/) {
+    int n_fail = 0;
+
+    printf("GGML_OP_MOE_ROUTE\n");
+    for (ggml_moe_gating gating : { GGML_MOE_GATING_SOFTMAX, GGML_MOE_GATING_SIGMOID, GGML_MOE_GATING_SOFTMAX_WEIGHT }) {
+        for (bool with_bias : { false, true }) {
+            for (bool norm : { false, true }) {
+                n_fail += !test_moe_route( 64, 8,  9, gating, with_bias, norm, 2.5f, 1);
+                n_fail += !test_moe_route(128, 8, 33, gating, with_bias, norm, 1.0f, 4);
+            }
+        }
+    }
+    // large selections use a partial sort instead of the insertion
+    n_fail += !test_moe_route(1024,  96, 5, GGML_MOE_GATING_SOFTMAX, false, false, 1.0f, 1);
+    n_fail += !test_moe_route(1024, 200, 7, GGML_MOE_GATING_SIGMOID, true,  true,  1.0f, 3);
+
+    printf("GGML_OP_MUL_MAT_SEL, GGML_OP_OUT_PROD_SEL\n");
+    for (ggml_type type : { GGML_TYPE_F32, GGML_TYPE_F16, GGML_TYPE_Q4_0, GGML_TYPE_Q8_0, GGML_TYPE_Q4_K, GGML_TYPE_Q6_K }) {
+        n_fail += !test_sel(type, 512, 300, 40, 1, 1);
+        n_fail += !test_sel(type, 512, 300, 40, 4, 3);
+        // more threads than blocks in a row of a: some threads of out_prod_sel have no work
+        n_fail += !test_sel(type, 256,  64, 17, 5, 8);
+    }
+
+    printf("GGML_OP_OPT_STEP_ADAMW, GGML_OP_OPT_STEP_SGD\n");
+    for (ggml_type type_w : { GGML_TYPE_F16, GGML_TYPE_BF16 }) {
+        n_fail += !test_opt_step_mixed(true,  type_w, GGML_TYPE_F32,   256, 5, 1);
+        n_fail += !test_opt_step_mixed(true,  type_w, GGML_TYPE_F32,  1000, 7, 3);
+        n_fail += !test_opt_step_mixed(true,  type_w, GGML_TYPE_Q8_0,  512, 7, 2);
+        n_fail += !test_opt_step_mixed(false, type_w, GGML_TYPE_F32,   256, 5, 1);
+        n_fail += !test_opt_step_mixed(false, type_w, GGML_TYPE_F32,  1000, 7, 3);
+        n_fail += !test_opt_step_mixed_sr(true,  type_w, 2);
+        n_fail += !test_opt_step_mixed_sr(false, type_w, 2);
+    }
+
+    // odd row lengths leave vector tails, 75 elements are split in two blocks of which 4 threads use only 2
+    printf("GGML_OP_ADD, GGML_OP_SUB, GGML_OP_MUL, GGML_OP_DIV\n");
+    const std::vector<int64_t> ne_ew = { 69, 5, 3, 1 };
+    const std::vector<int64_t> ne_ew_small = { 75, 1, 1, 1 };
+    for (ggml_op op : { GGML_OP_ADD, GGML_OP_SUB, GGML_OP_MUL, GGML_OP_DIV }) {
+        for (auto [type0, type1] : std::vector<std::pair<ggml_type, ggml_type>> {
+                { GGML_TYPE_F32,  GGML_TYPE_F32 }, { GGML_TYPE_F16, GGML_TYPE_F16 }, { GGML_TYPE_BF16, GGML_TYPE_BF16 },
+                { GGML_TYPE_F16,  GGML_TYPE_F32 }, { GGML_TYPE_BF16, GGML_TYPE_F32 } }) {
+            n_fail += !test_binary(op, type0, type1, EW_CONT, ne_ew, 1);
+            n_fail += !test_binary(op, type0, type1, EW_CONT, ne_ew, 4);
+            n_fail += !test_binary(op, type0, type1, EW_CONT, ne_ew_small, 4);
+            for (ew_layout layout : { EW_BCAST_ROWS, EW_BCAST_SCALAR, EW_BCAST_INNER, EW_PADDED, EW_PERMUTED }) {
+                n_fail += !test_binary(op, type0, type1, layout, ne_ew, 3);
+            }
+        }
+    }
+
+    printf("GGML_OP_SQR, GGML_OP_SQRT, GGML_OP_UNARY\n");
+    const std::vector<std::pair<ggml_op, ggml_unary_op>> unary_ops = {
+        { GGML_OP_SQR,   GGML_UNARY_OP_COUNT },
+        { GGML_OP_SQRT,  GGML_UNARY_OP_COUNT },
+        { GGML_OP_UNARY, GGML_UNARY_OP_ABS },
+        { GGML_OP_UNARY, GGML_UNARY_OP_SGN },
+        { GGML_OP_UNARY, GGML_UNARY_OP_NEG },
+        { GGML_OP_UNARY, GGML_UNARY_OP_STEP },
+        { GGML_OP_UNARY, GGML_UNARY_OP_TANH },
+        { GGML_OP_UNARY, GGML_UNARY_OP_RELU },
+        { GGML_OP_UNARY, GGML_UNARY_OP_SIGMOID },
+        { GGML_OP_UNARY, GGML_UNARY_OP_HARDSIGMOID },
+        { GGML_OP_UNARY, GGML_UNARY_OP_EXP },
+        { GGML_OP_UNARY, GGML_UNARY_OP_HARDSWISH },
+    };
+    for (auto [op, uop] : unary_ops) {
+        for (ggml_type type : { GGML_TYPE_F32, GGML_TYPE_F16, GGML_TYPE_BF16 }) {
+            n_fail += !test_unary(op, uop, type, EW_CONT,   ne_ew, 1);
+            n_fail += !test_unary(op, uop, type, EW_CONT,   ne_ew, 4);
+            n_fail += !test_unary(op, uop, type, EW_CONT,   ne_ew_small, 4);
+            n_fail += !test_unary(op, uop, type, EW_PADDED, ne_ew, 3);
+            // GGML_OP_UNARY requires contiguous rows
+            if (op != GGML_OP_UNARY) {
+                n_fail += !test_unary(op, uop, type, EW_PERMUTED, ne_ew, 3);
+            }
+        }
+    }
+
+    printf("GGML_OP_MUL_MAT with repacked weights\n");
+    ggml_backend_buffer_type_t buft_repack = get_repack_buft();
+    if (buft_repack && ggml_cpu_has_avx2()) {
+        ggml_backend_t backend = ggml_backend_cpu_init();
+        for (int64_t n : { 1, 4, 7, 32 }) {
+            n_fail += !test_repack(backend, buft_repack, GGML_TYPE_IQ1_S, 512, 64, n, 1);
+            n_fail += !test_repack(backend, buft_repack, GGML_TYPE_IQ1_S, 768, 36, n, 3);
+        }
+        ggml_backend_free(backend);
+    } else {
+        printf("  IQ1_S is not repacked on this CPU, skipped\n");
+    }
+
+    if (n_fail > 0) {
+        printf("%d tests failed\n", n_fail);
+        return 1;
+    }
+
+    printf("OK\n");
+    return 0;
+}
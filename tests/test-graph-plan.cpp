@@ -0,0 +1,113 @@
+// tests the execution plans that the scheduler caches for the graphs computed multiple times:
+// a reused plan must be re-planned when the number of threads of the CPU backend changes
+
+#include "ggml.h"
+#include "ggml-alloc.h"
+#include "ggml-backend.h"
+#include "ggml-cpu.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+// a plan that is not updated keeps computing with the thread count it was created with:
+// this op records the number of threads that actually run it
+static void record_n_threads(ggml_tensor * dst, const ggml_tensor * a, int ith, int nth, void * userdata) {
+    if (ith == 0) {
+        ((std::atomic<int> *) userdata)->store(nth);
+        memcpy(dst->data, a->data, ggml_nbytes(dst));
+    }
+}
+
+static std::vector<float> compute(ggml_backend_sched_t sched, ggml_cgraph * gf, ggml_tensor * out) {
+    if (ggml_backend_sched_graph_compute(sched, gf) != GGML_STATUS_SUCCESS) {
+        return {};
+    }
+
+    std::vector<float> res(ggml_nelements(out));
+    ggml_backend_tensor_get(out, res.data(), 0, ggml_nbytes(out));
+
+    return res;
+}
+
+int main(void) {
+    ggml_backend_t backend = ggml_backend_cpu_init();
+    GGML_ASSERT(backend != nullptr);
+
+    // weights in a static buffer, the graph is allocated by the scheduler
+    ggml_init_params params_w = {
+        /* .mem_size   = */ 2*ggml_tensor_overhead(),
+        /* .mem_buffer = */ NULL,
+        /* .no_alloc   = */ true,
+    };
+    ggml_context * ctx_w = ggml_init(params_w);
+
+    ggml_tensor * a = ggml_new_tensor_2d(ctx_w, GGML_TYPE_F32, 256, 512);
+    ggml_tensor * b = ggml_new_tensor_2d(ctx_w, GGML_TYPE_F32, 256, 64);
+
+    ggml_backend_buffer_t buf_w = ggml_backend_alloc_ctx_tensors(ctx_w, backend);
+
+    std::mt19937 rng(42);
+    std::normal_distribution<float> dist(0.0f, 1.0f);
+    for (ggml_tensor * t : { a, b }) {
+        std::vector<float> data(ggml_nelements(t));
+        for (auto & x : data) {
+            x = dist(rng);
+        }
+        ggml_backend_tensor_set(t, data.data(), 0, ggml_nbytes(t));
+    }
+
+    ggml_init_params params_g = {
+        /* .mem_size   = */ ggml_tensor_overhead()*GGML_DEFAULT_GRAPH_SIZE + ggml_graph_overhead(),
+        /* .mem_buffer = */ NULL,
+        /* .no_alloc   = */ true,
+    };
+    ggml_context * ctx_g = ggml_init(params_g);
+
+    std::atomic<int> n_threads_used(0);
+
+    // the work buffer of soft_max grows with the number of threads
+    ggml_tensor * out = ggml_soft_max(ctx_g, ggml_mul_mat(ctx_g, a, b));
+    out = ggml_map_custom1(ctx_g, out, record_n_threads, GGML_N_TASKS_MAX, &n_threads_used);
+    ggml_set_output(out);
+
+    ggml_cgraph * gf = ggml_new_graph(ctx_g);
+    ggml_build_forward_expand(gf, out);
+
+    ggml_backend_sched_t sched = ggml_backend_sched_new(&backend, NULL, 1, GGML_DEFAULT_GRAPH_SIZE, false, false);
+
+    ggml_backend_cpu_set_n_threads(backend, 1);
+    GGML_ASSERT(ggml_backend_sched_alloc_graph(sched, gf));
+
+    const std::vector<float> ref = compute(sched, gf, out);
+
+    int n_fail = ref.empty();
+
+    // the graph is not allocated again, so the plan of the first compute is reused
+    for (int n_threads : { 4, 2, 1, 3 }) {
+        ggml_backend_cpu_set_n_threads(backend, n_threads);
+
+        const std::vector<float> res = compute(sched, gf, out);
+        const bool ok = res.size() == ref.size() && memcmp(res.data(), ref.data(), ref.size()*sizeof(float)) == 0 &&
+            n_threads_used.load() == n_threads;
+
+        printf("  reused plan, n_threads = %d: %s\n", n_threads, ok ? "OK" : "FAIL");
+        n_fail += !ok;
+    }
+
+    ggml_backend_sched_free(sched);
+    ggml_free(ctx_g);
+    ggml_backend_buffer_free(buf_w);
+    ggml_free(ctx_w);
+    ggml_backend_free(backend);
+
+    if (n_fail > 0) {
+        printf("%d tests failed\n", n_fail);
+        return 1;
+    }
+
+    printf("OK\n");
+    return 0;
+}
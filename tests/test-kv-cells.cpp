@@ -0,0 +1,139 @@
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+
+#include "llama.h"
+
+#include "../src/llama-kv-cells.h"
+
+#include <cassert>
+#include <cstdio>
+#include <vector>
+
+// place the positions [p0, p1) of the sequences seqs in the cells [i0, i0 + p1 - p0)
+static void fill(llama_kv_cells & cells, uint32_t i0, llama_pos p0, llama_pos p1, const std::vector<llama_seq_id> & seqs) {
+    for (llama_pos p = p0; p < p1; ++p) {
+        const uint32_t i = i0 + (p - p0);
+
+        cells.pos_set(i, p);
+        for (const llama_seq_id s : seqs) {
+            cells.seq_add(i, s);
+        }
+    }
+}
+
+static void test_evict_single_seq() {
+    llama_kv_cells cells;
+    cells.resize(32);
+
+    fill(cells, 0, 0, 20, { 0 });
+
+    // the cells with the odd positions received more attention
+    for (uint32_t i = 0; i < 20; ++i) {
+        cells.score_add(i, (i % 2) ? 1.0f : 0.1f);
+    }
+
+    uint32_t idx_free = 0;
+
+    // below the budget nothing is evicted
+    assert(cells.seq_evict(0, 20, 2, 3, idx_free) == 0);
+    assert(idx_free == cells.size());
+    assert(cells.seq_n_cells(0) == 20);
+
+    assert(cells.seq_evict(0, 11, 2, 3, idx_free) == 9);
+    assert(cells.seq_n_cells(0) == 11);
+    assert(cells.get_used() == 11);
+
+    // the sinks [0, 2) and the recent window [17, 20) are kept
+    for (llama_pos p : { 0, 1, 17, 18, 19 }) {
+        assert(!cells.is_empty(p));
+    }
+    assert(cells.seq_pos_min(0) == 0);
+    assert(cells.seq_pos_max(0) == 19);
+
+    // the 8 even positions in [2, 17) are the least attended, then the lowest odd position
+    for (llama_pos p = 2; p < 17; ++p) {
+        const bool evicted = p % 2 == 0 || p == 3;
+        assert(cells.is_empty(p) == evicted);
+    }
+    assert(idx_free == 2);
+}
+
+static void test_evict_protected() {
+    llama_kv_cells cells;
+    cells.resize(16);
+
+    fill(cells, 0, 0, 10, { 0 });
+
+    uint32_t idx_free = 0;
+
+    // the sinks and the recent window cover the sequence
+    assert(cells.seq_evict(0, 4, 6, 4, idx_free) == 0);
+    assert(cells.seq_n_cells(0) == 10);
+
+    // only the 2 cells between the sinks and the recent window can be evicted, the budget is exceeded
+    assert(cells.seq_evict(0, 3, 4, 4, idx_free) == 2);
+    assert(cells.seq_n_cells(0) == 8);
+    assert(cells.is_empty(4) && cells.is_empty(5));
+    assert(idx_free == 4);
+
+    // nothing left to evict
+    assert(cells.seq_evict(0, 3, 4, 4, idx_free) == 0);
+    assert(cells.seq_n_cells(0) == 8);
+}
+
+static void test_evict_shared() {
+    llama_kv_cells cells;
+    cells.resize(64);
+
+    // a prefix of 10 cells shared by the sequences 0 and 1, then 10 cells of each sequence
+    fill(cells,  0,  0, 10, { 0, 1 });
+    fill(cells, 10, 10, 20, { 0 });
+    fill(cells, 20, 10, 20, { 1 });
+
+    // the prefix received no attention
+    for (uint32_t i = 10; i < 30; ++i) {
+        cells.score_add(i, 1.0f);
+    }
+
+    assert(cells.seq_n_cells(0) == 20);
+    assert(cells.seq_n_cells(1) == 20);
+    assert(cells.get_used() == 30);
+
+    uint32_t idx_free = 0;
+
+    // the shared cells lose sequence 0 but are still used by sequence 1
+    assert(cells.seq_evict(0, 12, 1, 2, idx_free) == 8);
+    assert(idx_free == cells.size());
+    assert(cells.seq_n_cells(0) == 12);
+    assert(cells.seq_n_cells(1) == 20);
+    assert(cells.get_used() == 30);
+
+    for (uint32_t i = 0; i < 10; ++i) {
+        assert(!cells.is_empty(i));
+        assert(cells.seq_has(i, 1));
+        assert(cells.seq_has(i, 0) == (i == 0 || i == 9));
+    }
+    assert(cells.seq_pos_min(0) == 0);
+    assert(cells.seq_pos_min(1) == 0);
+
+    // once sequence 1 drops them too, the cells become empty
+    assert(cells.seq_evict(1, 12, 1, 2, idx_free) == 8);
+    assert(idx_free == 1);
+    assert(cells.seq_n_cells(1) == 12);
+    assert(cells.get_used() == 22);
+
+    for (uint32_t i = 1; i < 9; ++i) {
+        assert(cells.is_empty(i));
+    }
+}
+
+int main() {
+    test_evict_single_seq();
+    test_evict_protected();
+    test_evict_shared();
+
+    printf("OK\n");
+
+    return 0;
+}
@@ -7,7 +7,9 @@
 
 #include <cmath>
 #include <cinttypes>
+#include <condition_variable>
 #include <cstring>
+#include <mutex>
 #include <random>
 #include <string>
 #include <thread>
@@ -839,6 +841,208 @@ static std::pair<int, int> test_regression(
     return std::make_pair(npass, ntest);
 }
 
+static ggml_opt_optimizer_params helper_get_data_parallel_opt_pars(void * userdata) {
+    ggml_opt_optimizer_params result = ggml_opt_get_default_optimizer_params(userdata);
+    result.adamw.alpha = 0.1f;
+    result.sgd.alpha   = 0.1f;
+    return result;
+}
+
+// all-reduce of the gradients of the data-parallel workers running in the threads of this process
+struct helper_all_reduce_data {
+    int32_t                 dp_size;
+    std::mutex              mutex;
+    std::condition_variable cv;
+    int32_t                 n_arrived = 0;
+    int32_t                 phase     = 0;
+    int64_t                 ncalls    = 0;
+    std::vector<float>      sum;
+
+    void barrier() {
+        std::unique_lock<std::mutex> lock(mutex);
+        const int32_t cur = phase;
+        if (++n_arrived == dp_size) {
+            n_arrived = 0;
+            phase++;
+            cv.notify_all();
+        } else {
+            cv.wait(lock, [&] { return phase != cur; });
+        }
+    }
+};
+
+static void helper_all_reduce(float * data, int64_t n, void * userdata) {
+    helper_all_reduce_data * ar = (helper_all_reduce_data *) userdata;
+
+    {
+        std::lock_guard<std::mutex> lock(ar->mutex);
+        if (ar->sum.empty()) {
+            ar->sum.assign(n, 0.0f);
+            ar->ncalls++;
+        }
+        for (int64_t i = 0; i < n; ++i) {
+            ar->sum[i] += data[i];
+        }
+    }
+    ar->barrier();
+
+    memcpy(data, ar->sum.data(), n*sizeof(float));
+    ar->barrier();
+
+    {
+        std::lock_guard<std::mutex> lock(ar->mutex);
+        ar->sum.clear();
+    }
+    ar->barrier();
+}
+
+// fits f(x) = a*x + b with batches of nbatch datapoints and returns {a, b}
+static std::vector<float> helper_fit_data_parallel(
+        enum ggml_opt_optimizer_type optim,
+        ggml_backend_sched_t backend_sched, ggml_backend_t backend, ggml_opt_dataset_t dataset, const int64_t nbatch,
+        const int32_t dp_rank, const int32_t dp_size, helper_all_reduce_data * ar, const int n_epoch) {
+    struct ggml_context * ctx_static;
+    struct ggml_context * ctx_compute;
+    {
+        struct ggml_init_params params = {
+            /*.mem_size   =*/ 3*ggml_tensor_overhead(),
+            /*.mem_buffer =*/ nullptr,
+            /*.no_alloc   =*/ true,
+        };
+        ctx_static = ggml_init(params);
+    }
+    {
+        struct ggml_init_params params = {
+            /*.mem_size   =*/ GGML_DEFAULT_GRAPH_SIZE*ggml_tensor_overhead() + 3*ggml_graph_overhead(),
+            /*.mem_buffer =*/ nullptr,
+            /*.no_alloc   =*/ true,
+        };
+        ctx_compute = ggml_init(params);
+    }
+
+    struct ggml_tensor * x = ggml_new_tensor_2d(ctx_static, GGML_TYPE_F32, 1, nbatch);
+    ggml_set_name(x, "x");
+
+    struct ggml_tensor * a = ggml_new_tensor_1d(ctx_static, GGML_TYPE_F32, 1);
+    ggml_set_name(a, "a");
+    ggml_set_param(a);
+
+    struct ggml_tensor * b = ggml_new_tensor_1d(ctx_static, GGML_TYPE_F32, 1);
+    ggml_set_name(b, "b");
+    ggml_set_param(b);
+
+    struct ggml_tensor * f = ggml_add(ctx_compute, ggml_mul(ctx_compute, x, a), b);
+    ggml_set_name(f, "f");
+
+    ggml_backend_buffer_t buf = ggml_backend_alloc_ctx_tensors(ctx_static, backend);
+    const float a0 = 1.0f;
+    const float b0 = 3.0f;
+    ggml_backend_tensor_set(a, &a0, 0, sizeof(float));
+    ggml_backend_tensor_set(b, &b0, 0, sizeof(float));
+
+    struct ggml_opt_params opt_params = ggml_opt_default_params(backend_sched, GGML_OPT_LOSS_TYPE_MEAN_SQUARED_ERROR);
+    opt_params.ctx_compute  = ctx_compute;
+    opt_params.inputs       = x;
+    opt_params.outputs      = f;
+    opt_params.optimizer    = optim;
+    opt_params.get_opt_pars = helper_get_data_parallel_opt_pars;
+    opt_params.dp_rank      = dp_rank;
+    opt_params.dp_size      = dp_size;
+    if (dp_size > 1) {
+        opt_params.all_reduce    = helper_all_reduce;
+        opt_params.all_reduce_ud = ar;
+    }
+    ggml_opt_context_t opt_ctx = ggml_opt_init(opt_params);
+    ggml_opt_result_t  result  = ggml_opt_result_init();
+
+    for (int epoch = 0; epoch < n_epoch; ++epoch) {
+        ggml_opt_epoch(opt_ctx, dataset, result, nullptr, ggml_opt_dataset_data(dataset)->ne[1], nullptr, nullptr);
+    }
+
+    std::vector<float> ab(2);
+    ggml_backend_tensor_get(a, &ab[0], 0, sizeof(float));
+    ggml_backend_tensor_get(b, &ab[1], 0, sizeof(float));
+
+    ggml_opt_result_free(result);
+    ggml_opt_free(opt_ctx);
+    ggml_backend_buffer_free(buf);
+    ggml_free(ctx_static);
+    ggml_free(ctx_compute);
+
+    return ab;
+}
+
+static std::pair<int, int> test_data_parallel(
+        enum ggml_opt_optimizer_type optim,
+        ggml_backend_sched_t backend_sched, ggml_backend_t backend, const int32_t dp_size) {
+    int ntest = 0;
+    int npass = 0;
+
+    constexpr int64_t ndata_dp   = 24;
+    constexpr int64_t nbatch_dp  = 2; // per worker
+    constexpr int     n_epoch_dp = 3;
+
+    ggml_opt_dataset_t dataset = ggml_opt_dataset_init(GGML_TYPE_F32, GGML_TYPE_F32, 1, 1, ndata_dp, nbatch_dp);
+
+    float * data   = ggml_get_data_f32(ggml_opt_dataset_data(  dataset));
+    float * labels = ggml_get_data_f32(ggml_opt_dataset_labels(dataset));
+    for (int64_t idata = 0; idata < ndata_dp; ++idata) {
+        data[idata]   = -1.0f + 2.0f*idata/(ndata_dp - 1);
+        labels[idata] = 1.2f*data[idata] + 3.4f + 0.1f*std::sin(7.0f*idata);
+    }
+
+    // reference: a single process whose batches are the union of the batches the workers take in the same step
+    const std::vector<float> ab_ref = helper_fit_data_parallel(
+        optim, backend_sched, backend, dataset, nbatch_dp*dp_size, 0, 1, nullptr, n_epoch_dp);
+
+    helper_all_reduce_data ar;
+    ar.dp_size = dp_size;
+
+    std::vector<std::vector<float>> ab(dp_size);
+    std::vector<std::thread> threads;
+    for (int32_t dp_rank = 0; dp_rank < dp_size; ++dp_rank) {
+        threads.emplace_back([&, dp_rank]() {
+            // every worker has its own backend instances
+            std::vector<ggml_backend_t> backends = { ggml_backend_dev_init(ggml_backend_get_device(backend), nullptr) };
+            if (ggml_backend_dev_type(ggml_backend_get_device(backend)) != GGML_BACKEND_DEVICE_TYPE_CPU) {
+                backends.push_back(ggml_backend_init_by_type(GGML_BACKEND_DEVICE_TYPE_CPU, nullptr));
+            }
+            ggml_backend_sched_t sched = ggml_backend_sched_new(
+                backends.data(), nullptr, backends.size(), GGML_DEFAULT_GRAPH_SIZE, false, true);
+
+            ab[dp_rank] = helper_fit_data_parallel(optim, sched, backends[0], dataset, nbatch_dp, dp_rank, dp_size, &ar, n_epoch_dp);
+
+            ggml_backend_sched_free(sched);
+            for (ggml_backend_t be : backends) {
+                ggml_backend_free(be);
+            }
+        });
+    }
+    for (std::thread & t : threads) {
+        t.join();
+    }
+
+    std::string args = "dp_size=" + std::to_string(dp_size) + ", optimizer=" + ggml_opt_optimizer_name(optim);
+
+    {
+        // a and b move away from their initial values by more than the tolerance
+        bool subtest_ok = fabsf(ab_ref[0] - 1.0f) > 1e-2f && fabsf(ab_ref[1] - 3.0f) > 1e-2f;
+        for (int32_t dp_rank = 0; dp_rank < dp_size; ++dp_rank) {
+            subtest_ok = subtest_ok && almost_equal(ab[dp_rank][0], ab_ref[0], 1e-5) && almost_equal(ab[dp_rank][1], ab_ref[1], 1e-5);
+        }
+        print_ok(__func__, subtest_ok, npass, ntest, (args + ", subtest=weights").c_str());
+    }
+    {
+        // one all-reduce per parameter and optimizer step
+        const int64_t nstep = n_epoch_dp*(ndata_dp/(nbatch_dp*dp_size));
+        print_ok(__func__, ar.ncalls == 2*nstep, npass, ntest, (args + ", subtest=all_reduce").c_str());
+    }
+
+    ggml_opt_dataset_free(dataset);
+
+    return std::make_pair(npass, ntest);
+}
+
 static std::pair<int, int> test_backend(
     ggml_backend_sched_t backend_sched, ggml_backend_t backend, enum ggml_opt_optimizer_type optim) {
     int npass = 0;
@@ -891,6 +1095,11 @@ static std::pair<int, int> test_backend(
         npass += partial.first;
         ntest += partial.second;
     }
+    for (int32_t dp_size : { 2, 3 }) {
+        std::pair<int, int> partial = test_data_parallel(optim, backend_sched, backend, dp_size);
+        npass += partial.first;
+        ntest += partial.second;
+    }
 
     return std::make_pair(npass, ntest);
 }
@@ -0,0 +1,583 @@
+// Offline batch inference over a JSONL file of prompts using continuous batching.
+//
+// input:  one JSON object per line: {"id": ..., "prompt": "...", "n_predict": N}, "id" and "n_predict" are optional
+// output: one JSON object per finished prompt, in completion order:
+//         {"id": ..., "text": "...", "n_prompt": N, "n_cached": N, "n_gen": N, "finish_reason": "stop" | "length"}
+//
+// the output file doubles as a checkpoint: when it already exists, the prompts whose id it contains are skipped
+
+#include "arg.h"
+#include "common.h"
+#include "sampling.h"
+#include "log.h"
+#include "llama.h"
+
+#include <nlohmann/json.hpp>
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <numeric>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+using json = nlohmann::ordered_json;
+
+// a set of prompts that share their leading tokens in the KV cache
+struct infer_group {
+    std::vector<llama_token> prefix; // empty = nothing shared
+
+    int32_t n_active = 0; // number of sequences that reference the prefix cells
+};
+
+struct infer_task {
+    json id;
+
+    std::vector<llama_token> tokens;
+
+    int32_t n_predict;
+
+    std::shared_ptr<infer_group> group;
+};
+
+struct infer_slot {
+    llama_seq_id id;
+
+    bool active = false;
+
+    infer_task task;
+
+    int32_t n_past    = 0;
+    int32_t i_prompt  = 0; // next prompt token to submit
+    int32_t n_decoded = 0;
+    int32_t i_batch   = -1;
+
+    llama_token sampled;
+
+    std::string text;
+
+    common_sampler * smpl = nullptr;
+
+    // number of KV cells reserved by the sequence, excluding the shared prefix
+    int32_t n_reserved() const {
+        return task.tokens.size() - task.group->prefix.size() + task.n_predict;
+    }
+};
+
+// reads the lines of the input files in order
+struct infer_reader {
+    std::vector<std::string> files;
+
+    size_t i_file = 0;
+    int64_t i_line = 0; // global line index, used as the default id
+
+    std::ifstream in;
+
+    bool next(std::string & line) {
+        while (true) {
+            if (!in.is_open()) {
+                if (i_file >= files.size()) {
+                    return false;
+                }
+                in.open(files[i_file++]);
+                if (!in) {
+                    LOG_ERR("%s: failed to open '%s'\n", __func__, files[i_file - 1].c_str());
+                    return false;
+                }
+            }
+
+            if (std::getline(in, line)) {
+                i_line++;
+                return true;
+            }
+
+            in.close();
+        }
+    }
+};
+
+// read the ids of the results that are already in the output file and drop a trailing partial line
+static std::unordered_set<std::string> load_checkpoint(const std::string & fname) {
+    std::unordered_set<std::string> done;
+
+    std::ifstream in(fname, std::ios::binary);
+    if (!in) {
+        return done;
+    }
+
+    std::string line;
+    size_t n_valid = 0; // size of the complete lines
+
+    while (std::getline(in, line)) {
+        if (in.eof()) {
+            break; // no newline - the result was not written completely
+        }
+
+        try {
+            done.insert(json::parse(line).at("id").dump());
+        } catch (const std::exception &) {
+            break;
+        }
+
+        n_valid += line.size() + 1;
+    }
+    in.close();
+
+    if (n_valid != std::filesystem::file_size(fname)) {
+        LOG_WRN("%s: truncating '%s' to the last complete result\n", __func__, fname.c_str());
+        std::filesystem::resize_file(fname, n_valid);
+    }
+
+    return done;
+}
+
+// order the tasks of a window for the scheduling:
+//  - tasks with a long common prefix are grouped, so that the prefix is evaluated once and shared via llama_memory_seq_cp
+//  - the groups with the longest tasks go first, and inside a group the longest tasks go first, so that the short ones
+//    fill the batch at the end
+static void schedule_window(std::vector<infer_task> & tasks, int32_t n_min_prefix) {
+    const size_t n = tasks.size();
+
+    std::vector<size_t> order(n);
+    std::iota(order.begin(), order.end(), 0);
+
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return tasks[a].tokens < tasks[b].tokens;
+    });
+
+    const auto task_len = [&](size_t i) {
+        return tasks[i].tokens.size() + tasks[i].n_predict;
+    };
+
+    struct group_range {
+        size_t i0;
+        size_t i1;
+
+        std::shared_ptr<infer_group> group;
+    };
+
+    std::vector<group_range> groups;
+
+    for (size_t i0 = 0; i0 < n; ) {
+        // extend the group while the common prefix stays long enough
+        size_t n_lcp = tasks[order[i0]].tokens.size();
+        size_t n_min = n_lcp;
+
+        size_t i1 = i0 + 1;
+        for (; i1 < n; ++i1) {
+            const size_t n_cur = std::min(n_lcp, common_lcp(tasks[order[i1 - 1]].tokens, tasks[order[i1]].tokens));
+            if ((int32_t) n_cur < n_min_prefix) {
+                break;
+            }
+            n_lcp = n_cur;
+            n_min = std::min(n_min, tasks[order[i1]].tokens.size());
+        }
+
+        auto group = std::make_shared<infer_group>();
+
+        // keep at least one token per task to evaluate, so that each task gets its own logits
+        const size_t n_prefix = std::min(n_lcp, n_min - 1);
+        if (i1 - i0 > 1 && (int32_t) n_prefix >= n_min_prefix) {
+            const auto & tokens = tasks[order[i0]].tokens;
+            group->prefix.assign(tokens.begin(), tokens.begin() + n_prefix);
+        }
+
+        std::stable_sort(order.begin() + i0, order.begin() + i1, [&](size_t a, size_t b) {
+            return task_len(a) > task_len(b);
+        });
+
+        groups.push_back({ i0, i1, std::move(group) });
+
+        i0 = i1;
+    }
+
+    // the first task of a group is its longest one
+    std::stable_sort(groups.begin(), groups.end(), [&](const group_range & a, const group_range & b) {
+        return task_len(order[a.i0]) > task_len(order[b.i0]);
+    });
+
+    std::vector<infer_task> res;
+    res.reserve(n);
+
+    for (const auto & g : groups) {
+        for (size_t i = g.i0; i < g.i1; ++i) {
+            res.push_back(std::move(tasks[order[i]]));
+            res.back().group = g.group;
+        }
+    }
+
+    tasks = std::move(res);
+}
+
+static void print_usage(int, char ** argv) {
+    LOG("\nexample usage:\n");
+    LOG("\n    %s -m model.gguf --in-file prompts.jsonl -o results.jsonl -c 16384 -np 32 -n 64 --temp 0\n", argv[0]);
+    LOG("\n");
+}
+
+int main(int argc, char ** argv) {
+    common_params params;
+
+    params.n_predict  = 128;
+    params.n_parallel = 16;
+
+    if (!common_params_parse(argc, argv, params, LLAMA_EXAMPLE_BATCH_INFER, print_usage)) {
+        return 1;
+    }
+
+    common_init();
+
+    if (params.in_files.empty() || params.out_file.empty()) {
+        LOG_ERR("%s: an input file (--in-file) and an output file (-o) are required\n", __func__);
+        return 1;
+    }
+
+    if (params.n_predict <= 0) {
+        LOG_ERR("%s: the number of tokens to predict must be positive\n", __func__);
+        return 1;
+    }
+
+    const int32_t n_slots = params.n_parallel;
+
+    // one extra sequence holds the shared prefix of the current group
+    const llama_seq_id seq_prefix = n_slots;
+    params.n_parallel += 1;
+
+    // a single KV buffer for all sequences, so that the prefix cells can be shared
+    params.kv_unified = true;
+
+    llama_backend_init();
+    llama_numa_init(params.numa);
+
+    common_init_result llama_init = common_init_from_params(params);
+
+    llama_model * model = llama_init.model.get();
+    llama_context * ctx = llama_init.context.get();
+
+    if (model == nullptr || ctx == nullptr) {
+        LOG_ERR("%s: failed to load the model\n", __func__);
+        return 1;
+    }
+
+    auto * mem = llama_get_memory(ctx);
+
+    const llama_vocab * vocab = llama_model_get_vocab(model);
+
+    const int32_t n_ctx   = llama_n_ctx(ctx);
+    const int32_t n_batch = llama_n_batch(ctx);
+
+    if (n_slots > n_batch) {
+        LOG_ERR("%s: the number of parallel sequences (%d) cannot exceed the batch size (%d)\n", __func__, n_slots, n_batch);
+        return 1;
+    }
+
+    auto done = load_checkpoint(params.out_file);
+    if (!done.empty()) {
+        LOG_INF("%s: resuming, %zu prompts are already done\n", __func__, done.size());
+    }
+
+    FILE * fout = fopen(params.out_file.c_str(), "ab");
+    if (!fout) {
+        LOG_ERR("%s: failed to open '%s'\n", __func__, params.out_file.c_str());
+        return 1;
+    }
+
+    infer_reader reader;
+    reader.files = params.in_files;
+
+    std::vector<infer_slot> slots(n_slots);
+    for (int32_t i = 0; i < n_slots; ++i) {
+        slots[i].id   = i;
+        slots[i].smpl = common_sampler_init(model, params.sampling);
+    }
+
+    // write a result line, the output is flushed periodically
+    const auto write_result = [&](const json & res) {
+        const std::string str = res.dump(-1, ' ', false, json::error_handler_t::replace) + "\n";
+        fwrite(str.data(), 1, str.size(), fout);
+    };
+
+    // load the next window of prompts
+    std::vector<infer_task> tasks;
+    size_t i_task = 0;
+
+    const auto load_window = [&]() {
+        tasks.clear();
+        i_task = 0;
+
+        std::string line;
+        while ((int32_t) tasks.size() < params.n_infer_window && reader.next(line)) {
+            if (line.find_first_not_of(" \t\r") == std::string::npos) {
+                continue;
+            }
+
+            json id = reader.i_line - 1;
+
+            try {
+                const json data = json::parse(line);
+
+                id = data.value("id", id);
+                if (done.count(id.dump())) {
+                    continue;
+                }
+
+                infer_task task;
+                task.id        = id;
+                task.tokens    = common_tokenize(ctx, data.at("prompt").get<std::string>(), true, true);
+                task.n_predict = data.value("n_predict", params.n_predict);
+
+                if (task.tokens.empty() || task.n_predict <= 0 || (int32_t) task.tokens.size() + task.n_predict > n_ctx) {
+                    write_result({ {"id", id}, {"error", "the prompt is empty or does not fit in the context"} });
+                    continue;
+                }
+
+                tasks.push_back(std::move(task));
+            } catch (const std::exception & e) {
+                if (done.count(id.dump())) {
+                    continue;
+                }
+                LOG_WRN("input line %" PRId64 ": %s\n", reader.i_line, e.what());
+                write_result({ {"id", id}, {"error", e.what()} });
+            }
+        }
+
+        schedule_window(tasks, params.n_infer_min_prefix);
+    };
+
+    llama_batch batch = llama_batch_init(n_batch, 0, 1);
+
+    // the shared prefixes are evaluated separately, while the main batch is being filled
+    llama_batch batch_prefix = llama_batch_init(n_batch, 0, 1);
+
+    // the group whose prefix is currently held by seq_prefix
+    std::shared_ptr<infer_group> group_cur;
+
+    int64_t n_done       = 0;
+    int64_t n_prompt_tot = 0; // evaluated prompt tokens
+    int64_t n_cached_tot = 0; // prompt tokens reused from a shared prefix
+    int64_t n_gen_tot    = 0;
+
+    const int64_t t_start = ggml_time_us();
+    int64_t t_report = t_start;
+
+    // the number of KV cells reserved by the active sequences and the prefixes they reference
+    const auto n_cells_reserved = [&]() {
+        int32_t res = group_cur ? group_cur->prefix.size() : 0;
+
+        std::vector<const infer_group *> counted = { group_cur.get() };
+        for (const auto & slot : slots) {
+            if (!slot.active) {
+                continue;
+            }
+            res += slot.n_reserved();
+            if (std::find(counted.begin(), counted.end(), slot.task.group.get()) == counted.end()) {
+                counted.push_back(slot.task.group.get());
+                res += slot.task.group->prefix.size();
+            }
+        }
+
+        return res;
+    };
+
+    // evaluate the prefix of a group in seq_prefix
+    const auto load_prefix = [&](const std::shared_ptr<infer_group> & group) {
+        llama_memory_seq_rm(mem, seq_prefix, -1, -1);
+        group_cur = group;
+
+        const auto & prefix = group->prefix;
+        for (size_t i = 0; i < prefix.size(); i += n_batch) {
+            common_batch_clear(batch_prefix);
+            for (size_t j = i; j < std::min(prefix.size(), i + n_batch); ++j) {
+                common_batch_add(batch_prefix, prefix[j], j, { seq_prefix }, false);
+            }
+            if (llama_decode(ctx, batch_prefix) != 0) {
+                return false;
+            }
+        }
+
+        n_prompt_tot += prefix.size();
+
+        return true;
+    };
+
+    const auto finish = [&](infer_slot & slot, const char * reason) {
+        write_result({
+            {"id",            slot.task.id},
+            {"text",          slot.text},
+            {"n_prompt",      slot.task.tokens.size()},
+            {"n_cached",      slot.task.group->prefix.size()},
+            {"n_gen",         slot.n_decoded},
+            {"finish_reason", reason},
+        });
+
+        llama_memory_seq_rm(mem, slot.id, -1, -1);
+
+        slot.task.group->n_active--;
+        slot.task = {};
+        slot.active = false;
+
+        n_gen_tot += slot.n_decoded;
+        n_done++;
+    };
+
+    LOG_INF("%s: n_slots = %d, n_ctx = %d, n_batch = %d, n_predict = %d, window = %d\n",
+            __func__, n_slots, n_ctx, n_batch, params.n_predict, params.n_infer_window);
+
+    while (true) {
+        if (i_task == tasks.size()) {
+            load_window();
+        }
+
+        common_batch_clear(batch);
+
+        // continue the sequences that are generating
+        for (auto & slot : slots) {
+            if (slot.active && slot.n_decoded > 0) {
+                slot.i_batch = batch.n_tokens;
+                common_batch_add(batch, slot.sampled, slot.n_past++, { slot.id }, true);
+            }
+        }
+
+        // start new tasks in the free slots as long as their KV cells are available
+        for (auto & slot : slots) {
+            if (slot.active || i_task == tasks.size()) {
+                continue;
+            }
+
+            auto & task = tasks[i_task];
+
+            // no sequence references the current prefix anymore, release its cells before reserving new ones
+            if (group_cur && group_cur->n_active == 0 && task.group != group_cur) {
+                llama_memory_seq_rm(mem, seq_prefix, -1, -1);
+                group_cur.reset();
+            }
+
+            const bool is_new_group = !task.group->prefix.empty() && task.group != group_cur && task.group->n_active == 0;
+            const int32_t n_needed  = task.tokens.size() - task.group->prefix.size() + task.n_predict + (is_new_group ? task.group->prefix.size() : 0);
+
+            if (n_cells_reserved() + n_needed > n_ctx) {
+                break;
+            }
+
+            if (!task.group->prefix.empty()) {
+                if (task.group != group_cur && !load_prefix(task.group)) {
+                    LOG_ERR("%s: failed to evaluate a shared prefix of %zu tokens\n", __func__, task.group->prefix.size());
+                    return 1;
+                }
+
+                llama_memory_seq_cp(mem, seq_prefix, slot.id, -1, -1);
+
+                n_cached_tot += task.group->prefix.size();
+            }
+
+            task.group->n_active++;
+
+            slot.task      = std::move(task);
+            slot.active    = true;
+            slot.n_past    = slot.task.group->prefix.size();
+            slot.i_prompt  = slot.n_past;
+            slot.n_decoded = 0;
+            slot.i_batch   = -1;
+            slot.text.clear();
+
+            common_sampler_reset(slot.smpl);
+
+            i_task++;
+        }
+
+        // fill the rest of the batch with prompt tokens
+        for (auto & slot : slots) {
+            const auto & tokens = slot.task.tokens;
+
+            while (slot.active && slot.i_prompt < (int32_t) tokens.size() && batch.n_tokens < n_batch) {
+                const bool is_last = slot.i_prompt == (int32_t) tokens.size() - 1;
+
+                if (is_last) {
+                    slot.i_batch = batch.n_tokens;
+                }
+
+                common_batch_add(batch, tokens[slot.i_prompt++], slot.n_past++, { slot.id }, is_last);
+
+                n_prompt_tot++;
+            }
+        }
+
+        if (batch.n_tokens == 0) {
+            if (i_task == tasks.size()) {
+                break;
+            }
+
+            LOG_ERR("%s: a task does not fit in the context\n", __func__);
+            return 1;
+        }
+
+        const int ret = llama_decode(ctx, batch);
+        if (ret != 0) {
+            LOG_ERR("%s: failed to decode the batch, ret = %d - try increasing the context size\n", __func__, ret);
+            return 1;
+        }
+
+        for (auto & slot : slots) {
+            if (!slot.active || slot.i_batch < 0) {
+                continue;
+            }
+
+            const llama_token id = common_sampler_sample(slot.smpl, ctx, slot.i_batch);
+
+            common_sampler_accept(slot.smpl, id, true);
+
+            slot.i_batch = -1;
+            slot.n_decoded++;
+            slot.sampled = id;
+
+            if (llama_vocab_is_eog(vocab, id)) {
+                slot.n_decoded--;
+                finish(slot, "stop");
+                continue;
+            }
+
+            slot.text += common_token_to_piece(ctx, id);
+
+            if (slot.n_decoded >= slot.task.n_predict) {
+                finish(slot, "length");
+            }
+        }
+
+        const int64_t t_now = ggml_time_us();
+        if (t_now - t_report > 10*1000*1000) {
+            t_report = t_now;
+            fflush(fout);
+
+            const double t = (t_now - t_start)/1e6;
+            LOG_INF("%s: done %" PRId64 ", %.2f prompts/s, prompt %.2f t/s, gen %.2f t/s\n",
+                    __func__, n_done, n_done/t, n_prompt_tot/t, n_gen_tot/t);
+        }
+    }
+
+    fclose(fout);
+
+    const double t = (ggml_time_us() - t_start)/1e6;
+
+    LOG_INF("\n");
+    LOG_INF("%s: prompts done:  %" PRId64 " in %.2f s, %.2f prompts/s\n", __func__, n_done, t, n_done/t);
+    LOG_INF("%s: prompt tokens: %" PRId64 " evaluated, %" PRId64 " reused from shared prefixes, %.2f t/s\n", __func__, n_prompt_tot, n_cached_tot, n_prompt_tot/t);
+    LOG_INF("%s: gen tokens:    %" PRId64 ", %.2f t/s\n", __func__, n_gen_tot, n_gen_tot/t);
+    LOG_INF("%s: total:         %.2f t/s\n", __func__, (n_prompt_tot + n_gen_tot)/t);
+
+    llama_perf_context_print(ctx);
+
+    for (auto & slot : slots) {
+        common_sampler_free(slot.smpl);
+    }
+
+    llama_batch_free(batch);
+    llama_batch_free(batch_prefix);
+
+    llama_backend_free();
+
+    return 0;
+}
@@ -17,6 +17,7 @@
 
 #include <algorithm>
 #include <climits>
+#include <cmath>
 #include <cstdio>
 #include <cstring>
 #include <fstream>
@@ -43,7 +44,7 @@ static void print_usage(int, char ** argv) {
     printf("\nexample usage:\n");
     printf("\n    CPU only:   %s -m ./llama-3.Q4_K_M.gguf\n", argv[0]);
     printf("\n    with GPU:   %s -m ./llama-3.Q4_K_M.gguf -ngl 99\n", argv[0]);
-    printf("\n    advanced:   %s -m ./llama-3.Q4_K_M.gguf -ngl 99 --pca-iter 2000 --pca-batch 100\n", argv[0]);
+    printf("\n    advanced:   %s -m ./llama-3.Q4_K_M.gguf -ngl 99 --pca-iter 16 --pca-batch 32 -np 32\n", argv[0]);
     printf("\n    using mean: %s -m ./llama-3.Q4_K_M.gguf --method mean\n", argv[0]);
     printf("\n");
 }
@@ -51,124 +52,42 @@ static void print_usage(int, char ** argv) {
 //////////////////////////////////////////////////
 
 
-// cb_eval is reused for each pair of positive - negative prompt
+// cb_eval collects the hidden state of the last token of each sequence in a batch of prompt pairs
 struct callback_data {
-    ggml_context * ctx_ggml = nullptr;   // holds v_pos, v_neg, v_diff_filtered
-
     int n_layers = 0;
-    int n_tokens = 0;
-    bool is_eval_pos = true;
+    int n_embd   = 0;
 
-    // each element of the vector correspond to one layer
-    std::vector<struct ggml_tensor *> v_pos; // vector of matrices of size [n_embd, n_tokens]
-    std::vector<struct ggml_tensor *> v_neg; // vector of matrices of size [n_embd, n_tokens]
-    std::vector<struct ggml_tensor *> v_diff_filtered;   // vector of matrices of size [n_embd, n_nonzero_rows]. NOTE: n_nonzero_rows maybe different for each layer
-
-    // save a tensor into either v_pos or v_neg (decided by is_eval_pos)
-    void save_tensor_for_layer(struct ggml_tensor * t) {
-        GGML_ASSERT(t->type == GGML_TYPE_F32);
-
-        if (ctx_ggml == nullptr) {
-            // alloc a new ctx_ggml if needed
-            struct ggml_init_params params_ggml = {
-                /*.mem_size   =*/ ggml_tensor_overhead() * n_layers * 3u,
-                /*.mem_buffer =*/ NULL,
-                /*.no_alloc   =*/ true,
-            };
-            ctx_ggml = ggml_init(params_ggml);
-        }
+    // batch row of the last token of each sequence, in ascending order
+    std::vector<int32_t> rows;
 
-        // copy tensor data
-        auto n_bytes = ggml_nbytes(t);
-        struct ggml_tensor * t_layer = ggml_new_tensor_2d(ctx_ggml, t->type, t->ne[0], t->ne[1]);
-        t_layer->data = malloc(n_bytes); // TODO @ngxson : get rid of this malloc somehow
-        ggml_backend_tensor_get(t, t_layer->data, 0, n_bytes);
-        ggml_set_name(t_layer, ggml_get_name(t));
-        //print_debug_tensor(t_layer);
-
-        if (is_eval_pos) {
-            v_pos.push_back(t_layer);
-        } else {
-            v_neg.push_back(t_layer);
-        }
-    }
+    // per layer: number of batch rows seen so far (a batch may be split into several ubatches)
+    std::vector<int32_t> n_seen;
 
-    // calculate diff (v_pos - v_neg) and place the result back to v_pos
-    // all zero rows in the diff tensor will also be removed
+    // per layer: hidden states of the selected rows, [n_rows][n_embd]
     // NOTE: final layer is ignored. we only have (n_layers - 1) to process
-    std::vector<struct ggml_tensor *> calc_diff() {
-        for (float il = 0; il < v_pos.size(); il++) {
-            float * a = (float *) v_pos[il]->data;
-            float * b = (float *) v_neg[il]->data;
-            size_t n_elem = ggml_nelements(v_pos[il]);
-            for (size_t j = 0; j < n_elem; j++) {
-                a[j] -= b[j];
-            }
-            //print_debug_tensor(v_pos[i]);
-            auto diff_filtered = filter_nonzero_rows(v_pos[il]);
-            v_diff_filtered.push_back(diff_filtered);
+    std::vector<std::vector<float>> v_rows;
+
+    void begin_batch(const std::vector<int32_t> & rows_) {
+        rows = rows_;
+        n_seen.assign(n_layers - 1, 0);
+        v_rows.resize(n_layers - 1);
+        for (auto & v : v_rows) {
+            v.assign(rows.size() * n_embd, 0.0f);
         }
-        return v_diff_filtered; // for convinient, we return the result std::vector
     }
 
-    // delete zero rows from a given 2D tensor
-    struct ggml_tensor * filter_nonzero_rows(struct ggml_tensor * a) {
-        //printf("filter_nonzero_rows\n");
-        auto is_row_all_zeros = [](struct ggml_tensor * t, int row, float eps) -> bool {
-            // check if given row containing all zero elements
-            int n_cols = t->ne[0]; // hint: should be equal to n_embd
-            for (int col = 0; col < n_cols; ++col) {
-                if (ggml_get_f32_nd(t, col, row, 0, 0) > eps) {
-                    return false;
-                }
-            }
-            return true;
-        };
-        std::vector<int> rows_to_copy; // the idx of non-zero cols (to be copied to row of diff_filtered)
-        for (int i_row = 0; i_row < a->ne[1]; i_row++) {
-            if (!is_row_all_zeros(a, i_row, 1e-6)) {
-                rows_to_copy.push_back(i_row);
-            }
-        }
+    // copy only the rows in [n_seen, n_seen + ne[1]) that are selected
+    void save_rows_for_layer(struct ggml_tensor * t, int il) {
+        GGML_ASSERT(t->type == GGML_TYPE_F32 && t->ne[0] == n_embd);
 
-        // get "n_nonzero_rows" for the output "diff_filtered"
-        int n_nonzero_rows = rows_to_copy.size();
-        //printf("n_nonzero_rows: %d\n", n_nonzero_rows);
-        int n_embd = a->ne[0];
-        GGML_ASSERT(n_nonzero_rows > 0);
-
-        // diff_filtered: [n_embd, n_nonzero_rows]
-        struct ggml_tensor * diff_filtered = ggml_new_tensor_2d(
-            ctx_ggml, GGML_TYPE_F32, n_embd, n_nonzero_rows);
-        ggml_format_name(diff_filtered, "diff_filtered_%s", a->name);
-        diff_filtered->data = malloc(ggml_nbytes(diff_filtered));
-
-        // copy non-zero rows
-        for (int dest_row = 0; dest_row < n_nonzero_rows; dest_row++) {
-            int src_row = rows_to_copy[dest_row];
-            for (int i = 0; i < n_embd; i++) {
-                float src_elem = ggml_get_f32_nd(a, i, src_row, 0, 0);
-                ggml_set_f32_nd(diff_filtered, i, dest_row, 0, 0, src_elem);
-            }
-        }
-
-        //print_debug_tensor(diff_filtered);
-
-        return diff_filtered;
-    }
-
-    // we don't implement destructor, because we want to reuse callback_data. we just want to free the tensors
-    void reset() {
-        for (auto ptr : v_pos) free(ptr->data);
-        for (auto ptr : v_neg) free(ptr->data);
-        for (auto ptr : v_diff_filtered) free(ptr->data);
-        v_pos.clear();
-        v_neg.clear();
-        v_diff_filtered.clear();
-        if (ctx_ggml) {
-            ggml_free(ctx_ggml);
+        const int32_t row0 = n_seen[il];
+        const int32_t row1 = row0 + (int32_t) t->ne[1];
+        auto it = std::lower_bound(rows.begin(), rows.end(), row0);
+        for (; it != rows.end() && *it < row1; ++it) {
+            const size_t idx = it - rows.begin();
+            ggml_backend_tensor_get(t, v_rows[il].data() + idx*n_embd, (*it - row0)*t->nb[1], n_embd*sizeof(float));
         }
-        ctx_ggml = nullptr;
+        n_seen[il] = row1;
     }
 };
 
@@ -187,8 +106,7 @@ struct train_context {
 
     // each element of the vector correspond to one layer
     // NOTE: the last layer is discard. therefore, we will have (n_layers - 1) elements here
-    // NOTE (2): v_diff is transposed from v_diff_tmp
-    std::vector<struct ggml_tensor *> v_diff;  // vector of matrices of size [m, n_embd] where m ~ n_tokens * n_completions (v_diff contains no zero-rows)
+    std::vector<struct ggml_tensor *> v_diff;  // vector of matrices of size [n_embd, m] where m is the number of non-zero prompt pairs
     std::vector<struct ggml_tensor *> v_final; // vector of vectors of size [n_embd] to be written to file
 
     // to easily re-alloc when concat v_diff, we temporary store v_diff in a vector instead of a tensor
@@ -213,49 +131,34 @@ struct train_context {
         }
     }
 
-    // add new rows into existing tensor in v_diff_tmp
-    void concat_diff_tmp(const std::vector<struct ggml_tensor *> & diff_filtered) {
-        GGML_ASSERT((int) diff_filtered.size() == n_layers - 1);
+    // add a new row into v_diff_tmp for each layer
+    void concat_diff_tmp(const std::vector<const float *> & diff) {
+        GGML_ASSERT((int) diff.size() == n_layers - 1);
         for (int il = 0; il < n_layers - 1; il++) {
-            auto t = diff_filtered[il];
             auto & diff_tmp = v_diff_tmp[il];
             size_t curr_size = diff_tmp.size();
-            diff_tmp.resize(curr_size + ggml_nbytes(t));
-            memcpy(diff_tmp.data() + curr_size, t->data, ggml_nbytes(t));
+            diff_tmp.resize(curr_size + n_embd*sizeof(float));
+            memcpy(diff_tmp.data() + curr_size, diff[il], n_embd*sizeof(float));
         }
     }
 
-    // build the v_diff tensors from v_diff_tmp (v_diff need to be transposed)
-    // TODO @ngxson : maybe add option NOT to transpose v_diff; will be useful for "mean" method
-    void build_v_diff(bool transpose) {
+    // build the v_diff tensors from v_diff_tmp
+    void build_v_diff() {
         printf("build_v_diff\n");
         for (int il = 0; il < n_layers - 1; il++) {
             auto & diff_tmp = v_diff_tmp[il];
             int n_elem = diff_tmp.size() / sizeof(float);
             GGML_ASSERT(n_elem % n_embd == 0);
             int n_rows = n_elem / n_embd;
-            struct ggml_tensor * diff = transpose
-                ? ggml_new_tensor_2d(ctx_ggml, GGML_TYPE_F32, n_rows, n_embd)
-                : ggml_new_tensor_2d(ctx_ggml, GGML_TYPE_F32, n_embd, n_rows);
+            struct ggml_tensor * diff = ggml_new_tensor_2d(ctx_ggml, GGML_TYPE_F32, n_embd, n_rows);
             ggml_set_name(diff, (std::string("diff_") + std::to_string(il)).c_str());
             diff->data = malloc(ggml_nbytes(diff)); // TODO: get rid of this malloc if possible
-            if (transpose) {
-                // copy data & transpose
-                float * arr = (float *) diff_tmp.data();
-                for (int ir = 0; ir < n_rows; ++ir) {
-                    for (int ic = 0; ic < n_embd; ++ic) {
-                        float f = arr[ir*n_embd + ic];
-                        ggml_set_f32_nd(diff, ir, ic, 0, 0, f);
-                    }
-                }
-            } else {
-                // only copy
-                memcpy(diff->data, diff_tmp.data(), ggml_nbytes(diff));
-            }
+            memcpy(diff->data, diff_tmp.data(), ggml_nbytes(diff));
             v_diff.push_back(diff);
             print_debug_tensor(diff);
             // free memory of diff_tmp
-            diff_tmp.resize(0);
+            diff_tmp.clear();
+            diff_tmp.shrink_to_fit();
         }
     }
 
@@ -270,7 +173,6 @@ struct train_context {
 struct tokenized_prompt {
     std::vector<llama_token> tokens_pos;
     std::vector<llama_token> tokens_neg;
-    size_t max_seq_len;
 
     tokenized_prompt(llama_context * ctx, std::string pos, std::string neg) {
         const llama_model * model = llama_get_model(ctx);
@@ -278,18 +180,10 @@ struct tokenized_prompt {
         const bool add_bos = llama_vocab_get_add_bos(vocab);
         tokens_pos = common_tokenize(ctx, pos, add_bos, true);
         tokens_neg = common_tokenize(ctx, neg, add_bos, true);
-        max_seq_len = std::max(tokens_pos.size(), tokens_neg.size());
-        padding_seq(ctx, tokens_pos, max_seq_len);
-        padding_seq(ctx, tokens_neg, max_seq_len);
     }
 
-    void padding_seq(llama_context * ctx, std::vector<llama_token> & tokens, size_t len) {
-        // TODO: customize padding token
-        std::vector<llama_token> pad_tokens = common_tokenize(ctx, " ", false);
-        llama_token pad_tok = pad_tokens.back();
-        while (tokens.size() < len) {
-            tokens.push_back(pad_tok);
-        }
+    size_t n_tokens() const {
+        return tokens_pos.size() + tokens_neg.size();
     }
 };
 
@@ -325,25 +219,48 @@ static std::vector<std::string> ctrlvec_load_prompt_file(std::string path, bool
 
 static bool cb_eval(struct ggml_tensor * t, bool ask, void * user_data) {
     auto * cb_data = (callback_data *) user_data;
-    static const char * l_out_name = "l_out";
+    static const char * l_out_name = "l_out-";
     const bool is_l_out = strncmp(t->name, l_out_name, strlen(l_out_name)) == 0;
 
     if (ask) {
         return is_l_out;
     }
 
-    if (!is_l_out || t->ne[1] != cb_data->n_tokens) {
+    if (!is_l_out) {
+        return true;
+    }
+
+    // the final layer only holds the output rows and is not used
+    const int il = atoi(t->name + strlen(l_out_name));
+    if (il < 0 || il >= cb_data->n_layers - 1) {
         return true;
     }
 
-    // save the tensor to current context
-    cb_data->save_tensor_for_layer(t);
+    // save the selected rows to current batch
+    cb_data->save_rows_for_layer(t, il);
     return true;
 }
 
-static bool get_hidden_layers(llama_context * ctx, std::vector<llama_token> & tokens) {
+// evaluate the prompt pairs [i0, i1) in a single batch: the positive prompt of pair i goes to sequence 2*(i - i0),
+// the negative one to sequence 2*(i - i0) + 1 and only the hidden state of the last token of each sequence is kept
+static bool get_hidden_layers(llama_context * ctx, llama_batch & batch, callback_data & cb_data,
+        const std::vector<tokenized_prompt> & prompts, size_t i0, size_t i1) {
+    std::vector<int32_t> rows;
+    common_batch_clear(batch);
+    for (size_t i = i0; i < i1; ++i) {
+        const llama_seq_id seq = 2*(i - i0);
+        for (int is_neg = 0; is_neg < 2; ++is_neg) {
+            const auto & tokens = is_neg ? prompts[i].tokens_neg : prompts[i].tokens_pos;
+            for (size_t j = 0; j < tokens.size(); ++j) {
+                common_batch_add(batch, tokens[j], j, { seq + is_neg }, j == tokens.size() - 1);
+            }
+            rows.push_back(batch.n_tokens - 1);
+        }
+    }
+    cb_data.begin_batch(rows);
+
     llama_memory_clear(llama_get_memory(ctx), true);
-    if (llama_decode(ctx, llama_batch_get_one(tokens.data(), tokens.size()))) {
+    if (llama_decode(ctx, batch)) {
         fprintf(stderr, "%s : failed to eval\n", __func__);
         return false;
     }
@@ -395,16 +312,19 @@ int main(int argc, char ** argv) {
     common_params params;
 
     params.out_file = "control_vector.gguf";
+    params.n_parallel = 64; // 2 sequences per prompt pair
 
     if (!common_params_parse(argc, argv, params, LLAMA_EXAMPLE_CVECTOR_GENERATOR, print_usage)) {
         return 1;
     }
 
-    if (params.n_pca_iterations % params.n_pca_batch != 0) {
-        fprintf(stderr, "PCA iterations must by multiply of PCA batch size\n");
+    if (params.n_parallel < 2) {
+        fprintf(stderr, "at least 2 parallel sequences are needed to evaluate a prompt pair\n");
         return 1;
     }
 
+    // all the sequences of a batch are evaluated together
+    params.kv_unified = true;
 
     callback_data cb_data;
 
@@ -443,40 +363,80 @@ int main(int argc, char ** argv) {
     size_t n_total_tokens = 0;
     for (size_t i = 0; i < ctx_train.positive_entries.size(); ++i) {
         tokenized_prompt t(ctx, ctx_train.positive_entries[i], ctx_train.negative_entries[i]);
-        n_total_tokens += 2 * t.max_seq_len;
+        n_total_tokens += t.n_tokens();
         tokenized_prompts.push_back(std::move(t));
     }
 
     std::cout << "n_total_tokens: " << n_total_tokens << std::endl;
 
-    for(size_t i = 0; i < ctx_train.positive_entries.size(); ++i) {
-        bool success = false;
-        tokenized_prompt t = tokenized_prompts[i];
-        cb_data.n_layers = n_layers;
-        cb_data.n_tokens = t.max_seq_len;
+    // pack as many prompt pairs as fit into each batch
+    const size_t n_batch_max = std::min(llama_n_batch(ctx), llama_n_ctx(ctx));
+    const size_t n_pair_max  = llama_n_seq_max(ctx) / 2;
 
-        printf("Evaluating prompt[%d/%d]: \"%s\" - \"%s\" (%d tokens)\n",
-            (int) i+1, (int) ctx_train.positive_entries.size(),
-            tokens_to_str(ctx, t.tokens_pos.cbegin(), t.tokens_pos.cend()).c_str(),
-            tokens_to_str(ctx, t.tokens_neg.cbegin(), t.tokens_neg.cend()).c_str(),
-            (int) t.max_seq_len);
+    llama_batch batch = llama_batch_init(n_batch_max, 0, 1);
 
-        cb_data.is_eval_pos = true;
-        success = get_hidden_layers(ctx, t.tokens_pos);
-        if (!success) break;
+    cb_data.n_layers = n_layers;
+    cb_data.n_embd   = n_embd;
 
-        cb_data.is_eval_pos = false;
-        success = get_hidden_layers(ctx, t.tokens_neg);
+    size_t n_pairs_used = 0;
+    bool success = true;
+    for (size_t i0 = 0; i0 < tokenized_prompts.size() && success; ) {
+        size_t i1 = i0;
+        size_t n_tokens = 0;
+        while (i1 < tokenized_prompts.size() && i1 - i0 < n_pair_max &&
+               n_tokens + tokenized_prompts[i1].n_tokens() <= n_batch_max) {
+            n_tokens += tokenized_prompts[i1].n_tokens();
+            i1++;
+        }
+        if (i1 == i0) {
+            fprintf(stderr, "prompt pair %d has %d tokens, which does not fit into a batch of %d tokens\n",
+                (int) i0+1, (int) tokenized_prompts[i0].n_tokens(), (int) n_batch_max);
+            success = false;
+            break;
+        }
+
+        for (size_t i = i0; i < i1; ++i) {
+            const tokenized_prompt & t = tokenized_prompts[i];
+            printf("Evaluating prompt[%d/%d]: \"%s\" - \"%s\" (%d tokens)\n",
+                (int) i+1, (int) ctx_train.positive_entries.size(),
+                tokens_to_str(ctx, t.tokens_pos.cbegin(), t.tokens_pos.cend()).c_str(),
+                tokens_to_str(ctx, t.tokens_neg.cbegin(), t.tokens_neg.cend()).c_str(),
+                (int) t.n_tokens());
+        }
+
+        success = get_hidden_layers(ctx, batch, cb_data, tokenized_prompts, i0, i1);
         if (!success) break;
 
-        // calculate diff and remove all zero rows
-        auto v_diff_filtered = cb_data.calc_diff();
+        // calculate diff (v_pos - v_neg) of each pair and skip the pairs that do not differ in any layer
+        for (size_t i = 0; i < i1 - i0; ++i) {
+            std::vector<const float *> diff(n_layers - 1);
+            bool is_zero = true;
+            for (int il = 0; il < n_layers - 1; ++il) {
+                float * a = cb_data.v_rows[il].data() + (2*i + 0)*n_embd;
+                float * b = cb_data.v_rows[il].data() + (2*i + 1)*n_embd;
+                for (int j = 0; j < n_embd; ++j) {
+                    a[j] -= b[j];
+                    is_zero = is_zero && std::fabs(a[j]) <= 1e-6f;
+                }
+                diff[il] = a;
+            }
+            if (!is_zero) {
+                ctx_train.concat_diff_tmp(diff);
+                n_pairs_used++;
+            }
+        }
+
+        i0 = i1;
+    }
 
-        // save & concat the filtered v_diff to ctx_train
-        ctx_train.concat_diff_tmp(v_diff_filtered);
+    llama_batch_free(batch);
 
-        // reset for next iteration
-        cb_data.reset();
+    if (!success) {
+        return 1;
+    }
+    if (n_pairs_used == 0) {
+        fprintf(stderr, "all prompt pairs have identical hidden states\n");
+        return 1;
     }
 
     // done with the model, we can now free it to make gain some memory
@@ -485,7 +445,7 @@ int main(int argc, char ** argv) {
     bool use_pca = params.cvector_dimre_method == DIMRE_METHOD_PCA;
 
     // prepare ctx_train for PCA
-    ctx_train.build_v_diff(use_pca);
+    ctx_train.build_v_diff();
 
     if (use_pca) {
         // run PCA
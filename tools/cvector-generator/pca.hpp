@@ -1,6 +1,9 @@
 #include "common.h"
 #include "llama.h"
 #include "ggml.h"
+#include "ggml-alloc.h"
+#include "ggml-backend.h"
+#include "ggml-cpu.h"
 
 #ifdef GGML_USE_CUDA
 #include "ggml-cuda.h"
@@ -10,8 +13,9 @@
 #include "ggml-metal.h"
 #endif
 
+#include <cmath>
 #include <cstdio>
-#include <ctime>
+#include <cstring>
 #include <random>
 #include <string>
 #include <vector>
@@ -28,39 +32,35 @@ static void print_debug_tensor(struct ggml_tensor * t, bool with_data = true) {
     printf(" ... ]\n");
 }
 
+// the principal direction of each layer is computed with a randomized SVD (Halko et al., https://arxiv.org/abs/0909.4061):
+// the row space of the [n_samples, n_embd] input is sketched by n_batch random vectors, refined with power iterations and
+// the top right singular vector is taken from the small projected matrix.
+// all layers are stacked along the 3rd dimension so that every step is a single batched matmul over all layers.
 namespace PCA {
 
 // input params for PCA computations
 struct pca_params {
     int n_threads = 1;
-    int n_batch = 20; // number of iterations do to in one batch. larger the batch, more memory is used
-    int n_iterations = 1000;
-    float tolerance = 1e-7;
-
-    // for debugging
-    int i_layer = 0;
-    int n_layers = 0;
-};
-
-// result from each iteration
-struct pca_result {
-    struct ggml_tensor * calculated_square = NULL;
-    std::vector<struct ggml_tensor *> eigenvectors;
-    std::vector<float> distances;
+    int n_batch = 16;     // number of random vectors sketching the input, more is more accurate but uses more memory
+    int n_iterations = 8; // number of power iterations
 };
 
 struct pca_model {
     ggml_backend_t backend = NULL;
     ggml_backend_buffer_t buffer;
-    struct ggml_context * ctx;      // context to compute graph on target device
-    struct ggml_context * ctx_host; // host context to store results
+    struct ggml_context * ctx; // context to compute graph on target device
+
+    int64_t n_embd;
+    int64_t n_samples;
+    int64_t n_layers;
+    int64_t n_rank; // number of random vectors
 
     // tensors on target device
-    struct ggml_tensor * dev_input;
-    struct ggml_tensor * dev_square;
-    struct ggml_tensor * dev_eigenvector;
+    struct ggml_tensor * dev_input; // [n_embd, n_samples, n_layers]
+    struct ggml_tensor * dev_omega; // [n_embd, n_rank, n_layers] random starting vectors
+    struct ggml_tensor * dev_q_t;   // [n_rank, n_samples, n_layers] orthonormal basis of the sketch, transposed
 
-    pca_model(struct ggml_tensor * t_input) {
+    pca_model(const std::vector<struct ggml_tensor *> & v_input, int n_batch) {
 #ifdef GGML_USE_CUDA
         fprintf(stderr, "%s: using CUDA backend\n", __func__);
         backend = ggml_backend_cuda_init(0); // init device 0
@@ -69,7 +69,7 @@ struct pca_model {
         }
 #endif
 
-// TODO: enable Metal support when support for GGML_OP_SQRT is added
+// TODO: enable Metal support when support for GGML_OP_OUT_PROD is added
 // #ifdef GGML_USE_METAL
 //         fprintf(stderr, "%s: using Metal backend\n", __func__);
 //         backend = ggml_backend_metal_init();
@@ -83,7 +83,12 @@ struct pca_model {
             backend = ggml_backend_cpu_init();
         }
 
-        const int num_tensors = 4;
+        n_embd    = v_input[0]->ne[0];
+        n_samples = v_input[0]->ne[1];
+        n_layers  = v_input.size();
+        n_rank    = std::min<int64_t>(n_batch, std::min(n_samples, n_embd));
+
+        const int num_tensors = 3;
         struct ggml_init_params params {
             /*.mem_size   =*/ ggml_tensor_overhead() * num_tensors,
             /*.mem_buffer =*/ NULL,
@@ -91,36 +96,29 @@ struct pca_model {
         };
         ctx = ggml_init(params);
 
-        auto n_samples = t_input->ne[0];
-        auto n_embd    = t_input->ne[1];
-
-        dev_input       = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, n_samples, n_embd);
-        dev_square      = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, n_embd,    n_embd);
-        dev_eigenvector = ggml_new_tensor_1d(ctx, GGML_TYPE_F32, n_embd);
+        dev_input = ggml_new_tensor_3d(ctx, GGML_TYPE_F32, n_embd, n_samples, n_layers);
+        dev_omega = ggml_new_tensor_3d(ctx, GGML_TYPE_F32, n_embd, n_rank,    n_layers);
+        dev_q_t   = ggml_new_tensor_3d(ctx, GGML_TYPE_F32, n_rank, n_samples, n_layers);
 
-        ggml_set_name(dev_input,       "dev_input");
-        ggml_set_name(dev_square,      "dev_square");
-        ggml_set_name(dev_eigenvector, "dev_eigenvector");
+        ggml_set_name(dev_input, "dev_input");
+        ggml_set_name(dev_omega, "dev_omega");
+        ggml_set_name(dev_q_t,   "dev_q_t");
         buffer = ggml_backend_alloc_ctx_tensors(ctx, backend);
-        ggml_backend_tensor_set(dev_input, t_input->data, 0, ggml_nbytes(t_input));
 
-        // initialize eigenvector to random normalized vector
+        for (size_t il = 0; il < v_input.size(); ++il) {
+            GGML_ASSERT(v_input[il]->ne[0] == n_embd && v_input[il]->ne[1] == n_samples);
+            ggml_backend_tensor_set(dev_input, v_input[il]->data, il*dev_input->nb[2], ggml_nbytes(v_input[il]));
+        }
+
+        // initialize the sketch with gaussian random vectors
         {
-            std::vector<float> random_vec(ggml_nelements(dev_eigenvector), 0.0);
-            std::default_random_engine generator(static_cast<unsigned int>(std::time(0)));
-            std::uniform_real_distribution<float> distribution(0.0, 1.0);
-            float sum_sqr = 0.0; // for normalizing random_vec
-            for (size_t i = 0; i < random_vec.size(); ++i) {
-                float f = distribution(generator);
-                sum_sqr += f * f;
-                random_vec[i] = f;
-            }
-            // normalize it
-            float random_vec_norm = std::sqrt(sum_sqr);
-            for (size_t i = 0; i < random_vec.size(); ++i) {
-                random_vec[i] /= random_vec_norm;
+            std::vector<float> random_vec(ggml_nelements(dev_omega));
+            std::mt19937 generator(42);
+            std::normal_distribution<float> distribution(0.0f, 1.0f);
+            for (auto & f : random_vec) {
+                f = distribution(generator);
             }
-            ggml_backend_tensor_set(dev_eigenvector, random_vec.data(), 0, ggml_nbytes(dev_eigenvector));
+            ggml_backend_tensor_set(dev_omega, random_vec.data(), 0, ggml_nbytes(dev_omega));
         }
     }
 
@@ -131,185 +129,234 @@ struct pca_model {
     }
 };
 
-static struct ggml_cgraph * build_graph_piter(
-        const struct pca_params & params,
+// first = true:  y = input * omega
+// first = false: z = input^T * q, y = input * z
+static struct ggml_cgraph * build_graph_rsvd(
         const pca_model & model,
-        bool calc_square = false) {
-    GGML_ASSERT(params.n_batch > 0);
-    // TODO: buf_size must be able to scale with params.n_batch
+        bool first) {
     static size_t buf_size = ggml_tensor_overhead()*GGML_DEFAULT_GRAPH_SIZE + ggml_graph_overhead();
     static std::vector<uint8_t> buf(buf_size);
 
     struct ggml_init_params params0 = {
         /*.mem_size   =*/ buf_size,
         /*.mem_buffer =*/ buf.data(),
-        /*.no_alloc   =*/ true, // the tensors will be allocated later by ggml_allocr_alloc_graph()
+        /*.no_alloc   =*/ true, // the tensors will be allocated later by ggml_gallocr_alloc_graph()
     };
     // create a temporally context to build the graph
     struct ggml_context * ctx0 = ggml_init(params0);
     struct ggml_cgraph * gf = ggml_new_graph(ctx0);
 
-    // turn v_diff_original into square matrix if needed
-    struct ggml_tensor * tmp_square;
-    if (calc_square) {
-        tmp_square = ggml_mul_mat(ctx0, model.dev_input, model.dev_input);
-        ggml_set_name(tmp_square, "tmp_square");
+    struct ggml_tensor * z = model.dev_omega;
+    if (!first) {
+        // [n_embd, n_rank, n_layers], the contraction is over the samples
+        z = ggml_out_prod(ctx0, model.dev_input, model.dev_q_t);
+        ggml_set_name(z, "z");
+        ggml_set_output(z);
+        ggml_build_forward_expand(gf, z);
     }
 
-    struct ggml_tensor * b_tensor;
-    struct ggml_tensor * distance;
-    struct ggml_tensor * old_eigen    = model.dev_eigenvector;
-    struct ggml_tensor * input_square = calc_square ? tmp_square : model.dev_square;
-
-    for (int i = 0; i < params.n_batch; ++i) {
-        // b_tensor = square * eigenvector^T
-        b_tensor = ggml_mul_mat(ctx0, input_square, old_eigen);
-        ggml_set_name(b_tensor, "b_tensor");
-
-        // normalize
-        b_tensor = ggml_div_inplace(ctx0,
-            b_tensor,
-            ggml_sqrt_inplace(ctx0, ggml_sum_rows(ctx0, ggml_sqr(ctx0, b_tensor)))
-        );
-        ggml_format_name(b_tensor, "b_tensor_norm_%d", i);
-
-        // calculate distance(new eigenvector - old eigenvector)
-        // we don't use ggml_sub because it may not be implemented on GPU backend
-        struct ggml_tensor * new_sub_old = ggml_add(ctx0, old_eigen, ggml_scale(ctx0, b_tensor, -1));
-        distance = ggml_sqrt_inplace(ctx0,
-            ggml_sum_rows(ctx0, ggml_sqr_inplace(ctx0, new_sub_old)));
-        ggml_format_name(distance, "distance_%d", i);
-
-        old_eigen = b_tensor;
-
-        // build operations nodes
-        ggml_build_forward_expand(gf, distance);
-    }
+    // [n_samples, n_rank, n_layers]
+    struct ggml_tensor * y = ggml_mul_mat(ctx0, model.dev_input, z);
+    ggml_set_name(y, "y");
+    ggml_set_output(y);
+    ggml_build_forward_expand(gf, y);
 
     // delete the temporally context used to build the graph
     ggml_free(ctx0);
     return gf;
 }
 
-static ggml_status compute_piter(
+static void compute_rsvd(
         const struct pca_params & params,
         const pca_model & model,
-        struct ggml_cgraph * gf,
+        bool first,
         ggml_gallocr_t allocr,
-        struct pca_result & result) {
-    // allocate tensors
+        std::vector<float> & y,
+        std::vector<float> * z) {
+    struct ggml_cgraph * gf = build_graph_rsvd(model, first);
     ggml_gallocr_alloc_graph(allocr, gf);
 
     if (ggml_backend_is_cpu(model.backend)) {
         ggml_backend_cpu_set_n_threads(model.backend, params.n_threads);
     }
 
-    ggml_status res = ggml_backend_graph_compute(model.backend, gf);
-    if (res == GGML_STATUS_SUCCESS) {
-        auto extract_i = [](std::string prefix, std::string str) -> int {
-            int i = -1;
-            if (str.rfind(prefix, 0) == 0) {
-                sscanf(str.c_str(), (prefix + "%d").c_str(), &i);
+    if (ggml_backend_graph_compute(model.backend, gf) != GGML_STATUS_SUCCESS) {
+        GGML_ABORT("%s: failed to compute graph", __func__);
+    }
+
+    struct ggml_tensor * t_y = ggml_graph_get_tensor(gf, "y");
+    y.resize(ggml_nelements(t_y));
+    ggml_backend_tensor_get(t_y, y.data(), 0, ggml_nbytes(t_y));
+    if (z) {
+        struct ggml_tensor * t_z = ggml_graph_get_tensor(gf, "z");
+        z->resize(ggml_nelements(t_z));
+        ggml_backend_tensor_get(t_z, z->data(), 0, ggml_nbytes(t_z));
+    }
+}
+
+// orthonormalize the n_rank columns (of length n) of each layer in place with modified Gram-Schmidt
+// columns that are linearly dependent on the previous ones are set to zero
+static void orthonormalize(std::vector<float> & y, int64_t n, int64_t n_rank, int64_t n_layers) {
+    for (int64_t il = 0; il < n_layers; ++il) {
+        float * cols = y.data() + il*n*n_rank;
+        for (int64_t j = 0; j < n_rank; ++j) {
+            float * cj = cols + j*n;
+            double norm0 = 0.0;
+            for (int64_t i = 0; i < n; ++i) {
+                norm0 += (double) cj[i]*cj[i];
             }
-            return i;
-        };
-        result.calculated_square = NULL;
-        result.eigenvectors.clear();
-        result.distances.clear();
-        result.eigenvectors.resize(params.n_batch);
-        result.distances.resize(params.n_batch);
-        // get output nodes
-        for (int i = 0; i < ggml_graph_n_nodes(gf); ++i) {
-            auto node = ggml_graph_node(gf, i);
-            int iter = -1;
-            // find b_tensor (without copying data from device)
-            if ((iter = extract_i("b_tensor_norm_", node->name)) > -1) {
-                result.eigenvectors[iter] = node;
+            // twice is enough (Kahan/Parlett) to keep the basis orthogonal in single precision
+            for (int pass = 0; pass < 2; ++pass) {
+                for (int64_t k = 0; k < j; ++k) {
+                    const float * ck = cols + k*n;
+                    double dot = 0.0;
+                    for (int64_t i = 0; i < n; ++i) {
+                        dot += (double) ck[i]*cj[i];
+                    }
+                    for (int64_t i = 0; i < n; ++i) {
+                        cj[i] -= (float) dot*ck[i];
+                    }
+                }
             }
-            // find distances, then copy data from device
-            if ((iter = extract_i("distance_", node->name)) > -1) {
-                float d;
-                ggml_backend_tensor_get(node, &d, 0, sizeof(float));
-                result.distances[iter] = d;
-                // std::cout << node->name << " = " << d << "\n";
+            double norm = 0.0;
+            for (int64_t i = 0; i < n; ++i) {
+                norm += (double) cj[i]*cj[i];
             }
-            // find tmp_square if it exists (without copying data from device)
-            if (std::string(node->name) == "tmp_square") {
-                result.calculated_square = node;
+            const float scale = norm > 1e-10*norm0 && norm > 0.0 ? (float) (1.0/std::sqrt(norm)) : 0.0f;
+            for (int64_t i = 0; i < n; ++i) {
+                cj[i] *= scale;
             }
         }
     }
-    return res;
 }
 
-static void power_iteration(
-        const struct pca_params & params,
-        struct ggml_tensor * input, // shape of input: [n_samples, n_embd]
-        struct ggml_tensor * output) {
-    //printf("in power iteration\n");
-    struct pca_model model(input);
-
-    ggml_gallocr_t allocr = ggml_gallocr_new(ggml_backend_get_default_buffer_type(model.backend));
-    struct pca_result result;
-    struct ggml_tensor * last_eigenvector = NULL;
-
-    int n_iters = params.n_iterations / params.n_batch; // more batch, fewer iterations
-    for (int iter = 0; iter < n_iters; ++iter) {
-        bool calc_square = (iter == 0); // only need to calculate square for first iteration
-        struct ggml_cgraph * gf = build_graph_piter(params, model, calc_square);
-        // ggml_graph_dump_dot(gf, nullptr, "/tmp/_cgraph.dot");
-        compute_piter(params, model, gf, allocr, result);
-
-        for (size_t k = 0; k < result.distances.size(); ++k) {
-            last_eigenvector = result.eigenvectors[k];
-            if (result.distances[k] < params.tolerance) {
-                break; // done
+// top eigenvector of the symmetric positive semi-definite n x n matrix g, by repeated squaring
+static std::vector<double> top_eigenvector(std::vector<double> g, int64_t n) {
+    std::vector<double> tmp(n*n);
+    for (int it = 0; it < 32; ++it) {
+        double norm = 0.0;
+        for (int64_t i = 0; i < n; ++i) {
+            for (int64_t j = 0; j < n; ++j) {
+                double s = 0.0;
+                for (int64_t k = 0; k < n; ++k) {
+                    s += g[i*n + k]*g[k*n + j];
+                }
+                tmp[i*n + j] = s;
+                norm = std::max(norm, std::fabs(s));
             }
         }
-
-        if (calc_square) {
-            // copy and store the square matrix if needed
-            GGML_ASSERT(result.calculated_square != NULL);
-            ggml_backend_tensor_copy(result.calculated_square, model.dev_square);
+        if (norm == 0.0) {
+            break;
         }
-
-        {
-            // copy last eigen vector and store as input for next iteration
-            GGML_ASSERT(last_eigenvector != NULL);
-            ggml_backend_tensor_copy(last_eigenvector, model.dev_eigenvector);
+        for (int64_t i = 0; i < n*n; ++i) {
+            g[i] = tmp[i]/norm;
         }
-
-        printf("%s: layer %d/%d, iteration: %d / total: %d (batch = %d) ...\n",
-            __func__, params.i_layer+1, params.n_layers, iter+1, n_iters, params.n_batch);
     }
-
-    // get output tensor
-    GGML_ASSERT(last_eigenvector);
-    ggml_backend_tensor_get(last_eigenvector, output->data, 0, ggml_nbytes(last_eigenvector));
-    //print_debug_tensor(output);
-    ggml_gallocr_free(allocr);
-
-    // TODO @ngxson : The output vector is randomly inverted
-    // Solution: https://github.com/ggerganov/llama.cpp/pull/8069#issuecomment-2185328171
+    // all columns of g^(2^32) are multiples of the top eigenvector, take the largest one
+    int64_t jmax = 0;
+    double  nmax = -1.0;
+    for (int64_t j = 0; j < n; ++j) {
+        double s = 0.0;
+        for (int64_t i = 0; i < n; ++i) {
+            s += g[i*n + j]*g[i*n + j];
+        }
+        if (s > nmax) {
+            nmax = s;
+            jmax = j;
+        }
+    }
+    std::vector<double> u(n);
+    for (int64_t i = 0; i < n; ++i) {
+        u[i] = nmax > 0.0 ? g[i*n + jmax]/std::sqrt(nmax) : (i == 0);
+    }
+    return u;
 }
 
 static void run_pca(
         struct pca_params & params,
-        const std::vector<struct ggml_tensor *> & v_input, // shape of v_input[0]: [n_samples, n_embd]
+        const std::vector<struct ggml_tensor *> & v_input, // shape of v_input[0]: [n_embd, n_samples]
         const std::vector<struct ggml_tensor *> & v_output) {
     printf("%s: Running PCA...\n", __func__);
-    for (size_t il = 0; il < v_input.size(); ++il) {
 
-        // prepare output vector
-        struct ggml_tensor * ctrl_out = v_output[il];
-        ggml_format_name(ctrl_out, "direction.%zu", il+1);
+    struct pca_model model(v_input, params.n_batch);
+    const int64_t n_embd    = model.n_embd;
+    const int64_t n_samples = model.n_samples;
+    const int64_t n_layers  = model.n_layers;
+    const int64_t n_rank    = model.n_rank;
 
-        // run power_iteration
-        params.i_layer = il;
-        params.n_layers = v_input.size();
-        power_iteration(params, v_input[il], ctrl_out);
-        printf("%s: Done layer %d / %d\n", __func__, (int) il+1, (int) v_input.size());
+    ggml_gallocr_t allocr = ggml_gallocr_new(ggml_backend_get_default_buffer_type(model.backend));
+
+    std::vector<float> y;   // [n_layers][n_rank][n_samples]
+    std::vector<float> z;   // [n_layers][n_rank][n_embd]
+    std::vector<float> q_t; // [n_layers][n_samples][n_rank]
+
+    auto upload_q = [&]() {
+        orthonormalize(y, n_samples, n_rank, n_layers);
+        q_t.resize(y.size());
+        for (int64_t il = 0; il < n_layers; ++il) {
+            for (int64_t j = 0; j < n_rank; ++j) {
+                for (int64_t i = 0; i < n_samples; ++i) {
+                    q_t[(il*n_samples + i)*n_rank + j] = y[(il*n_rank + j)*n_samples + i];
+                }
+            }
+        }
+        ggml_backend_tensor_set(model.dev_q_t, q_t.data(), 0, ggml_nbytes(model.dev_q_t));
+    };
+
+    compute_rsvd(params, model, /*first =*/ true, allocr, y, nullptr);
+    for (int iter = 0; iter < params.n_iterations; ++iter) {
+        upload_q();
+        compute_rsvd(params, model, /*first =*/ false, allocr, y, nullptr);
+        printf("%s: iteration: %d / total: %d (all %d layers, rank = %d) ...\n",
+            __func__, iter+1, params.n_iterations, (int) n_layers, (int) n_rank);
     }
+    // z = input^T q is the transpose of the projection of the input onto the sketch, y = input z
+    upload_q();
+    compute_rsvd(params, model, /*first =*/ false, allocr, y, &z);
+
+    for (int64_t il = 0; il < n_layers; ++il) {
+        const float * zl = z.data() + il*n_rank*n_embd;
+        const float * yl = y.data() + il*n_rank*n_samples;
+
+        // the top left singular vector of the small projection is the top eigenvector of z^T z
+        std::vector<double> g(n_rank*n_rank);
+        for (int64_t i = 0; i < n_rank; ++i) {
+            for (int64_t j = 0; j < n_rank; ++j) {
+                double s = 0.0;
+                for (int64_t k = 0; k < n_embd; ++k) {
+                    s += (double) zl[i*n_embd + k]*zl[j*n_embd + k];
+                }
+                g[i*n_rank + j] = s;
+            }
+        }
+        const std::vector<double> u = top_eigenvector(g, n_rank);
+
+        // the principal direction is z u, oriented so that the samples project onto it positively on average
+        double proj = 0.0;
+        for (int64_t j = 0; j < n_rank; ++j) {
+            for (int64_t i = 0; i < n_samples; ++i) {
+                proj += u[j]*yl[j*n_samples + i];
+            }
+        }
+        std::vector<double> v(n_embd, 0.0);
+        double norm = 0.0;
+        for (int64_t k = 0; k < n_embd; ++k) {
+            for (int64_t j = 0; j < n_rank; ++j) {
+                v[k] += u[j]*zl[j*n_embd + k];
+            }
+            norm += v[k]*v[k];
+        }
+        const double scale = (proj < 0.0 ? -1.0 : 1.0)/std::max(std::sqrt(norm), 1e-30);
+
+        struct ggml_tensor * ctrl_out = v_output[il];
+        ggml_format_name(ctrl_out, "direction.%d", (int) il+1);
+        for (int64_t k = 0; k < n_embd; ++k) {
+            ggml_set_f32_1d(ctrl_out, k, (float) (v[k]*scale));
+        }
+        printf("%s: Done layer %d / %d\n", __func__, (int) il+1, (int) n_layers);
+    }
+
+    ggml_gallocr_free(allocr);
 }
 
 }
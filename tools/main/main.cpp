@@ -190,6 +190,42 @@ int main(int argc, char ** argv) {
 
     llama_attach_threadpool(ctx, threadpool, threadpool_batch);
 
+    // context-parallel prefill: the workers split the rows of the prompt batches and exchange the K/V over a ring of
+    // RPC sockets, every worker ends up with the KV cache of the prompt and only the first one continues
+    typedef void (*ggml_backend_rpc_ring_free_t)(void * ring);
+    ggml_backend_rpc_ring_free_t cp_ring_free = nullptr;
+    void * cp_ring = nullptr;
+    if (!params.cp_ring.empty()) {
+        if (!params.path_prompt_cache.empty()) {
+            LOG_ERR("%s: --cp-ring cannot be used with --prompt-cache\n", __func__);
+            return 1;
+        }
+        ggml_backend_reg_t rpc_reg = ggml_backend_reg_by_name("RPC");
+        if (!rpc_reg) {
+            LOG_ERR("%s: --cp-ring requires the RPC backend\n", __func__);
+            return 1;
+        }
+        typedef void * (*ggml_backend_rpc_ring_init_t)(const char * endpoints, int rank);
+        typedef int    (*ggml_backend_rpc_ring_size_t)(void * ring);
+        auto ring_init  = (ggml_backend_rpc_ring_init_t) ggml_backend_reg_get_proc_address(rpc_reg, "ggml_backend_rpc_ring_init");
+        auto ring_size  = (ggml_backend_rpc_ring_size_t) ggml_backend_reg_get_proc_address(rpc_reg, "ggml_backend_rpc_ring_size");
+        auto all_gather = (llama_all_gather_t)           ggml_backend_reg_get_proc_address(rpc_reg, "ggml_backend_rpc_ring_all_gather");
+        cp_ring_free    = (ggml_backend_rpc_ring_free_t) ggml_backend_reg_get_proc_address(rpc_reg, "ggml_backend_rpc_ring_free");
+        if (!ring_init || !ring_size || !all_gather || !cp_ring_free) {
+            LOG_ERR("%s: failed to find the RPC ring functions\n", __func__);
+            return 1;
+        }
+
+        LOG_INF("%s: connecting context-parallel worker %d to %s\n", __func__, params.cp_rank, params.cp_ring.c_str());
+        cp_ring = ring_init(params.cp_ring.c_str(), params.cp_rank);
+        if (!cp_ring) {
+            LOG_ERR("%s: failed to set up the context-parallel ring\n", __func__);
+            return 1;
+        }
+
+        llama_set_context_parallel(ctx, params.cp_rank, ring_size(cp_ring), all_gather, cp_ring);
+    }
+
     const int n_ctx_train = llama_model_n_ctx_train(model);
     const int n_ctx = llama_n_ctx(ctx);
 
@@ -660,15 +696,34 @@ int main(int argc, char ** argv) {
                 }
             }
 
-            for (int i = 0; i < (int) embd.size(); i += params.n_batch) {
-                int n_eval = (int) embd.size() - i;
+            int n_eval = 0;
+            for (int i = 0; i < (int) embd.size(); i += n_eval) {
+                n_eval = (int) embd.size() - i;
                 if (n_eval > params.n_batch) {
                     n_eval = params.n_batch;
                 }
 
+                llama_batch batch = llama_batch_get_one(&embd[i], n_eval);
+
+                // the context-parallel workers compute the ubatches with outputs in full, so only the last token
+                // of the prompt requests logits and it is decoded alone
+                std::vector<int8_t> cp_output;
+                if (cp_ring) {
+                    const bool is_prompt = (int) embd_inp.size() > n_consumed;
+                    if (!is_prompt && i + n_eval == (int) embd.size() && n_eval > 1) {
+                        n_eval--;
+                    }
+
+                    cp_output.assign(n_eval, 0);
+                    cp_output.back() = !is_prompt && i + n_eval == (int) embd.size();
+
+                    batch.n_tokens = n_eval;
+                    batch.logits   = cp_output.data();
+                }
+
                 LOG_DBG("eval: %s\n", string_from(ctx, embd).c_str());
 
-                if (llama_decode(ctx, llama_batch_get_one(&embd[i], n_eval))) {
+                if (llama_decode(ctx, batch)) {
                     LOG_ERR("%s : failed to eval\n", __func__);
                     return 1;
                 }
@@ -690,6 +745,18 @@ int main(int argc, char ** argv) {
 
         embd.clear();
 
+        // the prompt has been processed by all context-parallel workers
+        if (cp_ring && (int) embd_inp.size() <= n_consumed) {
+            llama_set_context_parallel(ctx, 0, 1, nullptr, nullptr);
+            cp_ring_free(cp_ring);
+            cp_ring = nullptr;
+
+            if (params.cp_rank != 0) {
+                LOG_INF("\n%s: context-parallel worker %d done with the prompt\n", __func__, params.cp_rank);
+                break;
+            }
+        }
+
         if ((int) embd_inp.size() <= n_consumed && !is_interacting) {
             // optionally save the session on first sample (for faster prompt loading next time)
             if (!path_session.empty() && need_to_save_session && !params.prompt_cache_ro) {
@@ -973,6 +1040,10 @@ int main(int argc, char ** argv) {
         }
     }
 
+    if (cp_ring) {
+        cp_ring_free(cp_ring);
+    }
+
     if (!path_session.empty() && params.prompt_cache_all && !params.prompt_cache_ro) {
         LOG("\n%s: saving final output to session file '%s'\n", __func__, path_session.c_str());
         llama_state_save_file(ctx, path_session.c_str(), session_tokens.data(), session_tokens.size());
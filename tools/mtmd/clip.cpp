@@ -11,6 +11,7 @@
 #include "ggml-backend.h"
 #include "gguf.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cmath>
 #include <cstdlib>
@@ -27,6 +28,20 @@
 #include <array>
 #include <numeric>
 #include <functional>
+#include <memory>
+
+#ifdef _WIN32
+#   define WIN32_LEAN_AND_MEAN
+#   ifndef NOMINMAX
+#       define NOMINMAX
+#   endif
+#   include <windows.h>
+#else
+#   include <fcntl.h>
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <unistd.h>
+#endif
 
 struct clip_logger_state g_logger_state = {GGML_LOG_LEVEL_CONT, clip_log_callback_default, NULL};
 
@@ -368,6 +383,78 @@ struct clip_model {
     }
 };
 
+// read-only mapping of the whole model file
+// the weights can be used directly from the page cache, so processes loading the same mmproj share the memory
+struct clip_mmap {
+    void * addr = nullptr;
+    size_t size = 0;
+
+    clip_mmap(const clip_mmap &) = delete;
+
+#ifdef _WIN32
+    clip_mmap(const std::string & fname) {
+        HANDLE hfile = CreateFileA(fname.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (hfile == INVALID_HANDLE_VALUE) {
+            throw std::runtime_error(string_format("CreateFileA failed: %lu", GetLastError()));
+        }
+
+        LARGE_INTEGER file_size;
+        if (!GetFileSizeEx(hfile, &file_size)) {
+            DWORD error = GetLastError();
+            CloseHandle(hfile);
+            throw std::runtime_error(string_format("GetFileSizeEx failed: %lu", error));
+        }
+        size = (size_t) file_size.QuadPart;
+
+        HANDLE hmapping = CreateFileMappingA(hfile, NULL, PAGE_READONLY, 0, 0, NULL);
+        DWORD error = GetLastError();
+        CloseHandle(hfile);
+        if (hmapping == NULL) {
+            throw std::runtime_error(string_format("CreateFileMappingA failed: %lu", error));
+        }
+
+        addr = MapViewOfFile(hmapping, FILE_MAP_READ, 0, 0, 0);
+        error = GetLastError();
+        CloseHandle(hmapping);
+        if (addr == NULL) {
+            throw std::runtime_error(string_format("MapViewOfFile failed: %lu", error));
+        }
+    }
+
+    ~clip_mmap() {
+        if (!UnmapViewOfFile(addr)) {
+            LOG_WRN("%s: UnmapViewOfFile failed: %lu\n", __func__, GetLastError());
+        }
+    }
+#else
+    clip_mmap(const std::string & fname) {
+        int fd = open(fname.c_str(), O_RDONLY);
+        if (fd == -1) {
+            throw std::runtime_error(string_format("open failed: %s", strerror(errno)));
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            const int err = errno;
+            close(fd);
+            throw std::runtime_error(string_format("fstat failed: %s", strerror(err)));
+        }
+        size = st.st_size;
+
+        addr = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+        const int err = errno;
+        close(fd);
+        if (addr == MAP_FAILED) {
+            throw std::runtime_error(string_format("mmap failed: %s", strerror(err)));
+        }
+    }
+
+    ~clip_mmap() {
+        munmap(addr, size);
+    }
+#endif
+};
+
 struct clip_ctx {
     clip_model model;
 
@@ -381,7 +468,12 @@ struct clip_ctx {
 
     ggml_backend_t backend = nullptr;
     ggml_backend_t backend_cpu = nullptr;
-    ggml_backend_buffer_ptr buf;
+
+    // the weight buffers may point into the mapping, so it must outlive them
+    std::shared_ptr<clip_mmap> mapping;
+    std::vector<ggml_backend_buffer_ptr> bufs;
+
+    bool use_mmap = true;
 
     int max_nodes = 8192;
     ggml_backend_sched_ptr sched;
@@ -392,6 +484,7 @@ struct clip_ctx {
 
     clip_ctx(clip_context_params & ctx_params) {
         debug_graph = std::getenv("MTMD_DEBUG_GRAPH") != nullptr;
+        use_mmap    = ctx_params.use_mmap;
         backend_cpu = ggml_backend_init_by_type(GGML_BACKEND_DEVICE_TYPE_CPU, nullptr);
         if (!backend_cpu) {
             throw std::runtime_error("failed to initialize CPU backend");
@@ -445,7 +538,9 @@ struct clip_graph {
     const clip_hparams & hparams;
 
     // we only support single image per batch
+    // audio can be batched, all entries then have the same size as img
     const clip_image_f32 & img;
+    const int n_batch;
 
     const int patch_size;
     const int n_patches_x;
@@ -462,11 +557,12 @@ struct clip_graph {
     ggml_context * ctx0;
     ggml_cgraph * gf;
 
-    clip_graph(clip_ctx * ctx, const clip_image_f32 & img) :
+    clip_graph(clip_ctx * ctx, const clip_image_f32 & img, int n_batch = 1) :
             ctx(ctx),
             model(ctx->model),
             hparams(model.hparams),
             img(img),
+            n_batch(n_batch),
             patch_size(hparams.patch_size),
             n_patches_x(img.nx / patch_size),
             n_patches_y(img.ny / patch_size),
@@ -1512,17 +1608,32 @@ struct clip_graph {
         const int n_pos    = n_frames / 2;
         GGML_ASSERT(model.position_embeddings->ne[1] >= n_pos);
 
-        ggml_tensor * inp = build_inp_raw(1);
+        // one mel spectrogram per batch entry
+        ggml_tensor * inp = build_inp_raw(n_batch);
+
+        // same as ggml_conv_1d_ph, but the output is kept as [N*OL, OC] so that the batch entries do not get mixed
+        auto conv_1d_ph = [&](ggml_tensor * w, ggml_tensor * x, int s) {
+            ggml_tensor * im2col = ggml_im2col(ctx0, w, x, s, 0, w->ne[0] / 2, 0, 1, 0, false, GGML_TYPE_F16); // [N, OL, IC * K]
+            return ggml_mul_mat(ctx0,
+                    ggml_reshape_2d(ctx0, im2col, im2col->ne[0], im2col->ne[1] * im2col->ne[2]),
+                    ggml_reshape_2d(ctx0, w, w->ne[0] * w->ne[1], w->ne[2]));
+        };
 
         // conv1d block
         {
             // convolution + gelu
-            ggml_tensor * cur = ggml_conv_1d_ph(ctx0, model.conv1d_1_w, inp, 1, 1);
+            ggml_tensor * cur = conv_1d_ph(model.conv1d_1_w, inp, 1);
             cur = ggml_add(ctx0, cur, model.conv1d_1_b);
 
             cur = ggml_gelu_erf(ctx0, cur);
 
-            cur = ggml_conv_1d_ph(ctx0, model.conv1d_2_w, cur, 2, 1);
+            if (n_batch > 1) {
+                // [N*OL, OC] -> [OL, OC, N]
+                cur = ggml_reshape_3d(ctx0, cur, cur->ne[0] / n_batch, n_batch, cur->ne[1]);
+                cur = ggml_cont(ctx0, ggml_permute(ctx0, cur, 0, 2, 1, 3));
+            }
+
+            cur = conv_1d_ph(model.conv1d_2_w, cur, 2);
             cur = ggml_add(ctx0, cur, model.conv1d_2_b);
 
             cur = ggml_gelu_erf(ctx0, cur);
@@ -1556,14 +1667,16 @@ struct clip_graph {
         if (model.audio_has_stack_frames()) {
             // StackAudioFrames
             // https://huggingface.co/fixie-ai/ultravox-v0_5-llama-3_2-1b/blob/main/ultravox_model.py
+            // the frames of each batch entry are padded and stacked separately
+            int64_t n_elements = ggml_nelements(cur) / n_batch;
             int64_t stride = n_embd * hparams.proj_stack_factor;
-            int64_t padded_len = GGML_PAD(ggml_nelements(cur), stride);
-            int64_t pad = padded_len - ggml_nelements(cur);
+            int64_t padded_len = GGML_PAD(n_elements, stride);
+            int64_t pad = padded_len - n_elements;
             if (pad > 0) {
-                cur = ggml_view_1d(ctx0, cur, ggml_nelements(cur), 0);
+                cur = ggml_view_2d(ctx0, cur, n_elements, n_batch, ggml_row_size(cur->type, n_elements), 0);
                 cur = ggml_pad(ctx0, cur, pad, 0, 0, 0);
             }
-            cur = ggml_view_2d(ctx0, cur, stride, padded_len / stride,
+            cur = ggml_view_2d(ctx0, cur, stride, padded_len / stride * n_batch,
                                 ggml_row_size(cur->type, stride), 0);
             cb(cur, "after_stacked", -1);
         }
@@ -1709,9 +1822,9 @@ private:
                     cb(Kcur, "Kcur_norm", il);
                 }
 
-                Qcur = ggml_reshape_3d(ctx0, Qcur, d_head, n_head, n_pos);
-                Kcur = ggml_reshape_3d(ctx0, Kcur, d_head, n_head, n_pos);
-                Vcur = ggml_reshape_3d(ctx0, Vcur, d_head, n_head, n_pos);
+                Qcur = ggml_reshape_4d(ctx0, Qcur, d_head, n_head, n_pos, n_batch);
+                Kcur = ggml_reshape_4d(ctx0, Kcur, d_head, n_head, n_pos, n_batch);
+                Vcur = ggml_reshape_4d(ctx0, Vcur, d_head, n_head, n_pos, n_batch);
 
                 cb(Qcur, "Qcur", il);
                 cb(Kcur, "Kcur", il);
@@ -1945,7 +2058,7 @@ private:
 
         // TODO @ngxson : support flash attention
         {
-            const auto n_tokens = q->ne[1];
+            const auto n_tokens = q->ne[1]*q->ne[3]; // batch entries are concatenated
             const auto n_head   = q->ne[2];
             // const auto n_kv     = k->ne[1]; // for flash attention
 
@@ -2079,8 +2192,11 @@ private:
 };
 
 static ggml_cgraph * clip_image_build_graph(clip_ctx * ctx, const clip_image_f32_batch & imgs) {
-    GGML_ASSERT(imgs.entries.size() == 1 && "n_batch > 1 is not supported");
-    clip_graph graph(ctx, *imgs.entries[0]);
+    GGML_ASSERT((imgs.entries.size() == 1 || imgs.is_audio) && "n_batch > 1 is only supported for audio");
+    for (const auto & entry : imgs.entries) {
+        GGML_ASSERT(entry->nx == imgs.entries[0]->nx && entry->ny == imgs.entries[0]->ny);
+    }
+    clip_graph graph(ctx, *imgs.entries[0], imgs.entries.size());
 
     ggml_cgraph * res;
 
@@ -2136,6 +2252,9 @@ struct clip_model_loader {
 
     std::string fname;
 
+    // shared by the vision and audio contexts
+    std::shared_ptr<clip_mmap> mapping;
+
     size_t model_size = 0; // in bytes
 
     bool has_vision = false;
@@ -2756,41 +2875,192 @@ struct clip_model_loader {
 
         // load data
         {
-            std::vector<uint8_t> read_buf;
+            ggml_context * ctx_data = ctx_clip.ctx_data.get();
+
+            if (ctx_clip.use_mmap && !mapping) {
+                try {
+                    mapping = std::make_shared<clip_mmap>(fname);
+                } catch (const std::exception & e) {
+                    LOG_WRN("%s: failed to mmap %s (%s), reading the file instead\n", __func__, fname.c_str(), e.what());
+                    ctx_clip.use_mmap = false;
+                }
+            }
+
+            // quantized matrix weights of the encoder can use the CPU extra buffer types (e.g. repacking)
+            if (ctx_clip.backend == ctx_clip.backend_cpu) {
+                ggml_backend_dev_t dev_cpu = ggml_backend_get_device(ctx_clip.backend_cpu);
+                ggml_backend_reg_t reg_cpu = ggml_backend_dev_backend_reg(dev_cpu);
+
+                std::vector<ggml_backend_buffer_type_t> extra_bufts;
+                auto ggml_backend_dev_get_extra_bufts_fn = (ggml_backend_dev_get_extra_bufts_t)
+                    ggml_backend_reg_get_proc_address(reg_cpu, "ggml_backend_dev_get_extra_bufts");
+                if (ggml_backend_dev_get_extra_bufts_fn) {
+                    ggml_backend_buffer_type_t * extra_buft = ggml_backend_dev_get_extra_bufts_fn(dev_cpu);
+                    while (extra_buft && *extra_buft) {
+                        extra_bufts.push_back(*extra_buft);
+                        ++extra_buft;
+                    }
+                }
+
+                for (ggml_backend_buffer_type_t buft : extra_bufts) {
+                    std::vector<ggml_tensor *> tensors;
+                    size_t size = 0;
+
+                    for (ggml_tensor * cur = ggml_get_first_tensor(ctx_data); cur; cur = ggml_get_next_tensor(ctx_data, cur)) {
+                        if (cur->data == nullptr && is_matrix_weight(cur) && weight_buft_supported(cur, buft, dev_cpu)) {
+                            tensors.push_back(cur);
+                            size += GGML_PAD(ggml_backend_buft_get_alloc_size(buft, cur), ggml_backend_buft_get_alignment(buft));
+                        }
+                    }
+
+                    if (tensors.empty()) {
+                        continue;
+                    }
 
-            auto fin = std::ifstream(fname, std::ios::binary);
-            if (!fin) {
-                throw std::runtime_error(string_format("%s: failed to open %s\n", __func__, fname.c_str()));
+                    ggml_backend_buffer_t buf = ggml_backend_buft_alloc_buffer(buft, size);
+                    if (!buf) {
+                        throw std::runtime_error(string_format("%s: failed to allocate %s buffer\n", __func__, ggml_backend_buft_name(buft)));
+                    }
+                    ggml_backend_buffer_set_usage(buf, GGML_BACKEND_BUFFER_USAGE_WEIGHTS);
+                    ctx_clip.bufs.emplace_back(buf);
+
+                    ggml_tallocr alloc = ggml_tallocr_new(buf);
+                    for (ggml_tensor * cur : tensors) {
+                        ggml_tallocr_alloc(&alloc, cur);
+                    }
+
+                    LOG_INF("%s: %10s weight buffer size = %8.2f MiB (%zu tensors)\n", __func__, ggml_backend_buft_name(buft), size / 1024.0 / 1024.0, tensors.size());
+                }
             }
 
-            // alloc memory and offload data
+            // the remaining weights use the default buffer type of the backend
+            // if the device can wrap host memory, the tensors point directly into the mapped file and nothing has to be copied
             ggml_backend_buffer_type_t buft = ggml_backend_get_default_buffer_type(ctx_clip.backend);
-            ctx_clip.buf.reset(ggml_backend_alloc_ctx_tensors_from_buft(ctx_clip.ctx_data.get(), buft));
-            ggml_backend_buffer_set_usage(ctx_clip.buf.get(), GGML_BACKEND_BUFFER_USAGE_WEIGHTS);
-            for (auto & t : tensors_to_load) {
-                ggml_tensor * cur = ggml_get_tensor(ctx_clip.ctx_data.get(), t->name);
-                const size_t offset = tensor_offset[t->name];
+            ggml_backend_dev_t dev = ggml_backend_get_device(ctx_clip.backend);
+
+            ggml_backend_dev_props props;
+            ggml_backend_dev_get_props(dev, &props);
+
+            std::vector<ggml_tensor *> tensors_mapped;
+
+            if (ctx_clip.use_mmap && props.caps.buffer_from_host_ptr && buft == ggml_backend_dev_buffer_type(dev)) {
+                ggml_backend_buffer_t buf = ggml_backend_dev_buffer_from_host_ptr(dev, mapping->addr, mapping->size, ggml_get_max_tensor_size(ctx_data));
+                if (buf) {
+                    ggml_backend_buffer_set_usage(buf, GGML_BACKEND_BUFFER_USAGE_WEIGHTS);
+                    ctx_clip.bufs.emplace_back(buf);
+                    ctx_clip.mapping = mapping;
+
+                    for (ggml_tensor * cur = ggml_get_first_tensor(ctx_data); cur; cur = ggml_get_next_tensor(ctx_data, cur)) {
+                        if (cur->data == nullptr) {
+                            const size_t offset = tensor_offset[cur->name];
+                            if (offset + ggml_nbytes(cur) > mapping->size) {
+                                throw std::runtime_error(string_format("%s: tensor %s data is out of the file bounds\n", __func__, cur->name));
+                            }
+                            ggml_backend_tensor_alloc(buf, cur, (char *) mapping->addr + offset);
+                            tensors_mapped.push_back(cur);
+                        }
+                    }
+
+                    LOG_INF("%s: %10s weight buffer size = %8.2f MiB (mmap, %zu tensors)\n", __func__, ggml_backend_buft_name(buft), mapping->size / 1024.0 / 1024.0, tensors_mapped.size());
+                }
+            }
+
+            // returns nullptr if all tensors are already allocated
+            ggml_backend_buffer_t buf = ggml_backend_alloc_ctx_tensors_from_buft(ctx_data, buft);
+            if (buf) {
+                ggml_backend_buffer_set_usage(buf, GGML_BACKEND_BUFFER_USAGE_WEIGHTS);
+                ctx_clip.bufs.emplace_back(buf);
+            }
+
+            std::vector<uint8_t> read_buf;
+            std::ifstream fin;
+            if (!ctx_clip.use_mmap) {
+                fin.open(fname, std::ios::binary);
+                if (!fin) {
+                    throw std::runtime_error(string_format("%s: failed to open %s\n", __func__, fname.c_str()));
+                }
+            }
+
+            for (ggml_tensor * cur = ggml_get_first_tensor(ctx_data); cur; cur = ggml_get_next_tensor(ctx_data, cur)) {
+                if (std::find(tensors_mapped.begin(), tensors_mapped.end(), cur) != tensors_mapped.end()) {
+                    continue;
+                }
+
+                const size_t offset = tensor_offset[cur->name];
+                const size_t num_bytes = ggml_nbytes(cur);
+
+                if (ctx_clip.use_mmap) {
+                    if (offset + num_bytes > mapping->size) {
+                        throw std::runtime_error(string_format("%s: tensor %s data is out of the file bounds\n", __func__, cur->name));
+                    }
+                    // the backend copies (or repacks) the data from the mapping
+                    ggml_backend_tensor_set(cur, (const char *) mapping->addr + offset, 0, num_bytes);
+                    continue;
+                }
+
                 fin.seekg(offset, std::ios::beg);
                 if (!fin) {
-                    throw std::runtime_error(string_format("%s: failed to seek for tensor %s\n", __func__, t->name));
+                    throw std::runtime_error(string_format("%s: failed to seek for tensor %s\n", __func__, cur->name));
                 }
-                size_t num_bytes = ggml_nbytes(cur);
-                if (ggml_backend_buft_is_host(buft)) {
+                if (ggml_backend_buffer_get_type(cur->buffer) == buft && ggml_backend_buft_is_host(buft)) {
                     // for the CPU and Metal backend, we can read directly into the tensor
                     fin.read(reinterpret_cast<char *>(cur->data), num_bytes);
                 } else {
-                    // read into a temporary buffer first, then copy to device memory
+                    // read into a temporary buffer first, then copy to device memory (or repack)
                     read_buf.resize(num_bytes);
                     fin.read(reinterpret_cast<char *>(read_buf.data()), num_bytes);
                     ggml_backend_tensor_set(cur, read_buf.data(), 0, num_bytes);
                 }
             }
-            fin.close();
 
             LOG_DBG("%s: loaded %zu tensors from %s\n", __func__, tensors_to_load.size(), fname.c_str());
         }
     }
 
+    // weights of the transformer blocks that are only used as the first operand of ggml_mul_mat
+    static bool is_matrix_weight(const ggml_tensor * t) {
+        static const char * suffixes[] = {
+            ".attn_q.weight", ".attn_k.weight", ".attn_v.weight", ".attn_out.weight",
+            ".ffn_up.weight", ".ffn_gate.weight", ".ffn_down.weight",
+        };
+        const std::string name = t->name;
+        if (name.find(".blk.") == std::string::npos || ggml_n_dims(t) != 2) {
+            return false;
+        }
+        for (const char * suffix : suffixes) {
+            const size_t len = strlen(suffix);
+            if (name.size() >= len && name.compare(name.size() - len, len, suffix) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // check if the device can compute ggml_mul_mat with the weight stored in a buffer of the given type
+    static bool weight_buft_supported(ggml_tensor * w, ggml_backend_buffer_type_t buft, ggml_backend_dev_t dev) {
+        ggml_init_params params = {
+            /*.mem_size   =*/ ggml_tensor_overhead()*8,
+            /*.mem_buffer =*/ NULL,
+            /*.no_alloc   =*/ true,
+        };
+        ggml_context_ptr ctx { ggml_init(params) };
+        if (!ctx) {
+            throw std::runtime_error("failed to create ggml context");
+        }
+
+        ggml_tensor * b = ggml_new_tensor_2d(ctx.get(), GGML_TYPE_F32, w->ne[0], 512);
+        ggml_tensor * op_tensor = ggml_mul_mat(ctx.get(), w, b);
+
+        // create a temporary dummy buffer for the weight so that supports_op can check the buffer type
+        GGML_ASSERT(w->buffer == nullptr);
+        w->buffer = ggml_backend_buft_alloc_buffer(buft, 0);
+        const bool res = ggml_backend_dev_supports_op(dev, op_tensor);
+        ggml_backend_buffer_free(w->buffer);
+        w->buffer = nullptr;
+
+        return res;
+    }
+
     void alloc_compute_meta(clip_ctx & ctx_clip) {
         const auto & hparams = ctx_clip.model.hparams;
         ctx_clip.buf_compute_meta.resize(ctx_clip.max_nodes * ggml_tensor_overhead() + ggml_graph_overhead());
@@ -3944,7 +4214,8 @@ bool clip_image_batch_encode(clip_ctx * ctx, const int n_threads, const clip_ima
 
     // TODO @ngxson : implement batch size > 1 as a loop
     //                we don't need true batching support because the cgraph will gonna be big anyway
-    if (batch_size != 1) {
+    // audio windows are small enough to be encoded in a single graph
+    if (batch_size != 1 && !imgs.is_audio) {
         return false; // only support batch size of 1
     }
 
@@ -4034,13 +4305,14 @@ bool clip_image_batch_encode(clip_ctx * ctx, const int n_threads, const clip_ima
         set_input_f32("inp_raw", inp_raw);
 
     } else {
-        // audio input
-        GGML_ASSERT(imgs.entries.size() == 1);
-        const auto & mel_inp = imgs.entries[0];
-        const int n_step = mel_inp->nx;
-        const int n_mel  = mel_inp->ny;
-        std::vector<float> inp_raw(n_step * n_mel);
-        std::memcpy(inp_raw.data(), mel_inp->buf.data(), n_step * n_mel * sizeof(float));
+        // audio input, the mel spectrograms of the batch are stored one after another
+        const int n_step = imgs.entries[0]->nx;
+        const int n_mel  = imgs.entries[0]->ny;
+        std::vector<float> inp_raw(n_step * n_mel * batch_size);
+        for (int b = 0; b < batch_size; b++) {
+            const auto & mel_inp = imgs.entries[b];
+            std::memcpy(inp_raw.data() + b * n_step * n_mel, mel_inp->buf.data(), n_step * n_mel * sizeof(float));
+        }
         set_input_f32("inp_raw", inp_raw);
     }
 
@@ -4298,9 +4570,12 @@ bool clip_image_batch_encode(clip_ctx * ctx, const int n_threads, const clip_ima
     // the last node is the embedding tensor
     ggml_tensor * embeddings = ggml_graph_node(gf, -1);
 
-    // sanity check (only support batch size of 1 for now)
+    // sanity check (only audio supports batch size > 1 for now)
     const int n_tokens_out = embeddings->ne[1];
-    const int expected_n_tokens_out = clip_n_output_tokens(ctx, imgs.entries[0].get());
+    int expected_n_tokens_out = 0;
+    for (const auto & entry : imgs.entries) {
+        expected_n_tokens_out += clip_n_output_tokens(ctx, entry.get());
+    }
     if (n_tokens_out != expected_n_tokens_out) {
         LOG_ERR("%s: expected output %d tokens, got %d\n", __func__, expected_n_tokens_out, n_tokens_out);
         GGML_ABORT("Invalid number of output tokens");
@@ -24,6 +24,7 @@ enum clip_modality {
 
 struct clip_context_params {
     bool use_gpu;
+    bool use_mmap;
     enum ggml_log_level verbosity;
 };
 
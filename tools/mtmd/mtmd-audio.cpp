@@ -282,6 +282,7 @@ bool preprocess_audio(
         const float * samples,
         size_t n_samples,
         const whisper_filters & filters,
+        int n_threads,
         std::vector<whisper_mel> & output) {
 
     if (n_samples == 0) {
@@ -297,7 +298,7 @@ bool preprocess_audio(
                 WHISPER_N_FFT,
                 WHISPER_HOP_LENGTH,
                 filters.n_mel,
-                4, // n_threads
+                std::max(1, n_threads),
                 filters,
                 false, // debug
                 out_full);
@@ -36,6 +36,7 @@ bool preprocess_audio(
         const float * samples,
         size_t n_samples,
         const whisper_filters & filters,
+        int n_threads,
         std::vector<whisper_mel> & output);
 
 } // namespace whisper_preprocessor
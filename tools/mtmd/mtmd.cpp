@@ -9,8 +9,11 @@
 #include <cerrno>
 #include <cstdio>
 #include <cstdlib>
+#include <cmath>
 #include <cstring>
 #include <limits>
+#include <numeric>
+#include <thread>
 #include <vector>
 
 // represents raw image data, layout is RGBRGBRGB...
@@ -27,6 +30,7 @@ struct mtmd_image_tokens {
     uint32_t nx; // number of tokens in x direction
     uint32_t ny; // number of tokens in y direction
     bool use_mrope_pos = false; // use M-RoPE position counting (the whole image is 1 temporal position)
+    uint32_t n_tokens_enc = 0;  // number of embeddings produced by the encoder, if more than n_tokens() they are merged
     uint32_t n_tokens() const { return nx * ny; }
     clip_image_f32_batch batch_f32; // preprocessed image patches
     std::string id; // optional user-defined ID, useful for KV cache tracking
@@ -36,6 +40,7 @@ struct mtmd_image_tokens {
             nx,
             ny,
             use_mrope_pos,
+            n_tokens_enc,
             batch_f32.clone(),
             id
         };
@@ -86,6 +91,8 @@ const char * mtmd_default_marker() {
 mtmd_context_params mtmd_context_params_default() {
     mtmd_context_params params;
     params.use_gpu = true;
+    params.use_mmap = true;
+    params.image_merge_ratio = 0.0f;
     params.print_timings = true;
     params.n_threads = 4;
     params.verbosity = GGML_LOG_LEVEL_INFO;
@@ -102,6 +109,7 @@ struct mtmd_context {
 
     bool print_timings;
     int n_threads;
+    float image_merge_ratio;
     std::string media_marker;
     const int n_embd_text;
 
@@ -130,6 +138,9 @@ struct mtmd_context {
     // for whisper, we pre-calculate the mel filter bank
     whisper_preprocessor::whisper_filters w_filters;
 
+    // max number of 30 s audio windows encoded in one graph, the compute buffer grows linearly with it
+    size_t n_audio_batch = 4;
+
     // TODO @ngxson : add timings
 
     mtmd_context(const char * mmproj_fname,
@@ -138,6 +149,7 @@ struct mtmd_context {
         text_model   (text_model),
         print_timings(ctx_params.print_timings),
         n_threads    (ctx_params.n_threads),
+        image_merge_ratio(ctx_params.image_merge_ratio),
         media_marker (ctx_params.media_marker),
         n_embd_text  (llama_model_n_embd(text_model))
     {
@@ -151,6 +163,7 @@ struct mtmd_context {
 
         clip_context_params ctx_clip_params;
         ctx_clip_params.use_gpu   = ctx_params.use_gpu;
+        ctx_clip_params.use_mmap  = ctx_params.use_mmap;
         ctx_clip_params.verbosity = ctx_params.verbosity;
         auto res = clip_init(mmproj_fname, ctx_clip_params);
         ctx_v = res.ctx_v;
@@ -191,6 +204,15 @@ struct mtmd_context {
         GGML_ASSERT(ctx_v != nullptr);
         use_mrope = clip_is_qwen2vl(ctx_v);
 
+        if (image_merge_ratio < 0.0f || image_merge_ratio >= 1.0f) {
+            throw std::runtime_error(string_format("image_merge_ratio must be in [0, 1), got %f\n", image_merge_ratio));
+        }
+        if (image_merge_ratio > 0.0f && use_mrope) {
+            // M-RoPE needs the 2D grid of the image tokens
+            LOG_WRN("%s: image token merging is not supported with M-RoPE, disabling it\n", __func__);
+            image_merge_ratio = 0.0f;
+        }
+
         projector_type proj = clip_get_projector_type(ctx_v);
         int minicpmv_version = clip_is_minicpmv(ctx_v);
         if (minicpmv_version == 2) {
@@ -582,6 +604,7 @@ struct mtmd_tokenizer {
                     // other models, we only need the total number of tokens
                     image_tokens->nx = n_tokens;
                     image_tokens->ny = 1;
+                    set_merged_n_tokens(*image_tokens);
                 }
                 image_tokens->batch_f32 = std::move(batch_f32);
                 image_tokens->id = bitmap->id; // optional
@@ -625,24 +648,30 @@ struct mtmd_tokenizer {
             std::vector<whisper_preprocessor::whisper_mel> mel_spec_chunks;
             const float * samples = (const float *)bitmap->data.data();
             size_t n_samples = bitmap->data.size() / sizeof(float);
-            bool ok = whisper_preprocessor::preprocess_audio(samples, n_samples, ctx->w_filters, mel_spec_chunks);
+            bool ok = whisper_preprocessor::preprocess_audio(samples, n_samples, ctx->w_filters, ctx->n_threads, mel_spec_chunks);
             if (!ok) {
                 LOG_ERR("Unable to preprocess audio\n");
                 return 2;
             }
 
-            // consider each mel_spec as a separate audio chunk
-            // TODO: maybe support batching, but this may come with memory cost
-            for (auto & mel_spec : mel_spec_chunks) {
-                clip_image_f32_ptr mel_f32(clip_image_f32_init());
-                mel_f32->nx  = mel_spec.n_len;
-                mel_f32->ny  = mel_spec.n_mel;
-                mel_f32->buf = std::move(mel_spec.data);
-                size_t n_tokens = clip_n_output_tokens(ctx->ctx_a, mel_f32.get());
-
+            // group up to n_audio_batch mel windows into one audio chunk, the windows of a chunk are encoded in a single graph
+            // a chunk is decoded by the LLM as soon as it is encoded, so smaller chunks give the first embeddings sooner
+            for (size_t i = 0; i < mel_spec_chunks.size(); i += ctx->n_audio_batch) {
                 clip_image_f32_batch batch_f32;
                 batch_f32.is_audio = true;
-                batch_f32.entries.push_back(std::move(mel_f32));
+
+                size_t n_tokens = 0;
+                for (size_t j = i; j < std::min(i + ctx->n_audio_batch, mel_spec_chunks.size()); j++) {
+                    auto & mel_spec = mel_spec_chunks[j];
+
+                    clip_image_f32_ptr mel_f32(clip_image_f32_init());
+                    mel_f32->nx  = mel_spec.n_len;
+                    mel_f32->ny  = mel_spec.n_mel;
+                    mel_f32->buf = std::move(mel_spec.data);
+                    n_tokens += clip_n_output_tokens(ctx->ctx_a, mel_f32.get());
+
+                    batch_f32.entries.push_back(std::move(mel_f32));
+                }
 
                 mtmd_audio_tokens_ptr audio_tokens(new mtmd_audio_tokens);
                 audio_tokens->n_tokens = n_tokens;
@@ -668,6 +697,21 @@ struct mtmd_tokenizer {
         return 0;
     }
 
+    // the number of tokens must be known before encoding, so the merge ratio is applied here
+    void set_merged_n_tokens(mtmd_image_tokens & image_tokens) {
+        if (ctx->image_merge_ratio <= 0.0f) {
+            return;
+        }
+        GGML_ASSERT(!image_tokens.use_mrope_pos);
+
+        const uint32_t n_tokens = image_tokens.n_tokens();
+        const uint32_t n_merged = n_tokens * ctx->image_merge_ratio;
+
+        image_tokens.n_tokens_enc = n_tokens;
+        image_tokens.nx = std::max(1u, n_tokens - n_merged);
+        image_tokens.ny = 1;
+    }
+
     std::vector<mtmd_input_chunk> split_batch_to_chunk(clip_image_f32_batch && batch_f32, const std::string & id) {
         std::vector<mtmd_input_chunk> chunks;
 
@@ -675,6 +719,7 @@ struct mtmd_tokenizer {
             mtmd_image_tokens_ptr image_tokens(new mtmd_image_tokens);
             image_tokens->nx = clip_n_output_tokens(ctx->ctx_v, entry.get());
             image_tokens->ny = 1;
+            set_merged_n_tokens(*image_tokens);
             image_tokens->batch_f32.entries.push_back(std::move(entry));
             image_tokens->id = id;
 
@@ -770,14 +815,125 @@ int32_t mtmd_encode_chunk(mtmd_context * ctx, const mtmd_input_chunk * chunk) {
     return 1;
 }
 
+// bipartite soft matching, ref: https://arxiv.org/abs/2210.09461
+// the tokens are split into 2 alternating sets A and B, the A tokens that are the most similar to a B token are averaged into it
+// this is repeated until n_out tokens are left; the order of the remaining tokens is kept, so the sequential positions
+// still follow the layout of the image
+static void merge_similar_tokens(std::vector<float> & embd, int n_embd, int n_out, int n_threads) {
+    int n = embd.size() / n_embd;
+
+    // number of encoder tokens that each remaining token represents, used as the weight when averaging
+    std::vector<float> size(n, 1.0f);
+
+    std::vector<float> inv_norm;
+    std::vector<int>   best;
+    std::vector<float> score;
+
+    while (n > n_out) {
+        const int n_a = (n + 1) / 2; // even tokens
+        const int n_b = n / 2;       // odd tokens
+        if (n_b == 0) {
+            break;
+        }
+
+        inv_norm.resize(n);
+        for (int i = 0; i < n; i++) {
+            const float * e = embd.data() + (size_t) i*n_embd;
+            double sum = 0.0;
+            for (int k = 0; k < n_embd; k++) {
+                sum += e[k]*e[k];
+            }
+            inv_norm[i] = 1.0f/std::max(std::sqrt(sum), 1e-6);
+        }
+
+        // closest B token of each A token (cosine similarity)
+        best.resize(n_a);
+        score.resize(n_a);
+
+        auto worker = [&](int ith, int nth) {
+            for (int a = ith; a < n_a; a += nth) {
+                const float * ea = embd.data() + (size_t) 2*a*n_embd;
+                best[a]  = 0;
+                score[a] = -INFINITY;
+                for (int b = 0; b < n_b; b++) {
+                    const float * eb = embd.data() + (size_t) (2*b + 1)*n_embd;
+                    float dot = 0.0f;
+                    for (int k = 0; k < n_embd; k++) {
+                        dot += ea[k]*eb[k];
+                    }
+                    dot *= inv_norm[2*a]*inv_norm[2*b + 1];
+                    if (dot > score[a]) {
+                        best[a]  = b;
+                        score[a] = dot;
+                    }
+                }
+            }
+        };
+
+        const int nth = std::max(1, std::min(n_threads, n_a));
+        std::vector<std::thread> workers;
+        for (int ith = 1; ith < nth; ith++) {
+            workers.emplace_back(worker, ith, nth);
+        }
+        worker(0, nth);
+        for (auto & w : workers) {
+            w.join();
+        }
+
+        // merge the r most similar A tokens
+        const int r = std::min(n - n_out, n_a);
+
+        std::vector<int> order(n_a);
+        std::iota(order.begin(), order.end(), 0);
+        std::partial_sort(order.begin(), order.begin() + r, order.end(), [&](int i, int j) {
+            return score[i] > score[j];
+        });
+
+        std::vector<bool> merged(n, false);
+        for (int k = 0; k < r; k++) {
+            const int ia = 2*order[k];
+            const int ib = 2*best[order[k]] + 1;
+
+            const float * ea = embd.data() + (size_t) ia*n_embd;
+            float       * eb = embd.data() + (size_t) ib*n_embd;
+
+            const float w = size[ia]/(size[ia] + size[ib]);
+            for (int d = 0; d < n_embd; d++) {
+                eb[d] += w*(ea[d] - eb[d]);
+            }
+            size[ib] += size[ia];
+            merged[ia] = true;
+        }
+
+        // compact the remaining tokens
+        int j = 0;
+        for (int i = 0; i < n; i++) {
+            if (merged[i]) {
+                continue;
+            }
+            if (i != j) {
+                std::memcpy(embd.data() + (size_t) j*n_embd, embd.data() + (size_t) i*n_embd, n_embd*sizeof(float));
+                size[j] = size[i];
+            }
+            j++;
+        }
+        n = j;
+    }
+
+    embd.resize((size_t) n*n_embd);
+}
+
 int32_t mtmd_encode(mtmd_context * ctx, const mtmd_image_tokens * image_tokens) {
     clip_ctx * ctx_clip = ctx->ctx_v;
     if (!ctx_clip) {
         LOG_ERR("%s: this API does not support non-vision input, please use mtmd_encode_chunk instead\n", __func__);
         return 1;
     }
+    const int n_tokens_out = image_tokens->n_tokens();
+    const int n_tokens_enc = std::max(image_tokens->n_tokens_enc, image_tokens->n_tokens());
+
     int n_mmproj_embd = clip_n_mmproj_embd(ctx_clip);
-    ctx->image_embd_v.resize(image_tokens->n_tokens() * n_mmproj_embd);
+    ctx->image_embd_v.resize(n_tokens_enc * n_mmproj_embd);
     bool ok = false;
 
     if (clip_is_llava(ctx_clip) || clip_is_minicpmv(ctx_clip) || clip_is_glm(ctx_clip)) {
@@ -799,6 +955,14 @@ int32_t mtmd_encode(mtmd_context * ctx, const mtmd_image_tokens * image_tokens)
             ctx->image_embd_v.data());
     }
 
+    if (ok && n_tokens_out < n_tokens_enc) {
+        const int64_t t_start_us = ggml_time_us();
+        merge_similar_tokens(ctx->image_embd_v, n_mmproj_embd, n_tokens_out, ctx->n_threads);
+        GGML_ASSERT(ctx->image_embd_v.size() == (size_t) n_tokens_out * n_mmproj_embd);
+        LOG_DBG("%s: merged %d image tokens into %d in %.1f ms\n", __func__,
+            n_tokens_enc, n_tokens_out, (ggml_time_us() - t_start_us) / 1000.0);
+    }
+
     return ok ? 0 : 1;
 }
 
@@ -77,6 +77,8 @@ typedef struct mtmd_input_text   mtmd_input_text;
 
 struct mtmd_context_params {
     bool use_gpu;
+    bool use_mmap; // mmap the projector file, weights on the CPU are not copied
+    float image_merge_ratio; // fraction of the image tokens removed by merging similar ones before the LLM (0.0 = disabled)
     bool print_timings;
     int n_threads;
     enum ggml_log_level verbosity;
@@ -24,6 +24,8 @@
 #include <cstddef>
 #include <cinttypes>
 #include <deque>
+#include <fstream>
+#include <list>
 #include <memory>
 #include <mutex>
 #include <signal.h>
@@ -35,6 +37,9 @@ using json = nlohmann::ordered_json;
 
 constexpr int HTTP_POLLING_SECONDS = 1;
 
+// with --prefill-buckets, a prompt that was left out of this many batches in a row is batched first
+constexpr int PREFILL_MAX_SKIPS = 4;
+
 enum stop_type {
     STOP_TYPE_NONE,
     STOP_TYPE_EOS,
@@ -68,6 +73,7 @@ enum server_task_type {
     SERVER_TASK_TYPE_SLOT_RESTORE,
     SERVER_TASK_TYPE_SLOT_ERASE,
     SERVER_TASK_TYPE_SET_LORA,
+    SERVER_TASK_TYPE_PREFIX_LOOKUP,
 };
 
 enum oaicompat_type {
@@ -86,6 +92,7 @@ enum error_type {
     ERROR_TYPE_PERMISSION,
     ERROR_TYPE_UNAVAILABLE, // custom error
     ERROR_TYPE_NOT_SUPPORTED, // custom error
+    ERROR_TYPE_OVERLOADED, // custom error
 };
 
 static bool server_task_type_need_embd(server_task_type task_type) {
@@ -108,6 +115,15 @@ static bool server_task_type_need_logits(server_task_type task_type) {
     }
 }
 
+// KV length bucket of a prompt chunk, the buckets double in size starting from n_ubatch
+static int prompt_kv_bucket(int32_t n_kv, int32_t n_ubatch) {
+    int bucket = 0;
+    for (int64_t n = n_ubatch; n < n_kv; n *= 2) {
+        bucket++;
+    }
+    return bucket;
+}
+
 struct slot_params {
     bool stream        = true;
     bool cache_prompt  = true; // remember the prompt to avoid reprocessing all prompt
@@ -127,6 +143,7 @@ struct slot_params {
     std::vector<std::string> response_fields;
     bool timings_per_token = false;
     bool post_sampling_probs = false;
+    bool echo = false; // also return the probabilities of the prompt tokens (requires n_probs > 0)
 
     struct common_params_sampling sampling;
     struct common_params_speculative speculative;
@@ -195,6 +212,7 @@ struct slot_params {
                 {"speculative.p_min",         speculative.p_min},
                 {"timings_per_token",         timings_per_token},
                 {"post_sampling_probs",       post_sampling_probs},
+                {"echo",                      echo},
                 {"lora",                      lora},
             };
         }
@@ -253,6 +271,7 @@ struct slot_params {
             {"speculative.p_min",         speculative.p_min},
             {"timings_per_token",         timings_per_token},
             {"post_sampling_probs",       post_sampling_probs},
+            {"echo",                      echo},
             {"lora",                      lora},
         };
     }
@@ -272,6 +291,9 @@ struct server_task {
     server_tokens prompt_tokens;
     int id_selected_slot = -1;
 
+    // used by SERVER_TASK_TYPE_RERANK
+    int32_t n_shared_prefix = 0; // number of leading prompt tokens that are common to all tasks of the request
+
     // used by SERVER_TASK_TYPE_SLOT_SAVE, SERVER_TASK_TYPE_SLOT_RESTORE, SERVER_TASK_TYPE_SLOT_ERASE
     struct slot_action {
         int slot_id;
@@ -286,6 +308,9 @@ struct server_task {
     // used by SERVER_TASK_TYPE_SET_LORA
     std::vector<common_adapter_lora_info> set_lora;
 
+    // used by SERVER_TASK_TYPE_PREFIX_LOOKUP
+    std::vector<uint64_t> block_hashes;
+
     server_task(server_task_type type) : type(type) {}
 
     static slot_params params_from_json_cmpl(
@@ -344,6 +369,7 @@ struct server_task {
         params.sampling.n_probs            = json_value(data, "n_probs",            defaults.sampling.n_probs);
         params.sampling.min_keep           = json_value(data, "min_keep",           defaults.sampling.min_keep);
         params.post_sampling_probs         = json_value(data, "post_sampling_probs", defaults.post_sampling_probs);
+        params.echo                        = json_value(data, "echo",               defaults.echo);
 
         params.speculative.n_min = json_value(data, "speculative.n_min", defaults.speculative.n_min);
         params.speculative.n_max = json_value(data, "speculative.n_max", defaults.speculative.n_max);
@@ -765,6 +791,7 @@ struct server_task_result_cmpl_final : server_task_result {
 
     bool post_sampling_probs;
     std::vector<completion_token_output> probs_output;
+    std::vector<completion_token_output> prompt_probs_output;
     std::vector<std::string>  response_fields;
 
     slot_params generation_params;
@@ -820,15 +847,21 @@ struct server_task_result_cmpl_final : server_task_result {
         if (!stream && !probs_output.empty()) {
             res["completion_probabilities"] = completion_token_output::probs_vector_to_json(probs_output, post_sampling_probs);
         }
+        if (!prompt_probs_output.empty()) {
+            res["prompt_probabilities"] = completion_token_output::probs_vector_to_json(prompt_probs_output, post_sampling_probs);
+        }
         return response_fields.empty() ? res : json_get_nested_values(response_fields, res);
     }
 
     json to_json_oaicompat() {
         std::time_t t = std::time(0);
         json logprobs = json(nullptr); // OAI default to null
-        if (!stream && probs_output.size() > 0) {
+        if (!stream && (probs_output.size() > 0 || prompt_probs_output.size() > 0)) {
+            // with echo, the prompt tokens come first
+            std::vector<completion_token_output> probs = prompt_probs_output;
+            probs.insert(probs.end(), probs_output.begin(), probs_output.end());
             logprobs = json{
-                {"content", completion_token_output::probs_vector_to_json(probs_output, post_sampling_probs)},
+                {"content", completion_token_output::probs_vector_to_json(probs, post_sampling_probs)},
             };
         }
         json finish_reason = "length";
@@ -838,7 +871,7 @@ struct server_task_result_cmpl_final : server_task_result {
         json res = json {
             {"choices",            json::array({
                 json{
-                    {"text",          stream ? "" : content}, // in stream mode, content is already in last partial chunk
+                    {"text",          stream ? "" : (generation_params.echo ? prompt + content : content)}, // in stream mode, content is already in last partial chunk
                     {"index",         index},
                     {"logprobs",      logprobs},
                     {"finish_reason", finish_reason},
@@ -1224,6 +1257,10 @@ static json format_error_response(const std::string & message, const enum error_
             type_str = "unavailable_error";
             code = 503;
             break;
+        case ERROR_TYPE_OVERLOADED:
+            type_str = "overloaded_error";
+            code = 429;
+            break;
     }
     return json {
         {"code", code},
@@ -1350,6 +1387,55 @@ struct server_task_result_apply_lora : server_task_result {
     }
 };
 
+struct server_task_result_prefix_lookup : server_task_result {
+    struct slot_info {
+        int  id;
+        int  n_cached_tokens;
+        bool is_processing;
+    };
+
+    std::vector<slot_info> slots;
+    std::vector<int>       pinned; // number of cached tokens for each pinned prefix
+
+    virtual json to_json() override {
+        json slots_json  = json::array();
+        json pinned_json = json::array();
+
+        int n_cached_max = 0;
+        int id_slot_max  = -1;
+
+        for (size_t i = 0; i < pinned.size(); ++i) {
+            pinned_json.push_back({
+                { "id",              i },
+                { "n_cached_tokens", pinned[i] },
+            });
+
+            n_cached_max = std::max(n_cached_max, pinned[i]);
+        }
+
+        for (const auto & info : slots) {
+            slots_json.push_back({
+                { "id",              info.id },
+                { "n_cached_tokens", info.n_cached_tokens },
+                { "is_processing",   info.is_processing },
+            });
+
+            if (info.n_cached_tokens > n_cached_max) {
+                n_cached_max = info.n_cached_tokens;
+                id_slot_max  = info.id;
+            }
+        }
+
+        return json {
+            { "block_size",      PREFIX_BLOCK_SIZE },
+            { "n_cached_tokens", n_cached_max },
+            { "id_slot",         id_slot_max },
+            { "slots",           slots_json },
+            { "pinned",          pinned_json },
+        };
+    }
+};
+
 struct server_slot {
     int id;
     int id_task = -1;
@@ -1394,6 +1480,12 @@ struct server_slot {
     // input prompt tokens
     server_tokens prompt_tokens;
 
+    // the first n_shared_prefix prompt tokens can be forked from another slot that already evaluated them
+    int32_t n_shared_prefix = 0;
+
+    // number of batches in a row that were built without the remaining prompt tokens of this slot (--prefill-buckets)
+    int32_t n_prefill_skipped = 0;
+
     size_t last_nl_pos = 0;
 
     std::string  generated_text;
@@ -1404,6 +1496,10 @@ struct server_slot {
 
     std::vector<completion_token_output> generated_token_probs;
 
+    // probabilities of the prompt tokens (echo) and the (batch index, prompt position) of the pending ones
+    std::vector<completion_token_output> prompt_token_probs;
+    std::vector<std::pair<int32_t, int32_t>> i_batch_prompt;
+
     std::vector<swa_checkpoint> swa_checkpoints;
 
     bool has_next_token = true;
@@ -1455,6 +1551,8 @@ struct server_slot {
 
         generated_tokens.clear();
         generated_token_probs.clear();
+        prompt_token_probs.clear();
+        i_batch_prompt.clear();
         chat_msg = {};
         json_schema = json();
         generated_tool_call_ids.clear();
@@ -1472,12 +1570,16 @@ struct server_slot {
         return server_task_type_need_logits(task_type);
     }
 
+    bool need_prompt_probs() const {
+        return need_logits() && params.echo && params.sampling.n_probs > 0;
+    }
+
     // if the context does not have a memory module then all embeddings have to be computed within a single ubatch
     // also we cannot split if the pooling would require any past tokens
     bool can_split() const {
         return
             !need_embd() ||
-            (llama_get_memory(ctx) && llama_pooling_type(ctx) == LLAMA_POOLING_TYPE_LAST);
+            (llama_get_memory(ctx) && (llama_pooling_type(ctx) == LLAMA_POOLING_TYPE_LAST || llama_pooling_type(ctx) == LLAMA_POOLING_TYPE_RANK));
     }
 
     bool can_batch_with(server_slot & other_slot) const {
@@ -1500,6 +1602,16 @@ struct server_slot {
         return n_remaining > 0; // no budget
     }
 
+    // number of context cells used by the slot, compared with n_ctx
+    // with a KV budget, the evicted cells leave room for more than n_ctx positions
+    int32_t n_ctx_used(const common_params & global_params) const {
+        if (global_params.kv_budget > 0) {
+            return llama_memory_seq_n_cells(llama_get_memory(ctx), id);
+        }
+
+        return n_past;
+    }
+
     bool is_processing() const {
         return state != SLOT_STATE_IDLE;
     }
@@ -1678,6 +1790,15 @@ struct server_metrics {
     uint64_t n_decode_total     = 0;
     uint64_t n_busy_slots_total = 0;
 
+    // moving averages of the recent throughput, used to predict the cost of new tasks
+    double t_prompt_per_token    = 0.0; // ms
+    double t_predicted_per_token = 0.0; // ms
+    double n_predicted_per_task  = 0.0;
+
+    static void update_avg(double & avg, double value) {
+        avg = avg == 0.0 ? value : 0.9*avg + 0.1*value;
+    }
+
     void init() {
         t_start = ggml_time_us();
     }
@@ -1688,6 +1809,10 @@ struct server_metrics {
         t_prompt_processing             += slot.t_prompt_processing;
         t_prompt_processing_total       += slot.t_prompt_processing;
 
+        if (slot.n_prompt_tokens_processed > 0) {
+            update_avg(t_prompt_per_token, slot.t_prompt_processing / slot.n_prompt_tokens_processed);
+        }
+
         if (slot.n_past > 0) {
             n_past_max = std::max(n_past_max, (uint64_t) slot.n_past);
         }
@@ -1698,6 +1823,11 @@ struct server_metrics {
         n_tokens_predicted         += slot.n_decoded;
         t_tokens_generation        += slot.t_token_generation;
         t_tokens_generation_total  += slot.t_token_generation;
+
+        if (slot.n_decoded > 1) {
+            update_avg(t_predicted_per_token, slot.t_token_generation / (slot.n_decoded - 1));
+        }
+        update_avg(n_predicted_per_task, slot.n_decoded);
     }
 
     void on_decoded(const std::vector<server_slot> & slots) {
@@ -1720,6 +1850,90 @@ struct server_metrics {
     }
 };
 
+// prompt prefix loaded from a slot save file, kept in memory for the lifetime of the server
+struct server_pinned_prefix {
+    std::string path;
+
+    llama_tokens tokens;
+
+    std::vector<uint8_t>  state; // sequence state, in the format of llama_state_seq_get_data()
+    std::vector<uint64_t> block_hashes;
+};
+
+// results of deterministic completion requests, keyed by a hash of the prompt and the generation params
+// identical requests that arrive while the first one (the leader) is still processed are attached to it as followers
+struct server_cmpl_cache {
+    size_t n_max = 0; // max number of cached results, 0 = disabled
+
+    // most recently used first
+    std::list<std::pair<std::string, server_task_result_cmpl_final>> entries;
+    std::unordered_map<std::string, decltype(entries)::iterator> entries_map;
+
+    std::unordered_map<int, std::string>                      leaders;   // task id -> key
+    std::unordered_map<std::string, std::vector<server_task>> followers; // key -> waiting tasks
+
+    // the result must only depend on the prompt and the params
+    static bool can_cache(const server_task & task) {
+        if (task.type != SERVER_TASK_TYPE_COMPLETION && task.type != SERVER_TASK_TYPE_INFILL) {
+            return false;
+        }
+
+        const auto & params = task.params;
+
+        return !params.stream &&
+               !task.prompt_tokens.has_mtmd &&
+               params.t_max_predict_ms <= 0 &&
+               (params.sampling.temp <= 0.0f || params.sampling.seed != LLAMA_DEFAULT_SEED);
+    }
+
+    static std::string get_key(const server_task & task) {
+        const auto & params = task.params;
+
+        json data = params.to_json();
+        data["type"]              = task.type;
+        data["n_indent"]          = params.n_indent;
+        data["return_tokens"]     = params.return_tokens;
+        data["response_fields"]   = params.response_fields;
+        data["verbose"]           = params.verbose;
+        data["oaicompat"]         = params.oaicompat;
+        data["oaicompat_model"]   = params.oaicompat_model;
+        data["parse_tool_calls"]  = params.oaicompat_chat_syntax.parse_tool_calls;
+
+        const std::string    str    = data.dump();
+        const llama_tokens & tokens = task.prompt_tokens.get_text_tokens();
+
+        return fnv_hash((const uint8_t *) str.data(), str.size()) + ":" +
+               fnv_hash((const uint8_t *) tokens.data(), tokens.size()*sizeof(llama_token));
+    }
+
+    const server_task_result_cmpl_final * get(const std::string & key) {
+        auto it = entries_map.find(key);
+        if (it == entries_map.end()) {
+            return nullptr;
+        }
+
+        entries.splice(entries.begin(), entries, it->second);
+
+        return &it->second->second;
+    }
+
+    void put(const std::string & key, const server_task_result_cmpl_final & res) {
+        auto it = entries_map.find(key);
+        if (it != entries_map.end()) {
+            entries.erase(it->second);
+            entries_map.erase(it);
+        }
+
+        entries.emplace_front(key, res);
+        entries_map[key] = entries.begin();
+
+        while (entries.size() > n_max) {
+            entries_map.erase(entries.back().first);
+            entries.pop_back();
+        }
+    }
+};
+
 struct server_queue {
     int id = 0;
     bool running;
@@ -2053,12 +2267,26 @@ struct server_context {
 
     server_metrics metrics;
 
+    server_cmpl_cache cmpl_cache;
+
+    std::vector<server_pinned_prefix> pinned_prefixes;
+
+    // tasks that passed the admission control and wait for a slot -> predicted cost in ms
+    std::unordered_map<int, double> admitted_cost;
+
+    // top-n candidates buffer reused when computing token probabilities
+    std::vector<llama_token_data> token_probs_buf;
+
     // Necessary similarity of prompt for slot selection
     float slot_prompt_similarity = 0.0f;
 
     common_chat_templates_ptr chat_templates;
     oaicompat_parser_options  oai_parser_opt;
 
+    // CPU threadpool shared by all the contexts of the process (target and draft)
+    ggml_threadpool_t threadpool = nullptr;
+    decltype(ggml_threadpool_free) * threadpool_free_fn = nullptr;
+
     ~server_context() {
         mtmd_free(mctx);
 
@@ -2077,6 +2305,46 @@ struct server_context {
         }
 
         llama_batch_free(batch);
+
+        if (threadpool) {
+            if (ctx) {
+                llama_detach_threadpool(ctx);
+            }
+            threadpool_free_fn(threadpool);
+        }
+    }
+
+    // create a single threadpool for the process, so that the contexts do not create their own threads and compete for the cores
+    // the graphs of the contexts are computed one at a time on the shared threads
+    void init_threadpool() {
+        auto * cpu_dev = ggml_backend_dev_by_type(GGML_BACKEND_DEVICE_TYPE_CPU);
+        if (!cpu_dev) {
+            return;
+        }
+
+        auto * reg = ggml_backend_dev_backend_reg(cpu_dev);
+        auto * threadpool_new_fn = (decltype(ggml_threadpool_new) *) ggml_backend_reg_get_proc_address(reg, "ggml_threadpool_new");
+        threadpool_free_fn = (decltype(ggml_threadpool_free) *) ggml_backend_reg_get_proc_address(reg, "ggml_threadpool_free");
+        if (!threadpool_new_fn || !threadpool_free_fn) {
+            return;
+        }
+
+        // the threadpool must have enough threads for the largest of the contexts
+        struct ggml_threadpool_params tpp = ggml_threadpool_params_from_cpu_params(params_base.cpuparams_batch);
+        tpp.n_threads = std::max(tpp.n_threads, params_base.cpuparams.n_threads);
+        if (model_dft) {
+            tpp.n_threads = std::max({ tpp.n_threads, params_base.speculative.cpuparams.n_threads, params_base.speculative.cpuparams_batch.n_threads });
+        }
+
+        threadpool = threadpool_new_fn(&tpp);
+        if (!threadpool) {
+            SRV_WRN("failed to create the threadpool, n_threads = %d\n", tpp.n_threads);
+            return;
+        }
+
+        SRV_INF("shared threadpool created, n_threads = %d\n", tpp.n_threads);
+
+        llama_attach_threadpool(ctx, threadpool, nullptr);
     }
 
     bool load_model(const common_params & params) {
@@ -2112,6 +2380,7 @@ struct server_context {
             params_dft.n_parallel   = 1;
             params_dft.cache_type_k = params_base.speculative.cache_type_k;
             params_dft.cache_type_v = params_base.speculative.cache_type_v;
+            params_dft.kv_cache_file.clear();
 
             params_dft.cpuparams.n_threads = params_base.speculative.cpuparams.n_threads;
             params_dft.cpuparams_batch.n_threads = params_base.speculative.cpuparams_batch.n_threads;
@@ -2140,6 +2409,8 @@ struct server_context {
             llama_init_dft.context.reset();
         }
 
+        init_threadpool();
+
         chat_templates = common_chat_templates_init(model, params_base.chat_template);
         try {
             common_chat_format_example(chat_templates.get(), params.use_jinja, params.default_template_kwargs);
@@ -2153,6 +2424,8 @@ struct server_context {
         if (!mmproj_path.empty()) {
             mtmd_context_params mparams = mtmd_context_params_default();
             mparams.use_gpu       = params_base.mmproj_use_gpu;
+            mparams.use_mmap      = params_base.use_mmap;
+            mparams.image_merge_ratio = params_base.image_merge_ratio;
             mparams.print_timings = false;
             mparams.n_threads     = params_base.cpuparams.n_threads;
             mparams.verbosity     = params_base.verbosity > 0 ? GGML_LOG_LEVEL_DEBUG : GGML_LOG_LEVEL_INFO;
@@ -2191,6 +2464,74 @@ struct server_context {
             }
         }
 
+        if (!params_base.pinned_prefixes.empty()) {
+            if (mctx) {
+                SRV_ERR("%s\n", "err: pinned prefixes are not supported by multimodal");
+                return false;
+            }
+
+            if (llama_model_n_swa(model) > 0 && !params_base.swa_full) {
+                SRV_ERR("%s\n", "err: pinned prefixes require --swa-full for models with sliding window attention");
+                return false;
+            }
+
+            for (const auto & path : params_base.pinned_prefixes) {
+                if (!load_pinned_prefix(path)) {
+                    SRV_ERR("failed to load pinned prefix, '%s'\n", path.c_str());
+                    return false;
+                }
+            }
+        }
+
+        return true;
+    }
+
+    // the file is expected in the format written by llama_state_seq_save_file(), e.g. by the slot save endpoint
+    bool load_pinned_prefix(const std::string & path) {
+        std::ifstream file(path, std::ios::binary);
+        if (!file) {
+            return false;
+        }
+
+        const std::vector<uint8_t> buf((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+        uint32_t header[3]; // magic, version, number of tokens
+        if (buf.size() < sizeof(header)) {
+            return false;
+        }
+        memcpy(header, buf.data(), sizeof(header));
+
+        if (header[0] != LLAMA_STATE_SEQ_MAGIC || header[1] != LLAMA_STATE_SEQ_VERSION) {
+            SRV_ERR("unknown (magic, version) for sequence state file: %08x, %08x\n", header[0], header[1]);
+            return false;
+        }
+
+        const size_t n_tokens = header[2];
+        const size_t offs     = sizeof(header) + n_tokens*sizeof(llama_token);
+        if (n_tokens == 0 || buf.size() <= offs) {
+            return false;
+        }
+
+        server_pinned_prefix prefix;
+        prefix.path = path;
+        prefix.tokens.resize(n_tokens);
+        memcpy(prefix.tokens.data(), buf.data() + sizeof(header), n_tokens*sizeof(llama_token));
+        prefix.state.assign(buf.begin() + offs, buf.end());
+
+        server_tokens tokens;
+        tokens.insert(prefix.tokens);
+        prefix.block_hashes = tokens.get_block_hashes();
+
+        // make sure the state is compatible with the current context
+        if (llama_state_seq_set_data(ctx, prefix.state.data(), prefix.state.size(), 0) == 0) {
+            return false;
+        }
+        llama_memory_seq_rm(llama_get_memory(ctx), 0, -1, -1);
+
+        SRV_INF("loaded pinned prefix '%s', n_tokens = %zu, size = %.3f MiB\n", path.c_str(), n_tokens, prefix.state.size() / 1024.0 / 1024.0);
+
+        pinned_prefixes.push_back(std::move(prefix));
+
         return true;
     }
 
@@ -2218,6 +2559,10 @@ struct server_context {
                     return;
                 }
 
+                if (threadpool) {
+                    llama_attach_threadpool(slot.ctx_dft, threadpool, nullptr);
+                }
+
                 slot.spec = common_speculative_init(slot.ctx, slot.ctx_dft);
                 if (slot.spec == nullptr) {
                     SRV_ERR("%s", "failed to create speculator\n");
@@ -2253,6 +2598,8 @@ struct server_context {
 
         metrics.init();
 
+        cmpl_cache.n_max = std::max(0, params_base.n_cache_cmpl);
+
         oai_parser_opt = {
             /* use_jinja             */ params_base.use_jinja,
             /* prefill_assistant     */ params_base.prefill_assistant,
@@ -2275,6 +2622,35 @@ struct server_context {
         return nullptr;
     }
 
+    // find another slot that shares the first slot.n_shared_prefix prompt tokens with the given slot
+    // pending == true : the other slot is still evaluating its prompt
+    // pending == false: the shared prefix is already present in the memory of the other slot
+    server_slot * get_slot_with_shared_prefix(const server_slot & slot, bool pending) {
+        if (slot.n_shared_prefix <= 0) {
+            return nullptr;
+        }
+
+        for (server_slot & other : slots) {
+            if (other.id == slot.id || !are_lora_equal(other.lora, slot.lora)) {
+                continue;
+            }
+
+            const bool is_pending = other.state == SLOT_STATE_PROCESSING_PROMPT || other.state == SLOT_STATE_DONE_PROMPT;
+            const bool is_ready   = other.state == SLOT_STATE_IDLE              || other.state == SLOT_STATE_GENERATING;
+
+            if (pending ? !is_pending : !is_ready) {
+                continue;
+            }
+
+            const server_tokens & tokens = pending ? other.prompt_tokens : other.cache_tokens;
+            if ((int32_t) tokens.get_common_prefix(slot.prompt_tokens) >= slot.n_shared_prefix) {
+                return &other;
+            }
+        }
+
+        return nullptr;
+    }
+
     server_slot * get_available_slot(const server_task & task) {
         server_slot * ret = nullptr;
 
@@ -2338,13 +2714,58 @@ struct server_context {
         return ret;
     }
 
+    // predicted time in ms that a task occupies a slot, based on the recent throughput
+    double predict_task_cost(server_task_type type, int n_prompt_tokens, int n_predict, int n_decoded = 0) const {
+        double res = n_prompt_tokens*metrics.t_prompt_per_token;
+
+        if (server_task_type_need_logits(type)) {
+            if (n_predict < 0) {
+                n_predict = params_base.n_predict;
+            }
+
+            const double n_gen = n_predict < 0 ? metrics.n_predicted_per_task : n_predict;
+
+            res += std::max(0.0, n_gen - n_decoded)*metrics.t_predicted_per_token;
+        }
+
+        return res;
+    }
+
+    // predicted time in ms until a new task gets a slot
+    // the tasks that were already admitted take the slots that become free first
+    double predict_queue_wait() const {
+        // predicted time until each slot is free
+        std::vector<double> t_free;
+        t_free.reserve(slots.size());
+
+        for (const server_slot & slot : slots) {
+            if (!slot.is_processing()) {
+                t_free.push_back(0.0);
+                continue;
+            }
+
+            const int n_prompt_left = std::max(0, (int) slot.prompt_tokens.size() - slot.n_past);
+
+            t_free.push_back(predict_task_cost(slot.task_type, slot.n_decoded > 0 ? 0 : n_prompt_left, slot.params.n_predict, slot.n_decoded));
+        }
+
+        for (const auto & it : admitted_cost) {
+            *std::min_element(t_free.begin(), t_free.end()) += it.second;
+        }
+
+        return *std::min_element(t_free.begin(), t_free.end());
+    }
+
     bool launch_slot_with_task(server_slot & slot, server_task && task) {
+        admitted_cost.erase(task.id);
+
         slot.reset();
         slot.id_task       = task.id;
         slot.index         = task.index;
         slot.task_type     = task.type;
         slot.params        = std::move(task.params);
         slot.prompt_tokens = std::move(task.prompt_tokens);
+        slot.n_shared_prefix = task.n_shared_prefix;
 
         if (!are_lora_equal(slot.params.lora, slot.lora)) {
             // if lora is changed, we cannot reuse cached tokens
@@ -2451,7 +2872,7 @@ struct server_context {
         }
 
         // if context shifting is disabled, make sure that we don't run out of context
-        if (!params_base.ctx_shift && slot.n_past + 1 >= slot.n_ctx) {
+        if (!params_base.ctx_shift && slot.n_ctx_used(params_base) + 1 >= slot.n_ctx) {
             slot.stop           = STOP_TYPE_LIMIT;
             slot.has_next_token = false;
 
@@ -2516,7 +2937,7 @@ struct server_context {
         }
 
         // if context shift is disabled, we stop when it reaches the context limit
-        if (slot.n_past >= slot.n_ctx) {
+        if (slot.n_ctx_used(params_base) >= slot.n_ctx) {
             slot.truncated      = true;
             slot.stop           = STOP_TYPE_LIMIT;
             slot.has_next_token = false;
@@ -2550,9 +2971,8 @@ struct server_context {
         return slot.has_next_token; // continue
     }
 
-    void populate_token_probs(const server_slot & slot, completion_token_output & result, bool post_sampling, bool special, int idx) const {
+    void populate_token_probs(const server_slot & slot, completion_token_output & result, bool post_sampling, bool special, int idx) {
         size_t n_probs = slot.params.sampling.n_probs;
-        size_t n_vocab = llama_vocab_n_tokens(vocab);
 
         if (post_sampling) {
             const auto * cur_p = common_sampler_get_candidates(slot.smpl, true);
@@ -2576,28 +2996,47 @@ struct server_context {
                 });
             }
         } else {
-            // TODO: optimize this with min-p optimization
-            std::vector<llama_token_data> cur = get_token_probabilities(ctx, idx);
-
             // set probability for sampled token
-            for (size_t i = 0; i < n_vocab; i++) {
-                // set probability for sampled token
-                if (cur[i].id == result.tok) {
-                    result.prob = cur[i].p;
-                    break;
-                }
-            }
+            result.prob = get_token_probabilities(ctx, idx, result.tok, n_probs, token_probs_buf);
 
             // set probability for top n_probs tokens
-            result.probs.reserve(n_probs);
-            for (size_t i = 0; i < std::min(n_vocab, n_probs); i++) {
+            result.probs.reserve(token_probs_buf.size());
+            for (const auto & cur : token_probs_buf) {
+                result.probs.push_back({
+                    cur.id,
+                    common_token_to_piece(ctx, cur.id, special),
+                    cur.p
+                });
+            }
+        }
+    }
+
+    // compute the probabilities of the prompt tokens that were evaluated in the batch view [i_batch, i_batch + n_tokens)
+    void populate_prompt_probs(server_slot & slot, int32_t i_batch, int32_t n_tokens) {
+        size_t n_done = 0;
+
+        for (const auto & [idx, pos] : slot.i_batch_prompt) {
+            if (idx >= i_batch + n_tokens) {
+                break;
+            }
+
+            // the logits at position pos predict the next prompt token
+            auto & result = slot.prompt_token_probs[pos + 1];
+            result.prob = get_token_probabilities(ctx, idx - i_batch, result.tok, slot.params.sampling.n_probs, token_probs_buf);
+
+            result.probs.reserve(token_probs_buf.size());
+            for (const auto & cur : token_probs_buf) {
                 result.probs.push_back({
-                    cur[i].id,
-                    common_token_to_piece(ctx, cur[i].id, special),
-                    cur[i].p
+                    cur.id,
+                    common_token_to_piece(ctx, cur.id, params_base.special),
+                    cur.p
                 });
             }
+
+            n_done++;
         }
+
+        slot.i_batch_prompt.erase(slot.i_batch_prompt.begin(), slot.i_batch_prompt.begin() + n_done);
     }
 
     void send_error(const server_task & task, const std::string & error, const enum error_type type = ERROR_TYPE_SERVER) {
@@ -2611,6 +3050,8 @@ struct server_context {
     void send_error(const int id_task, const std::string & error, const enum error_type type = ERROR_TYPE_SERVER) {
         SRV_ERR("task id = %d, error: %s\n", id_task, error.c_str());
 
+        cmpl_cache_abort(id_task);
+
         auto res = std::make_unique<server_task_result_error>();
         res->id       = id_task;
         res->err_type = type;
@@ -2688,6 +3129,13 @@ struct server_context {
         res->oaicompat_cmpl_id     = slot.params.oaicompat_cmpl_id;
         res->oaicompat_msg         = slot.update_chat_msg(res->oaicompat_msg_diffs);
 
+        // populate res.prompt_probs_output, skipping the media chunks
+        for (auto & prob : slot.prompt_token_probs) {
+            if (prob.tok != LLAMA_TOKEN_NULL) {
+                res->prompt_probs_output.push_back(std::move(prob));
+            }
+        }
+
         // populate res.probs_output
         if (slot.params.sampling.n_probs > 0) {
             if (!slot.params.stream && slot.stop == STOP_TYPE_WORD) {
@@ -2706,9 +3154,65 @@ struct server_context {
 
         res->generation_params = slot.params; // copy the parameters
 
+        cmpl_cache_finish(*res);
+
         queue_results.send(std::move(res));
     }
 
+    void send_cmpl_cache_result(const server_task_result_cmpl_final & src, const server_task & task) {
+        auto res = std::make_unique<server_task_result_cmpl_final>(src);
+        res->id                = task.id;
+        res->index             = task.index;
+        res->oaicompat_cmpl_id = task.params.oaicompat_cmpl_id;
+
+        queue_results.send(std::move(res));
+    }
+
+    // store the result of a leader task and send it to the identical tasks that were attached to it
+    void cmpl_cache_finish(const server_task_result_cmpl_final & res) {
+        auto it = cmpl_cache.leaders.find(res.id);
+        if (it == cmpl_cache.leaders.end()) {
+            return;
+        }
+
+        const std::string key = std::move(it->second);
+        cmpl_cache.leaders.erase(it);
+
+        std::vector<server_task> followers = std::move(cmpl_cache.followers[key]);
+        cmpl_cache.followers.erase(key);
+
+        cmpl_cache.put(key, res);
+
+        for (const auto & task : followers) {
+            send_cmpl_cache_result(res, task);
+        }
+    }
+
+    // the task failed or was cancelled
+    // if it was a leader, the attached tasks are queued again to be processed on their own
+    void cmpl_cache_abort(int id_task) {
+        auto it = cmpl_cache.leaders.find(id_task);
+        if (it == cmpl_cache.leaders.end()) {
+            for (auto & [key, tasks] : cmpl_cache.followers) {
+                tasks.erase(std::remove_if(tasks.begin(), tasks.end(), [id_task](const server_task & task) {
+                    return task.id == id_task;
+                }), tasks.end());
+            }
+            return;
+        }
+
+        const std::string key = std::move(it->second);
+        cmpl_cache.leaders.erase(it);
+
+        std::vector<server_task> followers = std::move(cmpl_cache.followers[key]);
+        cmpl_cache.followers.erase(key);
+
+        if (!followers.empty()) {
+            SRV_DBG("leader task %d did not finish, requeue %zu identical tasks\n", id_task, followers.size());
+            queue_tasks.post(std::move(followers), true);
+        }
+    }
+
     void send_embedding(const server_slot & slot, const llama_batch & batch) {
         auto res = std::make_unique<server_task_result_embd>();
         res->id        = slot.id_task;
@@ -2895,6 +3399,44 @@ struct server_context {
             case SERVER_TASK_TYPE_EMBEDDING:
             case SERVER_TASK_TYPE_RERANK:
                 {
+                    if (cmpl_cache.n_max > 0 && server_cmpl_cache::can_cache(task) && cmpl_cache.leaders.count(task.id) == 0) {
+                        const std::string key = server_cmpl_cache::get_key(task);
+
+                        if (const auto * res = cmpl_cache.get(key)) {
+                            SRV_DBG("completion cache hit, id_task = %d\n", task.id);
+                            send_cmpl_cache_result(*res, task);
+                            break;
+                        }
+
+                        auto it = cmpl_cache.followers.find(key);
+                        if (it != cmpl_cache.followers.end()) {
+                            // an identical task is being processed - wait for its result
+                            SRV_DBG("attaching task to an identical task in flight, id_task = %d\n", task.id);
+                            it->second.push_back(std::move(task));
+                            break;
+                        }
+
+                        cmpl_cache.leaders[task.id] = key;
+                        cmpl_cache.followers[key].clear();
+                    }
+
+                    // shed load early instead of letting the client time out after the work has been done
+                    if (params_base.admission_deadline >= 0 && admitted_cost.count(task.id) == 0) {
+                        const int n_prompt_tokens = task.prompt_tokens.size();
+
+                        const double t_wait  = predict_queue_wait();
+                        const double t_first = t_wait + n_prompt_tokens*metrics.t_prompt_per_token;
+
+                        // a request that does not have to wait is always admitted, otherwise it could never be served
+                        if (t_wait > 0.0 && t_first > params_base.admission_deadline) {
+                            SRV_WRN("rejecting task %d, predicted time to first token = %.0f ms, queue wait = %.0f ms\n", task.id, t_first, t_wait);
+                            send_error(task, string_format("the server is overloaded, the predicted time to first token is %.0f ms", t_first), ERROR_TYPE_OVERLOADED);
+                            break;
+                        }
+
+                        admitted_cost[task.id] = predict_task_cost(task.type, n_prompt_tokens, task.params.n_predict);
+                    }
+
                     const int id_slot = task.id_selected_slot;
 
                     server_slot * slot = id_slot != -1 ? get_slot_by_id(id_slot) : get_available_slot(task);
@@ -2927,6 +3469,10 @@ struct server_context {
                             break;
                         }
                     }
+
+                    cmpl_cache_abort(task.id_target);
+
+                    admitted_cost.erase(task.id_target);
                 } break;
             case SERVER_TASK_TYPE_NEXT_RESPONSE:
                 {
@@ -3102,7 +3648,34 @@ struct server_context {
                     res->id = task.id;
                     queue_results.send(std::move(res));
                 } break;
+            case SERVER_TASK_TYPE_PREFIX_LOOKUP:
+                {
+                    auto res = std::make_unique<server_task_result_prefix_lookup>();
+                    res->id = task.id;
 
+                    // the hash of a block covers the entire prefix, so the blocks match up to the first difference
+                    const auto n_cached = [&task](const std::vector<uint64_t> & hashes) {
+                        size_t n_match = 0;
+                        while (n_match < hashes.size() && n_match < task.block_hashes.size() && hashes[n_match] == task.block_hashes[n_match]) {
+                            n_match++;
+                        }
+                        return (int) (n_match*PREFIX_BLOCK_SIZE);
+                    };
+
+                    for (const server_slot & slot : slots) {
+                        // a slot that is processing its prompt is about to have all of it in the cache
+                        const bool is_loading = slot.state == SLOT_STATE_STARTED || slot.state == SLOT_STATE_PROCESSING_PROMPT;
+                        const auto & hashes = is_loading ? slot.prompt_tokens.get_block_hashes() : slot.cache_tokens.get_block_hashes();
+
+                        res->slots.push_back({ slot.id, n_cached(hashes), slot.is_processing() });
+                    }
+
+                    for (const auto & prefix : pinned_prefixes) {
+                        res->pinned.push_back(n_cached(prefix.block_hashes));
+                    }
+
+                    queue_results.send(std::move(res));
+                } break;
         }
     }
 
@@ -3139,7 +3712,7 @@ struct server_context {
         // apply context-shift if needed
         // TODO: simplify and improve
         for (server_slot & slot : slots) {
-            if (slot.is_processing() && slot.n_past + 1 >= slot.n_ctx) {
+            if (slot.is_processing() && slot.n_ctx_used(params_base) + 1 >= slot.n_ctx) {
                 if (!params_base.ctx_shift) {
                     // this check is redundant (for good)
                     // we should never get here, because generation should already stopped in process_token()
@@ -3220,9 +3793,46 @@ struct server_context {
         int32_t n_batch  = llama_n_batch(ctx);
         int32_t n_ubatch = llama_n_ubatch(ctx);
 
+        // with --prefill-buckets: start of each group of prompt tokens with a different KV length bucket
+        // each group is decoded in separate llama_decode() calls so that its ubatches have a similar attention cost
+        std::vector<int32_t> batch_splits;
+        int prompt_bucket_last = -1;
+
+        // with --prefill-buckets, the prompts with the fewest remaining tokens are batched first to reduce the mean
+        // time to first token, otherwise the slots are visited in order
+        // a prompt that was passed over PREFILL_MAX_SKIPS times goes first, so that a stream of short prompts cannot starve it
+        std::vector<server_slot *> slots_order;
+        for (auto & slot : slots) {
+            slots_order.push_back(&slot);
+        }
+        if (params_base.prefill_buckets) {
+            auto n_prompt_left = [](const server_slot * slot) -> size_t {
+                switch (slot->state) {
+                    case SLOT_STATE_STARTED:           return slot->prompt_tokens.size();
+                    case SLOT_STATE_PROCESSING_PROMPT: return slot->n_prompt_tokens - slot->n_past;
+                    default:                           return 0;
+                }
+            };
+            for (auto * slot : slots_order) {
+                // reset below when the slot gets tokens in this batch
+                slot->n_prefill_skipped = n_prompt_left(slot) > 0 ? slot->n_prefill_skipped + 1 : 0;
+            }
+            auto is_starved = [](const server_slot * slot) {
+                return slot->n_prefill_skipped > PREFILL_MAX_SKIPS;
+            };
+            std::stable_sort(slots_order.begin(), slots_order.end(), [&](const server_slot * a, const server_slot * b) {
+                if (is_starved(a) || is_starved(b)) {
+                    return a->n_prefill_skipped > b->n_prefill_skipped;
+                }
+                return n_prompt_left(a) < n_prompt_left(b);
+            });
+        }
+
         // next, batch any pending prompts without exceeding n_batch
         if (params_base.cont_batching || batch.n_tokens == 0) {
-            for (auto & slot : slots) {
+            for (auto * slot_ptr : slots_order) {
+                auto & slot = *slot_ptr;
+
                 // check if we can batch this slot with the previous one
                 if (slot.is_processing()) {
                     if (!slot_batched) {
@@ -3236,6 +3846,12 @@ struct server_context {
                 if (slot.state == SLOT_STATE_PROCESSING_PROMPT || slot.state == SLOT_STATE_STARTED) {
                     auto & prompt_tokens = slot.prompt_tokens;
 
+                    // another slot is evaluating the same prompt prefix - wait for it and fork its memory instead
+                    if (slot.state == SLOT_STATE_STARTED && slot.can_split() && get_slot_with_shared_prefix(slot, true) != nullptr) {
+                        SLT_DBG(slot, "waiting for the shared prompt prefix, n_shared_prefix = %d\n", slot.n_shared_prefix);
+                        continue;
+                    }
+
                     // TODO: maybe move branch to outside of this loop in the future
                     if (slot.state == SLOT_STATE_STARTED) {
                         slot.t_start_process_prompt = ggml_time_us();
@@ -3389,6 +4005,65 @@ struct server_context {
 
                                     SLT_DBG(slot, "after context reuse, new slot.n_past = %d\n", slot.n_past);
                                 }
+
+                                // restore the longest matching pinned prefix if it covers more than the cached tokens
+                                if (!pinned_prefixes.empty()) {
+                                    const llama_tokens & tokens = prompt_tokens.get_text_tokens();
+
+                                    const server_pinned_prefix * best = nullptr;
+                                    size_t n_best = slot.n_past;
+
+                                    for (const auto & prefix : pinned_prefixes) {
+                                        size_t n = 0;
+                                        while (n < prefix.tokens.size() && n < tokens.size() && prefix.tokens[n] == tokens[n]) {
+                                            n++;
+                                        }
+
+                                        if (n > n_best) {
+                                            best   = &prefix;
+                                            n_best = n;
+                                        }
+                                    }
+
+                                    if (best != nullptr) {
+                                        slot.cache_tokens.clear();
+
+                                        if (llama_state_seq_set_data(ctx, best->state.data(), best->state.size(), slot.id) > 0) {
+                                            slot.cache_tokens.insert({ tokens.begin(), tokens.begin() + n_best });
+                                            slot.n_past = n_best;
+
+                                            SLT_INF(slot, "restored pinned prefix '%s', n_past = %d\n", best->path.c_str(), slot.n_past);
+                                        } else {
+                                            llama_memory_seq_rm(llama_get_memory(ctx), slot.id, -1, -1);
+                                            slot.n_past = 0;
+                                        }
+                                    }
+                                }
+
+                                // fork the shared prompt prefix from another slot (e.g. the query of a rerank request)
+                                if (slot.n_past < slot.n_shared_prefix && !mctx && llama_model_n_swa(model) == 0) {
+                                    const server_slot * other = get_slot_with_shared_prefix(slot, false);
+                                    if (other != nullptr) {
+                                        llama_memory_t mem = llama_get_memory(ctx);
+
+                                        // full copy, as copying a partial range is not supported across KV streams
+                                        llama_memory_seq_rm(mem, slot.id, -1, -1);
+                                        llama_memory_seq_cp(mem, other->id, slot.id, -1, -1);
+
+                                        slot.cache_tokens.clear();
+
+                                        if (llama_memory_seq_rm(mem, slot.id, slot.n_shared_prefix, -1)) {
+                                            const llama_tokens & tokens = prompt_tokens.get_text_tokens();
+                                            slot.cache_tokens.insert({ tokens.begin(), tokens.begin() + slot.n_shared_prefix });
+                                            slot.n_past = slot.n_shared_prefix;
+
+                                            SLT_INF(slot, "forked shared prompt prefix from slot %d, n_past = %d\n", other->id, slot.n_past);
+                                        } else {
+                                            llama_memory_seq_rm(mem, slot.id, -1, -1);
+                                            slot.n_past = 0;
+                                        }
+                                    }
+                                }
                             } else {
                                 // if we don't cache the prompt, we have to remove the entire KV cache
                                 slot.n_past = 0;
@@ -3459,6 +4134,21 @@ struct server_context {
                             }
                         }
 
+                        if (slot.need_prompt_probs()) {
+                            // the logits of all prompt tokens are needed, so the cached prompt cannot be reused
+                            slot.n_past = 0;
+
+                            // the first token (and the tokens of media chunks) have no probability (NAN is serialized as null)
+                            slot.prompt_token_probs.clear();
+                            slot.prompt_token_probs.reserve(slot.n_prompt_tokens);
+                            for (int i = 0; i < slot.n_prompt_tokens; ++i) {
+                                const llama_token tok = prompt_tokens[i];
+                                const std::string txt = tok == LLAMA_TOKEN_NULL ? "" : common_token_to_piece(ctx, tok, params_base.special);
+
+                                slot.prompt_token_probs.push_back({ tok, NAN, txt, {} });
+                            }
+                        }
+
                         if (slot.n_past == slot.n_prompt_tokens && slot.n_past > 0) {
                             SLT_WRN(slot, "need to evaluate at least 1 token for each active slot, n_past = %d, n_prompt_tokens = %d\n", slot.n_past, slot.n_prompt_tokens);
 
@@ -3513,6 +4203,17 @@ struct server_context {
                         slot.n_prompt_tokens_processed += n_pos;
                     }
 
+                    if (params_base.prefill_buckets && slot.n_past < slot.n_prompt_tokens && batch.n_tokens < n_batch) {
+                        slot.n_prefill_skipped = 0;
+
+                        const int32_t n_past_end = std::min(slot.n_prompt_tokens, slot.n_past + n_batch - batch.n_tokens);
+                        const int bucket = prompt_kv_bucket(n_past_end, n_ubatch);
+                        if (prompt_bucket_last >= 0 && bucket != prompt_bucket_last) {
+                            batch_splits.push_back(batch.n_tokens);
+                        }
+                        prompt_bucket_last = bucket;
+                    }
+
                     // add prompt tokens for processing in the current batch
                     while (slot.n_past < slot.n_prompt_tokens && batch.n_tokens < n_batch) {
                         // get next token to process
@@ -3524,7 +4225,13 @@ struct server_context {
                         // embedding requires all tokens in the batch to be output
                         const bool need_embd = server_task_type_need_embd(slot.task_type);
 
-                        common_batch_add(batch, cur_tok, slot.n_past, { slot.id }, need_embd);
+                        // prompt probabilities require the logits of all but the last prompt token (which is sampled below)
+                        const bool need_probs = slot.need_prompt_probs() && slot.n_past + 1 < slot.n_prompt_tokens && slot.prompt_tokens[slot.n_past + 1] != LLAMA_TOKEN_NULL;
+                        if (need_probs) {
+                            slot.i_batch_prompt.push_back({ batch.n_tokens, slot.n_past });
+                        }
+
+                        common_batch_add(batch, cur_tok, slot.n_past, { slot.id }, need_embd || need_probs);
                         slot.cache_tokens.push_back(cur_tok);
 
                         slot.n_prompt_tokens_processed++;
@@ -3586,7 +4293,15 @@ struct server_context {
 
         // process the created batch of tokens
         for (int32_t i = 0; i < batch.n_tokens; i = i_next) {
-            const int32_t n_tokens = std::min(n_batch, batch.n_tokens - i);
+            int32_t n_tokens = std::min(n_batch, batch.n_tokens - i);
+
+            // do not mix prompt tokens of different KV length buckets in one call
+            for (const int32_t split : batch_splits) {
+                if (split > i) {
+                    n_tokens = std::min(n_tokens, split - i);
+                    break;
+                }
+            }
 
             llama_batch batch_view = {
                 n_tokens,
@@ -3645,6 +4360,12 @@ struct server_context {
             // on successful decode, restore the original batch size
             n_batch = llama_n_batch(ctx);
 
+            for (auto & slot : slots) {
+                if (!slot.i_batch_prompt.empty()) {
+                    populate_prompt_probs(slot, i, n_tokens);
+                }
+            }
+
             for (auto & slot : slots) {
                 if (slot.i_batch < (int) i || slot.i_batch >= (int) (i + n_tokens)) {
                     continue; // continue loop of slots
@@ -3764,7 +4485,7 @@ struct server_context {
 
                 // note: n_past is not yet increased for the `id` token sampled above
                 //       also, need to leave space for 1 extra token to allow context shifts
-                n_draft_max = std::min(n_draft_max, slot.n_ctx - slot.n_past - 2);
+                n_draft_max = std::min(n_draft_max, slot.n_ctx - slot.n_ctx_used(params_base) - 2);
 
                 if (slot.n_remaining > 0) {
                     n_draft_max = std::min(n_draft_max, slot.n_remaining - 1);
@@ -4119,6 +4840,71 @@ int main(int argc, char ** argv) {
         res_ok(res, res_metrics->slots_data);
     };
 
+    const auto handle_prefix_lookup = [&](const httplib::Request & req, httplib::Response & res) {
+        if (!params.endpoint_slots) {
+            res_error(res, format_error_response("This server does not support slots endpoint. Start it with `--slots`", ERROR_TYPE_NOT_SUPPORTED));
+            return;
+        }
+
+        const json body = json::parse(req.body);
+
+        std::vector<uint64_t> block_hashes;
+        int n_prompt_tokens = -1;
+
+        if (body.contains("block_hashes")) {
+            try {
+                for (const auto & h : body.at("block_hashes")) {
+                    block_hashes.push_back(std::stoull(h.get<std::string>(), nullptr, 16));
+                }
+            } catch (const std::exception &) {
+                res_error(res, format_error_response("\"block_hashes\" must be an array of hexadecimal strings", ERROR_TYPE_INVALID_REQUEST));
+                return;
+            }
+        } else if (body.contains("prompt")) {
+            auto tokenized_prompts = tokenize_input_prompts(ctx_server.vocab, ctx_server.mctx, body.at("prompt"), true, true);
+            if (tokenized_prompts.size() != 1) {
+                res_error(res, format_error_response("\"prompt\" must contain only a single prompt", ERROR_TYPE_INVALID_REQUEST));
+                return;
+            }
+
+            n_prompt_tokens = tokenized_prompts[0].size();
+            block_hashes    = tokenized_prompts[0].get_block_hashes();
+        } else {
+            res_error(res, format_error_response("either \"prompt\" or \"block_hashes\" must be provided", ERROR_TYPE_INVALID_REQUEST));
+            return;
+        }
+
+        int task_id = ctx_server.queue_tasks.get_new_id();
+        {
+            server_task task(SERVER_TASK_TYPE_PREFIX_LOOKUP);
+            task.id           = task_id;
+            task.block_hashes = block_hashes;
+            ctx_server.queue_results.add_waiting_task_id(task_id);
+            ctx_server.queue_tasks.post(std::move(task), true); // high-priority task
+        }
+
+        server_task_result_ptr result = ctx_server.queue_results.recv(task_id);
+        ctx_server.queue_results.remove_waiting_task_id(task_id);
+
+        if (result->is_error()) {
+            res_error(res, result->to_json());
+            return;
+        }
+
+        json data = result->to_json();
+        if (n_prompt_tokens >= 0) {
+            json hashes = json::array();
+            for (const uint64_t h : block_hashes) {
+                hashes.push_back(string_format("%016" PRIx64, h));
+            }
+
+            data["n_prompt_tokens"] = n_prompt_tokens;
+            data["block_hashes"]    = hashes;
+        }
+
+        res_ok(res, data);
+    };
+
     const auto handle_metrics = [&](const httplib::Request &, httplib::Response & res) {
         if (!params.endpoint_metrics) {
             res_error(res, format_error_response("This server does not support metrics endpoint. Start it with `--metrics`", ERROR_TYPE_NOT_SUPPORTED));
@@ -4923,10 +5709,14 @@ int main(int argc, char ** argv) {
             tasks.reserve(tokenized_docs.size());
             for (size_t i = 0; i < tokenized_docs.size(); i++) {
                 auto tmp = format_rerank(ctx_server.vocab, tokenized_queries[0], tokenized_docs[i]);
-                server_task task   = server_task(SERVER_TASK_TYPE_RERANK);
-                task.id            = ctx_server.queue_tasks.get_new_id();
-                task.index         = i;
-                task.prompt_tokens = std::move(tmp);
+                // the query part of the prompt is evaluated once and then shared between the documents
+                const size_t n_doc = tokenized_docs[i].size() + (llama_vocab_get_add_eos(ctx_server.vocab) ? 1 : 0);
+
+                server_task task     = server_task(SERVER_TASK_TYPE_RERANK);
+                task.id              = ctx_server.queue_tasks.get_new_id();
+                task.index           = i;
+                task.n_shared_prefix = tmp.size() - n_doc;
+                task.prompt_tokens   = std::move(tmp);
                 tasks.push_back(std::move(task));
             }
 
@@ -5069,6 +5859,7 @@ int main(int argc, char ** argv) {
     // Save & load slots
     svr->Get (params.api_prefix + "/slots",               handle_slots);
     svr->Post(params.api_prefix + "/slots/:id_slot",      handle_slots_action);
+    svr->Post(params.api_prefix + "/prefix-lookup",       handle_prefix_lookup);
 
     //
     // Start the server
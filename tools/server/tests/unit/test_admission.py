@@ -0,0 +1,81 @@
+import pytest
+import time
+from utils import *
+
+server = ServerPreset.tinyllama2()
+
+
+@pytest.fixture(autouse=True)
+def create_server():
+    global server
+    server = ServerPreset.tinyllama2()
+    server.n_ctx = 4096
+    server.n_slots = 1
+    server.n_predict = -1
+    server.server_slots = True
+
+
+def wait_busy_and_request(data: dict) -> ServerResponse:
+    while not any(slot["is_processing"] for slot in server.make_request("GET", "/slots").body):
+        time.sleep(0.01)
+    return server.make_request("POST", "/completion", data=data)
+
+
+def test_admission_deadline_rejects_when_busy():
+    global server
+    # any request that has to wait for a slot is rejected
+    server.admission_deadline = 0
+    server.start()
+
+    # measure the throughput, an idle server always admits the request
+    res = server.make_request("POST", "/completion", data={
+        "prompt": "I believe the meaning of life is",
+        "n_predict": 16,
+    })
+    assert res.status_code == 200
+
+    results = parallel_function_calls([
+        (server.make_request, ("POST", "/completion", {
+            "prompt": "Write a very long book.",
+            "n_predict": 2048,
+            "ignore_eos": True,
+        })),
+        (wait_busy_and_request, ({
+            "prompt": "I believe the meaning of life is",
+            "n_predict": 16,
+        },)),
+    ])
+    assert results[0].status_code == 200
+    assert results[1].status_code == 429
+    assert results[1].body["error"]["type"] == "overloaded_error"
+
+    # the slot is free again
+    res = server.make_request("POST", "/completion", data={
+        "prompt": "I believe the meaning of life is",
+        "n_predict": 16,
+    })
+    assert res.status_code == 200
+
+
+def test_admission_deadline_disabled():
+    global server
+    server.start()
+    res = server.make_request("POST", "/completion", data={
+        "prompt": "I believe the meaning of life is",
+        "n_predict": 16,
+    })
+    assert res.status_code == 200
+
+    results = parallel_function_calls([
+        (server.make_request, ("POST", "/completion", {
+            "prompt": "Write a very long book.",
+            "n_predict": 256,
+            "ignore_eos": True,
+        })),
+        (wait_busy_and_request, ({
+            "prompt": "I believe the meaning of life is",
+            "n_predict": 16,
+        },)),
+    ])
+    assert results[0].status_code == 200
+    assert results[1].status_code == 200
@@ -533,3 +533,136 @@ def test_cancel_request():
     time.sleep(1) # wait for HTTP_POLLING_SECONDS
     res = server.make_request("GET", "/slots")
     assert res.body[0]["is_processing"] == False
+
+
+def test_cache_completions():
+    global server
+    server.temperature = 0.0
+    server.cache_completions = 4
+    server.start()
+    data = {"prompt": "I believe the meaning of life is", "n_predict": 16}
+    res1 = server.make_request("POST", "/completion", data=data)
+    assert res1.status_code == 200
+
+    # a cache hit is a copy of the first result, including its timings
+    res2 = server.make_request("POST", "/completion", data=data)
+    assert res2.status_code == 200
+    assert res2.body["content"] == res1.body["content"]
+    assert res2.body["timings"] == res1.body["timings"]
+
+    # different params are a different entry, the result is computed again
+    res3 = server.make_request("POST", "/completion", data={**data, "n_predict": 8})
+    assert res3.status_code == 200
+    assert res3.body["timings"] != res1.body["timings"]
+
+    # sampling without a fixed seed is not deterministic and is never cached
+    data = {**data, "temperature": 1.0, "seed": -1}
+    res4 = server.make_request("POST", "/completion", data=data)
+    res5 = server.make_request("POST", "/completion", data=data)
+    assert res4.status_code == 200
+    assert res5.status_code == 200
+    assert res5.body["timings"] != res4.body["timings"]
+
+
+def test_cache_completions_lru():
+    global server
+    server.temperature = 0.0
+    server.cache_completions = 1
+    server.start()
+    data_a = {"prompt": "I believe the meaning of life is", "n_predict": 8}
+    data_b = {"prompt": "Write a very long book.", "n_predict": 8}
+    res_a = server.make_request("POST", "/completion", data=data_a)
+    assert server.make_request("POST", "/completion", data=data_b).status_code == 200
+    # the result of a was evicted by the one of b
+    res = server.make_request("POST", "/completion", data=data_a)
+    assert res.status_code == 200
+    assert res.body["content"] == res_a.body["content"]
+    assert res.body["timings"] != res_a.body["timings"]
+
+
+def test_cache_completions_coalescing():
+    global server
+    server.temperature = 0.0
+    server.n_slots = 2
+    server.cache_completions = 4
+    server.start()
+    # identical requests in flight are attached to the first one and receive a copy of its result
+    tasks = [(server.make_request, ("POST", "/completion", {
+        "prompt": "Write a very long book.",
+        "n_predict": 32,
+    })) for _ in range(4)]
+    results = parallel_function_calls(tasks)
+    for res in results:
+        assert res.status_code == 200
+        assert res.body["content"] == results[0].body["content"]
+        assert res.body["timings"] == results[0].body["timings"]
+
+
+def test_echo_prompt_probabilities():
+    global server
+    server.start()
+    data = {
+        "prompt": "I believe the meaning of life is",
+        "n_probs": 5,
+        "temperature": 0.0,
+        "n_predict": 4,
+        "echo": True,
+    }
+    res = server.make_request("POST", "/completion", data=data)
+    assert res.status_code == 200
+    assert len(res.body["completion_probabilities"]) == 4
+    probs = res.body["prompt_probabilities"]
+    assert len(probs) == res.body["tokens_evaluated"]
+    # the first token has no context to predict it
+    assert probs[0]["logprob"] is None
+    for tok in probs[1:]:
+        assert "token" in tok and type(tok["token"]) == str
+        assert "logprob" in tok and tok["logprob"] <= 0.0
+        assert len(tok["top_logprobs"]) == 5
+        top = [prob["logprob"] for prob in tok["top_logprobs"]]
+        assert top == sorted(top, reverse=True)
+        # a token in the top candidates has the same logprob there
+        for prob in tok["top_logprobs"]:
+            if prob["id"] == tok["id"]:
+                assert prob["logprob"] == pytest.approx(tok["logprob"], abs=1e-4)
+
+    # the cached prompt has no logits, it is evaluated again
+    res2 = server.make_request("POST", "/completion", data=data)
+    assert res2.status_code == 200
+    assert res2.body["timings"]["prompt_n"] == res.body["tokens_evaluated"]
+    assert [tok["id"] for tok in res2.body["prompt_probabilities"]] == [tok["id"] for tok in probs]
+    for a, b in zip(res2.body["prompt_probabilities"][1:], probs[1:]):
+        assert a["logprob"] == pytest.approx(b["logprob"], abs=1e-4)
+
+    # without echo, the prompt probabilities are not returned
+    res = server.make_request("POST", "/completion", data={**data, "echo": False})
+    assert res.status_code == 200
+    assert "prompt_probabilities" not in res.body
+
+
+def test_echo_oai_completions():
+    global server
+    server.start()
+    prompt = "I believe the meaning of life is"
+    res = server.make_request("POST", "/v1/completions", data={
+        "prompt": prompt,
+        "logprobs": 3,
+        "temperature": 0.0,
+        "max_tokens": 4,
+        "echo": True,
+    })
+    assert res.status_code == 200
+    choice = res.body["choices"][0]
+    # the text starts with the detokenized prompt, including the special tokens that have logprobs
+    assert prompt in choice["text"]
+    usage = res.body["usage"]
+    assert len(choice["logprobs"]["content"]) == usage["prompt_tokens"] + usage["completion_tokens"]
+
+    res = server.make_request("POST", "/v1/completions", data={
+        "prompt": prompt,
+        "logprobs": 3,
+        "echo": True,
+        "stream": True,
+    })
+    assert res.status_code != 200
+    assert "error" in res.body
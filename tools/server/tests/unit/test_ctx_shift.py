@@ -55,6 +55,23 @@ def test_ctx_shift_disabled_short_prompt(n_predict: int, n_token_output: int, tr
     assert res.body["truncated"] == truncated
 
 
+def test_ctx_shift_disabled_kv_budget():
+    # the evicted cells do not count against the context of the slot (see test_ctx_shift_disabled_short_prompt)
+    global server
+    server.n_predict = -1
+    server.kv_budget = 64
+    server.kv_recent = 16
+    server.start()
+    res = server.make_request("POST", "/completion", data={
+        "n_predict": 300,
+        "prompt": "Hi how are you",
+        "ignore_eos": True,
+    })
+    assert res.status_code == 200
+    assert res.body["timings"]["predicted_n"] == 300
+    assert res.body["truncated"] is False
+
+
 def test_ctx_shift_disabled_long_prompt():
     global server
     server.start()
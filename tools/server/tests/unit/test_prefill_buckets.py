@@ -0,0 +1,82 @@
+import pytest
+from utils import *
+
+server = ServerPreset.tinyllama2()
+
+# prompts of very different lengths, so that their chunks fall in different KV length buckets
+PROMPTS = [
+    "I believe the meaning of life is",
+    "Once upon a time, there was a little girl named Lily. She loved to play outside in the park with her friends. " * 6,
+    "Write a very long book.",
+    "The sky is blue and the grass is green, and the little dog ran after the ball in the garden. " * 3,
+]
+
+
+@pytest.fixture(autouse=True)
+def create_server():
+    global server
+    server = ServerPreset.tinyllama2()
+    server.n_ctx = 2048
+    server.n_batch = 128
+    server.n_ubatch = 32
+    server.n_slots = 4
+    server.temperature = 0.0
+    server.prefill_buckets = True
+
+
+def first_token_logprobs(res: ServerResponse) -> dict:
+    return {prob["id"]: prob["logprob"] for prob in res.body["completion_probabilities"][0]["top_logprobs"]}
+
+
+def test_prefill_buckets_same_result():
+    global server
+    server.start()
+    data = {
+        "n_predict": 1,
+        "n_probs": 10,
+        "cache_prompt": False,
+    }
+
+    # one at a time, each prompt is alone in its batches
+    expected = []
+    for prompt in PROMPTS:
+        res = server.make_request("POST", "/completion", data={**data, "prompt": prompt})
+        assert res.status_code == 200
+        expected.append(res)
+
+    # all together, the batches are split at every change of bucket
+    results = parallel_function_calls([(server.make_request, ("POST", "/completion", {
+        **data,
+        "prompt": prompt,
+    })) for prompt in PROMPTS])
+    for res, ref in zip(results, expected):
+        assert res.status_code == 200
+        assert res.body["timings"]["prompt_n"] == ref.body["timings"]["prompt_n"]
+        # the batch composition changes the rounding, not the distribution of the first token
+        probs, probs_ref = first_token_logprobs(res), first_token_logprobs(ref)
+        for id in probs.keys() & probs_ref.keys():
+            assert probs[id] == pytest.approx(probs_ref[id], abs=1e-2)
+
+
+def test_prefill_buckets_long_prompt_not_starved():
+    global server
+    server.n_slots = 2
+    server.start()
+
+    # the long prompt needs several batches, while a stream of short prompts keeps arriving in the other slot
+    tasks = [(server.make_request, ("POST", "/completion", {
+        "prompt": PROMPTS[1] * 2,
+        "n_predict": 4,
+        "id_slot": 0,
+    }))]
+    for _ in range(8):
+        tasks.append((server.make_request, ("POST", "/completion", {
+            "prompt": PROMPTS[0],
+            "n_predict": 4,
+            "id_slot": 1,
+            "cache_prompt": False,
+        })))
+    results = parallel_function_calls(tasks)
+    for res in results:
+        assert res.status_code == 200
+    assert results[0].body["timings"]["prompt_n"] > 2 * server.n_batch
@@ -0,0 +1,123 @@
+import pytest
+from utils import *
+
+server = ServerPreset.tinyllama2()
+
+# long enough for several blocks of 64 tokens
+LONG_PROMPT = "Once upon a time, there was a little girl named Lily. She loved to play outside in the park with her friends. " * 6
+BLOCK_SIZE = 64
+
+
+@pytest.fixture(autouse=True)
+def create_server():
+    global server
+    server = ServerPreset.tinyllama2()
+    server.server_slots = True
+    server.temperature = 0.0
+    server.n_ctx = 1024
+
+
+def lookup(data: dict) -> dict:
+    res = server.make_request("POST", "/prefix-lookup", data=data)
+    assert res.status_code == 200
+    return res.body
+
+
+def test_prefix_lookup_empty_cache():
+    global server
+    server.start()
+    body = lookup({"prompt": LONG_PROMPT})
+    assert body["block_size"] == BLOCK_SIZE
+    assert body["n_cached_tokens"] == 0
+    assert len(body["slots"]) == 2
+    assert all(slot["n_cached_tokens"] == 0 for slot in body["slots"])
+    assert len(body["block_hashes"]) == body["n_prompt_tokens"] // BLOCK_SIZE
+
+
+def test_prefix_lookup_after_completion():
+    global server
+    server.start()
+    res = server.make_request("POST", "/completion", data={
+        "prompt": LONG_PROMPT,
+        "id_slot": 1,
+        "n_predict": 8,
+        "cache_prompt": True,
+    })
+    assert res.status_code == 200
+
+    body = lookup({"prompt": LONG_PROMPT})
+    n_blocks = body["n_prompt_tokens"] // BLOCK_SIZE
+    assert n_blocks >= 2
+    assert body["id_slot"] == 1
+    assert body["n_cached_tokens"] == n_blocks * BLOCK_SIZE
+    assert body["slots"][0]["n_cached_tokens"] == 0
+    assert body["slots"][1]["n_cached_tokens"] == n_blocks * BLOCK_SIZE
+
+    # the hashes returned for the prompt give the same answer
+    by_hashes = lookup({"block_hashes": body["block_hashes"]})
+    assert by_hashes["id_slot"] == 1
+    assert by_hashes["n_cached_tokens"] == body["n_cached_tokens"]
+    assert "block_hashes" not in by_hashes
+
+    # only the common prefix of a different prompt matches
+    body = lookup({"prompt": LONG_PROMPT[:len(LONG_PROMPT) // 2] + "The end."})
+    assert 0 < body["n_cached_tokens"] < n_blocks * BLOCK_SIZE
+
+
+def test_prefix_lookup_after_erase():
+    global server
+    server.slot_save_path = "./tmp"
+    server.start()
+    res = server.make_request("POST", "/completion", data={
+        "prompt": LONG_PROMPT,
+        "id_slot": 0,
+        "n_predict": 4,
+        "cache_prompt": True,
+    })
+    assert res.status_code == 200
+    assert lookup({"prompt": LONG_PROMPT})["n_cached_tokens"] > 0
+
+    res = server.make_request("POST", "/slots/0?action=erase")
+    assert res.status_code == 200
+    assert lookup({"prompt": LONG_PROMPT})["n_cached_tokens"] == 0
+
+
+def test_prefix_lookup_after_context_shift():
+    global server
+    server.n_ctx = 512
+    server.n_slots = 1
+    server.n_predict = -1
+    server.enable_ctx_shift = True
+    server.start()
+    res = server.make_request("POST", "/completion", data={
+        "prompt": LONG_PROMPT,
+        "n_predict": 512,
+        "ignore_eos": True,
+        "cache_prompt": True,
+    })
+    assert res.status_code == 200
+    assert res.body["truncated"] is True
+
+    # the shift removed tokens after the first one, the cached prefix no longer matches the prompt
+    body = lookup({"prompt": LONG_PROMPT})
+    assert body["n_cached_tokens"] == 0
+
+
+def test_prefix_lookup_requires_slots_endpoint():
+    global server
+    server.server_slots = False
+    server.start()
+    res = server.make_request("POST", "/prefix-lookup", data={"prompt": LONG_PROMPT})
+    assert res.status_code == 501
+
+
+@pytest.mark.parametrize("data", [
+    {},
+    {"block_hashes": ["not a hash"]},
+])
+def test_prefix_lookup_invalid_request(data):
+    global server
+    server.start()
+    res = server.make_request("POST", "/prefix-lookup", data=data)
+    assert res.status_code == 400
+    assert "error" in res.body
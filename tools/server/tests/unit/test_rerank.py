@@ -102,3 +102,36 @@ def test_rerank_usage(query, doc1, doc2, n_tokens):
     assert res.status_code == 200
     assert res.body['usage']['prompt_tokens'] == res.body['usage']['total_tokens']
     assert res.body['usage']['prompt_tokens'] == n_tokens
+
+
+def test_rerank_shared_query_prefix():
+    # decoder-based rerankers evaluate the query once and fork it into the slots of the other documents
+    global server
+    server = ServerPreset.tiny_qwen3_reranker()
+    server.server_metrics = True
+    server.start()
+    query = "Which city is the capital of France, and what is it famous for? " * 4
+    res = server.make_request("POST", "/rerank", data={
+        "query": query,
+        "documents": TEST_DOCUMENTS,
+    })
+    assert res.status_code == 200
+    assert len(res.body["results"]) == 4
+    n_prompt_tokens = res.body["usage"]["prompt_tokens"]
+    scores = {doc["index"]: doc["relevance_score"] for doc in res.body["results"]}
+
+    # the query tokens were processed once instead of once per document
+    metrics = requests.get(f"http://{server.server_host}:{server.server_port}/metrics").text
+    n_processed = int(re.search(r"^llamacpp:prompt_tokens_total ([0-9.e+]+)$", metrics, re.MULTILINE).group(1).split(".")[0])
+    n_query = server.make_request("POST", "/tokenize", data={"content": query})
+    n_query = len(n_query.body["tokens"])
+    assert n_processed <= n_prompt_tokens - 3 * n_query
+
+    # the scores are the same as when the documents are ranked one at a time
+    for i, doc in enumerate(TEST_DOCUMENTS):
+        res = server.make_request("POST", "/rerank", data={
+            "query": query,
+            "documents": [doc],
+        })
+        assert res.status_code == 200
+        assert res.body["results"][0]["relevance_score"] == pytest.approx(scores[i], rel=1e-3, abs=1e-4)
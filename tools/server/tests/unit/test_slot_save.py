@@ -96,3 +96,70 @@ def test_slot_erase():
     assert res.status_code == 200
     assert match_regex("(Whiskers|Flana)+", res.body["content"])
     assert res.body["timings"]["prompt_n"] == 21  # all tokens are processed
+
+
+def test_slot_pin_prefix():
+    global server
+    # long enough to fill a block of /prefix-lookup
+    prompt = "What is the capital of France? " * 12
+    server.start()
+
+    res = server.make_request("POST", "/completion", data={
+        "prompt": prompt,
+        "id_slot": 1,
+        "cache_prompt": True,
+    })
+    assert res.status_code == 200
+    n_prompt = res.body["timings"]["prompt_n"]
+    assert n_prompt >= 64
+
+    res = server.make_request("POST", "/slots/1?action=save", data={
+        "filename": "pinned.bin",
+    })
+    assert res.status_code == 200
+    server.stop()
+
+    # a new server keeps the saved prefix in memory
+    server = ServerPreset.tinyllama2()
+    server.temperature = 0.0
+    server.server_slots = True
+    server.pin_prefixes = ["./tmp/pinned.bin"]
+    server.start()
+
+    res = server.make_request("POST", "/prefix-lookup", data={"prompt": prompt})
+    assert res.status_code == 200
+    assert len(res.body["pinned"]) == 1
+    assert res.body["pinned"][0]["n_cached_tokens"] > 0
+    assert all(slot["n_cached_tokens"] == 0 for slot in res.body["slots"])
+
+    # any slot restores the prefix and only processes the rest of the prompt
+    for id_slot in [0, 1]:
+        res = server.make_request("POST", "/completion", data={
+            "prompt": prompt + "The capital of France is",
+            "id_slot": id_slot,
+            "cache_prompt": True,
+        })
+        assert res.status_code == 200
+        assert res.body["timings"]["prompt_n"] < n_prompt // 2
+
+    # the pinned prefix is not evicted by other prompts
+    res = server.make_request("POST", "/completion", data={
+        "prompt": "Tell me a story about a cat.",
+        "id_slot": 0,
+        "cache_prompt": True,
+    })
+    assert res.status_code == 200
+    res = server.make_request("POST", "/completion", data={
+        "prompt": prompt,
+        "id_slot": 0,
+        "cache_prompt": True,
+    })
+    assert res.status_code == 200
+    assert res.body["timings"]["prompt_n"] < n_prompt // 2
+
+
+def test_slot_pin_prefix_invalid_file():
+    global server
+    server.pin_prefixes = ["./tmp/does-not-exist.bin"]
+    with pytest.raises(RuntimeError):
+        server.start(timeout_seconds=10)
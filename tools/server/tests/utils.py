@@ -87,6 +87,12 @@ class ServerProcess:
     chat_template_file: str | None = None
     server_path: str | None = None
     mmproj_url: str | None = None
+    cache_completions: int | None = None
+    pin_prefixes: List[str] | None = None
+    admission_deadline: int | None = None
+    prefill_buckets: bool | None = False
+    kv_budget: int | None = None
+    kv_recent: int | None = None
 
     # session variables
     process: subprocess.Popen | None = None
@@ -199,6 +205,19 @@ class ServerProcess:
             server_args.extend(["--chat-template-file", self.chat_template_file])
         if self.mmproj_url:
             server_args.extend(["--mmproj-url", self.mmproj_url])
+        if self.cache_completions:
+            server_args.extend(["--cache-completions", self.cache_completions])
+        if self.pin_prefixes:
+            for pin_prefix in self.pin_prefixes:
+                server_args.extend(["--pin-prefix", pin_prefix])
+        if self.admission_deadline is not None:
+            server_args.extend(["--admission-deadline", self.admission_deadline])
+        if self.kv_budget:
+            server_args.extend(["--kv-budget", self.kv_budget])
+        if self.kv_recent is not None:
+            server_args.extend(["--kv-recent", self.kv_recent])
+        if self.prefill_buckets:
+            server_args.append("--prefill-buckets")
 
         args = [str(arg) for arg in [server_path, *server_args]]
         print(f"tests: starting server with: {' '.join(args)}")
@@ -475,6 +494,20 @@ class ServerPreset:
         server.server_reranking = True
         return server
 
+    @staticmethod
+    def tiny_qwen3_reranker() -> ServerProcess:
+        server = ServerProcess()
+        server.model_hf_repo = None
+        server.model_hf_file = None
+        server.model_file = make_tiny_qwen3_reranker()
+        server.model_alias = "tiny-qwen3-reranker"
+        server.n_ctx = 1024
+        server.n_batch = 512
+        server.n_slots = 4
+        server.seed = 42
+        server.server_reranking = True
+        return server
+
     @staticmethod
     def tinygemma3() -> ServerProcess:
         server = ServerProcess()
@@ -559,5 +592,84 @@ def download_file(url: str, output_file_path: str | None = None) -> str:
     return output_file
 
 
+def make_tiny_qwen3_reranker(output_file: str = "./tmp/tiny-qwen3-reranker.gguf") -> str:
+    """
+    Create a tiny decoder-based reranker (QWEN3 with a cls.output head) with random weights and the llama vocab.
+
+    There is no small public model of this kind, the scores are meaningless but deterministic.
+
+    Returns the local path of the model.
+    """
+    if os.path.exists(output_file):
+        return output_file
+
+    try:
+        import gguf
+    except ImportError:
+        sys.path.insert(0, os.path.join(os.path.dirname(__file__), "../../../gguf-py"))
+        import gguf
+    import numpy as np
+
+    os.makedirs(os.path.dirname(output_file), exist_ok=True)
+
+    vocab_file = os.path.join(os.path.dirname(__file__), "../../../models/ggml-vocab-llama-spm.gguf")
+    vocab = gguf.GGUFReader(vocab_file)
+
+    n_embd, n_ff, n_layer, n_head, n_head_kv = 64, 128, 2, 4, 2
+    n_embd_head = n_embd // n_head
+
+    writer = gguf.GGUFWriter(output_file, "qwen3")
+    writer.add_block_count(n_layer)
+    writer.add_context_length(4096)
+    writer.add_embedding_length(n_embd)
+    writer.add_feed_forward_length(n_ff)
+    writer.add_head_count(n_head)
+    writer.add_head_count_kv(n_head_kv)
+    writer.add_layer_norm_rms_eps(1e-6)
+    writer.add_pooling_type(gguf.PoolingType.RANK)
+
+    for field in vocab.fields.values():
+        if not field.name.startswith("tokenizer."):
+            continue
+        if field.types[0] == gguf.GGUFValueType.ARRAY:
+            writer.add_key_value(field.name, field.contents(), field.types[0], field.types[-1])
+        else:
+            writer.add_key_value(field.name, field.contents(), field.types[0])
+    # reranking needs a SEP token, the llama vocab does not have one
+    writer.add_sep_token_id(vocab.fields["tokenizer.ggml.eos_token_id"].contents())
+
+    n_vocab = len(vocab.fields["tokenizer.ggml.tokens"].data)
+
+    rng = np.random.default_rng(42)
+
+    def add(name: str, *shape: int, ones: bool = False):
+        # numpy shapes are the reverse of the ggml shapes
+        data = np.ones(shape[::-1], dtype=np.float32) if ones else rng.normal(0.0, 0.1, shape[::-1]).astype(np.float32)
+        writer.add_tensor(name, data)
+
+    add("token_embd.weight", n_embd, n_vocab)
+    add("output_norm.weight", n_embd, ones=True)
+    add("cls.output.weight", n_embd, 1)
+    for i in range(n_layer):
+        add(f"blk.{i}.attn_norm.weight", n_embd, ones=True)
+        add(f"blk.{i}.attn_q.weight", n_embd, n_embd)
+        add(f"blk.{i}.attn_k.weight", n_embd, n_embd_head * n_head_kv)
+        add(f"blk.{i}.attn_v.weight", n_embd, n_embd_head * n_head_kv)
+        add(f"blk.{i}.attn_output.weight", n_embd, n_embd)
+        add(f"blk.{i}.attn_q_norm.weight", n_embd_head, ones=True)
+        add(f"blk.{i}.attn_k_norm.weight", n_embd_head, ones=True)
+        add(f"blk.{i}.ffn_norm.weight", n_embd, ones=True)
+        add(f"blk.{i}.ffn_gate.weight", n_embd, n_ff)
+        add(f"blk.{i}.ffn_up.weight", n_embd, n_ff)
+        add(f"blk.{i}.ffn_down.weight", n_ff, n_embd)
+
+    writer.write_header_to_file()
+    writer.write_kv_data_to_file()
+    writer.write_tensors_to_file()
+    writer.close()
+
+    return output_file
+
+
 def is_slow_test_allowed():
     return os.environ.get("SLOW_TESTS") == "1" or os.environ.get("SLOW_TESTS") == "ON"
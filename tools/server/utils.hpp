@@ -20,6 +20,8 @@
 #define JSON_ASSERT GGML_ASSERT
 #include <nlohmann/json.hpp>
 
+#include <algorithm>
+#include <cmath>
 #include <random>
 #include <sstream>
 #include <string>
@@ -496,8 +498,8 @@ static json oaicompat_completion_params_parse(const json & body) {
     }
 
     // Handle "echo" field
-    if (json_value(body, "echo", false)) {
-        throw std::runtime_error("Only no echo is supported");
+    if (json_value(body, "echo", false) && json_value(body, "stream", false)) {
+        throw std::runtime_error("echo is not supported with stream");
     }
 
     // Params supported by OAI but unsupported by llama.cpp
@@ -943,8 +945,11 @@ static std::string safe_json_to_str(const json & data) {
     return data.dump(-1, ' ', false, json::error_handler_t::replace);
 }
 
-static std::vector<llama_token_data> get_token_probabilities(llama_context * ctx, int idx) {
-    std::vector<llama_token_data> cur;
+// compute the probability of token `tok` and the `n_probs` most likely tokens at batch position `idx`
+// the softmax normalizer is computed in a single pass over the logits (block-wise max + rescaled sum of exp)
+// and the top tokens are selected with a bounded min-heap, so the full vocab is never sorted
+// `top` is reused between calls to avoid allocations, on return it contains the top tokens sorted by probability
+static float get_token_probabilities(llama_context * ctx, int idx, llama_token tok, size_t n_probs, std::vector<llama_token_data> & top) {
     const auto * logits = llama_get_logits_ith(ctx, idx);
 
     const llama_model * model = llama_get_model(ctx);
@@ -952,29 +957,63 @@ static std::vector<llama_token_data> get_token_probabilities(llama_context * ctx
 
     const int n_vocab = llama_vocab_n_tokens(vocab);
 
-    cur.resize(n_vocab);
-    for (llama_token token_id = 0; token_id < n_vocab; token_id++) {
-        cur[token_id] = llama_token_data{token_id, logits[token_id], 0.0f};
-    }
+    n_probs = std::min(n_probs, (size_t) n_vocab);
 
-    // sort tokens by logits
-    std::sort(cur.begin(), cur.end(), [](const llama_token_data & a, const llama_token_data & b) {
+    const auto cmp = [](const llama_token_data & a, const llama_token_data & b) {
         return a.logit > b.logit;
-    });
+    };
+
+    top.clear();
+    top.reserve(n_probs + 1);
+
+    constexpr int block_size = 256;
 
-    // apply softmax
-    float max_l = cur[0].logit;
+    float max_l   = -INFINITY;
     float cum_sum = 0.0f;
-    for (size_t i = 0; i < cur.size(); ++i) {
-        float p = expf(cur[i].logit - max_l);
-        cur[i].p = p;
-        cum_sum += p;
+
+    for (int i0 = 0; i0 < n_vocab; i0 += block_size) {
+        const int i1 = std::min(i0 + block_size, n_vocab);
+
+        float max_b = -INFINITY;
+        for (int i = i0; i < i1; ++i) {
+            max_b = std::max(max_b, logits[i]);
+        }
+
+        if (max_b > max_l) {
+            cum_sum *= expf(max_l - max_b);
+            max_l    = max_b;
+        }
+
+        float sum_b = 0.0f;
+        for (int i = i0; i < i1; ++i) {
+            sum_b += expf(logits[i] - max_l);
+        }
+        cum_sum += sum_b;
+
+        // most blocks cannot contain any candidate better than the current worst one
+        if (n_probs == 0 || (top.size() == n_probs && max_b <= top.front().logit)) {
+            continue;
+        }
+
+        for (int i = i0; i < i1; ++i) {
+            if (top.size() < n_probs) {
+                top.push_back({ i, logits[i], 0.0f });
+                std::push_heap(top.begin(), top.end(), cmp);
+            } else if (logits[i] > top.front().logit) {
+                std::pop_heap(top.begin(), top.end(), cmp);
+                top.back() = { i, logits[i], 0.0f };
+                std::push_heap(top.begin(), top.end(), cmp);
+            }
+        }
     }
-    for (size_t i = 0; i < cur.size(); ++i) {
-        cur[i].p /= cum_sum;
+
+    std::sort_heap(top.begin(), top.end(), cmp);
+
+    for (auto & cur : top) {
+        cur.p = expf(cur.logit - max_l) / cum_sum;
     }
 
-    return cur;
+    return expf(logits[tok] - max_l) / cum_sum;
 }
 
 static bool are_lora_equal(
@@ -1018,11 +1057,30 @@ static std::vector<common_adapter_lora_info> parse_lora_request(
     return lora;
 }
 
+// Computes FNV-1a hash of the data
+// pass the result of a previous call as hash to continue hashing
+static uint64_t fnv_hash_u64(const uint8_t * data, size_t len, uint64_t hash = 0xcbf29ce484222325ULL) {
+    const uint64_t fnv_prime = 0x100000001b3ULL;
+
+    for (size_t i = 0; i < len; ++i) {
+        hash ^= data[i];
+        hash *= fnv_prime;
+    }
+    return hash;
+}
+
+static std::string fnv_hash(const uint8_t * data, size_t len) {
+    return std::to_string(fnv_hash_u64(data, len));
+}
+
 //
 // utils for interacting with libmtmd
 // (may need to refactor in near future)
 //
 
+// number of tokens per block of server_tokens::get_block_hashes()
+constexpr size_t PREFIX_BLOCK_SIZE = 64;
+
 /**
  * server_tokens is a helper to manage the input tokens and image for the server.
  * it is made this way to simplify the logic of KV cache management.
@@ -1035,6 +1093,9 @@ private: // disallow accessing these members directly, risking out-of-sync
     // map a **start** position in tokens to the image chunk
     std::unordered_map<llama_pos, mtmd::input_chunk_ptr> map_pos_to_media;
 
+    // rolling hashes of the complete blocks of PREFIX_BLOCK_SIZE text tokens, kept in sync with the tokens
+    std::vector<uint64_t> block_hashes;
+
     // list of tokens
     // it can include LLAMA_TOKEN_NULL, which is used to indicate a token that is not a text token
     // a mtmd_input_chunk can occupy multiple tokens, one llama_token per **position**
@@ -1068,7 +1129,9 @@ public:
         }
     }
 
-    server_tokens(llama_tokens & tokens, bool has_mtmd) : has_mtmd(has_mtmd), tokens(tokens) {}
+    server_tokens(llama_tokens & tokens, bool has_mtmd) : has_mtmd(has_mtmd), tokens(tokens) {
+        update_block_hashes();
+    }
 
     // for debugging
     std::string str() const {
@@ -1103,6 +1166,7 @@ public:
             throw std::runtime_error("Invalid token");
         }
         tokens.emplace_back(tok);
+        update_block_hashes();
     }
 
     // will create a copy of the chunk if it contains non-text data
@@ -1117,6 +1181,7 @@ public:
             }
             mtmd::input_chunk_ptr new_chunk(mtmd_input_chunk_copy(chunk));
             map_pos_to_media[start_pos] = std::move(new_chunk);
+            update_block_hashes();
         } else if (type == MTMD_INPUT_CHUNK_TYPE_TEXT) {
             size_t n_tokens;
             auto text_tokens = mtmd_input_chunk_get_tokens_text(chunk, &n_tokens);
@@ -1150,6 +1215,7 @@ public:
     void insert(const llama_tokens & inp_tokens) {
         GGML_ASSERT(!has_mtmd); // only allow this if mtmd is disabled
         tokens.insert(tokens.end(), inp_tokens.begin(), inp_tokens.end());
+        update_block_hashes();
     }
 
     // for compatibility with speculative decoding, ctx shift, slot save/load
@@ -1162,6 +1228,8 @@ public:
     void set_token(llama_pos pos, llama_token id) {
         GGML_ASSERT(!has_mtmd); // only allow this if mtmd is disabled
         tokens[pos] = id;
+        block_hashes.resize(std::min(block_hashes.size(), pos/PREFIX_BLOCK_SIZE));
+        update_block_hashes();
     }
 
     size_t size() const {
@@ -1174,6 +1242,7 @@ public:
 
     void clear() {
         tokens.clear();
+        block_hashes.clear();
     }
 
     void keep_first(size_t n) {
@@ -1206,6 +1275,7 @@ public:
             }
         }
         tokens.resize(n);
+        block_hashes.resize(std::min(block_hashes.size(), n/PREFIX_BLOCK_SIZE));
     }
 
     std::string detokenize(const llama_context * ctx, bool special) const {
@@ -1219,6 +1289,12 @@ public:
         return common_detokenize(ctx, text_tokens, special);
     }
 
+    // rolling FNV-1a hashes of consecutive blocks of PREFIX_BLOCK_SIZE tokens - the hash of a block also covers all blocks before it
+    // hashing stops at the first incomplete block or media chunk
+    const std::vector<uint64_t> & get_block_hashes() const {
+        return block_hashes;
+    }
+
     size_t get_common_prefix(const server_tokens & b) const {
         size_t max_idx = std::min(tokens.size(), b.tokens.size());
         for (size_t i = 0; i < max_idx; ++i) {
@@ -1303,19 +1379,24 @@ public:
         n_pos_out = new_n_past;
         return 0;
     }
-};
 
-// Computes FNV-1a hash of the data
-static std::string fnv_hash(const uint8_t * data, size_t len) {
-    const uint64_t fnv_prime = 0x100000001b3ULL;
-    uint64_t hash = 0xcbf29ce484222325ULL;
+private:
+    // hash the blocks that were completed since the last call
+    void update_block_hashes() {
+        uint64_t hash = block_hashes.empty() ? fnv_hash_u64(nullptr, 0) : block_hashes.back();
 
-    for (size_t i = 0; i < len; ++i) {
-        hash ^= data[i];
-        hash *= fnv_prime;
+        for (size_t i0 = block_hashes.size()*PREFIX_BLOCK_SIZE; i0 + PREFIX_BLOCK_SIZE <= tokens.size(); i0 += PREFIX_BLOCK_SIZE) {
+            for (size_t i = i0; i < i0 + PREFIX_BLOCK_SIZE; ++i) {
+                if (tokens[i] == LLAMA_TOKEN_NULL) {
+                    return;
+                }
+            }
+
+            hash = fnv_hash_u64((const uint8_t *) &tokens[i0], PREFIX_BLOCK_SIZE*sizeof(llama_token), hash);
+            block_hashes.push_back(hash);
+        }
     }
-    return std::to_string(hash);
-}
+};
 
 
 // format rerank task: [BOS]query[EOS][SEP]doc[EOS].